@@ -0,0 +1,26 @@
+#ifndef BUTTON_CAPTURE_H
+#define BUTTON_CAPTURE_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+// Interrupt-driven button capture. Every contact edge on a button pin is
+// timestamped with micros() inside the ISR and buffered until the button
+// task drains it into button_input.h, so debouncing never polls the pins.
+// An optional onEdge callback runs from the ISR after each edge.
+
+#define BUTTON_EDGE_BUFFER_SIZE 32
+#define BUTTON_CAPTURE_PINS 3
+
+struct ButtonEdge {
+  uint32_t timestamp;  // micros() at the edge
+  uint8_t button;      // Index into the pins given to setupButtonCapture()
+  bool pressed;        // Contact level after the edge
+};
+
+// Buttons are active low, with pull-ups
+void setupButtonCapture(const uint8_t pins[BUTTON_CAPTURE_PINS], HalIsr onEdge = nullptr);
+bool popButtonEdge(ButtonEdge* edge);
+uint32_t buttonEdgeOverflows();
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef BUTTON_INPUT_H
+#define BUTTON_INPUT_H
+
+#include <stdint.h>
+
+// Button input over timestamped contact edges, in two stages:
+//
+//   debounce  an integrator per button runs up while the contact reads
+//             pressed and down while it reads released, and the button only
+//             changes state once it reaches the other end. Bounce and
+//             chatter cancel out instead of restarting a timer.
+//   gestures  debounced presses become taps, chords, long presses and
+//             double taps by time windows. Chord buttons hold their tap for
+//             the chord window, long press buttons until release.
+//
+// Pure logic with the time passed in, so the Linux trace tests run the same
+// code as the device.
+
+#define BUTTON_COUNT 3
+#define BUTTON_INTEGRATE_US 10000       // Net contact time to confirm a change
+#define BUTTON_CHORD_US 50000           // Chord presses at most this far apart
+#define BUTTON_LONG_PRESS_US 1500000UL
+#define BUTTON_DOUBLE_TAP_US 400000UL   // Press to press
+#define BUTTON_EVENT_QUEUE_SIZE 8
+#define BUTTON_INPUT_IDLE 0xFFFFFFFFUL
+
+enum ButtonId : uint8_t {
+  BUTTON_UP,
+  BUTTON_DOWN,
+  BUTTON_QUANTUM
+};
+
+enum ButtonGesture : uint8_t {
+  BUTTON_GESTURE_TAP,
+  BUTTON_GESTURE_DOUBLE_TAP,   // Follows the second tap's TAP
+  BUTTON_GESTURE_LONG_PRESS,   // Instead of a tap
+  BUTTON_GESTURE_CHORD         // Instead of the taps, button is the first pressed
+};
+
+struct ButtonEvent {
+  uint8_t gesture;
+  uint8_t button;            // ButtonId
+  uint8_t buttons;           // Bit per ButtonId, several for a chord
+  uint32_t atMicros;         // When it was recognized
+  uint32_t latencyMicros;    // First contact edge of the press to atMicros
+};
+
+struct ButtonInputStats {
+  uint32_t edges;
+  uint32_t bounces;      // Contact changes undone before they were confirmed
+  uint32_t presses;      // Debounced
+  uint32_t taps;
+  uint32_t doubleTaps;
+  uint32_t longPresses;
+  uint32_t chords;
+  uint32_t overflows;    // Events lost because nobody drained them
+  uint32_t maxDebounceMicros;  // Longest first edge to confirmed change
+};
+
+#define BUTTON_BIT(button) (1 << (button))
+
+// Buttons in chordMask form chords, buttons in longPressMask report long
+// presses. Starts over with every button at its level in pressedMask.
+void resetButtonInput(uint8_t chordMask, uint8_t longPressMask, uint8_t pressedMask, uint32_t nowMicros);
+
+// Edges must be fed in timestamp order
+void buttonInputEdge(uint8_t button, bool pressed, uint32_t timestampMicros);
+
+// Next event once the windows have run up to nowMicros, false when none
+bool nextButtonEvent(ButtonEvent* event, uint32_t nowMicros);
+
+// us until nextButtonEvent() has something to do, or BUTTON_INPUT_IDLE
+uint32_t buttonInputTimeout(uint32_t nowMicros);
+
+bool buttonPressed(uint8_t button);   // Debounced
+
+const ButtonInputStats& buttonInputStats();
+
+const char* buttonName(uint8_t button);
+const char* buttonGestureName(uint8_t gesture);
+
+#endif
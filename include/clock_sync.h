@@ -0,0 +1,82 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Offset between this device's halMicros() and the Pi's clock, estimated
+// the way NTP does it. The device sends its time t0 to the Pi's clock port;
+// the Pi answers with t0 echoed, t1 when the request arrived and t2 when it
+// sent the answer; the device notes t3 when that arrives:
+//
+//   offset = ((t1 - t0) + (t2 - t3)) / 2    Pi clock minus device clock
+//   delay  = (t3 - t0) - (t2 - t1)          time on the air, both ways
+//
+// The offset is exact when both legs take as long, and off by at most
+// delay / 2 when they don't. Of the last CLOCK_SYNC_SAMPLES exchanges the
+// one with the least delay is used - the others sat behind WiFi retries or
+// a busy Pi. Exchanges run every CLOCK_SYNC_INTERVAL_MS, so crystal drift
+// between the two (tens of ppm) stays well below the delay.
+//
+// Packet, both ways, 16 bytes little-endian:
+//   0  'F' 'T'        magic
+//   2  version        CLOCK_PACKET_VERSION
+//   3  type           ClockPacketType
+//   4  t0             uint32, device micros
+//   8  t1             uint32, Pi micros - 0 in a request
+//   12 t2             uint32, Pi micros - 0 in a request
+//
+// The Pi's clock is any monotonic microsecond count, truncated to 32 bits.
+// Requests go out from the score broadcast socket, so answers come back to
+// SCORE_BROADCAST_PORT. Pure logic with the times passed in; the Pi's side
+// is answerClockRequest().
+
+#define CLOCK_SYNC_PORT 4211
+#define CLOCK_PACKET_SIZE 16
+#define CLOCK_PACKET_VERSION 1
+#define CLOCK_SYNC_SAMPLES 8
+#define CLOCK_SYNC_INTERVAL_MS 1000
+#define CLOCK_SYNC_STEP_US 100000   // Offset jumps further than this, the Pi's clock restarted
+
+enum ClockPacketType : uint8_t {
+  CLOCK_REQUEST = 1,
+  CLOCK_REPLY = 2
+};
+
+struct ClockSyncStats {
+  bool synced;
+  uint32_t offsetUs;      // Add to device micros for Pi micros, wraps
+  uint32_t delayUs;       // Of the sample in use
+  uint32_t requests;
+  uint32_t replies;
+  uint32_t stale;         // Answers to an earlier request, or malformed
+  uint32_t steps;         // Times the Pi's clock jumped and the samples were dropped
+};
+
+void resetClockSync();
+
+// Builds the next request at nowMicros, returns its length. An answer to
+// an earlier request is ignored from here on.
+size_t startClockExchange(uint32_t nowMicros, uint8_t* out, size_t size);
+
+// False if the datagram isn't a clock packet at all, so the caller can try
+// it as something else. arrivedMicros is t3.
+bool acceptClockReply(const uint8_t* data, size_t length, uint32_t arrivedMicros);
+
+bool clockSynced();
+
+// Device micros in the Pi's clock, unchanged until synced
+uint32_t deviceToPiMicros(uint32_t deviceMicros);
+
+// Worst case error of deviceToPiMicros(), half the sample's delay
+uint32_t clockSyncErrorMicros();
+
+const ClockSyncStats& clockSyncStats();
+
+// The Pi's side: answers a request received at receivedMicros and sent at
+// sendMicros, both Pi clock. Returns the answer's length, 0 if the request
+// is malformed.
+size_t answerClockRequest(const uint8_t* request, size_t length, uint32_t receivedMicros, uint32_t sendMicros,
+                          uint8_t* out, size_t size);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef DEVICE_CONFIG_H
+#define DEVICE_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "goal_detector.h"
+#include "score_broadcast.h"
+
+// Per-device configuration, kept in flash as one fixed-size binary record
+// so a single firmware image serves every table and side. A device that was
+// never provisioned boots with the defaults below; POST /config rewrites
+// the record. The goal detector's calibration is stored in it as well.
+
+#define DEVICE_CONFIG_FILE "/device_config.bin"
+#define DEVICE_CONFIG_MAGIC 0x31434446UL  // "FDC1"
+
+#define DEVICE_SSID_MAX 33       // 32 characters, as in 802.11
+#define DEVICE_PASSWORD_MAX 65   // WPA2 passphrase or 64 hex digits
+#define DEVICE_HOST_MAX 40
+
+// Defaults - override with build flags to pre-provision a batch
+#ifndef DEFAULT_TABLE_ID
+#define DEFAULT_TABLE_ID 1
+#endif
+#ifndef DEFAULT_SIDE
+#define DEFAULT_SIDE SCORE_PLAYER_BLUE
+#endif
+#ifndef DEFAULT_WIFI_SSID
+#define DEFAULT_WIFI_SSID "Foosball_Table"
+#endif
+#ifndef DEFAULT_WIFI_PASSWORD
+#define DEFAULT_WIFI_PASSWORD "ilovefoosball"
+#endif
+#ifndef DEFAULT_SERVER_HOST
+#define DEFAULT_SERVER_HOST "192.168.4.1"
+#endif
+#ifndef DEFAULT_SERVER_PORT
+#define DEFAULT_SERVER_PORT 3000
+#endif
+#ifndef DEFAULT_PROTOCOL
+#define DEFAULT_PROTOCOL DEVICE_PROTOCOL_JSON
+#endif
+#ifndef DEFAULT_IDLE_S
+#define DEFAULT_IDLE_S 120       // Untouched this long: modem sleep, dimmed LEDs
+#endif
+#ifndef DEFAULT_SLEEP_S
+#define DEFAULT_SLEEP_S 1800     // And this long: light sleep, see power_state.h
+#endif
+
+// How goals, resets and event batches go to the Pi, see wire_protocol.h
+enum DeviceProtocol : uint8_t {
+  DEVICE_PROTOCOL_JSON,
+  DEVICE_PROTOCOL_BINARY,   // When the Pi's /status offers it, JSON otherwise
+  DEVICE_PROTOCOL_COUNT
+};
+
+struct DeviceConfig {
+  uint32_t magic;
+  uint16_t tableId;      // Below SCORE_TABLE_ANY
+  uint8_t side;          // ScorePlayer this device's buttons score for
+  char ssid[DEVICE_SSID_MAX];
+  char password[DEVICE_PASSWORD_MAX];
+  char serverHost[DEVICE_HOST_MAX];
+  uint8_t protocol;      // DeviceProtocol, in what was padding so older records read as JSON
+  uint16_t serverPort;
+  GoalDetectorConfig detector;
+  uint16_t idleS;        // Power state timeouts, 0 never steps down
+  uint16_t sleepS;
+};
+
+// Records stored before the power timeouts end at idleS
+#define DEVICE_CONFIG_V1_SIZE offsetof(DeviceConfig, idleS)
+
+enum DeviceConfigChange : uint8_t {
+  DEVICE_CONFIG_UNCHANGED,
+  DEVICE_CONFIG_TUNING,    // Only the detector or power timeouts - applies immediately
+  DEVICE_CONFIG_RESTART    // Identity or network - takes effect after a reboot
+};
+
+// Loads the stored record, or the defaults when there is none. Returns
+// false in the latter case.
+bool loadDeviceConfig();
+const DeviceConfig& deviceConfig();
+bool validDeviceConfig(const DeviceConfig& config);
+
+// Validates and stores config. Fails, leaving everything as it was, when
+// the record is invalid or flash can't be written.
+bool saveDeviceConfig(const DeviceConfig& config);
+
+// Applies the fields present in a JSON provisioning body to config:
+//   {"table":2,"side":"red","ssid":"...","password":"...",
+//    "host":"192.168.4.1","port":3000,"protocol":"binary",
+//    "glitchUs":300,"minBreakUs":1000,"rearmMs":400,
+//    "idleS":120,"sleepS":1800}
+// Strings may not contain escapes. Returns false on a malformed field.
+bool parseDeviceConfig(const char* body, DeviceConfig* config);
+
+DeviceConfigChange compareDeviceConfig(const DeviceConfig& before, const DeviceConfig& after);
+
+const char* deviceProtocolName(uint8_t protocol);
+
+#endif
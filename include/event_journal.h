@@ -0,0 +1,57 @@
+#ifndef EVENT_JOURNAL_H
+#define EVENT_JOURNAL_H
+
+#include <Arduino.h>
+#include "payloads.h"
+
+// Event journal - goals, points and resets that can't be sent right away are
+// stored as compact binary records in a RAM ring (optionally mirrored to
+// LittleFS with -D JOURNAL_USE_LITTLEFS) and sent in order as batches to
+// POST /events once WiFi is up. Every record carries a sequence number so
+// the Pi can drop replays it has already applied.
+//
+// Point events always go through the journal: presses arriving within
+// EVENT_BATCH_WINDOW_MS of the first pending one are coalesced into a single
+// batch. Goals and resets flush the batch immediately.
+//
+// Goals and resets go straight to /score and /reset while nothing is
+// journaled, one at a time, under a seq from the same sequence. One that
+// fails is journaled under that seq, ahead of anything journaled while it
+// was out, so the Pi sees every seq in order and drops the replay if the
+// first copy did get through.
+
+#define JOURNAL_CAPACITY 64
+#define JOURNAL_BATCH_MAX 8
+#define JOURNAL_RETRY_DELAY_MS 2000
+
+#ifndef EVENT_BATCH_WINDOW_MS
+#define EVENT_BATCH_WINDOW_MS 150
+#endif
+
+#define JOURNAL_FILE "/journal.bin"
+#define JOURNAL_SEQ_BLOCK 256  // Sequence numbers reserved per flash write
+
+// Told the fate of every journaled event exactly once: delivered when the
+// Pi accepted its batch, not delivered when the Pi rejected the batch (see
+// outboundRejected()) or the event was overwritten unsent. A full journal
+// never overwrites the batch in flight, the Pi may be applying it.
+typedef void (*JournalResultHandler)(uint32_t seq, bool delivered);
+
+// table goes along with every batch, see formatEventsBody()
+void setupJournal(const char* player, const char* opponent, uint16_t table);
+void setJournalResultHandler(JournalResultHandler handler);
+// Returns the event's seq
+uint32_t journalEvent(JournalEventType type, uint16_t value, uint8_t flags);
+// Fills in a goal or reset to send directly, false when it has to be
+// journaled instead to keep its place in line
+bool journalDirect(JournalEventType type, uint16_t value, JournalEvent* event, JournalSeq* seq);
+// The direct send's outcome, its outbound result. A failed one is
+// journaled to go out again; false when the event is gone instead, because
+// the Pi rejected it or the journal is full.
+bool journalDirectResult(const JournalEvent& event, int result);
+void startJournalReplay();
+void updateJournal(bool wifiConnected);
+uint8_t journalPending();
+uint32_t journalDropped();
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef EVENT_STREAM_H
+#define EVENT_STREAM_H
+
+#include <Arduino.h>
+
+// Live event stream - a WebSocket endpoint that pushes laser, button,
+// quantum-mode and WiFi events to subscribed clients as they happen.
+//
+//   ws://<device>:81/stream                    every event
+//   ws://<device>:81/stream?events=laser,wifi  only those types
+//
+// Each event is one text frame:
+//   {"seq":12,"t":81234,"type":"laser","broken":true,"goal":true}
+// seq counts every event published, so a client can spot gaps.
+//
+// Every client has a bounded send queue. A client that falls a full queue
+// behind is disconnected rather than allowed to hold up the others.
+
+#define EVENT_STREAM_PORT 81
+#define EVENT_STREAM_MAX_CLIENTS 3
+#define EVENT_STREAM_QUEUE_BYTES 512
+#define EVENT_STREAM_LINE_MAX 96
+#define EVENT_STREAM_EVENT_MAX 128
+#define EVENT_STREAM_HANDSHAKE_TIMEOUT_MS 2000
+#define EVENT_STREAM_POLL_MS 50        // Accepts and client frames
+#define EVENT_STREAM_FLUSH_POLL_MS 2   // While a queue is draining
+
+enum StreamEventType : uint8_t {
+  STREAM_EVENT_LASER,
+  STREAM_EVENT_BUTTON,
+  STREAM_EVENT_QUANTUM,
+  STREAM_EVENT_WIFI,
+  STREAM_EVENT_TYPE_COUNT
+};
+
+struct EventStreamStats {
+  uint32_t published;
+  uint32_t connections;
+  uint32_t slowConsumerDrops;
+  uint8_t clients;          // Currently subscribed
+};
+
+bool setupEventStream(uint16_t port = EVENT_STREAM_PORT);
+
+void streamLaserBreak(bool goal, uint32_t timestampMicros);
+void streamLaserRestore(uint32_t widthMicros, uint16_t speedKmhX10);
+void streamButtonEvent(const char* action);
+void streamQuantumEvent(bool enabled);
+void streamWiFiEvent(bool connected);
+
+const EventStreamStats& eventStreamStats();
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef FIRMWARE_PATCH_H
+#define FIRMWARE_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sha1.h"
+
+// Delta patches for OTA updates - a new firmware image described as runs
+// copied from the image it replaces plus the bytes that are new. Applied
+// as a stream: the patch arrives in whatever pieces the network hands over,
+// and target bytes go straight out through writeTarget, so neither image
+// has to fit in RAM.
+//
+// Little-endian:
+//   0  'F' 'P'        magic
+//   2  version        FIRMWARE_PATCH_VERSION
+//   3  0
+//   4  base size      uint32, the running image the patch applies to
+//   8  base SHA-1     20 bytes
+//   28 target size    uint32
+//   32 ops until target size bytes were produced:
+//        COPY    0x01, offset u32, length u32 - base bytes
+//        INSERT  0x02, length u32, then that many bytes
+//
+// Pure logic, the Linux patch tool builds and applies patches with it.
+
+#define FIRMWARE_PATCH_VERSION 1
+#define FIRMWARE_PATCH_HEADER_SIZE 32
+#define FIRMWARE_PATCH_COPY 0x01
+#define FIRMWARE_PATCH_INSERT 0x02
+#define FIRMWARE_PATCH_PIECE 256   // Base bytes read per COPY step
+
+enum FirmwarePatchState : uint8_t {
+  FIRMWARE_PATCH_READ_HEADER,
+  FIRMWARE_PATCH_READ_OP,
+  FIRMWARE_PATCH_READ_COPY,
+  FIRMWARE_PATCH_READ_INSERT,
+  FIRMWARE_PATCH_COPYING,
+  FIRMWARE_PATCH_INSERTING,
+  FIRMWARE_PATCH_DONE,
+  FIRMWARE_PATCH_FAILED
+};
+
+typedef bool (*FirmwarePatchRead)(uint32_t offset, uint8_t* data, size_t length);
+typedef bool (*FirmwarePatchWrite)(const uint8_t* data, size_t length);
+
+struct FirmwarePatch {
+  uint8_t state;                 // FirmwarePatchState
+  uint8_t field[FIRMWARE_PATCH_HEADER_SIZE];   // Header or op arguments being collected
+  uint8_t fieldLength;
+  uint32_t baseSize;
+  uint8_t baseSha1[SHA1_DIGEST_SIZE];
+  uint32_t targetSize;
+  uint32_t produced;             // Target bytes written
+  uint32_t copyOffset;
+  uint32_t remaining;            // Of the current op
+  const char* error;             // Why it failed
+  FirmwarePatchRead readBase;
+  FirmwarePatchWrite writeTarget;
+};
+
+void beginFirmwarePatch(FirmwarePatch* patch, FirmwarePatchRead readBase, FirmwarePatchWrite writeTarget);
+
+// Feeds patch bytes and returns how many were used. Stops right after the
+// header, so it can be checked before anything is written, and once about
+// maxOutput target bytes were written, so a long COPY is spread over
+// several calls - keep calling, with length 0 if need be, while
+// firmwarePatchBusy(). Bytes after the last op are left unused.
+size_t feedFirmwarePatch(FirmwarePatch* patch, const uint8_t* data, size_t length, size_t maxOutput);
+
+bool firmwarePatchHeaderRead(const FirmwarePatch& patch);
+bool firmwarePatchBusy(const FirmwarePatch& patch);   // Output due without more input
+
+// Encoding, for the tool that builds patches
+size_t encodeFirmwarePatchHeader(uint32_t baseSize, const uint8_t baseSha1[SHA1_DIGEST_SIZE], uint32_t targetSize,
+                                 uint8_t* out, size_t size);
+size_t encodeFirmwarePatchCopy(uint32_t offset, uint32_t length, uint8_t* out, size_t size);
+size_t encodeFirmwarePatchInsert(uint32_t length, uint8_t* out, size_t size);   // The bytes follow
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <Arduino.h>
+#include "shot_speed.h"
+#include "metrics.h"
+#include "score_broadcast.h"
+#include "match_state.h"
+
+// Table game logic - laser goals, buttons, LEDs and the API events they
+// produce. Only talks to hardware through hal.h so the same code runs on
+// the ESP8266 and in the native simulator.
+
+// Pin definitions
+#define LASER_BREAK_PIN 14
+#define BUTTON_UP_PIN 5
+#define BUTTON_DOWN_PIN 4
+#define BUTTON_QUANTUM_PIN 0
+#define LED_ACTIVITY_PIN 16
+#define LED_BUILTIN_PIN 2  // Built-in blue LED for network activity
+
+// RGB LED pins for status indication
+#define RGB_RED_PIN 15
+#define RGB_GREEN_PIN 12
+#define RGB_BLUE_PIN 13
+
+// LED animation timing
+#define STARTUP_BLINK_MS 200
+#define CONNECTING_BLINK_MS 500
+#define ERROR_FLASH_MS 200
+#define QUANTUM_FEEDBACK_MS 300
+#define POINT_FEEDBACK_MS 120
+#define GOAL_FLASH_MS 2000
+#define OWN_GOAL_BLINK_MS 2000
+#define OWN_GOAL_BLINK_INTERVAL_MS 250
+#define NETWORK_FLASH_MS 100
+#define CALIBRATION_PULSE_MS 600
+
+// Scheduler polling while work is in progress
+#define NETWORK_POLL_MS 2    // Outbound request in flight
+#define JOURNAL_POLL_MS 20   // Batch window or replay retry pending
+#define MATCH_POLL_MS 500    // Acknowledged goals waiting for their broadcast
+#define POWER_BUSY_POLL_MS 1000  // Idle timeout passed while busy, see power_state.h
+
+// Status colors on the RGB LED
+enum DeviceStatus : uint8_t {
+  STATUS_STARTUP,
+  STATUS_CONNECTING,
+  STATUS_READY,         // In this device's side color
+  STATUS_DISCONNECTED,
+  STATUS_ERROR,
+  STATUS_OFF
+};
+
+extern uint8_t playerSide;     // ScorePlayer, from the device config
+extern uint8_t opponentSide;
+extern bool wifiConnected;
+extern bool quantumMode;
+extern ShotSpeedHistory shotSpeeds;
+extern LatencySummary goalAckLatency;  // Beam break to the Pi's reply
+extern LatencySummary buttonLatency;   // First contact edge to the gesture
+
+// Registers the game's scheduler tasks, see scheduler.h. Call
+// loadDeviceConfig() first.
+void setupGame();
+
+// Run the network task on the next scheduler pass, e.g. after WiFi returns
+void wakeNetworkTask();
+
+// Score notifications - UDP broadcasts, with POST /scoreMade as fallback.
+// Listening has to be (re)started once WiFi is up.
+void listenForScoreBroadcasts();
+
+// The Pi's address for clock exchanges, see clock_sync.h. They run while
+// WiFi is up and the broadcast listener is, none until this is set.
+void setClockServer(const char* host);
+
+// /scoreMade's trace fields, see goal_trace.h - id 0 when untraced
+struct ScoreMadeTrace {
+  uint32_t id;
+  uint32_t piReceivedUs;
+  uint32_t piSentUs;
+  uint32_t arrivedMicros;
+};
+
+// boot is the Pi's boot id from the same body, SCORE_BOOT_UNKNOWN without one
+void handleScoreMade(const char* scoringPlayer, bool hasSeq, uint32_t seq, uint32_t boot, const ScoreMadeTrace& trace);
+void handleScoreNotification(uint8_t scoringPlayer, uint32_t trace);
+
+void handleLaserBreak();
+
+// Learns the goal detector's thresholds, see goal_detector.h. The result is
+// saved to the device config.
+void startLaserCalibration();
+
+void handleButtonActions();
+
+// Power state timeouts from /config, see power_state.h. 0 never steps down.
+void setIdleTimeouts(uint16_t idleS, uint16_t sleepS);
+void triggerOwnGoalBlink();
+void triggerGoalFlash();
+void sendGoalAPI(uint16_t speedKmhX10);
+void sendAddPointAPI(int amount);
+void sendResetAPI();
+
+// Asks the Pi's GET /status whether it takes binary frames, when the device
+// config selects them (see wire_protocol.h). Call once WiFi is up; requests
+// stay JSON until the Pi answers.
+void negotiateWireProtocol();
+void setRGBColor(int red, int green, int blue);
+void setStatusColor(DeviceStatus status);
+void flashNetworkActivity();
+void startupBlink();
+
+#endif
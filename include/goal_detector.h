@@ -0,0 +1,108 @@
+#ifndef GOAL_DETECTOR_H
+#define GOAL_DETECTOR_H
+
+#include <stdint.h>
+
+// Goal detection over timestamped beam edges, in three stages:
+//
+//   glitch filter  a level change only counts once it has held for glitchUs,
+//                  so ambient flicker and a ball edge jittering in the beam
+//                  never split or fake a break
+//   minimum width  a filtered break shorter than minBreakUs is noise
+//   hysteresis     after a break the beam has to stay clear for rearmUs
+//                  before the next break is a goal - until then it is the
+//                  ball bouncing around the goal mouth
+//
+// Calibration replaces the defaults: a quiet phase with no ball learns the
+// noise floor, then a few shots learn break widths and bounce gaps. Pure
+// logic with the time passed in, so the Linux trace evaluator runs the same
+// code as the device.
+
+#define GOAL_GLITCH_US 300
+#define GOAL_MIN_BREAK_US 1000
+#define GOAL_REARM_US 400000UL
+#define GOAL_EVENT_QUEUE_SIZE 8
+#define GOAL_DETECTOR_IDLE 0xFFFFFFFFUL
+
+// Bounds on what calibration may learn
+#define GOAL_GLITCH_MIN_US 200      // Below this, gaps at the ball's edge split breaks
+#define GOAL_GLITCH_MAX_US 1000
+#define GOAL_MIN_BREAK_MAX_US 2000     // A 60 km/h shot breaks the beam for ~2.1 ms
+#define GOAL_REARM_MIN_US 150000UL
+#define GOAL_REARM_MAX_US 1000000UL
+
+#define GOAL_CALIBRATION_QUIET_US 5000000UL     // Keep the ball out of the goal
+#define GOAL_CALIBRATION_SHOT_COUNT 5
+#define GOAL_CALIBRATION_SHOT_MIN_US 1000         // Shorter breaks are noise, not shots
+#define GOAL_CALIBRATION_SHOT_GAP_US 1000000UL  // Closer breaks are bounces
+#define GOAL_CALIBRATION_TIMEOUT_US 120000000UL
+
+struct GoalDetectorConfig {
+  uint32_t glitchUs;
+  uint32_t minBreakUs;
+  uint32_t rearmUs;
+};
+
+enum GoalEventType : uint8_t {
+  GOAL_EVENT_BREAK,     // A break passed the minimum width
+  GOAL_EVENT_RESTORE    // ...and has now ended
+};
+
+struct GoalEvent {
+  uint8_t type;
+  bool goal;             // False for bounces, and for everything while calibrating
+  uint32_t startMicros;  // Raw edge the break began with
+  uint32_t widthMicros;  // RESTORE only, glitches inside the break included
+};
+
+struct GoalDetectorStats {
+  uint32_t edges;
+  uint32_t glitches;     // Level changes shorter than glitchUs
+  uint32_t shortBreaks;  // Filtered breaks under minBreakUs
+  uint32_t bounces;      // Breaks inside the rearm window
+  uint32_t goals;
+  uint32_t overflows;    // Events lost because nobody drained them
+};
+
+enum GoalCalibrationPhase : uint8_t {
+  GOAL_CALIBRATION_OFF,
+  GOAL_CALIBRATION_QUIET,
+  GOAL_CALIBRATION_SHOTS,
+  GOAL_CALIBRATION_DONE,
+  GOAL_CALIBRATION_FAILED   // No shots before the timeout, config unchanged
+};
+
+struct GoalCalibration {
+  uint8_t phase;
+  uint8_t shots;
+  uint32_t noiseFloorUs;       // Longest break seen with no ball
+  uint32_t shortestShotUs;
+  uint32_t longestBounceGapUs;
+  GoalDetectorConfig learned;
+};
+
+void setGoalDetectorConfig(const GoalDetectorConfig& config);
+const GoalDetectorConfig& goalDetectorConfig();
+bool validGoalDetectorConfig(const GoalDetectorConfig& config);
+
+// Starts over with the beam at the given level
+void resetGoalDetector(bool broken, uint32_t nowMicros);
+
+// Edges must be fed in timestamp order
+void goalDetectorEdge(bool broken, uint32_t timestampMicros);
+
+// Next event once the filters have settled up to nowMicros, false when none
+bool nextGoalEvent(GoalEvent* event, uint32_t nowMicros);
+
+// us until the detector next needs nextGoalEvent(), or GOAL_DETECTOR_IDLE
+uint32_t goalDetectorTimeout(uint32_t nowMicros);
+
+const GoalDetectorStats& goalDetectorStats();
+
+// The learned config is applied when calibration reaches DONE
+void startGoalCalibration(uint32_t nowMicros);
+const GoalCalibration& goalCalibration();
+
+const char* goalCalibrationPhaseName(uint8_t phase);
+
+#endif
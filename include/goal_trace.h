@@ -0,0 +1,88 @@
+#ifndef GOAL_TRACE_H
+#define GOAL_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "payloads.h"
+
+// Where a goal's time goes, from the beam break on one device to the
+// celebration on the other. Hops, and who stamps them:
+//
+//   break       beam broken, the laser ISR's time           scored-on device
+//   sent        goal queued for the Pi, once the beam was
+//               restored and the shot speed known           scored-on device
+//   piReceived  /score, or its frame, reached the Pi        Pi
+//   piSent      Pi sent the score broadcast and /scoreMade  Pi
+//   ack         the Pi's answer came back                   scored-on device
+//   notified    the first copy of the broadcast or
+//               /scoreMade arrived                          every device
+//   celebrated  own goal blink started                      scoring device
+//
+// The scored-on device makes up a trace id at the beam break and sends it
+// with the goal. The Pi stamps its two hops and passes id and stamps on in
+// the score broadcast and /scoreMade. Each device keeps the last
+// GOAL_TRACE_SLOTS traces it took part in, its own hops converted to the
+// Pi's clock (see clock_sync.h), and serves them on GET /traces, one JSON
+// object per line, for the trace_collector tool to merge into timelines.
+// A trace started before the clock was synced keeps device time and says
+// so. Goals journaled while offline aren't traced past the break.
+
+#define GOAL_TRACE_SLOTS 8
+#define GOAL_TRACE_LINE_MAX 320
+
+enum GoalHop : uint8_t {
+  GOAL_HOP_BREAK,
+  GOAL_HOP_SENT,
+  GOAL_HOP_PI_RECEIVED,
+  GOAL_HOP_PI_SENT,
+  GOAL_HOP_ACK,
+  GOAL_HOP_NOTIFIED,
+  GOAL_HOP_CELEBRATED,
+  GOAL_HOP_COUNT
+};
+
+// How the notification arrived
+enum GoalVia : uint8_t {
+  GOAL_VIA_NONE,
+  GOAL_VIA_UDP,
+  GOAL_VIA_HTTP
+};
+
+struct GoalTrace {
+  uint32_t id;
+  uint8_t scorer;      // ScorePlayer
+  uint8_t via;         // GoalVia
+  uint8_t seen;        // Bit per GoalHop
+  bool synced;         // Hops in the Pi's clock, otherwise this device's
+  uint32_t errorUs;    // Clock error bound when the trace started
+  uint32_t hops[GOAL_HOP_COUNT];
+};
+
+void resetGoalTraces();
+
+// A new trace at a beam break, scorer is the side the goal counts for
+void startGoalTrace(uint32_t id, uint8_t scorer, uint32_t breakMicros);
+
+// One of this device's hops at halMicros() time. Ignored for id 0, or a
+// trace no longer kept.
+void traceGoalHop(uint32_t id, uint8_t hop, uint32_t micros);
+
+// A score notification with the Pi's stamps, starting the trace on a
+// device that didn't send the goal. Only the first copy of a goal counts.
+void traceGoalNotified(uint32_t id, uint8_t scorer, uint8_t via, uint32_t piReceivedUs, uint32_t piSentUs,
+                       uint32_t arrivedMicros);
+
+// What the goal tells the Pi, false when the trace is gone
+bool goalScoreTrace(uint32_t id, ScoreTrace* trace);
+
+uint8_t goalTraceCount();
+const GoalTrace& goalTrace(uint8_t index);   // 0 is the oldest
+
+// One line per trace, oldest first
+typedef void (*GoalTraceSink)(const char* text, size_t length);
+void writeGoalTraces(GoalTraceSink sink, uint16_t table, const char* side);
+
+const char* goalHopName(uint8_t hop);
+const char* goalViaName(uint8_t via);
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hardware abstraction layer - everything the game logic needs from the
+// board. hal_esp8266.cpp maps it onto the Arduino core; the native backend
+// (src/native/hal_native.cpp) runs it on Linux against a virtual clock,
+// scripted GPIO traces and loopback sockets.
+
+#define HAL_MAX_SOCKETS 9   // Outbound, OTA download, event stream and HTTP clients
+#define HAL_INVALID_SOCKET -1
+#define HAL_MAX_LISTENERS 2
+#define HAL_UDP_DATAGRAM_MAX 32   // Longer datagrams are truncated
+#define HAL_UDP_QUEUE_SIZE 8
+#define HAL_FLASH_SECTOR_SIZE 4096
+#define HAL_MAX_WAKE_PINS 4
+#define HAL_LIGHT_SLEEP_MIN_MS 10   // Shorter sleeps keep the CPU running
+#define HAL_LIGHT_WAKE_US 3000      // Typical ESP8266 light sleep wake-up
+
+typedef int8_t HalSocket;
+typedef void (*HalIsr)();
+
+// Time
+uint32_t halMillis();
+uint32_t halMicros();
+void halDelay(uint32_t ms);
+
+// Free-running CPU cycle counter for cheap interval timing. Wraps, so only
+// differences mean anything.
+uint32_t halCycleCount();
+uint32_t halCyclesPerMicro();
+
+// Idle until maxMs passes or an ISR calls halWake(), whichever is first
+void halSleep(uint32_t maxMs);
+void halWake();  // ISR-safe
+
+// Power - how deep halSleep() goes
+enum HalPowerMode : uint8_t {
+  HAL_POWER_FULL,    // Radio always on, the lowest latency
+  HAL_POWER_MODEM,   // Radio sleeps between the AP's beacons, packets for
+                     // the device wait for the next one
+  HAL_POWER_LIGHT    // As MODEM, and halSleep() also stops the CPU until a
+                     // wake pin changes level, a beacon or the timeout
+};
+
+// Wake pins must have an ISR attached, see halPinEdge()
+void halSetPowerMode(uint8_t mode, const uint8_t* wakePins, uint8_t wakePinCount);
+
+// GPIO - modes and levels use the Arduino constants (INPUT_PULLUP, HIGH...)
+void halPinMode(uint8_t pin, uint8_t mode);
+int halDigitalRead(uint8_t pin);
+void halDigitalWrite(uint8_t pin, uint8_t value);
+void halAnalogWrite(uint8_t pin, int value);
+void halAttachInterrupt(uint8_t pin, HalIsr isr, int mode);
+
+// In a pin's ISR: the level the pin changed to, and the halMicros() it did.
+// Pin ISRs can't run in light sleep. When it ends, wake pins that changed
+// have their ISR replayed: the change stamped HAL_LIGHT_WAKE_US before the
+// CPU ran again and, for a pin already back at its old level, the change
+// back at the wake-up. A break the CPU slept through reads that wide.
+int halPinEdge(uint8_t pin, uint32_t* micros);
+
+// System
+uint32_t halRandom();
+
+// Debug console (the UART). halConsoleWrite() never blocks as long as
+// length stays within halConsoleWritable().
+int halConsoleWritable();
+void halConsoleWrite(const char* data, size_t length);
+
+// Persistent storage - small fixed-size records kept across reboots, one
+// file per path. Load fails when the record is missing or a different size.
+bool halStorageLoad(const char* path, void* data, size_t size);
+bool halStorageSave(const char* path, const void* data, size_t size);
+
+// Firmware images. Flash below the filesystem holds the running image, a
+// backup slot for a copy of it, and a staging area for a new image written
+// a chunk at a time. halFirmwareEnd() or halFirmwareRestoreBackup() leave a
+// command for the boot loader, which copies that image over the running one
+// on the next halRestart(). Erasing and writing flash stalls the CPU for
+// tens of ms per sector.
+uint32_t halFirmwareSize();
+bool halFirmwareRead(uint32_t offset, uint8_t* data, size_t length);
+bool halFirmwareBackup(uint32_t sector);    // One sector of the running image
+bool halFirmwareBegin(uint32_t size);       // Fails unless image, backup and stage all fit
+bool halFirmwareWrite(const uint8_t* data, size_t length);
+bool halFirmwareEnd();                      // Stage complete, boot it next
+void halFirmwareAbort();
+bool halFirmwareRestoreBackup(uint32_t size);
+void halRestart();
+
+// Network - halTcpConnect() is the only call allowed to block, for at most
+// timeoutMs. Everything else returns immediately.
+bool halNetworkConnected();
+HalSocket halTcpConnect(const char* host, uint16_t port, uint32_t timeoutMs);
+
+// Opens a connection without waiting for the handshake. Poll
+// halTcpConnecting() until it turns false, then halTcpConnected() tells
+// whether it came up. Closing the socket gives up on it.
+HalSocket halTcpConnectStart(const char* host, uint16_t port);
+bool halTcpConnecting(HalSocket socket);
+int halTcpWrite(HalSocket socket, const uint8_t* data, size_t length);
+int halTcpAvailable(HalSocket socket);
+int halTcpRead(HalSocket socket, uint8_t* data, size_t length);
+bool halTcpConnected(HalSocket socket);
+void halTcpClose(HalSocket socket);
+
+// Space in the socket's send buffer - writes up to this never block
+int halTcpWritable(HalSocket socket);
+
+// Listening sockets - accepted connections come from the same socket pool.
+// halTcpAccept() returns HAL_INVALID_SOCKET when nobody is waiting.
+int8_t halTcpListen(uint16_t port);
+HalSocket halTcpAccept(int8_t listener);
+
+// UDP - datagrams for the port (and multicast group, if one is given) are
+// queued by the network stack as they arrive. onReceive runs in that
+// context, so ISR rules apply. Call again after reconnecting to rejoin the
+// group. halUdpRead() returns one datagram's length, 0 when none is queued,
+// and the halMicros() it arrived at. halUdpSend() goes out from the
+// listening port, so answers come back to it; host is an IP address.
+bool halUdpListen(const char* group, uint16_t port, HalIsr onReceive);
+int halUdpRead(uint8_t* data, size_t size, uint32_t* arrivedMicros);
+bool halUdpSend(const char* host, uint16_t port, const uint8_t* data, size_t length);
+
+#endif
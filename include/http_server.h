@@ -0,0 +1,82 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Cooperative HTTP/1.1 server on the HAL socket pool. Up to
+// HTTP_MAX_CLIENTS connections are served at once; requests are parsed
+// incrementally as bytes arrive, so a slow or half-sent request never holds
+// up the loop or the other clients. Connections are kept alive and
+// pipelined requests are answered in order, one at a time.
+//
+// Handlers run from the server task and answer with httpSend(), or stream
+// a page of unknown length with httpBeginStream() and httpWrite(). Buffered
+// responses are rendered into one shared buffer and written out as the
+// socket has room; a request waits while another client's response still
+// holds it. Streamed pages go out chunked and synchronously, since they are
+// generated a chunk at a time and never held in RAM.
+
+#define HTTP_SERVER_PORT 80
+#define HTTP_MAX_CLIENTS 4
+#define HTTP_MAX_ROUTES 10
+#define HTTP_INPUT_MAX 128        // Unparsed bytes held per client
+#define HTTP_LINE_MAX 96          // Longer header lines are truncated
+#define HTTP_PATH_MAX 48          // Including the query
+#define HTTP_BODY_MAX 384
+#define HTTP_HEADER_RESERVE 160   // Status line and headers, ahead of the body
+#define HTTP_RESPONSE_MAX (HTTP_HEADER_RESERVE + 3072)  // /status is 2819 at most
+#define HTTP_STREAM_CHUNK 512
+
+#define HTTP_REQUEST_TIMEOUT_MS 2000     // First byte to complete request
+#define HTTP_KEEPALIVE_TIMEOUT_MS 10000  // Idle connection
+#define HTTP_SEND_TIMEOUT_MS 2000        // Client not reading its response
+#define HTTP_IDLE_POLL_MS 20     // Nobody connected, only accepts
+#define HTTP_CLIENT_POLL_MS 5    // Connections open, nothing ready
+#define HTTP_FLUSH_POLL_MS 1     // A response or a parsed request waiting
+
+enum HttpMethod : uint8_t {
+  HTTP_METHOD_GET,
+  HTTP_METHOD_POST,
+  HTTP_METHOD_OTHER
+};
+
+struct HttpRequest {
+  uint8_t method;       // HttpMethod
+  const char* path;     // Without the query
+  const char* query;    // After the '?', "" when there is none
+  const char* body;     // NUL-terminated
+  uint16_t bodyLength;
+};
+
+typedef void (*HttpHandler)(const HttpRequest& request);
+
+struct HttpServerStats {
+  uint32_t connections;
+  uint32_t requests;
+  uint32_t keepAliveRequests;  // Served on a connection that had served one before
+  uint32_t pipelined;          // Already waiting when the previous response went out
+  uint32_t errors;             // Answered 4xx/5xx by the server itself
+  uint32_t timeouts;           // Dropped mid-request or mid-response
+  uint32_t bufferWaits;        // Requests that waited for the shared buffer
+  uint8_t clients;             // Currently connected
+  uint8_t maxClients;
+};
+
+bool setupHttpServer(uint16_t port = HTTP_SERVER_PORT);
+void httpOn(HttpMethod method, const char* path, HttpHandler handler);
+
+// Answers the current request. body may already point into
+// httpResponseBuffer(), then nothing is copied.
+void httpSend(int status, const char* contentType, const char* body);
+
+// Room for rendering a buffered body in place
+char* httpResponseBuffer(size_t* size);
+
+// Streams the current response with chunked encoding
+void httpBeginStream(int status, const char* contentType);
+void httpWrite(const char* data, size_t length);
+
+const HttpServerStats& httpServerStats();
+
+#endif
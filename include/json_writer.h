@@ -0,0 +1,180 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Minimal JSON writer over a caller-owned fixed buffer - no heap, no String.
+// Keys are written as-is, so they must be fixed tokens that need no
+// escaping. String values are escaped, since some come from users (the
+// WiFi SSID). Output that doesn't fit is truncated and flagged by
+// overflowed(). Everything but the rare \u escape is copied or converted
+// by hand - snprintf() per field dominated the cost of a batch.
+class JsonWriter {
+public:
+  JsonWriter(char* buffer, size_t size) : _buffer(buffer), _size(size) {
+    if (_size > 0) {
+      _buffer[0] = '\0';
+    }
+  }
+
+  void openObject(const char* key = nullptr) { open(key, '{'); }
+  void closeObject() { close('}'); }
+  void openArray(const char* key = nullptr) { open(key, '['); }
+  void closeArray() { close(']'); }
+
+  void addString(const char* key, const char* value) {
+    writeKey(key);
+    appendChar('"');
+    // Runs that need no escaping go out in one piece
+    const char* run = value;
+    for (const char* p = value;; p++) {
+      char c = *p;
+      if (c != '\0' && c != '"' && c != '\\' && (uint8_t)c >= 0x20) {
+        continue;
+      }
+      appendRaw(run, p - run);
+      if (c == '\0') {
+        break;
+      }
+      appendEscaped(c);
+      run = p + 1;
+    }
+    appendChar('"');
+  }
+  void addUint(const char* key, uint32_t value) {
+    writeKey(key);
+    appendUint(value);
+  }
+  void addInt(const char* key, int32_t value) {
+    writeKey(key);
+    if (value < 0) {
+      appendChar('-');
+      appendUint(0u - (uint32_t)value);  // INT32_MIN too
+    } else {
+      appendUint(value);
+    }
+  }
+  void addBool(const char* key, bool value) {
+    writeKey(key);
+    if (value) {
+      appendRaw("true", 4);
+    } else {
+      appendRaw("false", 5);
+    }
+  }
+  // Fixed-point value stored in tenths, written as a decimal
+  void addTenths(const char* key, uint16_t value) {
+    writeKey(key);
+    appendUint(value / 10);
+    appendChar('.');
+    appendUint(value % 10);
+  }
+
+  size_t length() const { return _length; }
+  bool overflowed() const { return _overflowed; }
+
+private:
+  void writeKey(const char* key) {
+    if (_needComma) {
+      appendChar(',');
+    }
+    if (key != nullptr) {
+      appendChar('"');
+      appendRaw(key, strlen(key));
+      appendRaw("\":", 2);
+    }
+    _needComma = true;
+  }
+
+  void appendEscaped(char c) {
+    switch (c) {
+      case '"':
+        appendRaw("\\\"", 2);
+        break;
+      case '\\':
+        appendRaw("\\\\", 2);
+        break;
+      case '\n':
+        appendRaw("\\n", 2);
+        break;
+      case '\r':
+        appendRaw("\\r", 2);
+        break;
+      case '\t':
+        appendRaw("\\t", 2);
+        break;
+      default:
+        append("\\u%04x", (unsigned)(uint8_t)c);
+        break;
+    }
+  }
+
+  void open(const char* key, char bracket) {
+    writeKey(key);
+    appendChar(bracket);
+    _needComma = false;
+  }
+
+  void close(char bracket) {
+    appendChar(bracket);
+    _needComma = true;
+  }
+
+  // Digits from the lowest up, into the end of a scratch buffer
+  void appendUint(uint32_t value) {
+    char digits[10];
+    uint8_t count = 0;
+    do {
+      digits[sizeof(digits) - ++count] = '0' + value % 10;
+      value /= 10;
+    } while (value > 0);
+    appendRaw(digits + sizeof(digits) - count, count);
+  }
+
+  void appendChar(char c) {
+    appendRaw(&c, 1);
+  }
+
+  // Truncates like snprintf() would, keeping the buffer terminated
+  void appendRaw(const char* text, size_t length) {
+    if (_overflowed) {
+      return;
+    }
+    if (length >= _size - _length) {
+      _overflowed = true;
+      if (_length < _size) {
+        memcpy(_buffer + _length, text, _size - _length - 1);
+        _length = _size - 1;
+        _buffer[_length] = '\0';
+      }
+      return;
+    }
+    memcpy(_buffer + _length, text, length);
+    _length += length;
+    _buffer[_length] = '\0';
+  }
+
+  template <typename... Args>
+  void append(const char* format, Args... args) {
+    if (_overflowed) {
+      return;
+    }
+    int written = snprintf(_buffer + _length, _size - _length, format, args...);
+    if (written < 0 || (size_t)written >= _size - _length) {
+      _overflowed = true;
+      _length = _size - 1;
+      return;
+    }
+    _length += written;
+  }
+
+  char* _buffer;
+  size_t _size;
+  size_t _length = 0;
+  bool _needComma = false;
+  bool _overflowed = false;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef LASER_CAPTURE_H
+#define LASER_CAPTURE_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+// Interrupt-driven laser beam capture. Every edge on the laser pin is
+// timestamped with micros() inside the ISR and buffered until loop() drains
+// it, so short beam breaks are never missed between polls. An optional
+// onEdge callback runs from the ISR after each edge is buffered.
+
+#define LASER_EDGE_BUFFER_SIZE 32
+
+struct LaserEdge {
+  uint32_t timestamp;  // micros() at the edge
+  bool broken;         // Beam state after the edge
+};
+
+void setupLaserCapture(uint8_t pin, HalIsr onEdge = nullptr);
+bool popLaserEdge(LaserEdge* edge);
+uint32_t laserEdgeOverflows();
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef LED_ANIMATION_H
+#define LED_ANIMATION_H
+
+#include <Arduino.h>
+
+// Non-blocking keyframe animations for the status LEDs. Animations are
+// constexpr keyframe tables; each channel has one slot per priority and
+// the highest active slot drives the LED. Lower slots keep their timeline
+// while hidden, so a goal flash over an own-goal blink resumes mid-blink.
+// Stepping runs as its own scheduler task and sleeps between keyframes.
+
+#define LED_ANIMATION_FRAME_MS 20  // Step interval while fading
+#define LED_REPEAT_FOREVER 0
+
+enum LedChannel : uint8_t {
+  LED_CHANNEL_RGB,
+  LED_CHANNEL_ACTIVITY,
+  LED_CHANNEL_NETWORK,
+  LED_CHANNEL_COUNT
+};
+
+// Higher wins
+enum LedPriority : uint8_t {
+  LED_PRIORITY_STATUS,    // Persistent state - ready, connecting...
+  LED_PRIORITY_FEEDBACK,  // Short acknowledgements - button toggles
+  LED_PRIORITY_ALERT,     // Goals
+  LED_PRIORITY_COUNT
+};
+
+enum LedEasing : uint8_t {
+  LED_EASE_STEP,    // Jump to the color and hold it
+  LED_EASE_LINEAR   // Fade from the previous keyframe's color
+};
+
+struct LedKeyframe {
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint8_t easing;
+  uint16_t durationMs;  // 0 on a single-frame animation holds it forever
+};
+
+struct LedAnimation {
+  const LedKeyframe* frames;
+  uint8_t count;
+  uint8_t repeats;      // LED_REPEAT_FOREVER or a play count
+  uint32_t totalMs;     // One pass through the frames
+};
+
+// Receives the channel's color; single-color LEDs treat any non-zero
+// component as on
+typedef void (*LedOutput)(uint8_t red, uint8_t green, uint8_t blue);
+
+constexpr LedKeyframe ledHold(uint8_t red, uint8_t green, uint8_t blue, uint16_t durationMs) {
+  return {red, green, blue, LED_EASE_STEP, durationMs};
+}
+
+constexpr LedKeyframe ledFade(uint8_t red, uint8_t green, uint8_t blue, uint16_t durationMs) {
+  return {red, green, blue, LED_EASE_LINEAR, durationMs};
+}
+
+constexpr uint32_t ledFramesTotal(const LedKeyframe* frames, size_t count) {
+  return count == 0 ? 0 : frames[0].durationMs + ledFramesTotal(frames + 1, count - 1);
+}
+
+template <size_t N>
+constexpr LedAnimation ledAnimation(const LedKeyframe (&frames)[N], uint8_t repeats) {
+  return {frames, (uint8_t)N, repeats, ledFramesTotal(frames, N)};
+}
+
+void setupLedAnimations(const LedOutput outputs[LED_CHANNEL_COUNT]);
+
+// Animations are referenced, not copied - pass static tables only
+void playAnimation(LedChannel channel, LedPriority priority, const LedAnimation& animation);
+void stopAnimation(LedChannel channel, LedPriority priority);
+bool animationActive(LedChannel channel, LedPriority priority);
+
+// Scales every channel's output, 255 is full and 0 turns all LEDs off.
+// Single-color LEDs stay on at any other brightness.
+void setLedBrightness(uint8_t brightness);
+
+#endif
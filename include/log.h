@@ -0,0 +1,77 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Logging with the level and categories fixed at compile time. A disabled
+// LOG_*() is a constant-false branch, so the compiler drops the call, its
+// format string and its arguments. Enabled lines are formatted into a RAM
+// ring and never block: the "log" task drains the ring to the UART as its
+// FIFO has room, and GET /log serves whatever the ring still holds.
+//
+// Build with -D LOG_LEVEL=... and/or -D LOG_CATEGORIES=... to narrow it,
+// see [env:esp12e_production]. Not for use in ISRs.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4   // Per edge, press and request - the hot paths
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_CAT_SYSTEM 0x01   // Boot, scheduler, storage
+#define LOG_CAT_WIFI 0x02
+#define LOG_CAT_HTTP 0x04     // Requests to the device's own web server
+#define LOG_CAT_NET 0x08      // Outbound requests and the event journal
+#define LOG_CAT_GAME 0x10     // Scores, goals and status colors
+#define LOG_CAT_BUTTON 0x20
+#define LOG_CAT_LASER 0x40
+#define LOG_CAT_STREAM 0x80   // Event stream and score broadcasts
+#define LOG_CAT_ALL 0xFF
+
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES LOG_CAT_ALL
+#endif
+
+#define LOG_BUFFER_SIZE 2048   // Power of two
+#define LOG_LINE_MAX 160       // Longer lines are truncated
+#define LOG_DRAIN_MS 5         // ~60 bytes at 115200 baud
+
+#define LOG_ENABLED(level, category) ((level) <= LOG_LEVEL && ((category) & LOG_CATEGORIES) != 0)
+
+#define LOG_AT(level, category, ...)                \
+  do {                                              \
+    if (LOG_ENABLED(level, category)) {             \
+      logWrite(level, category, __VA_ARGS__);       \
+    }                                               \
+  } while (0)
+
+#define LOG_ERROR(category, ...) LOG_AT(LOG_LEVEL_ERROR, category, __VA_ARGS__)
+#define LOG_WARN(category, ...) LOG_AT(LOG_LEVEL_WARN, category, __VA_ARGS__)
+#define LOG_INFO(category, ...) LOG_AT(LOG_LEVEL_INFO, category, __VA_ARGS__)
+#define LOG_DEBUG(category, ...) LOG_AT(LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+
+struct LogStats {
+  uint32_t lines;
+  uint32_t droppedLines;   // Overwritten before the UART got to them
+};
+
+// Registers the UART drain task. Lines logged before this are kept.
+void setupLog();
+
+// printf-style, use the macros above instead so disabled lines compile out
+void logWrite(uint8_t level, uint8_t category, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+const LogStats& logStats();
+
+// Receives the retained lines, oldest first, in at most two pieces
+typedef void (*LogSink)(const char* text, size_t length);
+
+void writeLog(LogSink sink);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef MATCH_STATE_H
+#define MATCH_STATE_H
+
+#include <stdint.h>
+#include "score_broadcast.h"
+
+// The match as this device sees it - goals, points and quantum points per
+// side plus the recent goals - so /status and the LEDs never wait on the Pi.
+//
+// Local events (a goal against this side, a point, a reset) are applied at
+// once as pending ops on top of the last confirmed state, then settle:
+//
+//   acknowledged  points and resets fold into the confirmed state; a goal
+//                 waits for the Pi's score broadcast that announces it, or
+//                 MATCH_GOAL_SETTLE_MS, whichever is first
+//   failed        the request didn't get through - the op stays pending,
+//                 counted, while it goes out again through the journal
+//   rejected      the Pi refused it, or it was dropped unsent for good - the
+//                 op is rolled back
+//   broadcast     the Pi's goal counts replace the confirmed ones and the
+//                 oldest pending goal for the scoring side is retired, since
+//                 goals for a side only ever come from the other side's device
+//
+// Every change bumps version, so pollers can tell when anything moved.
+// Pure logic with the time passed in.
+
+#define MATCH_PENDING_MAX 16
+#define MATCH_HISTORY_SIZE 16
+#define MATCH_GOAL_SETTLE_MS 5000
+#define MATCH_NO_OP 0
+
+enum MatchAck : uint8_t {
+  MATCH_ACK_APPLIED,    // The Pi answered 2xx
+  MATCH_ACK_FAILED,     // No answer or a transient error, to be resent
+  MATCH_ACK_REJECTED    // Refused by the Pi, or lost without being sent
+};
+
+enum MatchOpType : uint8_t {
+  MATCH_OP_GOAL,
+  MATCH_OP_POINT,
+  MATCH_OP_RESET
+};
+
+struct MatchSide {
+  uint16_t goals;
+  uint16_t points;
+  uint16_t quantumPoints;
+};
+
+struct MatchGoal {
+  uint32_t timeMs;
+  uint16_t speedKmhX10;   // 0 when unknown, always for the other side's goals
+  uint8_t player;
+  bool confirmed;         // Announced by the Pi
+  uint16_t op;            // Local op that scored it, MATCH_NO_OP if remote
+};
+
+struct MatchState {
+  uint32_t version;
+  uint32_t serverSeq;       // Last score broadcast folded in, 0 before the first
+  bool quantum;
+  uint8_t pending;          // Local ops not yet settled
+  MatchSide sides[SCORE_PLAYER_COUNT];      // Confirmed plus pending
+  MatchSide confirmed[SCORE_PLAYER_COUNT];  // As last acknowledged by the Pi
+};
+
+void resetMatchState();
+
+// Local events - each returns the op to settle later
+uint16_t matchLocalGoal(uint8_t player, uint16_t speedKmhX10, uint32_t nowMs);
+uint16_t matchLocalPoint(uint8_t player, uint16_t amount, bool quantum);
+uint16_t matchLocalReset();
+void matchSetQuantum(bool quantum);
+
+// Settles an op sent directly. Only MATCH_ACK_REJECTED takes it back.
+void matchAcknowledge(uint16_t op, MatchAck ack, uint32_t nowMs);
+
+// Ops sent through the event journal settle by journal seq instead
+void matchJournaled(uint16_t op, uint32_t journalSeq);
+void matchJournalResult(uint32_t journalSeq, MatchAck ack, uint32_t nowMs);
+
+// A score broadcast, delivered in seq order by the receiver
+void matchServerGoal(uint32_t seq, uint8_t player, const uint16_t goals[SCORE_PLAYER_COUNT], uint32_t nowMs);
+
+// Settles acknowledged goals the Pi never announced
+void updateMatchState(uint32_t nowMs);
+
+const MatchState& matchState();
+
+// Most recent goal first, i < matchGoalCount()
+uint8_t matchGoalCount();
+const MatchGoal& matchRecentGoal(uint8_t i);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lightweight instrumentation - fixed-bucket histograms and a rolling
+// latency summary, cheap enough to leave on in production. Stage timings
+// come from the CPU cycle counter (halCycleCount()), a single register read
+// on the ESP8266, instead of micros().
+//
+// writeMetrics() renders every module's counters and histograms in the
+// Prometheus text format for GET /metrics, a chunk at a time so the page
+// never has to fit in RAM.
+
+#define METRICS_BUCKET_COUNT 9       // Bounds below, plus +Inf
+#define METRICS_FIRST_BUCKET_US 16   // Each bound is 4x the previous, up to ~1 s
+#define METRICS_SUMMARY_SAMPLES 32
+#define METRICS_CHUNK_SIZE 512
+#define METRICS_LINE_MAX 128
+
+// Histogram of durations in microseconds. Counts are per bucket, not
+// cumulative; the writer accumulates them for Prometheus.
+struct MetricHistogram {
+  uint32_t counts[METRICS_BUCKET_COUNT];
+  uint32_t count;
+  uint64_t sumMicros;
+  uint32_t maxMicros;
+
+  void observe(uint32_t micros) {
+    uint8_t bucket = 0;
+    uint32_t bound = METRICS_FIRST_BUCKET_US;
+    while (bucket < METRICS_BUCKET_COUNT - 1 && micros > bound) {
+      bucket++;
+      bound <<= 2;
+    }
+    counts[bucket]++;
+    count++;
+    sumMicros += micros;
+    if (micros > maxMicros) {
+      maxMicros = micros;
+    }
+  }
+};
+
+// The most recent samples, for percentiles of rare but important events
+struct LatencySummary {
+  uint32_t samples[METRICS_SUMMARY_SAMPLES];
+  uint8_t next;
+  uint8_t filled;
+  uint32_t count;
+  uint64_t sumMicros;
+
+  void observe(uint32_t micros) {
+    samples[next] = micros;
+    next = (next + 1) % METRICS_SUMMARY_SAMPLES;
+    if (filled < METRICS_SUMMARY_SAMPLES) {
+      filled++;
+    }
+    count++;
+    sumMicros += micros;
+  }
+
+  // permille = 500 for the median, 0 when nothing was observed
+  uint32_t quantile(uint16_t permille) const;
+};
+
+// Stage timing on the cycle counter
+uint32_t metricsStart();
+uint32_t metricsElapsedMicros(uint32_t start);
+
+// Receives the rendered page one chunk at a time
+typedef void (*MetricsSink)(const char* text, size_t length);
+
+void writeMetrics(MetricsSink sink);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+// Host stand-in for the parts of the Arduino core the portable modules use
+// (Serial, String and pin constants). Hardware access goes through hal.h,
+// which the native backend implements in src/native/hal_native.cpp.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+
+#define IRAM_ATTR
+
+#define LOW 0
+#define HIGH 1
+
+#define INPUT 0x00
+#define INPUT_PULLUP 0x02
+#define OUTPUT 0x01
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+class String {
+public:
+  String() {}
+  String(const char* value) : _value(value != nullptr ? value : "") {}
+
+  const char* c_str() const { return _value.c_str(); }
+  size_t length() const { return _value.length(); }
+
+  bool operator==(const char* other) const { return _value == other; }
+  bool operator==(const String& other) const { return _value == other._value; }
+  bool operator!=(const char* other) const { return _value != other; }
+
+private:
+  std::string _value;
+};
+
+class Print {
+public:
+  void begin(unsigned long) {}
+
+  void print(const char* value) { write("%s", value); }
+  void print(const String& value) { write("%s", value.c_str()); }
+  void print(char value) { write("%c", value); }
+  void print(int value) { write("%d", value); }
+  void print(unsigned int value) { write("%u", value); }
+  void print(long value) { write("%ld", value); }
+  void print(unsigned long value) { write("%lu", value); }
+  void print(double value) { write("%.2f", value); }
+
+  template <typename T>
+  void println(T value) {
+    print(value);
+    println();
+  }
+  void println() {
+    if (echo) {
+      fputs("\n", stdout);
+    }
+  }
+
+  bool echo = false;  // Off by default so simulations run at full speed
+
+private:
+  template <typename... Args>
+  void write(const char* format, Args... args) {
+    if (echo) {
+      printf(format, args...);
+    }
+  }
+};
+
+typedef Print HardwareSerial;
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef MOCK_PI_H
+#define MOCK_PI_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+// Stand-in for the Pi's HTTP API on a Linux host - answers every request
+// with 200 {} on a keep-alive connection, from a single poll() thread.
+// Each complete request is handed to the handler first.
+//
+// With setMockPiWire() the same thread also takes binary frames (see
+// wire_protocol.h) on a second listener. Each is decoded into the path and
+// JSON body it stands for, handed to the handler as a POST and acked with
+// 200. GET /status then advertises the wire port.
+
+typedef void (*MockPiHandler)(const char* method, const char* path, const std::string& body);
+
+// Listens on address ("127.0.0.1", "0.0.0.0") and *port, 0 for any free
+// port, which is written back. Returns the socket, or -1.
+int openMockPi(const char* address, uint16_t* port);
+
+// A second socket from openMockPi() for frames, before runMockPi()
+void setMockPiWire(int wireFd, uint16_t wirePort);
+
+// Serves until running turns false, then closes every client
+void runMockPi(int listenFd, MockPiHandler handler, const std::atomic<bool>& running);
+
+// A slow or stalled Pi, before runMockPi(). Every request still reaches the
+// handler, as if the Pi applied it, but its answer is held back delayMs;
+// with stallEvery N, every Nth one is never answered at all. Held answers
+// only go out from sendMockPiAnswers(), so the delay can be on the
+// simulator's virtual clock.
+void setMockPiDelay(uint32_t delayMs, uint32_t stallEvery);
+void sendMockPiAnswers(uint32_t nowMs);
+uint32_t mockPiStalls();
+
+// A Pi that falls over mid-request: every Nth POST or frame never reaches
+// the handler and its connection is closed instead of answered
+void setMockPiLoss(uint32_t loseEvery);
+uint32_t mockPiLosses();
+
+#endif
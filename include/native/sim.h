@@ -0,0 +1,41 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Controls for the native simulation backend. Time only moves when the
+// simulator advances it; scripted pin edges fire their ISRs at exactly the
+// scheduled virtual time.
+
+void simSeed(uint32_t seed);
+uint64_t simNowMicros();
+void simAdvanceMicros(uint32_t micros);
+
+// From here on the virtual clock also moves while code runs: by this
+// thread's host CPU time times scale, charged whenever the firmware reads
+// the clock. 0 stops it again. Without it a task takes no time at all.
+void simChargeCpuTime(uint32_t scale);
+
+// Schedules an input level change at an absolute virtual time
+void simScheduleEdge(uint64_t atMicros, uint8_t pin, int level);
+size_t simPendingEdges();
+
+void simSetNetworkConnected(bool connected);
+
+// While set, TCP connects get no answer, as if the host had dropped off the
+// network: halTcpConnecting() stays true and halTcpConnect() waits out its
+// timeout. Setting it also cuts the connections already open.
+void simSetTcpUnreachable(bool unreachable);
+uint32_t simUnansweredConnects();
+
+int simPinOutput(uint8_t pin);
+int simAnalogOutput(uint8_t pin);
+
+// Firmware images live in RAM. halRestart() doesn't restart the process, it
+// copies whichever image the boot loader was told to and counts restarts.
+void simSetFirmware(const uint8_t* image, size_t size);
+size_t simFirmware(const uint8_t** image);
+uint32_t simRestarts();
+
+#endif
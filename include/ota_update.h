@@ -0,0 +1,116 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sha1.h"
+
+// Over-the-air firmware updates from the Pi. POST /ota names a file on the
+// Pi's HTTP server - a full image, or a delta patch against the running one
+// (see firmware_patch.h) - with the new image's size and SHA-1. The update
+// task then works through it in the background:
+//
+//   backup     copies the running image to the backup slot a sector per
+//              pass, hashing it on the way - a patch's base has to match
+//   download   GETs the file and writes each chunk, or what the patch makes
+//              of it, straight to the staging area. A dropped connection is
+//              resumed with a Range request from the last byte received.
+//   staged     the image's SHA-1 matched and it boots on the next restart,
+//              which waits for play to be quiet
+//
+// Nothing is buffered beyond one chunk. Flash work and the download run at
+// most a chunk per OTA_CHUNK_INTERVAL_MS, and pause while the laser or
+// buttons are in use and for OTA_QUIET_MS after.
+//
+// The new image boots on trial. Unless it reaches ready (WiFi up, which
+// calls confirmOtaUpdate()) within OTA_TRIAL_MS, and before its
+// OTA_TRIAL_BOOTS'th boot, the boot loader copies the backup back and the
+// device restarts into the previous image.
+
+#define OTA_STATE_FILE "/ota.bin"
+#define OTA_PATH_MAX 64
+#define OTA_LINE_MAX 96
+#define OTA_CHUNK_SIZE 1024          // Socket bytes, or patch output, per pass
+#define OTA_CHUNK_INTERVAL_MS 10     // Between chunks - caps the transfer near 100 KB/s
+#define OTA_POLL_MS 20               // Waiting for the Pi's next bytes
+#define OTA_QUIET_MS 15000           // Paused for this long after laser or button activity
+#define OTA_CONNECT_TIMEOUT_MS 250
+#define OTA_STALL_MS 5000            // No bytes for this long, reconnect and resume
+#define OTA_RETRY_MS 1000
+#define OTA_MAX_CONNECTIONS 8        // Per update, resumes included
+#define OTA_RESTART_DELAY_MS 1000    // Staged to restart, once quiet
+#define OTA_TRIAL_MS 60000
+#define OTA_TRIAL_BOOTS 3
+
+enum OtaPhase : uint8_t {
+  OTA_IDLE,
+  OTA_BACKUP,
+  OTA_DOWNLOAD,
+  OTA_STAGED,
+  OTA_FAILED
+};
+
+// What the last update left behind, kept in OTA_STATE_FILE
+enum OtaBoot : uint8_t {
+  OTA_BOOT_NORMAL,
+  OTA_BOOT_TRIAL,        // New image, not ready yet
+  OTA_BOOT_CONFIRMED,    // New image reached ready
+  OTA_BOOT_ROLLED_BACK   // New image never did, the previous one is back
+};
+
+struct OtaRequest {
+  char path[OTA_PATH_MAX];
+  uint16_t port;                       // 0 for the Pi's API port
+  bool patch;
+  uint32_t size;                       // Of the new image, not the patch
+  uint8_t sha1[SHA1_DIGEST_SIZE];      // Same
+};
+
+struct OtaStatus {
+  uint8_t phase;           // OtaPhase
+  uint8_t boot;            // OtaBoot
+  uint8_t trialBoots;
+  bool paused;             // Waiting for play to go quiet
+  bool patch;
+  uint32_t imageSize;
+  uint32_t backedUp;       // Running image bytes copied to the backup slot
+  uint32_t fileSize;       // Of the file on the Pi, 0 until it answered
+  uint32_t downloaded;
+  uint32_t written;        // Image bytes staged
+  uint32_t connections;
+  uint32_t resumes;        // Range requests after a dropped connection
+  uint32_t pauses;
+  uint32_t durationMs;     // Start to staged
+  const char* error;       // Why the last update failed
+};
+
+// Call once per boot, right after loadDeviceConfig() so a trial image that
+// crashes early still counts its boots. May not return: a trial image out
+// of boots is rolled back here.
+void setupOta(const char* host, uint16_t port);
+
+// False if the body lacks a path, size or SHA-1
+bool parseOtaRequest(const char* body, OtaRequest* request);
+
+// Busy while an update runs or the running image is still on trial
+bool otaBusy();
+
+// False when the image won't fit beside the running one and its backup
+bool startOtaUpdate(const OtaRequest& request);
+
+// Laser or button activity, pauses flash work and the download
+void otaPlayActivity(uint32_t nowMs);
+
+// The running image reached ready, ends its trial
+void confirmOtaUpdate();
+
+const OtaStatus& otaStatus();
+
+// SHA-1 of the running image, false until a backup or trial has made it
+// known
+bool otaFirmwareSha1(uint8_t digest[SHA1_DIGEST_SIZE]);
+
+const char* otaPhaseName(uint8_t phase);
+const char* otaBootName(uint8_t boot);
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef OUTBOUND_H
+#define OUTBOUND_H
+
+#include <Arduino.h>
+#include "metrics.h"
+
+// Outbound request queue - requests to the Pi are queued here and sent by a
+// small state machine that advances one step per loop() pass, so a slow
+// or unreachable server never stalls laser polling, buttons or the local
+// web server.
+// A single HTTP/1.1 keep-alive connection is reused across requests and
+// transparently reopened when the Pi closes it.
+//
+// Once setOutboundWire() gives the Pi's wire port, binary frames (see
+// wire_protocol.h) can be queued too. They go out on the same single
+// connection, reopened to the wire port, and complete with the status in
+// the Pi's ack frame as if it were an HTTP status.
+//
+// A keep-alive connection the Pi closed while idle only shows up once a
+// request is sent on it. Only requests queued OUTBOUND_RESENDABLE, which the
+// Pi can safely see twice (GETs, and anything it dedupes by seq), are resent
+// on a fresh connection then; the rest fail with OUTBOUND_ERROR_LOST, as
+// the Pi may have applied them before the connection went.
+
+#define OUTBOUND_QUEUE_SIZE 8
+#define OUTBOUND_PATH_MAX 16
+#define OUTBOUND_BODY_MAX 160   // A traced, sequenced /score body with every field at its longest
+#define OUTBOUND_CONNECT_TIMEOUT_MS 250
+#define OUTBOUND_REQUEST_TIMEOUT_MS 3000
+#define OUTBOUND_READ_CHUNK 64
+#define OUTBOUND_LINE_MAX 64
+#define OUTBOUND_RESPONSE_MAX 256   // Start of a response body kept for onComplete
+
+// Negative result codes (positive codes are HTTP status codes)
+#define OUTBOUND_ERROR_CONNECT -1
+#define OUTBOUND_ERROR_TIMEOUT -2
+#define OUTBOUND_ERROR_LOST -3
+#define OUTBOUND_ERROR_BAD_RESPONSE -4
+
+enum OutboundKind : uint8_t {
+  OUTBOUND_POST,
+  OUTBOUND_GET,
+  OUTBOUND_FRAME    // Binary frame to the wire port
+};
+
+enum OutboundState {
+  OUTBOUND_IDLE,
+  OUTBOUND_CONNECTING,
+  OUTBOUND_OPENING,   // Waiting for the TCP handshake, up to OUTBOUND_CONNECT_TIMEOUT_MS
+  OUTBOUND_SENDING,
+  OUTBOUND_WAITING,   // Reading the status line, or the ack frame
+  OUTBOUND_HEADERS,
+  OUTBOUND_BODY
+};
+
+enum OutboundResend : uint8_t {
+  OUTBOUND_ONCE,
+  OUTBOUND_RESENDABLE
+};
+
+typedef void (*OutboundCallback)(int result);
+
+struct OutboundRequest {
+  uint8_t kind;                // OutboundKind
+  uint8_t wireType;            // WireType of a frame
+  bool resendable;             // OutboundResend, always true for GETs
+  uint16_t bodyLength;         // Payload bytes of a frame, bodies are strings
+  char path[OUTBOUND_PATH_MAX];
+  char body[OUTBOUND_BODY_MAX];
+  const char* externalBody;    // Caller-owned body for payloads larger than body[]
+  const char* label;           // Used for logging, e.g. "Goal API"
+  unsigned long timeoutMs;     // Deadline measured from when the request starts
+  OutboundCallback onComplete; // Optional, called with the final result
+};
+
+struct OutboundStats {
+  uint32_t requests;
+  uint32_t reuseHits;    // Requests sent on an already open connection
+  uint32_t reconnects;   // New connections opened to the Pi
+  uint32_t retries;      // Resendable requests resent after a stale connection died
+  uint32_t dropped;      // Refused because the queue was full
+  uint32_t failures;     // Completed with an error code instead of a status
+  uint32_t frames;       // Requests sent as binary frames
+  uint32_t wireFallbacks;  // Times the wire port failed and JSON took over
+  uint32_t bytesSent;
+  uint32_t bytesReceived;
+  MetricHistogram requestTime;  // Start of sending to the final result
+};
+
+void setupOutbound(const char* host, uint16_t port);
+bool queueOutbound(const char* path, const char* body, const char* label,
+                   OutboundCallback onComplete = nullptr, OutboundResend resend = OUTBOUND_ONCE,
+                   unsigned long timeoutMs = OUTBOUND_REQUEST_TIMEOUT_MS);
+// Queues a request whose body is owned by the caller and must stay valid
+// until onComplete runs
+bool queueOutboundBuffer(const char* path, const char* body, const char* label,
+                         OutboundCallback onComplete, OutboundResend resend = OUTBOUND_ONCE,
+                         unsigned long timeoutMs = OUTBOUND_REQUEST_TIMEOUT_MS);
+bool queueOutboundGet(const char* path, const char* label, OutboundCallback onComplete,
+                      unsigned long timeoutMs = OUTBOUND_REQUEST_TIMEOUT_MS);
+// A binary frame's payload, copied like queueOutbound() copies a body
+bool queueOutboundFrame(uint8_t type, const uint8_t* payload, size_t length, const char* label,
+                        OutboundCallback onComplete = nullptr, OutboundResend resend = OUTBOUND_ONCE,
+                        unsigned long timeoutMs = OUTBOUND_REQUEST_TIMEOUT_MS);
+// ...or caller-owned like queueOutboundBuffer()
+bool queueOutboundFrameBuffer(uint8_t type, const uint8_t* payload, size_t length, const char* label,
+                              OutboundCallback onComplete, OutboundResend resend = OUTBOUND_ONCE,
+                              unsigned long timeoutMs = OUTBOUND_REQUEST_TIMEOUT_MS);
+void updateOutbound();
+uint8_t outboundPending();
+const OutboundStats& outboundStats();
+
+// The start of the response body, NUL-terminated. Only valid in onComplete.
+const char* outboundResponseBody();
+
+// True for a result the Pi won't change its mind on however often the
+// request is sent: a 4xx other than 408 and 429
+bool outboundRejected(int result);
+
+// Port the Pi takes binary frames on, 0 for JSON only. Callers check
+// outboundWireActive() before queueing frames; it turns false by itself when
+// the wire port can't be reached.
+void setOutboundWire(uint16_t port);
+bool outboundWireActive();
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef PAYLOADS_H
+#define PAYLOADS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "score_broadcast.h"
+
+// Request bodies exchanged with the Pi, built into caller-owned fixed
+// buffers. All formatters return the body length, or -1 if it didn't fit.
+
+#define PLAYER_NAME_MAX 8
+#define TRACE_ID_CHARS 8   // Hex digits
+
+// A goal's trace, see goal_trace.h. The break and sent hops are the Pi's
+// clock, so they only go along once the device's clock is synced.
+struct ScoreTrace {
+  uint32_t id;
+  bool timed;
+  uint32_t breakUs;
+  uint32_t sentUs;
+};
+
+// A goal or reset's place in the sending device's journal (see
+// event_journal.h), so the Pi can drop a copy it already applied. seq 0 is
+// none, for requests from outside the journal.
+struct JournalSeq {
+  uint32_t epoch;
+  uint32_t seq;
+};
+
+// POST /score - {"player":"red","speed":24.6}, speed omitted when 0. The
+// sending device's "table" follows the player, left out for SCORE_TABLE_ANY.
+// With a seq, "epoch" and "seq" come next. A traced goal adds
+// "trace":"1a2b3c4d" and, when timed, "breakUs" and "sentUs".
+int formatScoreBody(char* out, size_t size, const char* player, uint16_t table, uint16_t speedKmhX10,
+                    const ScoreTrace* trace = nullptr, const JournalSeq* seq = nullptr);
+
+// POST /reset - {"player":"blue","table":2,"epoch":123,"seq":8}, table,
+// epoch and seq as for /score
+int formatResetBody(char* out, size_t size, const char* player, uint16_t table, const JournalSeq* seq = nullptr);
+
+// POST /scoreMade - {"player":"blue"}
+int formatPlayerBody(char* out, size_t size, const char* player);
+
+// Journal records, see event_journal.h
+enum JournalEventType : uint8_t {
+  JOURNAL_GOAL = 1,
+  JOURNAL_POINT = 2,
+  JOURNAL_RESET = 3
+};
+
+#define JOURNAL_FLAG_QUANTUM 0x01
+
+struct JournalEvent {
+  uint32_t seq;
+  uint32_t timestamp;  // millis() when the event happened
+  uint8_t type;        // JournalEventType
+  uint8_t flags;
+  uint16_t value;      // Point amount, or goal speed in km/h * 10
+};
+
+// POST /events - {"player":"blue","table":2,"epoch":123,"now":4567,
+// "events":[...]}, table as for /score. Goals are reported against
+// opponent, points and resets for player.
+int formatEventsBody(char* out, size_t size, const char* player, const char* opponent, uint16_t table,
+                     uint32_t epoch, uint32_t now, const JournalEvent* events, uint8_t count);
+
+// Request line and headers of a keep-alive POST to the Pi
+int formatRequestHeader(char* out, size_t size, const char* path, const char* host, uint16_t port,
+                        size_t bodyLength);
+
+// Same for a GET
+int formatGetHeader(char* out, size_t size, const char* path, const char* host, uint16_t port);
+
+// Finds the "player" string field in a JSON body without copying or
+// allocating the document. Returns false if it is missing or too long.
+bool parsePlayerField(const char* body, char* player, size_t size);
+
+// Same for any string field - escapes are not decoded
+bool parseStringField(const char* body, const char* field, char* value, size_t size);
+
+// Same for an unsigned integer field such as "seq"
+bool parseUintField(const char* body, const char* field, uint32_t* value);
+
+// The "trace" id of a goal or score notification, false when absent or 0
+bool parseTraceField(const char* body, uint32_t* id);
+
+bool hasJsonField(const char* body, const char* field);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef POWER_STATE_H
+#define POWER_STATE_H
+
+#include <stdint.h>
+
+// Low-power idle. With the table left alone - no beam or button edges, no
+// goals from the other side - the device steps down:
+//
+//   ACTIVE  radio always on, LEDs at full brightness
+//   IDLE    after idleMs: the radio sleeps between the AP's beacons and
+//           the LEDs dim. Polling tasks run up to POWER_IDLE_SLACK_MS late
+//           so their wake-ups coincide.
+//   SLEEP   after sleepMs: the CPU also stops between beacons until the
+//           laser or a button pin changes (see halSleep()). LEDs are off,
+//           PWM stops with the clocks. Slack is POWER_SLEEP_SLACK_MS.
+//
+// Both timeouts count from the last activity, 0 never steps down. Activity
+// returns to ACTIVE at once; the time from the event that woke the device
+// to being back at full power is its wake-to-ready latency. Nothing steps
+// down while the device is busy - a goal or request in flight, an update.
+//
+// Pure logic with the times passed in; game.cpp applies the states.
+
+#define POWER_TIMEOUT_NONE 0xFFFFFFFFUL
+#define POWER_IDLE_SLACK_MS 100     // About a beacon interval, the radio hears nothing sooner
+#define POWER_SLEEP_SLACK_MS 300
+#define POWER_IDLE_BRIGHTNESS 32    // Of 255
+
+enum PowerState : uint8_t {
+  POWER_ACTIVE,
+  POWER_IDLE,
+  POWER_SLEEP,
+  POWER_STATE_COUNT
+};
+
+// What brought the device back to ACTIVE
+enum PowerWake : uint8_t {
+  POWER_WAKE_LASER,
+  POWER_WAKE_BUTTON,
+  POWER_WAKE_GOAL,      // Score notification for the other side's goal
+  POWER_WAKE_COUNT
+};
+
+struct PowerStats {
+  uint8_t state;
+  uint32_t seconds[POWER_STATE_COUNT];    // Time in each state, the current one up to now
+  uint32_t entered[POWER_STATE_COUNT];
+  uint32_t wakes[POWER_WAKE_COUNT];
+  uint32_t lastWakeUs;                    // Wake-to-ready of the last wake
+  uint32_t maxWakeUs;
+  uint32_t wakeGoals;                     // Goals whose beam break was the waking event
+};
+
+void resetPowerState(uint32_t idleMs, uint32_t sleepMs, uint32_t nowMs);
+void setPowerTimeouts(uint32_t idleMs, uint32_t sleepMs);
+
+// Table activity at nowMs. Returns the state it ended, POWER_ACTIVE when
+// the device was awake already.
+uint8_t powerActivity(uint8_t wake, uint32_t nowMs);
+
+// Steps down once a timeout has passed, unless busy. Returns the state.
+uint8_t updatePowerState(uint32_t nowMs, bool busy);
+
+// ms until updatePowerState() next steps down, or POWER_TIMEOUT_NONE
+uint32_t powerStateTimeout(uint32_t nowMs);
+
+// Back at full power at readyMicros after a wake by an event at eventMicros
+void powerWakeReady(uint32_t eventMicros, uint32_t readyMicros);
+void powerWakeGoal();
+
+uint8_t powerState();
+const PowerStats& powerStats(uint32_t nowMs);
+
+const char* powerStateName(uint8_t state);
+const char* powerWakeName(uint8_t wake);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include "metrics.h"
+
+// Cooperative task scheduler. Each task returns how long until it next
+// wants to run; those deadlines live on a timer wheel. ISRs signal a task
+// for immediate dispatch and wake the loop out of halSleep(), so loop()
+// only wakes when something is actually due. In low power, timed runs
+// take slack so wake-ups of different tasks fall together.
+
+#define SCHEDULER_MAX_TASKS 12
+#define SCHEDULER_WHEEL_SLOTS 64    // 1 ms per slot
+#define SCHEDULER_MAX_SLEEP_MS 1000
+#define SCHEDULER_IDLE 0xFFFFFFFFUL // Task only runs when signaled or woken
+
+typedef uint32_t (*TaskFunction)();  // Returns ms until the next run
+
+struct TaskStats {
+  const char* name;
+  uint32_t runs;
+  uint32_t signals;
+  uint32_t maxSignalLatencyMicros;  // Signal to dispatch
+  MetricHistogram runTime;          // Time inside the task function
+};
+
+int8_t schedulerAddTask(const char* name, TaskFunction function);
+
+// ISR-safe - dispatch the task on the next scheduler pass
+void schedulerSignal(int8_t task);
+
+// Bring a task's next run forward to at most delayMs from now
+void schedulerWake(int8_t task, uint32_t delayMs = 0);
+
+// Lets timed runs be up to slackMs late, rounded to multiples of it so
+// tasks due close together run in one wake-up. Signals and wakes for now
+// never wait. 0 runs everything on time again.
+void schedulerSetSlack(uint32_t slackMs);
+
+// Runs signaled and due tasks, returns how long the caller may sleep
+uint32_t schedulerRun();
+
+// Runs every task unconditionally, as the old fixed-delay loop did
+void schedulerRunAll();
+
+uint8_t schedulerTaskCount();
+const TaskStats& schedulerTaskStats(int8_t task);
+
+// Busy time of each schedulerRun() pass, i.e. of one loop() iteration
+const MetricHistogram& schedulerPassTime();
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SCORE_BROADCAST_H
+#define SCORE_BROADCAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Score broadcasts - the Pi announces each goal with one UDP multicast
+// datagram instead of an HTTP POST to every device. POST /scoreMade stays
+// as the fallback; when it carries a "seq" it goes through the same
+// receiver so a goal is never celebrated twice.
+//
+// Packet, 30 bytes little-endian:
+//   0  'F' 'S'        magic
+//   2  version        SCORE_PACKET_VERSION
+//   3  player         ScorePlayer that scored
+//   4  seq            uint32, +1 per goal
+//   8  red score      uint16
+//   10 blue score     uint16
+//   12 trace          uint32, the goal's trace id or 0 (see goal_trace.h)
+//   16 Pi received    uint32, Pi clock micros when /score arrived
+//   20 Pi sent        uint32, Pi clock micros when this went out
+//   24 table          uint16, the table the goal was scored on
+//   26 boot           uint32, picked at random each time the Pi starts
+//
+// Every table's Pi sends to the same group and port, so the receiver drops
+// packets for other tables before they touch its seq tracking. Version 1
+// packets end after the scores and version 2 after the Pi timestamps; both
+// are still accepted, as coming from a Pi that only runs one table.
+//
+// The receiver delivers packets in seq order from the first one it sees.
+// Duplicates are dropped; packets ahead of a gap wait up to
+// SCORE_REORDER_WINDOW_MS for the missing one before the gap is skipped.
+// A restarted Pi counts from 1 again under a new boot id, and the receiver
+// starts over with it. Without a boot id (version 1 and 2, or a /scoreMade
+// without "boot"), a seq more than SCORE_SEQ_DUPLICATE_WINDOW behind is
+// taken as a restart rather than a duplicate.
+// Pure logic with the time passed in, so the Linux sender tool runs the
+// same code.
+
+#define SCORE_BROADCAST_GROUP "239.70.83.1"
+#define SCORE_BROADCAST_PORT 4210
+
+#define SCORE_PACKET_SIZE 30
+#define SCORE_PACKET_V1_SIZE 12
+#define SCORE_PACKET_V2_SIZE 24
+#define SCORE_PACKET_VERSION 3
+#define SCORE_TABLE_ANY 0xFFFF       // Table of a version 1 or 2 packet
+#define SCORE_BOOT_UNKNOWN 0         // Boot id of a version 1 or 2 packet
+#define SCORE_REORDER_SLOTS 4
+#define SCORE_REORDER_WINDOW_MS 40
+#define SCORE_SEQ_RESTART_GAP 1024   // Further ahead than this, the Pi restarted
+#define SCORE_SEQ_DUPLICATE_WINDOW 16
+#define SCORE_REORDER_IDLE 0xFFFFFFFFUL
+
+enum ScorePlayer : uint8_t {
+  SCORE_PLAYER_RED,
+  SCORE_PLAYER_BLUE,
+  SCORE_PLAYER_COUNT
+};
+
+struct ScorePacket {
+  uint32_t seq;
+  uint8_t player;
+  uint16_t scores[SCORE_PLAYER_COUNT];
+  uint32_t trace;          // 0 when untraced
+  uint32_t piReceivedUs;
+  uint32_t piSentUs;
+  uint16_t table;
+  uint32_t boot;           // SCORE_BOOT_UNKNOWN when not sent
+};
+
+struct ScoreReceiverStats {
+  uint32_t received;
+  uint32_t delivered;
+  uint32_t duplicates;
+  uint32_t reordered;   // Arrived ahead of a missing seq
+  uint32_t skipped;     // Seqs given up on after the reorder window
+  uint32_t malformed;
+  uint32_t otherTable;  // Dropped, meant for another table
+  uint32_t restarts;    // Times the sender started its seqs over
+};
+
+const char* scorePlayerName(uint8_t player);
+bool parseScorePlayer(const char* name, uint8_t* player);
+
+size_t encodeScorePacket(const ScorePacket& packet, uint8_t* out, size_t size);
+bool decodeScorePacket(const uint8_t* data, size_t length, ScorePacket* packet);
+
+void resetScoreReceiver();
+void setScoreReceiverTable(uint16_t table);
+bool scorePacketForTable(const ScorePacket& packet);
+void acceptScorePacket(const ScorePacket& packet, uint32_t nowMs);
+void acceptScoreDatagram(const uint8_t* data, size_t length, uint32_t nowMs);
+
+// Next packet in seq order, false when nothing is deliverable yet
+bool nextScorePacket(ScorePacket* packet, uint32_t nowMs);
+
+// ms until a held packet's reorder window runs out, or SCORE_REORDER_IDLE
+uint32_t scoreReorderTimeout(uint32_t nowMs);
+
+const ScoreReceiverStats& scoreReceiverStats();
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-1, one-shot for the WebSocket handshake and incremental for firmware
+// images, which are hashed a chunk at a time as they stream to flash. An
+// integrity check against corrupt or truncated transfers, not for anything
+// that needs collision resistance.
+
+#define SHA1_DIGEST_SIZE 20
+#define SHA1_BLOCK_SIZE 64
+
+struct Sha1 {
+  uint32_t state[5];
+  uint8_t block[SHA1_BLOCK_SIZE];   // Partial block waiting for more input
+  uint8_t blockLength;
+  uint64_t length;                  // Bytes hashed so far
+};
+
+void sha1Begin(Sha1* sha1);
+void sha1Update(Sha1* sha1, const uint8_t* data, size_t length);
+void sha1Finish(Sha1* sha1, uint8_t digest[SHA1_DIGEST_SIZE]);
+
+void sha1Digest(const uint8_t* data, size_t length, uint8_t digest[SHA1_DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SHOT_SPEED_H
+#define SHOT_SPEED_H
+
+#include <stdint.h>
+
+// Shot speed from how long the ball keeps the beam broken. Everything is in
+// integer tenths of km/h so it stays cheap enough for the laser path.
+
+#define BALL_DIAMETER_MM 35
+#define SHOT_SPEED_HISTORY 8
+#define SHOT_MAX_PULSE_US 150000UL  // Slower than ~0.8 km/h is not a shot
+
+// 1 mm/us = 3600 km/h, so km/h * 10 = diameter_mm * 36000 / width_us
+inline uint16_t shotSpeedKmhX10(uint32_t pulseWidthMicros) {
+  if (pulseWidthMicros == 0 || pulseWidthMicros > SHOT_MAX_PULSE_US) {
+    return 0;
+  }
+  uint32_t speed = ((uint32_t)BALL_DIAMETER_MM * 36000UL + pulseWidthMicros / 2) / pulseWidthMicros;
+  return speed > 0xFFFF ? 0xFFFF : (uint16_t)speed;
+}
+
+// Most recent shot speeds, oldest entry overwritten first
+struct ShotSpeedHistory {
+  uint16_t speeds[SHOT_SPEED_HISTORY];
+  uint8_t next;
+  uint8_t count;
+
+  void add(uint16_t speedKmhX10) {
+    speeds[next] = speedKmhX10;
+    next = (next + 1) % SHOT_SPEED_HISTORY;
+    if (count < SHOT_SPEED_HISTORY) {
+      count++;
+    }
+  }
+
+  // i = 0 is the most recent shot
+  uint16_t recent(uint8_t i) const {
+    return speeds[(next + SHOT_SPEED_HISTORY - 1 - i) % SHOT_SPEED_HISTORY];
+  }
+};
+
+#endif
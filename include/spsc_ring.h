@@ -0,0 +1,49 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+
+// Lock-free single-producer/single-consumer ring buffer. The producer is
+// normally an ISR and the consumer is loop(); each side only ever writes its
+// own index, so no interrupt masking is needed. Size must be a power of two.
+template <typename T, uint8_t Size>
+class SpscRing {
+  static_assert((Size & (Size - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+  // Forced inline so calls from an IRAM_ATTR ISR never jump into flash
+  inline __attribute__((always_inline)) bool push(const T& item) {
+    uint8_t head = _head;
+    if ((uint8_t)(head - _tail) >= Size) {
+      _overflows++;
+      return false;
+    }
+    _items[head & (Size - 1)] = item;
+    __asm__ __volatile__("" ::: "memory");  // Publish the item before the index
+    _head = head + 1;
+    return true;
+  }
+
+  bool pop(T* item) {
+    uint8_t tail = _tail;
+    if (tail == _head) {
+      return false;
+    }
+    *item = _items[tail & (Size - 1)];
+    __asm__ __volatile__("" ::: "memory");  // Finish reading before freeing the slot
+    _tail = tail + 1;
+    return true;
+  }
+
+  bool empty() const { return _tail == _head; }
+  uint8_t count() const { return (uint8_t)(_head - _tail); }
+  uint32_t overflows() const { return _overflows; }
+
+private:
+  T _items[Size];
+  volatile uint8_t _head = 0;
+  volatile uint8_t _tail = 0;
+  volatile uint32_t _overflows = 0;
+};
+
+#endif
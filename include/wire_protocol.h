@@ -0,0 +1,109 @@
+#ifndef WIRE_PROTOCOL_H
+#define WIRE_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "payloads.h"
+
+// Compact binary frames for device-to-Pi traffic - an optional stand-in for
+// the JSON requests to /score, /reset and /events, sent back to back on one
+// persistent TCP stream to the Pi's wire port. A device set to the binary
+// protocol only switches once the Pi's GET /status advertises
+// "wireVersion" (at least WIRE_VERSION) and "wirePort"; until then, and
+// whenever the wire port can't be reached, it stays on JSON.
+//
+// Frame, little-endian:
+//   0  'F' 'W'        magic
+//   2  version        WIRE_VERSION
+//   3  type           WireType
+//   4  seq            uint32, +1 per frame the sender sends
+//   8  length         uint16, payload bytes that follow
+//   10 payload
+//
+// Payloads:
+//   WIRE_GOAL    player u8, table u16, speed u16 (km/h * 10, 0 when
+//                unknown), epoch u32, seq u32 (see JournalSeq in
+//                payloads.h), then for a traced goal trace u32, timed u8,
+//                break u32, sent u32 (see ScoreTrace)
+//   WIRE_RESET   player u8, table u16, epoch u32, seq u32
+//   WIRE_EVENTS  player u8, count u8, table u16, epoch u32, now u32, then
+//                per event seq u32, t u32, type u8, flags u8, value u16
+//   WIRE_ACK     status u16, HTTP semantics - the Pi's answer to the frame
+//                whose seq it echoes
+//
+// Goals name the side that scored, points and resets the device's own side,
+// as in the JSON bodies. Version 2 added the traced goal, version 3 the
+// epoch and seq of goals and resets, version 4 the sending device's table.
+// The decoders still take the shorter payloads of older versions, with seq
+// 0 and table SCORE_TABLE_ANY. Pure logic, shared with the Linux decoder
+// and mock Pi.
+
+#define WIRE_VERSION 4
+#define WIRE_HEADER_SIZE 10
+#define WIRE_GOAL_SIZE 13
+#define WIRE_GOAL_TRACED_SIZE 26
+#define WIRE_GOAL_V3_SIZE 11
+#define WIRE_GOAL_V3_TRACED_SIZE 24
+#define WIRE_GOAL_V2_SIZE 3
+#define WIRE_GOAL_V2_TRACED_SIZE 16
+#define WIRE_RESET_SIZE 11
+#define WIRE_RESET_V3_SIZE 9
+#define WIRE_RESET_V1_SIZE 1
+#define WIRE_EVENTS_HEADER_SIZE 12
+#define WIRE_EVENTS_V3_HEADER_SIZE 10
+#define WIRE_EVENT_SIZE 12
+#define WIRE_ACK_SIZE 2
+#define WIRE_EVENTS_MAX 16
+#define WIRE_PAYLOAD_MAX (WIRE_EVENTS_HEADER_SIZE + WIRE_EVENTS_MAX * WIRE_EVENT_SIZE)
+
+enum WireType : uint8_t {
+  WIRE_GOAL = 1,
+  WIRE_RESET = 2,
+  WIRE_EVENTS = 3,
+  WIRE_ACK = 4
+};
+
+struct WireHeader {
+  uint8_t version;
+  uint8_t type;      // WireType
+  uint32_t seq;
+  uint16_t length;
+};
+
+struct WireEvents {
+  uint8_t player;
+  uint8_t count;
+  uint16_t table;
+  uint32_t epoch;
+  uint32_t now;
+  JournalEvent events[WIRE_EVENTS_MAX];
+};
+
+// Encoders return the bytes written, 0 if they didn't fit
+size_t encodeWireHeader(const WireHeader& header, uint8_t* out, size_t size);
+size_t encodeWireGoal(uint8_t player, uint16_t table, uint16_t speedKmhX10, uint8_t* out, size_t size,
+                      const ScoreTrace* trace = nullptr, const JournalSeq* seq = nullptr);
+size_t encodeWireReset(uint8_t player, uint16_t table, uint8_t* out, size_t size, const JournalSeq* seq = nullptr);
+size_t encodeWireEvents(uint8_t player, uint16_t table, uint32_t epoch, uint32_t now, const JournalEvent* events,
+                        uint8_t count, uint8_t* out, size_t size);
+size_t encodeWireAck(uint16_t status, uint8_t* out, size_t size);
+
+// False on a bad magic, a newer version than this build knows, or a
+// payload length over WIRE_PAYLOAD_MAX
+bool decodeWireHeader(const uint8_t* data, size_t length, WireHeader* header);
+bool decodeWireGoal(const uint8_t* data, size_t length, uint8_t* player, uint16_t* table, uint16_t* speedKmhX10,
+                    ScoreTrace* trace = nullptr, JournalSeq* seq = nullptr);
+bool decodeWireReset(const uint8_t* data, size_t length, uint8_t* player, uint16_t* table,
+                     JournalSeq* seq = nullptr);
+bool decodeWireEvents(const uint8_t* data, size_t length, WireEvents* batch);
+bool decodeWireAck(const uint8_t* data, size_t length, uint16_t* status);
+
+// Reference decoder for the Pi - turns a frame's payload into the path and
+// JSON body the HTTP API would have received for it. Returns the body
+// length, or -1 if the payload is malformed or the body didn't fit.
+int wireFrameToRequest(const WireHeader& header, const uint8_t* payload, const char** path, char* body,
+                       size_t size);
+
+const char* wireTypeName(uint8_t type);
+
+#endif
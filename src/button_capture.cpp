@@ -0,0 +1,50 @@
+#include "button_capture.h"
+#include "spsc_ring.h"
+#include "hal.h"
+
+static uint8_t buttonPins[BUTTON_CAPTURE_PINS];
+static HalIsr buttonOnEdge = nullptr;
+
+// GPIO interrupts don't nest, so the three ISRs are still one producer
+static SpscRing<ButtonEdge, BUTTON_EDGE_BUFFER_SIZE> buttonEdges;
+
+static inline __attribute__((always_inline)) void captureEdge(uint8_t button) {
+  ButtonEdge edge;
+  edge.button = button;
+  edge.pressed = !halPinEdge(buttonPins[button], &edge.timestamp);  // Inverted because of pullup
+  buttonEdges.push(edge);
+  if (buttonOnEdge != nullptr) {
+    buttonOnEdge();
+  }
+}
+
+// HalIsr takes no argument, so one ISR per pin
+static void IRAM_ATTR buttonEdgeISR0() {
+  captureEdge(0);
+}
+
+static void IRAM_ATTR buttonEdgeISR1() {
+  captureEdge(1);
+}
+
+static void IRAM_ATTR buttonEdgeISR2() {
+  captureEdge(2);
+}
+
+static const HalIsr buttonIsrs[BUTTON_CAPTURE_PINS] = {buttonEdgeISR0, buttonEdgeISR1, buttonEdgeISR2};
+
+void setupButtonCapture(const uint8_t pins[BUTTON_CAPTURE_PINS], HalIsr onEdge) {
+  buttonOnEdge = onEdge;
+  for (uint8_t i = 0; i < BUTTON_CAPTURE_PINS; i++) {
+    buttonPins[i] = pins[i];
+    halAttachInterrupt(pins[i], buttonIsrs[i], CHANGE);
+  }
+}
+
+bool popButtonEdge(ButtonEdge* edge) {
+  return buttonEdges.pop(edge);
+}
+
+uint32_t buttonEdgeOverflows() {
+  return buttonEdges.overflows();
+}
@@ -0,0 +1,342 @@
+#include "button_input.h"
+#include <string.h>
+
+struct ButtonTrack {
+  // Debounce
+  bool raw;               // Contact level from the last edge
+  bool pressed;           // Debounced
+  bool changing;          // Raw left the debounced level, not confirmed or undone yet
+  uint32_t integral;      // 0 released .. BUTTON_INTEGRATE_US pressed
+  uint32_t updatedMicros;
+  uint32_t changeStart;   // First edge of the change in progress
+  uint32_t lastEdge;
+
+  // Gestures
+  bool pending;           // Press not turned into a gesture yet
+  bool chordOpen;         // ...and still inside the chord window
+  bool released;          // ...and already let go
+  uint32_t pressStart;    // First contact edge of the press
+  uint32_t pressMicros;   // Debounced
+  bool tapped;            // A tap that a second one could make a double tap
+  uint32_t lastTapPress;
+};
+
+static ButtonTrack tracks[BUTTON_COUNT];
+static uint8_t chordButtons = 0;
+static uint8_t longPressButtons = 0;
+static uint32_t lastMicros = 0;   // Nothing before this is fed in any more
+
+static ButtonEvent events[BUTTON_EVENT_QUEUE_SIZE];
+static uint8_t eventHead = 0;
+static uint8_t eventCount = 0;
+static ButtonInputStats stats = {};
+
+static const char* const buttonNames[BUTTON_COUNT] = {"up", "down", "quantum"};
+static const char* const gestureNames[] = {"tap", "double-tap", "long-press", "chord"};
+
+static bool before(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) < 0;
+}
+
+static void pushEvent(uint8_t gesture, uint8_t button, uint8_t buttons, uint32_t atMicros) {
+  // Only reachable if the caller stops draining nextButtonEvent()
+  if (eventCount >= BUTTON_EVENT_QUEUE_SIZE) {
+    stats.overflows++;
+    return;
+  }
+  ButtonEvent* event = &events[(eventHead + eventCount) % BUTTON_EVENT_QUEUE_SIZE];
+  event->gesture = gesture;
+  event->button = button;
+  event->buttons = buttons;
+  event->atMicros = atMicros;
+  event->latencyMicros = atMicros - tracks[button].pressStart;
+  eventCount++;
+}
+
+// Debounce
+
+static void integrate(ButtonTrack* track, uint32_t nowMicros) {
+  uint32_t elapsed = before(nowMicros, track->updatedMicros) ? 0 : nowMicros - track->updatedMicros;
+  track->updatedMicros = nowMicros;
+  if (track->raw) {
+    track->integral = elapsed >= BUTTON_INTEGRATE_US - track->integral ? BUTTON_INTEGRATE_US
+                                                                        : track->integral + elapsed;
+  } else {
+    track->integral = elapsed >= track->integral ? 0 : track->integral - elapsed;
+  }
+
+  // Bounced back and stayed where it started, the next edge is a new change
+  if (track->changing && track->raw == track->pressed &&
+      track->integral == (track->pressed ? BUTTON_INTEGRATE_US : 0) &&
+      nowMicros - track->lastEdge >= BUTTON_INTEGRATE_US) {
+    track->changing = false;
+  }
+}
+
+// When the integrator reaches the other end, false when it isn't heading there
+static bool crossing(const ButtonTrack& track, uint32_t* atMicros) {
+  if (track.raw == track.pressed) {
+    return false;
+  }
+  *atMicros = track.updatedMicros + (track.raw ? BUTTON_INTEGRATE_US - track.integral : track.integral);
+  return true;
+}
+
+// Gestures
+
+static void tap(uint8_t button, uint32_t atMicros) {
+  ButtonTrack& track = tracks[button];
+  track.pending = false;
+  pushEvent(BUTTON_GESTURE_TAP, button, BUTTON_BIT(button), atMicros);
+  stats.taps++;
+
+  if (track.tapped && track.pressMicros - track.lastTapPress <= BUTTON_DOUBLE_TAP_US) {
+    pushEvent(BUTTON_GESTURE_DOUBLE_TAP, button, BUTTON_BIT(button), atMicros);
+    stats.doubleTaps++;
+    track.tapped = false;
+    return;
+  }
+  track.tapped = true;
+  track.lastTapPress = track.pressMicros;
+}
+
+static void onPress(uint8_t button, uint32_t atMicros) {
+  ButtonTrack& track = tracks[button];
+  stats.presses++;
+  track.pressMicros = atMicros;
+  track.pending = true;
+  track.chordOpen = false;
+  track.released = false;
+
+  if ((chordButtons & BUTTON_BIT(button)) == 0) {
+    if ((longPressButtons & BUTTON_BIT(button)) == 0) {
+      tap(button, atMicros);
+    }
+    return;
+  }
+
+  // Joins the chord windows still open, the first contact names the chord
+  uint8_t chord = BUTTON_BIT(button);
+  uint8_t first = button;
+  for (uint8_t other = 0; other < BUTTON_COUNT; other++) {
+    if (other != button && tracks[other].chordOpen) {
+      chord |= BUTTON_BIT(other);
+      if (before(tracks[other].pressStart, tracks[first].pressStart)) {
+        first = other;
+      }
+    }
+  }
+  if (chord == BUTTON_BIT(button)) {
+    track.chordOpen = true;
+    return;
+  }
+
+  for (uint8_t member = 0; member < BUTTON_COUNT; member++) {
+    if (chord & BUTTON_BIT(member)) {
+      tracks[member].pending = false;
+      tracks[member].chordOpen = false;
+      tracks[member].tapped = false;
+    }
+  }
+  pushEvent(BUTTON_GESTURE_CHORD, first, chord, atMicros);
+  stats.chords++;
+}
+
+static void onRelease(uint8_t button, uint32_t atMicros) {
+  ButtonTrack& track = tracks[button];
+  if (!track.pending) {
+    return;
+  }
+  if (track.chordOpen) {
+    // Tapped when the window closes
+    track.released = true;
+    return;
+  }
+  // Long press button let go in time
+  tap(button, atMicros);
+}
+
+// When the press's current window ends, false when it has none
+static bool gestureDeadline(uint8_t button, uint32_t* atMicros) {
+  const ButtonTrack& track = tracks[button];
+  if (!track.pending) {
+    return false;
+  }
+  if (track.chordOpen) {
+    *atMicros = track.pressMicros + BUTTON_CHORD_US;
+    return true;
+  }
+  if ((longPressButtons & BUTTON_BIT(button)) != 0 && !track.released) {
+    *atMicros = track.pressMicros + BUTTON_LONG_PRESS_US;
+    return true;
+  }
+  return false;
+}
+
+static void gestureTimeout(uint8_t button, uint32_t atMicros) {
+  ButtonTrack& track = tracks[button];
+  if (track.chordOpen) {
+    track.chordOpen = false;
+    if ((longPressButtons & BUTTON_BIT(button)) == 0 || track.released) {
+      tap(button, atMicros);
+    }
+    return;
+  }
+
+  track.pending = false;
+  track.tapped = false;
+  pushEvent(BUTTON_GESTURE_LONG_PRESS, button, BUTTON_BIT(button), atMicros);
+  stats.longPresses++;
+}
+
+static void debounced(uint8_t button, uint32_t atMicros) {
+  ButtonTrack& track = tracks[button];
+  track.pressed = track.raw;
+  track.changing = false;
+  uint32_t took = atMicros - track.changeStart;
+  if (took > stats.maxDebounceMicros) {
+    stats.maxDebounceMicros = took;
+  }
+
+  if (track.pressed) {
+    track.pressStart = track.changeStart;
+    onPress(button, atMicros);
+  } else {
+    onRelease(button, atMicros);
+  }
+}
+
+// Runs debounce crossings and gesture windows in time order up to nowMicros.
+// A crossing wins a tie, so a press confirmed as a window closes still counts.
+static void advanceTo(uint32_t nowMicros) {
+  while (true) {
+    bool found = false;
+    bool timer = false;
+    uint8_t button = 0;
+    uint32_t due = 0;
+    uint32_t at;
+
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      if (crossing(tracks[i], &at) && !before(nowMicros, at) && (!found || before(at, due))) {
+        found = true;
+        button = i;
+        due = at;
+      }
+    }
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      if (gestureDeadline(i, &at) && !before(nowMicros, at) && (!found || before(at, due))) {
+        found = true;
+        timer = true;
+        button = i;
+        due = at;
+      }
+    }
+    if (!found) {
+      break;
+    }
+
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      integrate(&tracks[i], due);
+    }
+    if (timer) {
+      gestureTimeout(button, due);
+    } else {
+      debounced(button, due);
+    }
+  }
+
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    integrate(&tracks[i], nowMicros);
+  }
+  lastMicros = nowMicros;
+}
+
+void resetButtonInput(uint8_t chordMask, uint8_t longPressMask, uint8_t pressedMask, uint32_t nowMicros) {
+  memset(tracks, 0, sizeof(tracks));
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    bool pressed = (pressedMask & BUTTON_BIT(i)) != 0;
+    tracks[i].raw = pressed;
+    tracks[i].pressed = pressed;
+    tracks[i].integral = pressed ? BUTTON_INTEGRATE_US : 0;
+    tracks[i].updatedMicros = nowMicros;
+  }
+  chordButtons = chordMask;
+  longPressButtons = longPressMask;
+  lastMicros = nowMicros;
+  eventHead = 0;
+  eventCount = 0;
+  stats = {};
+}
+
+void buttonInputEdge(uint8_t button, bool pressed, uint32_t timestampMicros) {
+  // An edge that raced an earlier nextButtonEvent() counts from then
+  if (before(timestampMicros, lastMicros)) {
+    timestampMicros = lastMicros;
+  }
+  advanceTo(timestampMicros);
+  stats.edges++;
+
+  ButtonTrack& track = tracks[button];
+  if (pressed == track.raw) {
+    return;
+  }
+  track.raw = pressed;
+  track.lastEdge = timestampMicros;
+  if (pressed != track.pressed) {
+    if (!track.changing) {
+      track.changing = true;
+      track.changeStart = timestampMicros;
+    }
+  } else if (track.changing) {
+    stats.bounces++;
+  }
+}
+
+bool nextButtonEvent(ButtonEvent* event, uint32_t nowMicros) {
+  if (!before(nowMicros, lastMicros)) {
+    advanceTo(nowMicros);
+  }
+  if (eventCount == 0) {
+    return false;
+  }
+  *event = events[eventHead];
+  eventHead = (eventHead + 1) % BUTTON_EVENT_QUEUE_SIZE;
+  eventCount--;
+  return true;
+}
+
+uint32_t buttonInputTimeout(uint32_t nowMicros) {
+  uint32_t wait = BUTTON_INPUT_IDLE;
+  uint32_t at;
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    if (crossing(tracks[i], &at)) {
+      uint32_t left = before(nowMicros, at) ? at - nowMicros : 0;
+      if (left < wait) {
+        wait = left;
+      }
+    }
+    if (gestureDeadline(i, &at)) {
+      uint32_t left = before(nowMicros, at) ? at - nowMicros : 0;
+      if (left < wait) {
+        wait = left;
+      }
+    }
+  }
+  return eventCount > 0 ? 0 : wait;
+}
+
+bool buttonPressed(uint8_t button) {
+  return tracks[button].pressed;
+}
+
+const ButtonInputStats& buttonInputStats() {
+  return stats;
+}
+
+const char* buttonName(uint8_t button) {
+  return button < BUTTON_COUNT ? buttonNames[button] : "?";
+}
+
+const char* buttonGestureName(uint8_t gesture) {
+  return gesture <= BUTTON_GESTURE_CHORD ? gestureNames[gesture] : "?";
+}
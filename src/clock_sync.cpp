@@ -0,0 +1,141 @@
+#include "clock_sync.h"
+#include <string.h>
+
+struct ClockSample {
+  uint32_t offsetUs;
+  uint32_t delayUs;
+};
+
+static ClockSample samples[CLOCK_SYNC_SAMPLES];
+static uint8_t sampleCount = 0;
+static uint8_t nextSample = 0;
+static bool awaitingReply = false;
+static uint32_t requestMicros = 0;   // t0 of the request in flight
+static ClockSyncStats stats = {};
+
+static void putUint32(uint8_t* out, uint32_t value) {
+  out[0] = value & 0xFF;
+  out[1] = (value >> 8) & 0xFF;
+  out[2] = (value >> 16) & 0xFF;
+  out[3] = value >> 24;
+}
+
+static uint32_t getUint32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static size_t encodeClockPacket(uint8_t type, uint32_t t0, uint32_t t1, uint32_t t2, uint8_t* out, size_t size) {
+  if (size < CLOCK_PACKET_SIZE) {
+    return 0;
+  }
+  out[0] = 'F';
+  out[1] = 'T';
+  out[2] = CLOCK_PACKET_VERSION;
+  out[3] = type;
+  putUint32(out + 4, t0);
+  putUint32(out + 8, t1);
+  putUint32(out + 12, t2);
+  return CLOCK_PACKET_SIZE;
+}
+
+static bool isClockPacket(const uint8_t* data, size_t length, uint8_t type) {
+  return length >= CLOCK_PACKET_SIZE && data[0] == 'F' && data[1] == 'T' && data[2] == CLOCK_PACKET_VERSION &&
+         data[3] == type;
+}
+
+void resetClockSync() {
+  memset(samples, 0, sizeof(samples));
+  sampleCount = 0;
+  nextSample = 0;
+  awaitingReply = false;
+  memset(&stats, 0, sizeof(stats));
+}
+
+size_t startClockExchange(uint32_t nowMicros, uint8_t* out, size_t size) {
+  size_t length = encodeClockPacket(CLOCK_REQUEST, nowMicros, 0, 0, out, size);
+  if (length > 0) {
+    awaitingReply = true;
+    requestMicros = nowMicros;
+    stats.requests++;
+  }
+  return length;
+}
+
+// The least delayed of the samples kept
+static void chooseSample() {
+  uint8_t best = 0;
+  for (uint8_t i = 1; i < sampleCount; i++) {
+    if (samples[i].delayUs < samples[best].delayUs) {
+      best = i;
+    }
+  }
+  stats.synced = true;
+  stats.offsetUs = samples[best].offsetUs;
+  stats.delayUs = samples[best].delayUs;
+}
+
+bool acceptClockReply(const uint8_t* data, size_t length, uint32_t arrivedMicros) {
+  if (length < 2 || data[0] != 'F' || data[1] != 'T') {
+    return false;
+  }
+  if (!isClockPacket(data, length, CLOCK_REPLY) || !awaitingReply || getUint32(data + 4) != requestMicros) {
+    stats.stale++;
+    return true;
+  }
+  awaitingReply = false;
+  stats.replies++;
+
+  uint32_t t0 = requestMicros;
+  uint32_t t1 = getUint32(data + 8);
+  uint32_t t2 = getUint32(data + 12);
+  uint32_t t3 = arrivedMicros;
+
+  // Differences first, the clocks themselves can be anywhere in 32 bits
+  uint32_t outbound = t1 - t0;
+  uint32_t inbound = t2 - t3;
+  ClockSample sample;
+  sample.offsetUs = outbound + (int32_t)(inbound - outbound) / 2;
+  int32_t delay = (int32_t)((t3 - t0) - (t2 - t1));
+  sample.delayUs = delay > 0 ? delay : 0;
+
+  if (stats.synced) {
+    int32_t step = (int32_t)(sample.offsetUs - stats.offsetUs);
+    if (step > CLOCK_SYNC_STEP_US || step < -CLOCK_SYNC_STEP_US) {
+      sampleCount = 0;
+      nextSample = 0;
+      stats.steps++;
+    }
+  }
+
+  samples[nextSample] = sample;
+  nextSample = (nextSample + 1) % CLOCK_SYNC_SAMPLES;
+  if (sampleCount < CLOCK_SYNC_SAMPLES) {
+    sampleCount++;
+  }
+  chooseSample();
+  return true;
+}
+
+bool clockSynced() {
+  return stats.synced;
+}
+
+uint32_t deviceToPiMicros(uint32_t deviceMicros) {
+  return stats.synced ? deviceMicros + stats.offsetUs : deviceMicros;
+}
+
+uint32_t clockSyncErrorMicros() {
+  return stats.delayUs / 2;
+}
+
+const ClockSyncStats& clockSyncStats() {
+  return stats;
+}
+
+size_t answerClockRequest(const uint8_t* request, size_t length, uint32_t receivedMicros, uint32_t sendMicros,
+                          uint8_t* out, size_t size) {
+  if (!isClockPacket(request, length, CLOCK_REQUEST)) {
+    return 0;
+  }
+  return encodeClockPacket(CLOCK_REPLY, getUint32(request + 4), receivedMicros, sendMicros, out, size);
+}
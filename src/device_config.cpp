@@ -0,0 +1,160 @@
+#include "device_config.h"
+#include <string.h>
+#include "hal.h"
+#include "payloads.h"
+
+static DeviceConfig config;
+
+static const char* const protocolNames[DEVICE_PROTOCOL_COUNT] = {"json", "binary"};
+
+static void copyString(char* out, const char* value, size_t size) {
+  strncpy(out, value, size - 1);
+  out[size - 1] = '\0';
+}
+
+static void defaultDeviceConfig(DeviceConfig* out) {
+  memset(out, 0, sizeof(*out));
+  out->magic = DEVICE_CONFIG_MAGIC;
+  out->tableId = DEFAULT_TABLE_ID;
+  out->side = DEFAULT_SIDE;
+  copyString(out->ssid, DEFAULT_WIFI_SSID, sizeof(out->ssid));
+  copyString(out->password, DEFAULT_WIFI_PASSWORD, sizeof(out->password));
+  copyString(out->serverHost, DEFAULT_SERVER_HOST, sizeof(out->serverHost));
+  out->serverPort = DEFAULT_SERVER_PORT;
+  out->protocol = DEFAULT_PROTOCOL;
+  out->detector = {GOAL_GLITCH_US, GOAL_MIN_BREAK_US, GOAL_REARM_US};
+  out->idleS = DEFAULT_IDLE_S;
+  out->sleepS = DEFAULT_SLEEP_S;
+}
+
+bool loadDeviceConfig() {
+  if (halStorageLoad(DEVICE_CONFIG_FILE, &config, sizeof(config)) && validDeviceConfig(config)) {
+    return true;
+  }
+  // A record from before the power timeouts keeps its settings
+  if (halStorageLoad(DEVICE_CONFIG_FILE, &config, DEVICE_CONFIG_V1_SIZE) && validDeviceConfig(config)) {
+    config.idleS = DEFAULT_IDLE_S;
+    config.sleepS = DEFAULT_SLEEP_S;
+    return true;
+  }
+  defaultDeviceConfig(&config);
+  return false;
+}
+
+const DeviceConfig& deviceConfig() {
+  return config;
+}
+
+// Strings must be terminated within their field
+static bool validString(const char* value, size_t size) {
+  return memchr(value, '\0', size) != nullptr;
+}
+
+bool validDeviceConfig(const DeviceConfig& candidate) {
+  return candidate.magic == DEVICE_CONFIG_MAGIC && candidate.tableId != SCORE_TABLE_ANY &&
+         candidate.side < SCORE_PLAYER_COUNT &&
+         validString(candidate.ssid, sizeof(candidate.ssid)) && candidate.ssid[0] != '\0' &&
+         validString(candidate.password, sizeof(candidate.password)) &&
+         validString(candidate.serverHost, sizeof(candidate.serverHost)) && candidate.serverHost[0] != '\0' &&
+         candidate.serverPort != 0 && candidate.protocol < DEVICE_PROTOCOL_COUNT &&
+         validGoalDetectorConfig(candidate.detector);
+}
+
+bool saveDeviceConfig(const DeviceConfig& newConfig) {
+  if (!validDeviceConfig(newConfig) || !halStorageSave(DEVICE_CONFIG_FILE, &newConfig, sizeof(newConfig))) {
+    return false;
+  }
+  config = newConfig;
+  return true;
+}
+
+// A present field that doesn't parse or fit fails the whole body
+static bool parseString(const char* body, const char* field, char* out, size_t size) {
+  char value[DEVICE_PASSWORD_MAX];
+  if (!hasJsonField(body, field)) {
+    return true;
+  }
+  if (!parseStringField(body, field, value, sizeof(value)) || strlen(value) >= size) {
+    return false;
+  }
+  copyString(out, value, size);
+  return true;
+}
+
+static bool parseUint(const char* body, const char* field, uint32_t max, uint32_t* out) {
+  if (!hasJsonField(body, field)) {
+    return true;
+  }
+  uint32_t value;
+  if (!parseUintField(body, field, &value) || value > max) {
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+bool parseDeviceConfig(const char* body, DeviceConfig* out) {
+  char side[PLAYER_NAME_MAX] = "";
+  char protocol[8] = "";
+  uint32_t tableId = out->tableId;
+  uint32_t port = out->serverPort;
+  uint32_t rearmMs = 0;
+  uint32_t idleS = out->idleS;
+  uint32_t sleepS = out->sleepS;
+
+  if (!parseString(body, "side", side, sizeof(side)) ||
+      !parseString(body, "ssid", out->ssid, sizeof(out->ssid)) ||
+      !parseString(body, "password", out->password, sizeof(out->password)) ||
+      !parseString(body, "host", out->serverHost, sizeof(out->serverHost)) ||
+      !parseString(body, "protocol", protocol, sizeof(protocol)) ||
+      !parseUint(body, "table", SCORE_TABLE_ANY - 1, &tableId) ||
+      !parseUint(body, "port", 0xFFFF, &port) ||
+      !parseUint(body, "glitchUs", GOAL_GLITCH_MAX_US, &out->detector.glitchUs) ||
+      !parseUint(body, "minBreakUs", GOAL_MIN_BREAK_MAX_US, &out->detector.minBreakUs) ||
+      !parseUint(body, "rearmMs", GOAL_REARM_MAX_US / 1000, &rearmMs) ||
+      !parseUint(body, "idleS", 0xFFFF, &idleS) ||
+      !parseUint(body, "sleepS", 0xFFFF, &sleepS)) {
+    return false;
+  }
+  if (side[0] != '\0' && !parseScorePlayer(side, &out->side)) {
+    return false;
+  }
+  if (protocol[0] != '\0') {
+    uint8_t i = 0;
+    while (i < DEVICE_PROTOCOL_COUNT && strcmp(protocol, protocolNames[i]) != 0) {
+      i++;
+    }
+    if (i == DEVICE_PROTOCOL_COUNT) {
+      return false;
+    }
+    out->protocol = i;
+  }
+
+  out->tableId = tableId;
+  out->serverPort = port;
+  out->idleS = idleS;
+  out->sleepS = sleepS;
+  // Calibrated values aren't whole milliseconds, only replace when given
+  if (hasJsonField(body, "rearmMs")) {
+    out->detector.rearmUs = rearmMs * 1000;
+  }
+  return true;
+}
+
+DeviceConfigChange compareDeviceConfig(const DeviceConfig& before, const DeviceConfig& after) {
+  if (before.tableId != after.tableId || before.side != after.side ||
+      strcmp(before.ssid, after.ssid) != 0 || strcmp(before.password, after.password) != 0 ||
+      strcmp(before.serverHost, after.serverHost) != 0 || before.serverPort != after.serverPort ||
+      before.protocol != after.protocol) {
+    return DEVICE_CONFIG_RESTART;
+  }
+  if (memcmp(&before.detector, &after.detector, sizeof(before.detector)) != 0 ||
+      before.idleS != after.idleS || before.sleepS != after.sleepS) {
+    return DEVICE_CONFIG_TUNING;
+  }
+  return DEVICE_CONFIG_UNCHANGED;
+}
+
+const char* deviceProtocolName(uint8_t protocol) {
+  return protocol < DEVICE_PROTOCOL_COUNT ? protocolNames[protocol] : "?";
+}
@@ -0,0 +1,325 @@
+#include "event_journal.h"
+#include "outbound.h"
+#include "hal.h"
+#include "log.h"
+#include "score_broadcast.h"
+#include "wire_protocol.h"
+
+#ifdef JOURNAL_USE_LITTLEFS
+#include <LittleFS.h>
+
+#define JOURNAL_MAGIC 0x314A4646UL  // "FFJ1"
+
+struct JournalFileHeader {
+  uint32_t magic;
+  uint32_t epoch;
+  uint32_t seqReserved;  // Every seq below this may already have been used
+};
+
+// Flash is only written when the reserved sequence block runs out, while
+// offline, or to clear events that were persisted before being sent
+static uint32_t seqReserved = 0;
+static bool journalDirty = false;
+static bool journalPersisted = false;
+#endif
+
+static const char* journalPlayer = "";
+static const char* journalOpponent = "";
+static uint8_t journalPlayerId = SCORE_PLAYER_RED;   // ScorePlayer, for binary batches
+static uint16_t journalTable = SCORE_TABLE_ANY;
+
+// Identifies this journal's sequence space. Without LittleFS sequence numbers
+// restart every boot, so the Pi deduplicates on (player, epoch, seq).
+static uint32_t journalEpoch = 0;
+static uint32_t nextSeq = 1;
+
+static JournalEvent journal[JOURNAL_CAPACITY];
+static uint8_t journalHead = 0;
+static uint8_t journalCount = 0;
+static uint32_t droppedEvents = 0;
+static JournalResultHandler resultHandler = nullptr;
+
+// A goal or reset sent directly, waiting on its answer
+static bool directInFlight = false;
+
+// Replay state
+static bool replayInFlight = false;
+static uint8_t replayBatchCount = 0;
+static unsigned long lastReplayAttempt = 0;
+static bool replayBackoff = false;
+static char replayBody[96 + JOURNAL_BATCH_MAX * 112];
+
+#ifdef JOURNAL_USE_LITTLEFS
+// Rewrites the file from the RAM ring. The journal is small and only changes
+// on offline events or acknowledged batches, so a full rewrite is fine.
+static void saveJournal() {
+  File file = LittleFS.open(JOURNAL_FILE, "w");
+  if (!file) {
+    LOG_ERROR(LOG_CAT_NET, "Journal: failed to open file for writing");
+    return;
+  }
+
+  JournalFileHeader header = {JOURNAL_MAGIC, journalEpoch, seqReserved};
+  file.write((const uint8_t*)&header, sizeof(header));
+  for (uint8_t i = 0; i < journalCount; i++) {
+    file.write((const uint8_t*)&journal[(journalHead + i) % JOURNAL_CAPACITY], sizeof(JournalEvent));
+  }
+  file.close();
+
+  journalDirty = false;
+  journalPersisted = journalCount > 0;
+}
+
+static bool loadJournal() {
+  File file = LittleFS.open(JOURNAL_FILE, "r");
+  if (!file) {
+    return false;
+  }
+
+  JournalFileHeader header;
+  if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != JOURNAL_MAGIC) {
+    file.close();
+    return false;
+  }
+
+  journalEpoch = header.epoch;
+  nextSeq = header.seqReserved;
+  seqReserved = header.seqReserved;
+  while (journalCount < JOURNAL_CAPACITY &&
+         file.read((uint8_t*)&journal[journalCount], sizeof(JournalEvent)) == sizeof(JournalEvent)) {
+    journalCount++;
+  }
+  file.close();
+
+  journalPersisted = journalCount > 0;
+  return true;
+}
+#endif
+
+void setupJournal(const char* player, const char* opponent, uint16_t table) {
+  journalPlayer = player;
+  journalOpponent = opponent;
+  journalTable = table;
+  parseScorePlayer(player, &journalPlayerId);
+  journalEpoch = halRandom();
+
+#ifdef JOURNAL_USE_LITTLEFS
+  if (!LittleFS.begin()) {
+    LOG_ERROR(LOG_CAT_NET, "Journal: LittleFS mount failed, using RAM only");
+    return;
+  }
+  if (loadJournal()) {
+    LOG_INFO(LOG_CAT_NET, "Journal: restored %u unsent events from flash", journalCount);
+  }
+  // Skip past any sequence numbers the previous boot may have handed out
+  seqReserved = nextSeq + JOURNAL_SEQ_BLOCK;
+  saveJournal();
+#endif
+}
+
+void setJournalResultHandler(JournalResultHandler handler) {
+  resultHandler = handler;
+}
+
+uint32_t journalEvent(JournalEventType type, uint16_t value, uint8_t flags) {
+  if (journalCount >= JOURNAL_CAPACITY) {
+    // Keep the newest events, the oldest one that isn't in the batch in
+    // flight is overwritten - the Pi may be applying those right now. The
+    // batch moves up a slot over it.
+    uint8_t inFlight = replayInFlight ? replayBatchCount : 0;
+    uint32_t droppedSeq = journal[(journalHead + inFlight) % JOURNAL_CAPACITY].seq;
+    for (uint8_t i = inFlight; i > 0; i--) {
+      journal[(journalHead + i) % JOURNAL_CAPACITY] = journal[(journalHead + i - 1) % JOURNAL_CAPACITY];
+    }
+    journalHead = (journalHead + 1) % JOURNAL_CAPACITY;
+    journalCount--;
+    droppedEvents++;
+    LOG_WARN(LOG_CAT_NET, "Journal full, dropped unsent event #%u", (unsigned)droppedSeq);
+    if (resultHandler) {
+      resultHandler(droppedSeq, false);
+    }
+  }
+
+  JournalEvent* event = &journal[(journalHead + journalCount) % JOURNAL_CAPACITY];
+  event->seq = nextSeq++;
+  event->timestamp = halMillis();
+  event->type = type;
+  event->flags = flags;
+  event->value = value;
+  journalCount++;
+
+  LOG_INFO(LOG_CAT_NET, "Queued event #%u (%u pending)", (unsigned)event->seq, journalCount);
+
+#ifdef JOURNAL_USE_LITTLEFS
+  journalDirty = true;
+  if (nextSeq >= seqReserved) {
+    seqReserved = nextSeq + JOURNAL_SEQ_BLOCK;
+    saveJournal();
+  }
+#endif
+  return event->seq;
+}
+
+bool journalDirect(JournalEventType type, uint16_t value, JournalEvent* event, JournalSeq* seq) {
+  if (journalCount > 0 || directInFlight) {
+    return false;
+  }
+  event->seq = nextSeq++;
+  event->timestamp = halMillis();
+  event->type = type;
+  event->flags = 0;
+  event->value = value;
+  seq->epoch = journalEpoch;
+  seq->seq = event->seq;
+  directInFlight = true;
+
+#ifdef JOURNAL_USE_LITTLEFS
+  if (nextSeq >= seqReserved) {
+    seqReserved = nextSeq + JOURNAL_SEQ_BLOCK;
+    saveJournal();
+  }
+#endif
+  return true;
+}
+
+bool journalDirectResult(const JournalEvent& event, int result) {
+  directInFlight = false;
+  if (result >= 200 && result < 300) {
+    return true;
+  }
+  if (outboundRejected(result)) {
+    LOG_WARN(LOG_CAT_NET, "Pi rejected event #%u (%d), dropping it", (unsigned)event.seq, result);
+    return false;
+  }
+  if (journalCount >= JOURNAL_CAPACITY) {
+    droppedEvents++;
+    LOG_WARN(LOG_CAT_NET, "Journal full, dropped failed event #%u", (unsigned)event.seq);
+    return false;
+  }
+
+  // Everything journaled meanwhile has a later seq and was held back
+  journalHead = (journalHead + JOURNAL_CAPACITY - 1) % JOURNAL_CAPACITY;
+  journal[journalHead] = event;
+  journalCount++;
+  LOG_INFO(LOG_CAT_NET, "Journaled failed event #%u (%u pending)", (unsigned)event.seq, journalCount);
+
+#ifdef JOURNAL_USE_LITTLEFS
+  journalDirty = true;
+#endif
+  return true;
+}
+
+uint8_t journalPending() {
+  return journalCount;
+}
+
+uint32_t journalDropped() {
+  return droppedEvents;
+}
+
+void startJournalReplay() {
+  if (journalCount == 0) {
+    return;
+  }
+  LOG_INFO(LOG_CAT_NET, "Journal: replaying %u events", journalCount);
+  replayBackoff = false;
+}
+
+static void onReplayComplete(int result) {
+  replayInFlight = false;
+
+  bool delivered = result >= 200 && result < 300;
+  if (!delivered && !outboundRejected(result)) {
+    // Leave the events in place and try again later
+    replayBackoff = true;
+    return;
+  }
+
+  // The Pi applied (or had already applied) the batch, or refused it and
+  // would refuse it again - drop it either way
+  if (!delivered) {
+    LOG_WARN(LOG_CAT_NET, "Journal: Pi rejected batch (%d), dropping %u events", result, replayBatchCount);
+  }
+  for (uint8_t i = 0; i < replayBatchCount; i++) {
+    uint32_t seq = journal[journalHead].seq;
+    journalHead = (journalHead + 1) % JOURNAL_CAPACITY;
+    journalCount--;
+    if (resultHandler) {
+      resultHandler(seq, delivered);
+    }
+  }
+  replayBatchCount = 0;
+
+#ifdef JOURNAL_USE_LITTLEFS
+  if (journalPersisted) {
+    saveJournal();
+  }
+#endif
+
+  if (journalCount == 0) {
+    LOG_INFO(LOG_CAT_NET, "Journal: replay complete");
+  }
+}
+
+// True while the pending events are a fresh burst of points that more
+// presses may still join
+static bool batchWindowOpen(unsigned long currentTime) {
+  if (journalCount >= JOURNAL_BATCH_MAX) {
+    return false;
+  }
+  for (uint8_t i = 0; i < journalCount; i++) {
+    if (journal[(journalHead + i) % JOURNAL_CAPACITY].type != JOURNAL_POINT) {
+      return false;
+    }
+  }
+  return currentTime - journal[journalHead].timestamp < EVENT_BATCH_WINDOW_MS;
+}
+
+void updateJournal(bool wifiConnected) {
+#ifdef JOURNAL_USE_LITTLEFS
+  // Only events that can't be sent now need to survive a reboot
+  if (!wifiConnected && journalDirty) {
+    saveJournal();
+  }
+#endif
+
+  // A direct send that fails goes ahead of the journal, so wait for it
+  if (journalCount == 0 || replayInFlight || directInFlight || !wifiConnected) {
+    return;
+  }
+
+  unsigned long currentTime = halMillis();
+  if (replayBackoff && currentTime - lastReplayAttempt < JOURNAL_RETRY_DELAY_MS) {
+    return;
+  }
+  if (batchWindowOpen(currentTime)) {
+    return;
+  }
+
+  // The batch is copied out of the ring so it is contiguous
+  JournalEvent batch[JOURNAL_BATCH_MAX];
+  uint8_t batchCount = 0;
+  while (batchCount < JOURNAL_BATCH_MAX && batchCount < journalCount) {
+    batch[batchCount] = journal[(journalHead + batchCount) % JOURNAL_CAPACITY];
+    batchCount++;
+  }
+  // The Pi dedupes by seq, so a batch can go out again on a fresh connection
+  bool queued;
+  if (outboundWireActive()) {
+    size_t length = encodeWireEvents(journalPlayerId, journalTable, journalEpoch, currentTime, batch, batchCount,
+                                     (uint8_t*)replayBody, sizeof(replayBody));
+    queued = queueOutboundFrameBuffer(WIRE_EVENTS, (const uint8_t*)replayBody, length, "Events frame",
+                                      onReplayComplete, OUTBOUND_RESENDABLE);
+  } else {
+    formatEventsBody(replayBody, sizeof(replayBody), journalPlayer, journalOpponent, journalTable, journalEpoch,
+                     currentTime, batch, batchCount);
+    queued = queueOutboundBuffer("/events", replayBody, "Events API", onReplayComplete, OUTBOUND_RESENDABLE);
+  }
+  if (!queued) {
+    return;
+  }
+
+  replayInFlight = true;
+  replayBatchCount = batchCount;
+  lastReplayAttempt = currentTime;
+}
@@ -0,0 +1,452 @@
+#include "event_stream.h"
+#include <string.h>
+#include <strings.h>
+#include "hal.h"
+#include "json_writer.h"
+#include "log.h"
+#include "scheduler.h"
+#include "sha1.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_MAX 32
+#define WS_CONTROL_MAX 125
+#define WS_READ_CHUNK 32
+
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+enum StreamClientState : uint8_t {
+  CLIENT_FREE,
+  CLIENT_HANDSHAKE,  // Reading the HTTP upgrade request
+  CLIENT_OPEN,       // Receiving events
+  CLIENT_CLOSING     // Close once the queue has drained
+};
+
+struct StreamClient {
+  uint8_t state;
+  HalSocket socket;
+  uint8_t eventMask;
+  uint32_t acceptedMs;
+  bool subscribed;       // Counted in stats.clients
+
+  // Upgrade request
+  bool requestLineSeen;
+  bool upgradeRequested;
+  char line[EVENT_STREAM_LINE_MAX];
+  uint8_t lineLength;
+  char key[WS_KEY_MAX];
+
+  // Incoming frame parser - only control frames are kept
+  uint8_t rxHeader[14];
+  uint8_t rxHeaderLength;
+  bool rxInPayload;
+  uint32_t rxRemaining;
+  uint8_t rxPayload[WS_CONTROL_MAX];
+  uint8_t rxPayloadLength;
+
+  // Outgoing byte ring
+  uint8_t queue[EVENT_STREAM_QUEUE_BYTES];
+  uint16_t queueHead;
+  uint16_t queueLength;
+};
+
+static const char* const eventTypeNames[STREAM_EVENT_TYPE_COUNT] = {"laser", "button", "quantum", "wifi"};
+
+static StreamClient clients[EVENT_STREAM_MAX_CLIENTS];
+static int8_t streamListener = -1;
+static int8_t streamTask = -1;
+static uint32_t eventSeq = 0;
+static EventStreamStats stats = {};
+
+static void freeClient(StreamClient* client) {
+  halTcpClose(client->socket);
+  if (client->subscribed) {
+    stats.clients--;
+  }
+  client->state = CLIENT_FREE;
+}
+
+static bool enqueue(StreamClient* client, const uint8_t* data, size_t length) {
+  if (length > (size_t)(EVENT_STREAM_QUEUE_BYTES - client->queueLength)) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    client->queue[(client->queueHead + client->queueLength + i) % EVENT_STREAM_QUEUE_BYTES] = data[i];
+  }
+  client->queueLength += length;
+  return true;
+}
+
+// Server frames are never masked or fragmented
+static bool enqueueFrame(StreamClient* client, uint8_t opcode, const uint8_t* payload, size_t length) {
+  uint8_t header[4];
+  uint8_t headerLength = 2;
+  header[0] = 0x80 | opcode;
+  if (length < 126) {
+    header[1] = length;
+  } else {
+    header[1] = 126;
+    header[2] = length >> 8;
+    header[3] = length & 0xFF;
+    headerLength = 4;
+  }
+
+  if (headerLength + length > (size_t)(EVENT_STREAM_QUEUE_BYTES - client->queueLength)) {
+    return false;
+  }
+  enqueue(client, header, headerLength);
+  enqueue(client, payload, length);
+  return true;
+}
+
+static void flushClient(StreamClient* client) {
+  while (client->queueLength > 0) {
+    int writable = halTcpWritable(client->socket);
+    if (writable <= 0) {
+      return;
+    }
+
+    size_t chunk = EVENT_STREAM_QUEUE_BYTES - client->queueHead;
+    if (chunk > client->queueLength) {
+      chunk = client->queueLength;
+    }
+    if (chunk > (size_t)writable) {
+      chunk = writable;
+    }
+
+    int written = halTcpWrite(client->socket, client->queue + client->queueHead, chunk);
+    if (written <= 0) {
+      return;
+    }
+    client->queueHead = (client->queueHead + written) % EVENT_STREAM_QUEUE_BYTES;
+    client->queueLength -= written;
+  }
+}
+
+static size_t base64Encode(const uint8_t* data, size_t length, char* out) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t written = 0;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t group = (uint32_t)data[i] << 16;
+    if (i + 1 < length) {
+      group |= (uint32_t)data[i + 1] << 8;
+    }
+    if (i + 2 < length) {
+      group |= data[i + 2];
+    }
+    out[written++] = alphabet[(group >> 18) & 0x3F];
+    out[written++] = alphabet[(group >> 12) & 0x3F];
+    out[written++] = i + 1 < length ? alphabet[(group >> 6) & 0x3F] : '=';
+    out[written++] = i + 2 < length ? alphabet[group & 0x3F] : '=';
+  }
+  out[written] = '\0';
+  return written;
+}
+
+// "GET /stream?events=laser,wifi HTTP/1.1"
+static void parseRequestLine(StreamClient* client, const char* line) {
+  if (strncmp(line, "GET /stream", 11) != 0 || (line[11] != ' ' && line[11] != '?')) {
+    return;
+  }
+  client->upgradeRequested = true;
+
+  const char* query = strstr(line, "events=");
+  if (query == nullptr) {
+    client->eventMask = (1 << STREAM_EVENT_TYPE_COUNT) - 1;
+    return;
+  }
+  query += 7;
+  for (uint8_t type = 0; type < STREAM_EVENT_TYPE_COUNT; type++) {
+    const char* name = eventTypeNames[type];
+    size_t length = strlen(name);
+    for (const char* p = query; *p != '\0' && *p != ' ';) {
+      if (strncmp(p, name, length) == 0 && (p[length] == ',' || p[length] == ' ' || p[length] == '\0')) {
+        client->eventMask |= 1 << type;
+      }
+      while (*p != '\0' && *p != ' ' && *p != ',') {
+        p++;
+      }
+      if (*p == ',') {
+        p++;
+      }
+    }
+  }
+}
+
+static void completeHandshake(StreamClient* client) {
+  if (!client->upgradeRequested || client->key[0] == '\0') {
+    static const char notFound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    enqueue(client, (const uint8_t*)notFound, sizeof(notFound) - 1);
+    client->state = CLIENT_CLOSING;
+    return;
+  }
+
+  char source[WS_KEY_MAX + sizeof(WS_GUID)];
+  strcpy(source, client->key);
+  strcat(source, WS_GUID);
+  uint8_t digest[SHA1_DIGEST_SIZE];
+  sha1Digest((const uint8_t*)source, strlen(source), digest);
+  char accept[32];
+  base64Encode(digest, sizeof(digest), accept);
+
+  char response[160];
+  int length = snprintf(response, sizeof(response),
+                        "HTTP/1.1 101 Switching Protocols\r\n"
+                        "Upgrade: websocket\r\n"
+                        "Connection: Upgrade\r\n"
+                        "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+  enqueue(client, (const uint8_t*)response, length);
+
+  client->state = CLIENT_OPEN;
+  client->subscribed = true;
+  stats.clients++;
+  stats.connections++;
+  LOG_INFO(LOG_CAT_STREAM, "Event stream client connected, %u subscribed", stats.clients);
+}
+
+static void readHandshake(StreamClient* client, const uint8_t* data, int length) {
+  for (int i = 0; i < length && client->state == CLIENT_HANDSHAKE; i++) {
+    char c = data[i];
+    if (c != '\n') {
+      if (c != '\r' && client->lineLength < EVENT_STREAM_LINE_MAX - 1) {
+        client->line[client->lineLength++] = c;
+      }
+      continue;
+    }
+
+    client->line[client->lineLength] = '\0';
+    if (client->lineLength == 0) {
+      completeHandshake(client);
+    } else if (!client->requestLineSeen) {
+      client->requestLineSeen = true;
+      parseRequestLine(client, client->line);
+    } else if (strncasecmp(client->line, "Sec-WebSocket-Key:", 18) == 0) {
+      const char* value = client->line + 18;
+      while (*value == ' ') {
+        value++;
+      }
+      strncpy(client->key, value, WS_KEY_MAX - 1);
+      client->key[WS_KEY_MAX - 1] = '\0';
+    }
+    client->lineLength = 0;
+  }
+}
+
+static void handleControlFrame(StreamClient* client, uint8_t opcode) {
+  if (opcode == WS_OPCODE_PING) {
+    enqueueFrame(client, WS_OPCODE_PONG, client->rxPayload, client->rxPayloadLength);
+  } else if (opcode == WS_OPCODE_CLOSE) {
+    // Echo the status code back and hang up once it's sent
+    enqueueFrame(client, WS_OPCODE_CLOSE, client->rxPayload, client->rxPayloadLength < 2 ? 0 : 2);
+    client->state = CLIENT_CLOSING;
+  }
+}
+
+// Client frames are masked; text from clients is ignored
+static void readFrames(StreamClient* client, const uint8_t* data, int length) {
+  for (int i = 0; i < length && client->state == CLIENT_OPEN; i++) {
+    if (!client->rxInPayload) {
+      client->rxHeader[client->rxHeaderLength++] = data[i];
+      if (client->rxHeaderLength < 2) {
+        continue;
+      }
+
+      uint8_t lengthCode = client->rxHeader[1] & 0x7F;
+      uint8_t needed = 2 + (lengthCode == 126 ? 2 : lengthCode == 127 ? 8 : 0) +
+                       ((client->rxHeader[1] & 0x80) ? 4 : 0);
+      if (client->rxHeaderLength < needed) {
+        continue;
+      }
+
+      uint32_t payloadLength = lengthCode;
+      if (lengthCode == 126) {
+        payloadLength = (client->rxHeader[2] << 8) | client->rxHeader[3];
+      } else if (lengthCode == 127) {
+        payloadLength = ((uint32_t)client->rxHeader[6] << 24) | ((uint32_t)client->rxHeader[7] << 16) |
+                        ((uint32_t)client->rxHeader[8] << 8) | client->rxHeader[9];
+      }
+      client->rxRemaining = payloadLength;
+      client->rxPayloadLength = 0;
+      client->rxInPayload = payloadLength > 0;
+      if (!client->rxInPayload) {
+        handleControlFrame(client, client->rxHeader[0] & 0x0F);
+        client->rxHeaderLength = 0;
+      }
+      continue;
+    }
+
+    // Unmask and keep what fits, control payloads are at most 125 bytes
+    uint8_t maskOffset = client->rxHeaderLength - 4;
+    uint32_t position = client->rxPayloadLength;
+    if (position < WS_CONTROL_MAX) {
+      uint8_t mask = (client->rxHeader[1] & 0x80) ? client->rxHeader[maskOffset + position % 4] : 0;
+      client->rxPayload[client->rxPayloadLength++] = data[i] ^ mask;
+    }
+    if (--client->rxRemaining == 0) {
+      handleControlFrame(client, client->rxHeader[0] & 0x0F);
+      client->rxInPayload = false;
+      client->rxHeaderLength = 0;
+    }
+  }
+}
+
+static void serviceClient(StreamClient* client) {
+  uint8_t data[WS_READ_CHUNK];
+  int available;
+  while (client->state != CLIENT_CLOSING && (available = halTcpAvailable(client->socket)) > 0) {
+    int length = halTcpRead(client->socket, data, available < WS_READ_CHUNK ? available : WS_READ_CHUNK);
+    if (length <= 0) {
+      break;
+    }
+    if (client->state == CLIENT_HANDSHAKE) {
+      readHandshake(client, data, length);
+    } else {
+      readFrames(client, data, length);
+    }
+  }
+
+  if (client->state == CLIENT_HANDSHAKE &&
+      halMillis() - client->acceptedMs > EVENT_STREAM_HANDSHAKE_TIMEOUT_MS) {
+    LOG_WARN(LOG_CAT_STREAM, "Event stream handshake timed out");
+    freeClient(client);
+    return;
+  }
+
+  flushClient(client);
+
+  if (!halTcpConnected(client->socket) || (client->state == CLIENT_CLOSING && client->queueLength == 0)) {
+    freeClient(client);
+  }
+}
+
+static void acceptClients() {
+  HalSocket socket;
+  while ((socket = halTcpAccept(streamListener)) != HAL_INVALID_SOCKET) {
+    StreamClient* client = nullptr;
+    for (uint8_t i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++) {
+      if (clients[i].state == CLIENT_FREE) {
+        client = &clients[i];
+        break;
+      }
+    }
+    if (client == nullptr) {
+      LOG_WARN(LOG_CAT_STREAM, "Event stream full, refusing client");
+      halTcpClose(socket);
+      continue;
+    }
+
+    memset(client, 0, sizeof(*client));
+    client->state = CLIENT_HANDSHAKE;
+    client->socket = socket;
+    client->acceptedMs = halMillis();
+  }
+}
+
+static uint32_t runStreamTask() {
+  acceptClients();
+
+  bool draining = false;
+  for (uint8_t i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++) {
+    if (clients[i].state != CLIENT_FREE) {
+      serviceClient(&clients[i]);
+      draining |= clients[i].state != CLIENT_FREE && clients[i].queueLength > 0;
+    }
+  }
+  return draining ? EVENT_STREAM_FLUSH_POLL_MS : EVENT_STREAM_POLL_MS;
+}
+
+bool setupEventStream(uint16_t port) {
+  streamListener = halTcpListen(port);
+  if (streamListener < 0) {
+    LOG_ERROR(LOG_CAT_STREAM, "Event stream listener failed");
+    return false;
+  }
+  streamTask = schedulerAddTask("stream", runStreamTask);
+
+  LOG_INFO(LOG_CAT_STREAM, "Event stream on ws://<device>:%u/stream", port);
+  return true;
+}
+
+// Starts an event object with the fields every event carries
+static void beginEvent(JsonWriter& json, StreamEventType type) {
+  json.openObject();
+  json.addUint("seq", ++eventSeq);
+  json.addUint("t", halMillis());
+  json.addString("type", eventTypeNames[type]);
+}
+
+static void publishEvent(JsonWriter& json, const char* buffer, StreamEventType type) {
+  json.closeObject();
+  stats.published++;
+  if (json.overflowed() || stats.clients == 0) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++) {
+    StreamClient* client = &clients[i];
+    if (client->state != CLIENT_OPEN || !(client->eventMask & (1 << type))) {
+      continue;
+    }
+    if (!enqueueFrame(client, WS_OPCODE_TEXT, (const uint8_t*)buffer, json.length())) {
+      LOG_WARN(LOG_CAT_STREAM, "Event stream client too slow, disconnecting");
+      stats.slowConsumerDrops++;
+      freeClient(client);
+    }
+  }
+
+  // The stream task runs after the game tasks, so this flushes in the same
+  // scheduler pass
+  schedulerWake(streamTask);
+}
+
+void streamLaserBreak(bool goal, uint32_t timestampMicros) {
+  char buffer[EVENT_STREAM_EVENT_MAX];
+  JsonWriter json(buffer, sizeof(buffer));
+  beginEvent(json, STREAM_EVENT_LASER);
+  json.addBool("broken", true);
+  json.addBool("goal", goal);
+  json.addUint("us", timestampMicros);
+  publishEvent(json, buffer, STREAM_EVENT_LASER);
+}
+
+void streamLaserRestore(uint32_t widthMicros, uint16_t speedKmhX10) {
+  char buffer[EVENT_STREAM_EVENT_MAX];
+  JsonWriter json(buffer, sizeof(buffer));
+  beginEvent(json, STREAM_EVENT_LASER);
+  json.addBool("broken", false);
+  json.addUint("widthUs", widthMicros);
+  if (speedKmhX10 > 0) {
+    json.addTenths("speed", speedKmhX10);
+  }
+  publishEvent(json, buffer, STREAM_EVENT_LASER);
+}
+
+void streamButtonEvent(const char* action) {
+  char buffer[EVENT_STREAM_EVENT_MAX];
+  JsonWriter json(buffer, sizeof(buffer));
+  beginEvent(json, STREAM_EVENT_BUTTON);
+  json.addString("action", action);
+  publishEvent(json, buffer, STREAM_EVENT_BUTTON);
+}
+
+void streamQuantumEvent(bool enabled) {
+  char buffer[EVENT_STREAM_EVENT_MAX];
+  JsonWriter json(buffer, sizeof(buffer));
+  beginEvent(json, STREAM_EVENT_QUANTUM);
+  json.addBool("enabled", enabled);
+  publishEvent(json, buffer, STREAM_EVENT_QUANTUM);
+}
+
+void streamWiFiEvent(bool connected) {
+  char buffer[EVENT_STREAM_EVENT_MAX];
+  JsonWriter json(buffer, sizeof(buffer));
+  beginEvent(json, STREAM_EVENT_WIFI);
+  json.addBool("connected", connected);
+  publishEvent(json, buffer, STREAM_EVENT_WIFI);
+}
+
+const EventStreamStats& eventStreamStats() {
+  return stats;
+}
@@ -0,0 +1,212 @@
+#include "firmware_patch.h"
+#include <string.h>
+
+#define COPY_ARGS_SIZE 8
+#define INSERT_ARGS_SIZE 4
+
+static void putUint32(uint8_t* out, uint32_t value) {
+  out[0] = value & 0xFF;
+  out[1] = (value >> 8) & 0xFF;
+  out[2] = (value >> 16) & 0xFF;
+  out[3] = value >> 24;
+}
+
+static uint32_t getUint32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void fail(FirmwarePatch* patch, const char* error) {
+  patch->state = FIRMWARE_PATCH_FAILED;
+  patch->error = error;
+}
+
+// Bytes the current state collects before it can be parsed
+static uint8_t fieldSize(uint8_t state) {
+  switch (state) {
+    case FIRMWARE_PATCH_READ_HEADER:
+      return FIRMWARE_PATCH_HEADER_SIZE;
+    case FIRMWARE_PATCH_READ_COPY:
+      return COPY_ARGS_SIZE;
+    case FIRMWARE_PATCH_READ_INSERT:
+      return INSERT_ARGS_SIZE;
+    default:
+      return 1;
+  }
+}
+
+// An op has to produce something, and nothing past the target's end
+static bool startOp(FirmwarePatch* patch, uint32_t length, uint8_t state) {
+  if (length == 0 || length > patch->targetSize - patch->produced) {
+    fail(patch, "op past the target's end");
+    return false;
+  }
+  patch->remaining = length;
+  patch->state = state;
+  return true;
+}
+
+static void parseField(FirmwarePatch* patch) {
+  const uint8_t* field = patch->field;
+  patch->fieldLength = 0;
+
+  switch (patch->state) {
+    case FIRMWARE_PATCH_READ_HEADER:
+      if (field[0] != 'F' || field[1] != 'P' || field[2] != FIRMWARE_PATCH_VERSION) {
+        fail(patch, "not a patch, or a newer version");
+        return;
+      }
+      patch->baseSize = getUint32(field + 4);
+      memcpy(patch->baseSha1, field + 8, SHA1_DIGEST_SIZE);
+      patch->targetSize = getUint32(field + 28);
+      if (patch->targetSize == 0) {
+        fail(patch, "empty target");
+        return;
+      }
+      patch->state = FIRMWARE_PATCH_READ_OP;
+      return;
+
+    case FIRMWARE_PATCH_READ_OP:
+      if (field[0] == FIRMWARE_PATCH_COPY) {
+        patch->state = FIRMWARE_PATCH_READ_COPY;
+      } else if (field[0] == FIRMWARE_PATCH_INSERT) {
+        patch->state = FIRMWARE_PATCH_READ_INSERT;
+      } else {
+        fail(patch, "unknown op");
+      }
+      return;
+
+    case FIRMWARE_PATCH_READ_COPY: {
+      uint32_t offset = getUint32(field);
+      uint32_t length = getUint32(field + 4);
+      if (offset > patch->baseSize || length > patch->baseSize - offset) {
+        fail(patch, "copy past the base's end");
+        return;
+      }
+      patch->copyOffset = offset;
+      startOp(patch, length, FIRMWARE_PATCH_COPYING);
+      return;
+    }
+
+    case FIRMWARE_PATCH_READ_INSERT:
+      startOp(patch, getUint32(field), FIRMWARE_PATCH_INSERTING);
+      return;
+  }
+}
+
+static void produced(FirmwarePatch* patch, size_t length) {
+  patch->produced += length;
+  patch->remaining -= length;
+  if (patch->remaining == 0) {
+    patch->state = patch->produced == patch->targetSize ? FIRMWARE_PATCH_DONE : FIRMWARE_PATCH_READ_OP;
+  }
+}
+
+void beginFirmwarePatch(FirmwarePatch* patch, FirmwarePatchRead readBase, FirmwarePatchWrite writeTarget) {
+  memset(patch, 0, sizeof(*patch));
+  patch->state = FIRMWARE_PATCH_READ_HEADER;
+  patch->readBase = readBase;
+  patch->writeTarget = writeTarget;
+}
+
+size_t feedFirmwarePatch(FirmwarePatch* patch, const uint8_t* data, size_t length, size_t maxOutput) {
+  size_t used = 0;
+  size_t output = 0;
+
+  while (patch->state != FIRMWARE_PATCH_DONE && patch->state != FIRMWARE_PATCH_FAILED && output < maxOutput) {
+    if (patch->state == FIRMWARE_PATCH_COPYING) {
+      uint8_t piece[FIRMWARE_PATCH_PIECE];
+      size_t take = patch->remaining;
+      if (take > sizeof(piece)) {
+        take = sizeof(piece);
+      }
+      if (take > maxOutput - output) {
+        take = maxOutput - output;
+      }
+      if (!patch->readBase(patch->copyOffset, piece, take) || !patch->writeTarget(piece, take)) {
+        fail(patch, "flash access failed");
+        break;
+      }
+      patch->copyOffset += take;
+      output += take;
+      produced(patch, take);
+      continue;
+    }
+
+    if (used >= length) {
+      break;
+    }
+
+    // Literal bytes go through without a copy
+    if (patch->state == FIRMWARE_PATCH_INSERTING) {
+      size_t take = patch->remaining;
+      if (take > length - used) {
+        take = length - used;
+      }
+      if (take > maxOutput - output) {
+        take = maxOutput - output;
+      }
+      if (!patch->writeTarget(data + used, take)) {
+        fail(patch, "flash access failed");
+        break;
+      }
+      used += take;
+      output += take;
+      produced(patch, take);
+      continue;
+    }
+
+    // Header, op code or arguments, collected across calls
+    patch->field[patch->fieldLength++] = data[used++];
+    if (patch->fieldLength == fieldSize(patch->state)) {
+      bool header = patch->state == FIRMWARE_PATCH_READ_HEADER;
+      parseField(patch);
+      if (header) {
+        break;
+      }
+    }
+  }
+
+  return used;
+}
+
+bool firmwarePatchHeaderRead(const FirmwarePatch& patch) {
+  return patch.state != FIRMWARE_PATCH_READ_HEADER && patch.targetSize > 0;
+}
+
+bool firmwarePatchBusy(const FirmwarePatch& patch) {
+  return patch.state == FIRMWARE_PATCH_COPYING;
+}
+
+size_t encodeFirmwarePatchHeader(uint32_t baseSize, const uint8_t baseSha1[SHA1_DIGEST_SIZE], uint32_t targetSize,
+                                 uint8_t* out, size_t size) {
+  if (size < FIRMWARE_PATCH_HEADER_SIZE) {
+    return 0;
+  }
+  out[0] = 'F';
+  out[1] = 'P';
+  out[2] = FIRMWARE_PATCH_VERSION;
+  out[3] = 0;
+  putUint32(out + 4, baseSize);
+  memcpy(out + 8, baseSha1, SHA1_DIGEST_SIZE);
+  putUint32(out + 28, targetSize);
+  return FIRMWARE_PATCH_HEADER_SIZE;
+}
+
+size_t encodeFirmwarePatchCopy(uint32_t offset, uint32_t length, uint8_t* out, size_t size) {
+  if (size < 1 + COPY_ARGS_SIZE) {
+    return 0;
+  }
+  out[0] = FIRMWARE_PATCH_COPY;
+  putUint32(out + 1, offset);
+  putUint32(out + 5, length);
+  return 1 + COPY_ARGS_SIZE;
+}
+
+size_t encodeFirmwarePatchInsert(uint32_t length, uint8_t* out, size_t size) {
+  if (size < 1 + INSERT_ARGS_SIZE) {
+    return 0;
+  }
+  out[0] = FIRMWARE_PATCH_INSERT;
+  putUint32(out + 1, length);
+  return 1 + INSERT_ARGS_SIZE;
+}
@@ -0,0 +1,834 @@
+#include "game.h"
+#include "hal.h"
+#include "outbound.h"
+#include "laser_capture.h"
+#include "button_capture.h"
+#include "button_input.h"
+#include "event_journal.h"
+#include "payloads.h"
+#include "wire_protocol.h"
+#include "clock_sync.h"
+#include "goal_trace.h"
+#include "scheduler.h"
+#include "led_animation.h"
+#include "score_broadcast.h"
+#include "event_stream.h"
+#include "goal_detector.h"
+#include "ota_update.h"
+#include "power_state.h"
+#include "log.h"
+#include "device_config.h"
+
+// Resolved from the device config in setupGame()
+uint8_t playerSide = DEFAULT_SIDE;
+uint8_t opponentSide = DEFAULT_SIDE == SCORE_PLAYER_RED ? SCORE_PLAYER_BLUE : SCORE_PLAYER_RED;
+
+// Shot speed state - the goal is sent once the beam is restored so the
+// break width (and therefore speed) is known
+bool goalPending = false;
+uint32_t goalBreakMicros = 0;
+uint32_t beamBrokenMicros = 0;  // Last break edge, goal or not
+static uint32_t goalTraceId = 0;  // Made up at the break, see goal_trace.h
+ShotSpeedHistory shotSpeeds = {};
+bool quantumMode = false;
+
+// Set by the platform's WiFi handling
+bool wifiConnected = false;
+
+LatencySummary goalAckLatency = {};
+LatencySummary buttonLatency = {};
+
+// The goal or reset sent directly and not yet answered - the journal lets
+// one out at a time. For a goal, its beam break time and trace too.
+static JournalEvent directEvent;
+static uint16_t directOp;
+static uint32_t directStart;
+static uint32_t directTrace;
+
+// LED animations - activity LED frames use white for on
+static constexpr LedKeyframe solidPurpleFrames[] = {ledHold(255, 0, 255, 0)};
+static constexpr LedKeyframe solidRedFrames[] = {ledHold(255, 0, 0, 0)};
+static constexpr LedKeyframe solidBlueFrames[] = {ledHold(0, 0, 255, 0)};
+static constexpr LedKeyframe solidOrangeFrames[] = {ledHold(255, 128, 0, 0)};
+static constexpr LedKeyframe connectingFrames[] = {
+  ledHold(255, 255, 0, CONNECTING_BLINK_MS), ledHold(0, 0, 0, CONNECTING_BLINK_MS)};
+static constexpr LedKeyframe errorFlashFrames[] = {
+  ledHold(255, 0, 0, ERROR_FLASH_MS), ledHold(0, 0, 0, ERROR_FLASH_MS)};
+static constexpr LedKeyframe quantumOnFrames[] = {ledHold(0, 255, 0, QUANTUM_FEEDBACK_MS)};
+static constexpr LedKeyframe quantumOffFrames[] = {ledHold(255, 0, 0, QUANTUM_FEEDBACK_MS)};
+static constexpr LedKeyframe pointFrames[] = {ledHold(255, 255, 255, POINT_FEEDBACK_MS)};
+static constexpr LedKeyframe startupFrames[] = {ledHold(255, 0, 255, STARTUP_BLINK_MS * 6)};
+static constexpr LedKeyframe startupBlinkFrames[] = {
+  ledHold(255, 255, 255, STARTUP_BLINK_MS), ledHold(0, 0, 0, STARTUP_BLINK_MS)};
+static constexpr LedKeyframe goalFlashFrames[] = {ledHold(255, 255, 255, GOAL_FLASH_MS)};
+static constexpr LedKeyframe ownGoalBlinkFrames[] = {
+  ledHold(255, 255, 255, OWN_GOAL_BLINK_INTERVAL_MS), ledHold(0, 0, 0, OWN_GOAL_BLINK_INTERVAL_MS)};
+static constexpr LedKeyframe networkFlashFrames[] = {ledHold(255, 255, 255, NETWORK_FLASH_MS)};
+static constexpr LedKeyframe calibratingFrames[] = {
+  ledFade(0, 255, 255, CALIBRATION_PULSE_MS), ledFade(0, 0, 0, CALIBRATION_PULSE_MS)};
+
+static constexpr LedAnimation solidPurple = ledAnimation(solidPurpleFrames, LED_REPEAT_FOREVER);
+static constexpr LedAnimation solidRed = ledAnimation(solidRedFrames, LED_REPEAT_FOREVER);
+static constexpr LedAnimation solidBlue = ledAnimation(solidBlueFrames, LED_REPEAT_FOREVER);
+static constexpr LedAnimation solidOrange = ledAnimation(solidOrangeFrames, LED_REPEAT_FOREVER);
+static constexpr LedAnimation connectingBlink = ledAnimation(connectingFrames, LED_REPEAT_FOREVER);
+static constexpr LedAnimation errorFlash = ledAnimation(errorFlashFrames, 1);
+static constexpr LedAnimation quantumOnFeedback = ledAnimation(quantumOnFrames, 1);
+static constexpr LedAnimation quantumOffFeedback = ledAnimation(quantumOffFrames, 1);
+static constexpr LedAnimation pointFeedback = ledAnimation(pointFrames, 1);
+static constexpr LedAnimation startupColor = ledAnimation(startupFrames, 1);
+static constexpr LedAnimation startupActivityBlink = ledAnimation(startupBlinkFrames, 3);
+static constexpr LedAnimation goalFlash = ledAnimation(goalFlashFrames, 1);
+static constexpr LedAnimation ownGoalBlink =
+  ledAnimation(ownGoalBlinkFrames, OWN_GOAL_BLINK_MS / (2 * OWN_GOAL_BLINK_INTERVAL_MS));
+static constexpr LedAnimation networkFlash = ledAnimation(networkFlashFrames, 1);
+static constexpr LedAnimation calibratingPulse = ledAnimation(calibratingFrames, LED_REPEAT_FOREVER);
+
+// Scheduler tasks - see setupGame()
+static int8_t networkTask = -1;
+static int8_t buttonTask = -1;
+static int8_t laserTask = -1;
+static int8_t broadcastTask = -1;
+static int8_t powerTask = -1;
+
+// Low-power idle, indexed by PowerState. Light sleep wakes on any of the
+// table's inputs.
+static const uint8_t wakePins[] = {LASER_BREAK_PIN, BUTTON_UP_PIN, BUTTON_DOWN_PIN, BUTTON_QUANTUM_PIN};
+static const uint8_t powerModes[POWER_STATE_COUNT] = {HAL_POWER_FULL, HAL_POWER_MODEM, HAL_POWER_LIGHT};
+static const uint8_t powerBrightness[POWER_STATE_COUNT] = {255, POWER_IDLE_BRIGHTNESS, 0};
+static const uint32_t powerSlackMs[POWER_STATE_COUNT] = {0, POWER_IDLE_SLACK_MS, POWER_SLEEP_SLACK_MS};
+static bool wakeBreakPending = false;  // Laser edge that woke the device, not yet a break event
+static uint32_t wakeBreakMicros = 0;
+
+// Clock exchanges with the Pi go out from the broadcast socket, see
+// clock_sync.h
+static const char* clockHost = nullptr;
+static bool broadcastListening = false;
+static bool clockExchangeStarted = false;
+static uint32_t lastClockExchangeMs = 0;
+
+// Ready color for each side, indexed by ScorePlayer
+static const LedAnimation* const sideColors[SCORE_PLAYER_COUNT] = {&solidRed, &solidBlue};
+static const char* const sideColorNames[SCORE_PLAYER_COUNT] = {"Red", "Blue"};
+
+static uint8_t lastCalibrationPhase = GOAL_CALIBRATION_OFF;
+
+static void writeActivityLED(uint8_t red, uint8_t green, uint8_t blue) {
+  halDigitalWrite(LED_ACTIVITY_PIN, (red | green | blue) ? HIGH : LOW);
+}
+
+static void writeNetworkLED(uint8_t red, uint8_t green, uint8_t blue) {
+  halDigitalWrite(LED_BUILTIN_PIN, (red | green | blue) ? LOW : HIGH); // Inverted logic
+}
+
+static void writeRGBLED(uint8_t red, uint8_t green, uint8_t blue) {
+  setRGBColor(red, green, blue);
+}
+
+static void IRAM_ATTR laserEdgeSignal() {
+  schedulerSignal(laserTask);
+}
+
+static void IRAM_ATTR buttonEdgeSignal() {
+  schedulerSignal(buttonTask);
+}
+
+static void IRAM_ATTR scoreDatagramSignal() {
+  schedulerSignal(broadcastTask);
+}
+
+static void applyPowerState(uint8_t state) {
+  halSetPowerMode(powerModes[state], wakePins, sizeof(wakePins));
+  setLedBrightness(powerBrightness[state]);
+  schedulerSetSlack(powerSlackMs[state]);
+}
+
+// Table activity - beam or button edges, a goal from the other side. Back
+// to full power at once when it woke the device.
+static void noteActivity(uint8_t wake, uint32_t eventMicros) {
+  uint8_t left = powerActivity(wake, halMillis());
+  if (left == POWER_ACTIVE) {
+    return;
+  }
+  applyPowerState(POWER_ACTIVE);
+  powerWakeReady(eventMicros, halMicros());
+  LOG_INFO(LOG_CAT_SYSTEM, "Woken from %s by %s, ready after %uus", powerStateName(left), powerWakeName(wake),
+           (unsigned)powerStats(halMillis()).lastWakeUs);
+
+  if (wake == POWER_WAKE_LASER) {
+    wakeBreakPending = true;
+    wakeBreakMicros = eventMicros;
+  }
+  // Clock exchanges resume, and the idle timeouts start over
+  schedulerWake(broadcastTask);
+  schedulerWake(powerTask);
+}
+
+// Anything in flight that stepping down would delay
+static bool powerBusy() {
+  uint8_t calibration = goalCalibration().phase;
+  return goalPending || outboundPending() > 0 || (journalPending() > 0 && wifiConnected) || otaBusy() ||
+         calibration == GOAL_CALIBRATION_QUIET || calibration == GOAL_CALIBRATION_SHOTS;
+}
+
+// Steps down once the table has been left alone. Otherwise only wakes for
+// the next timeout, and after activity.
+static uint32_t runPowerTask() {
+  uint32_t now = halMillis();
+  uint8_t before = powerState();
+  uint8_t state = updatePowerState(now, powerBusy());
+  if (state != before) {
+    applyPowerState(state);
+    LOG_INFO(LOG_CAT_SYSTEM, "Power state: %s", powerStateName(state));
+  }
+
+  uint32_t timeout = powerStateTimeout(now);
+  if (timeout == POWER_TIMEOUT_NONE) {
+    return SCHEDULER_IDLE;
+  }
+  return timeout > 0 ? timeout : POWER_BUSY_POLL_MS;
+}
+
+// Replay journaled events, then advance queued outbound API requests.
+// Sockets are polled while a request is in flight, otherwise this only
+// runs when an event is queued.
+static uint32_t runNetworkTask() {
+  updateJournal(wifiConnected);
+  updateOutbound();
+  updateMatchState(halMillis());
+
+  if (outboundPending() > 0) {
+    return NETWORK_POLL_MS;
+  }
+  // Offline events wait for wakeNetworkTask() when WiFi comes back
+  if (journalPending() > 0 && wifiConnected) {
+    return JOURNAL_POLL_MS;
+  }
+  // Settles goals whose broadcast never came
+  if (matchState().pending > 0 && wifiConnected) {
+    return MATCH_POLL_MS;
+  }
+  return SCHEDULER_IDLE;
+}
+
+// One request per CLOCK_SYNC_INTERVAL_MS while online and active, returns
+// the wait for the next
+static uint32_t syncClock(uint32_t now) {
+  if (clockHost == nullptr || !broadcastListening || !wifiConnected || powerState() != POWER_ACTIVE) {
+    return SCHEDULER_IDLE;
+  }
+  uint32_t elapsed = now - lastClockExchangeMs;
+  if (clockExchangeStarted && elapsed < CLOCK_SYNC_INTERVAL_MS) {
+    return CLOCK_SYNC_INTERVAL_MS - elapsed;
+  }
+
+  uint8_t request[CLOCK_PACKET_SIZE];
+  size_t length = startClockExchange(halMicros(), request, sizeof(request));
+  if (!halUdpSend(clockHost, CLOCK_SYNC_PORT, request, length)) {
+    LOG_DEBUG(LOG_CAT_STREAM, "Clock request to %s:%u not sent", clockHost, CLOCK_SYNC_PORT);
+  }
+  clockExchangeStarted = true;
+  lastClockExchangeMs = now;
+  return CLOCK_SYNC_INTERVAL_MS;
+}
+
+// Signaled when a score datagram or a clock answer arrives. Otherwise only
+// wakes for the next clock exchange, and while a packet is held waiting for
+// a missing seq.
+static uint32_t runBroadcastTask() {
+  uint32_t now = halMillis();
+  uint8_t datagram[HAL_UDP_DATAGRAM_MAX];
+  uint32_t arrivedMicros;
+  int length;
+  while ((length = halUdpRead(datagram, sizeof(datagram), &arrivedMicros)) > 0) {
+    if (acceptClockReply(datagram, length, arrivedMicros)) {
+      continue;
+    }
+    // Traced on arrival, the reorder window is part of the goal's latency
+    ScorePacket packet;
+    if (decodeScorePacket(datagram, length, &packet) && scorePacketForTable(packet)) {
+      noteActivity(POWER_WAKE_GOAL, arrivedMicros);
+      traceGoalNotified(packet.trace, packet.player, GOAL_VIA_UDP, packet.piReceivedUs, packet.piSentUs,
+                        arrivedMicros);
+    }
+    acceptScoreDatagram(datagram, length, now);
+  }
+
+  ScorePacket packet;
+  while (nextScorePacket(&packet, now)) {
+    LOG_INFO(LOG_CAT_STREAM, "Score broadcast #%u: %s scored, red %u - blue %u", (unsigned)packet.seq,
+             scorePlayerName(packet.player), packet.scores[SCORE_PLAYER_RED], packet.scores[SCORE_PLAYER_BLUE]);
+
+    matchServerGoal(packet.seq, packet.player, packet.scores, now);
+    handleScoreNotification(packet.player, packet.trace);
+  }
+
+  uint32_t wait = syncClock(now);
+  uint32_t timeout = scoreReorderTimeout(now);
+  if (timeout != SCORE_REORDER_IDLE && timeout < wait) {
+    wait = timeout;
+  }
+  return wait;
+}
+
+// Signaled by the button ISRs. Otherwise only wakes when a debounce or a
+// gesture window ends.
+static uint32_t runButtonTask() {
+  handleButtonActions();
+  otaPlayActivity(halMillis());
+
+  uint32_t timeout = buttonInputTimeout(halMicros());
+  return timeout == BUTTON_INPUT_IDLE ? SCHEDULER_IDLE : timeout / 1000 + 1;
+}
+
+// Signaled by the laser ISR. Otherwise only wakes for the pending goal
+// timeout and whenever the goal detector's filters settle.
+static uint32_t runLaserTask() {
+  handleLaserBreak();
+  otaPlayActivity(halMillis());
+
+  uint32_t wait = SCHEDULER_IDLE;
+  if (goalPending) {
+    wait = (SHOT_MAX_PULSE_US - (halMicros() - goalBreakMicros)) / 1000 + 1;
+  }
+  uint32_t detectorMicros = goalDetectorTimeout(halMicros());
+  if (detectorMicros != GOAL_DETECTOR_IDLE && detectorMicros / 1000 + 1 < wait) {
+    wait = detectorMicros / 1000 + 1;
+  }
+  return wait;
+}
+
+// The learned thresholds go into the device config record
+static void saveGoalCalibration() {
+  DeviceConfig config = deviceConfig();
+  config.detector = goalDetectorConfig();
+  if (!saveDeviceConfig(config)) {
+    LOG_ERROR(LOG_CAT_LASER, "Goal detector: failed to save calibration");
+  }
+}
+
+static void onJournalResult(uint32_t seq, bool delivered) {
+  matchJournalResult(seq, delivered ? MATCH_ACK_APPLIED : MATCH_ACK_REJECTED, halMillis());
+}
+
+// Reports calibration progress once per phase change
+static void checkGoalCalibration() {
+  const GoalCalibration& calibration = goalCalibration();
+  if (calibration.phase == lastCalibrationPhase) {
+    return;
+  }
+  lastCalibrationPhase = calibration.phase;
+
+  if (calibration.phase == GOAL_CALIBRATION_SHOTS) {
+    LOG_INFO(LOG_CAT_LASER, "Calibration: noise floor %uus, now shoot %u goals",
+             (unsigned)calibration.noiseFloorUs, GOAL_CALIBRATION_SHOT_COUNT);
+  } else if (calibration.phase == GOAL_CALIBRATION_DONE) {
+    LOG_INFO(LOG_CAT_LASER, "Calibration done after %u shots: glitch %uus, min break %uus, rearm %ums",
+             calibration.shots, (unsigned)calibration.learned.glitchUs, (unsigned)calibration.learned.minBreakUs,
+             (unsigned)(calibration.learned.rearmUs / 1000));
+    saveGoalCalibration();
+    stopAnimation(LED_CHANNEL_RGB, LED_PRIORITY_FEEDBACK);
+  } else if (calibration.phase == GOAL_CALIBRATION_FAILED) {
+    LOG_WARN(LOG_CAT_LASER, "Calibration failed - no shots seen, keeping previous settings");
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_FEEDBACK, errorFlash);
+  }
+}
+
+
+void setupGame() {
+  // Resolve this device's side once, everything after compares enums
+  playerSide = deviceConfig().side;
+  opponentSide = playerSide == SCORE_PLAYER_RED ? SCORE_PLAYER_BLUE : SCORE_PLAYER_RED;
+
+  // Initialize pins
+  halPinMode(LASER_BREAK_PIN, INPUT_PULLUP);
+  halPinMode(BUTTON_UP_PIN, INPUT_PULLUP);
+  halPinMode(BUTTON_DOWN_PIN, INPUT_PULLUP);
+  halPinMode(BUTTON_QUANTUM_PIN, INPUT_PULLUP);
+  halPinMode(LED_ACTIVITY_PIN, OUTPUT);
+  halPinMode(LED_BUILTIN_PIN, OUTPUT);
+
+  // Initialize RGB LED pins
+  halPinMode(RGB_RED_PIN, OUTPUT);
+  halPinMode(RGB_GREEN_PIN, OUTPUT);
+  halPinMode(RGB_BLUE_PIN, OUTPUT);
+
+  // Local score events settle against the Pi's answers
+  resetMatchState();
+  setJournalResultHandler(onJournalResult);
+
+  // Register tasks in the order the old loop ran them
+  networkTask = schedulerAddTask("network", runNetworkTask);
+  buttonTask = schedulerAddTask("buttons", runButtonTask);
+  laserTask = schedulerAddTask("laser", runLaserTask);
+  broadcastTask = schedulerAddTask("broadcast", runBroadcastTask);
+  powerTask = schedulerAddTask("power", runPowerTask);
+  resetPowerState(deviceConfig().idleS * 1000UL, deviceConfig().sleepS * 1000UL, halMillis());
+  const LedOutput ledOutputs[LED_CHANNEL_COUNT] = {writeRGBLED, writeActivityLED, writeNetworkLED};
+  setupLedAnimations(ledOutputs);
+
+  // Capture laser edges from an interrupt instead of polling, and dispatch
+  // the laser task as soon as one arrives
+  const GoalDetectorConfig& detector = deviceConfig().detector;
+  setGoalDetectorConfig(detector);
+  LOG_INFO(LOG_CAT_LASER, "Goal detector: glitch %uus, min break %uus, rearm %ums", (unsigned)detector.glitchUs,
+           (unsigned)detector.minBreakUs, (unsigned)(detector.rearmUs / 1000));
+  resetGoalDetector(!halDigitalRead(LASER_BREAK_PIN), halMicros());
+  setupLaserCapture(LASER_BREAK_PIN, laserEdgeSignal);
+
+  // Button edges are captured the same way. Up and down together reset,
+  // holding quantum starts laser calibration.
+  static const uint8_t buttonPins[BUTTON_CAPTURE_PINS] = {BUTTON_UP_PIN, BUTTON_DOWN_PIN, BUTTON_QUANTUM_PIN};
+  uint8_t held = 0;
+  for (uint8_t button = 0; button < BUTTON_COUNT; button++) {
+    if (!halDigitalRead(buttonPins[button])) {
+      held |= BUTTON_BIT(button);
+    }
+  }
+  resetButtonInput(BUTTON_BIT(BUTTON_UP) | BUTTON_BIT(BUTTON_DOWN), BUTTON_BIT(BUTTON_QUANTUM), held, halMicros());
+  setupButtonCapture(buttonPins, buttonEdgeSignal);
+
+  // Initialize LEDs (off) - the animation task drives them from here on
+  halDigitalWrite(LED_ACTIVITY_PIN, LOW);
+  halDigitalWrite(LED_BUILTIN_PIN, HIGH); // Built-in LED off (inverted logic)
+  setRGBColor(0, 0, 0); // Turn off RGB LED
+}
+
+void wakeNetworkTask() {
+  schedulerWake(networkTask);
+}
+
+void listenForScoreBroadcasts() {
+  setScoreReceiverTable(deviceConfig().tableId);
+  broadcastListening = halUdpListen(SCORE_BROADCAST_GROUP, SCORE_BROADCAST_PORT, scoreDatagramSignal);
+  if (broadcastListening) {
+    LOG_INFO(LOG_CAT_STREAM, "Listening for score broadcasts on %s:%u", SCORE_BROADCAST_GROUP, SCORE_BROADCAST_PORT);
+  } else {
+    LOG_ERROR(LOG_CAT_STREAM, "Score broadcast listener failed, relying on /scoreMade");
+  }
+  // Starts the clock exchanges, which need the socket
+  schedulerWake(broadcastTask);
+}
+
+void setClockServer(const char* host) {
+  clockHost = host;
+}
+
+void setIdleTimeouts(uint16_t idleS, uint16_t sleepS) {
+  setPowerTimeouts(idleS * 1000UL, sleepS * 1000UL);
+  schedulerWake(powerTask);
+}
+
+void handleScoreNotification(uint8_t scoringPlayer, uint32_t trace) {
+  LOG_DEBUG(LOG_CAT_GAME, "Scoring player: %s, this device player: %s", scorePlayerName(scoringPlayer),
+            scorePlayerName(playerSide));
+
+  // Handle own goal celebration
+  if (scoringPlayer == playerSide) {
+    LOG_INFO(LOG_CAT_GAME, "THIS PLAYER SCORED! Triggering celebration blink sequence");
+    triggerOwnGoalBlink();
+    traceGoalHop(trace, GOAL_HOP_CELEBRATED, halMicros());
+  } else {
+    LOG_DEBUG(LOG_CAT_GAME, "Opponent scored - no action needed (goal flash already handled by defending side)");
+  }
+}
+
+void handleScoreMade(const char* scoringPlayer, bool hasSeq, uint32_t seq, uint32_t boot, const ScoreMadeTrace& trace) {
+  uint8_t player;
+  if (!parseScorePlayer(scoringPlayer, &player)) {
+    LOG_WARN(LOG_CAT_GAME, "Unknown scoring player \"%s\"", scoringPlayer);
+    return;
+  }
+  noteActivity(POWER_WAKE_GOAL, trace.arrivedMicros);
+  traceGoalNotified(trace.id, player, GOAL_VIA_HTTP, trace.piReceivedUs, trace.piSentUs, trace.arrivedMicros);
+
+  // Without a seq there is nothing to match against the broadcasts
+  if (!hasSeq) {
+    handleScoreNotification(player, trace.id);
+    return;
+  }
+
+  // Fed through the broadcast receiver, so whichever copy of the goal
+  // arrives second is dropped as a duplicate. /scoreMade carries no
+  // scores, they are extrapolated from the last confirmed ones.
+  const MatchState& match = matchState();
+  ScorePacket packet;
+  packet.seq = seq;
+  packet.player = player;
+  packet.trace = trace.id;
+  packet.piReceivedUs = trace.piReceivedUs;
+  packet.piSentUs = trace.piSentUs;
+  packet.table = deviceConfig().tableId;
+  packet.boot = boot;
+  for (uint8_t side = 0; side < SCORE_PLAYER_COUNT; side++) {
+    packet.scores[side] = match.confirmed[side].goals;
+  }
+  packet.scores[player]++;
+  acceptScorePacket(packet, halMillis());
+  schedulerWake(broadcastTask);
+}
+
+void setRGBColor(int red, int green, int blue) {
+  // ESP8266 uses inverted logic for some pins, adjust as needed
+  halAnalogWrite(RGB_RED_PIN, red);
+  halAnalogWrite(RGB_GREEN_PIN, green);
+  halAnalogWrite(RGB_BLUE_PIN, blue);
+}
+
+void setStatusColor(DeviceStatus status) {
+  // Everything but connecting leaves the activity LED to goal animations
+  if (status != STATUS_CONNECTING) {
+    stopAnimation(LED_CHANNEL_ACTIVITY, LED_PRIORITY_STATUS);
+  }
+
+  if (status == STATUS_STARTUP) {
+    // Purple - Starting up (brighter purple)
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_STATUS, solidPurple);
+    LOG_INFO(LOG_CAT_GAME, "Status: Startup (Purple)");
+  }
+  else if (status == STATUS_CONNECTING) {
+    // Blinking yellow, with the activity LED - Connecting to WiFi
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_STATUS, connectingBlink);
+    playAnimation(LED_CHANNEL_ACTIVITY, LED_PRIORITY_STATUS, connectingBlink);
+    LOG_INFO(LOG_CAT_GAME, "Status: Connecting (Blinking Yellow)");
+  }
+  else if (status == STATUS_READY) {
+    // Player color - Ready and connected
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_STATUS, *sideColors[playerSide]);
+    LOG_INFO(LOG_CAT_GAME, "Status: Ready (%s)", sideColorNames[playerSide]);
+  }
+  else if (status == STATUS_DISCONNECTED) {
+    // Orange - WiFi disconnected (brighter orange)
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_STATUS, solidOrange);
+    LOG_INFO(LOG_CAT_GAME, "Status: Disconnected (Orange)");
+  }
+  else if (status == STATUS_ERROR) {
+    // Flashing red, then solid red - Error state
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_STATUS, solidRed);
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_FEEDBACK, errorFlash);
+    LOG_INFO(LOG_CAT_GAME, "Status: Error (Flashing Red)");
+  }
+  else if (status == STATUS_OFF) {
+    // Turn off RGB LED
+    stopAnimation(LED_CHANNEL_RGB, LED_PRIORITY_STATUS);
+    LOG_INFO(LOG_CAT_GAME, "Status: Off");
+  }
+}
+
+void flashNetworkActivity() {
+  // Flash the built-in LED for network activity (like ethernet port)
+  playAnimation(LED_CHANNEL_NETWORK, LED_PRIORITY_ALERT, networkFlash);
+  LOG_DEBUG(LOG_CAT_GAME, "Network activity flash");
+}
+
+void startupBlink() {
+  LOG_DEBUG(LOG_CAT_GAME, "Starting LED activity pin blink sequence (3 blinks)");
+
+  // Purple for the length of the blinks, then back to the status color
+  playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_FEEDBACK, startupColor);
+  playAnimation(LED_CHANNEL_ACTIVITY, LED_PRIORITY_FEEDBACK, startupActivityBlink);
+}
+
+void handleLaserBreak() {
+  // The detector filters glitches, short breaks and goal mouth bounces
+  LaserEdge edge;
+  while (popLaserEdge(&edge)) {
+    noteActivity(POWER_WAKE_LASER, edge.timestamp);
+    goalDetectorEdge(edge.broken, edge.timestamp);
+  }
+
+  GoalEvent event;
+  while (nextGoalEvent(&event, halMicros())) {
+    // Log laser state changes
+    LOG_DEBUG(LOG_CAT_LASER, "Laser break sensor state change: %s (pin %d)",
+              event.type == GOAL_EVENT_BREAK ? "BROKEN" : "RESTORED", LASER_BREAK_PIN);
+
+    // Beam restored - the break width gives the shot speed
+    if (event.type == GOAL_EVENT_RESTORE) {
+      uint16_t restoredSpeed = goalPending ? shotSpeedKmhX10(event.widthMicros) : 0;
+      streamLaserRestore(event.widthMicros, restoredSpeed);
+
+      if (goalPending) {
+        LOG_INFO(LOG_CAT_LASER, "Beam broken for %uus, shot speed: %u.%u km/h", (unsigned)event.widthMicros,
+                 restoredSpeed / 10, restoredSpeed % 10);
+
+        if (restoredSpeed > 0) {
+          shotSpeeds.add(restoredSpeed);
+        }
+        sendGoalAPI(restoredSpeed);
+        goalPending = false;
+      }
+      continue;
+    }
+
+    beamBrokenMicros = event.startMicros;
+    streamLaserBreak(event.goal, event.startMicros);
+    // A goal shot at the sleeping table still counts, see halPinEdge()
+    bool wakeBreak = wakeBreakPending && event.startMicros == wakeBreakMicros;
+    wakeBreakPending = false;
+    if (!event.goal) {
+      LOG_DEBUG(LOG_CAT_LASER, "%s", goalCalibration().phase == GOAL_CALIBRATION_SHOTS
+                                         ? "Calibration shot recorded"
+                                         : "Goal ignored - ball bouncing in the goal mouth");
+      continue;
+    }
+
+    LOG_INFO(LOG_CAT_LASER, "GOAL CONFIRMED! Waiting for beam restore to measure speed.");
+    goalPending = true;
+    goalBreakMicros = event.startMicros;
+    if (wakeBreak) {
+      powerWakeGoal();
+    }
+    goalTraceId = halRandom() | 1;
+    startGoalTrace(goalTraceId, opponentSide, goalBreakMicros);
+
+    // Trigger 2-second solid LED flash
+    triggerGoalFlash();
+  }
+  checkGoalCalibration();
+
+  // Ball stopped in the beam - don't hold the goal back waiting for a speed
+  if (goalPending && halMicros() - goalBreakMicros > SHOT_MAX_PULSE_US) {
+    LOG_INFO(LOG_CAT_LASER, "Beam still broken, sending goal without shot speed");
+    sendGoalAPI(0);
+    goalPending = false;
+  }
+}
+
+void startLaserCalibration() {
+  LOG_INFO(LOG_CAT_LASER, "Calibration started - keep the ball out of the goal");
+  startGoalCalibration(halMicros());
+  // Cyan pulse over the status color until calibration finishes
+  playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_FEEDBACK, calibratingPulse);
+  schedulerWake(laserTask);
+}
+
+static void toggleQuantumMode() {
+  quantumMode = !quantumMode;
+  matchSetQuantum(quantumMode);
+  LOG_INFO(LOG_CAT_BUTTON, "Quantum mode changed to: %s", quantumMode ? "ENABLED" : "DISABLED");
+  streamButtonEvent("quantum");
+  streamQuantumEvent(quantumMode);
+
+  // Flash RGB LED to indicate quantum mode toggle, the status color
+  // returns once it ends
+  if (quantumMode) {
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_FEEDBACK, quantumOnFeedback); // Green for ON
+  } else {
+    playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_FEEDBACK, quantumOffFeedback); // Red for OFF
+  }
+}
+
+static void handleButtonTap(uint8_t button) {
+  if (button == BUTTON_QUANTUM) {
+    toggleQuantumMode();
+    return;
+  }
+  LOG_INFO(LOG_CAT_BUTTON, "%s button: adding 1 point for player: %s, Quantum mode: %s",
+           button == BUTTON_UP ? "Up" : "Down", scorePlayerName(playerSide), quantumMode ? "ENABLED" : "DISABLED");
+  streamButtonEvent(buttonName(button));
+  sendAddPointAPI(1);
+}
+
+void handleButtonActions() {
+  ButtonEdge edge;
+  while (popButtonEdge(&edge)) {
+    noteActivity(POWER_WAKE_BUTTON, edge.timestamp);
+    buttonInputEdge(edge.button, edge.pressed, edge.timestamp);
+  }
+
+  ButtonEvent event;
+  while (nextButtonEvent(&event, halMicros())) {
+    LOG_DEBUG(LOG_CAT_BUTTON, "Button %s: %s, %uus after the first contact edge", buttonName(event.button),
+              buttonGestureName(event.gesture), (unsigned)event.latencyMicros);
+    buttonLatency.observe(event.latencyMicros);
+
+    switch (event.gesture) {
+      case BUTTON_GESTURE_TAP:
+        handleButtonTap(event.button);
+        break;
+      case BUTTON_GESTURE_CHORD:
+        LOG_INFO(LOG_CAT_BUTTON, "Reset combination (Up + Down), sending reset API for player: %s",
+                 scorePlayerName(playerSide));
+        streamButtonEvent("reset");
+        sendResetAPI();
+        break;
+      case BUTTON_GESTURE_LONG_PRESS:
+        streamButtonEvent("calibrate");
+        startLaserCalibration();
+        break;
+      case BUTTON_GESTURE_DOUBLE_TAP: {
+        // Both taps already counted, the stream just gets to know
+        char action[16];
+        snprintf(action, sizeof(action), "double-%s", buttonName(event.button));
+        streamButtonEvent(action);
+        break;
+      }
+    }
+  }
+}
+
+void triggerOwnGoalBlink() {
+  // Own goal celebration blinking, hidden behind a goal flash if one is on
+  LOG_DEBUG(LOG_CAT_GAME, "Own goal scored! Triggering celebration LED blink");
+  playAnimation(LED_CHANNEL_ACTIVITY, LED_PRIORITY_FEEDBACK, ownGoalBlink);
+}
+
+void triggerGoalFlash() {
+  LOG_DEBUG(LOG_CAT_GAME, "Triggering goal flash - solid LED for 2 seconds");
+  playAnimation(LED_CHANNEL_ACTIVITY, LED_PRIORITY_ALERT, goalFlash);
+}
+
+// A direct send that didn't get through goes on to the journal under the
+// same seq, the Pi drops it there if it did apply it after all. It stays
+// counted meanwhile; only a rejection, or a full journal losing it, takes
+// it back.
+static void settleDirect(int result) {
+  if (!journalDirectResult(directEvent, result)) {
+    matchAcknowledge(directOp, MATCH_ACK_REJECTED, halMillis());
+  } else if (result >= 200 && result < 300) {
+    matchAcknowledge(directOp, MATCH_ACK_APPLIED, halMillis());
+  } else {
+    matchAcknowledge(directOp, MATCH_ACK_FAILED, halMillis());
+    matchJournaled(directOp, directEvent.seq);
+  }
+  wakeNetworkTask();
+}
+
+static void onGoalAck(int result) {
+  if (result >= 200 && result < 300) {
+    goalAckLatency.observe(halMicros() - directStart);
+    traceGoalHop(directTrace, GOAL_HOP_ACK, halMicros());
+  } else {
+    LOG_WARN(LOG_CAT_NET, "Goal API failed (%d)", result);
+  }
+  settleDirect(result);
+}
+
+static void onResetAck(int result) {
+  if (result < 200 || result >= 300) {
+    LOG_WARN(LOG_CAT_NET, "Reset API failed (%d)", result);
+  }
+  settleDirect(result);
+}
+
+void sendGoalAPI(uint16_t speedKmhX10) {
+  // The goal counts against this side straight away
+  uint16_t op = matchLocalGoal(opponentSide, speedKmhX10, halMillis());
+
+  // Keep ordering: while anything is journaled or a direct send is out, new
+  // events queue behind it
+  JournalSeq seq;
+  if (!wifiConnected || !journalDirect(JOURNAL_GOAL, speedKmhX10, &directEvent, &seq)) {
+    LOG_INFO(LOG_CAT_NET, "WiFi not connected or journal replay pending, journaling goal");
+    matchJournaled(op, journalEvent(JOURNAL_GOAL, speedKmhX10, 0));
+    wakeNetworkTask();
+    return;
+  }
+  directOp = op;
+  directStart = goalBreakMicros;
+  directTrace = goalTraceId;
+
+  // Flash network activity LED for outgoing data
+  flashNetworkActivity();
+
+  // The trace id and hop times so far go along to the Pi
+  traceGoalHop(goalTraceId, GOAL_HOP_SENT, halMicros());
+  ScoreTrace trace = {};
+  goalScoreTrace(goalTraceId, &trace);
+
+  // The Pi dedupes by seq, so a goal can go out again on a fresh connection
+  bool queued;
+  if (outboundWireActive()) {
+    uint8_t frame[WIRE_GOAL_TRACED_SIZE];
+    size_t length = encodeWireGoal(opponentSide, deviceConfig().tableId, speedKmhX10, frame, sizeof(frame), &trace, &seq);
+    queued = queueOutboundFrame(WIRE_GOAL, frame, length, "Goal frame", onGoalAck, OUTBOUND_RESENDABLE);
+  } else {
+    char payload[OUTBOUND_BODY_MAX];
+    formatScoreBody(payload, sizeof(payload), scorePlayerName(opponentSide), deviceConfig().tableId, speedKmhX10,
+                    &trace, &seq);
+    LOG_DEBUG(LOG_CAT_NET, "Queueing goal payload: %s", payload);
+    queued = queueOutbound("/score", payload, "Goal API", onGoalAck, OUTBOUND_RESENDABLE);
+  }
+
+  // Queue full, never sent - straight to the journal under the seq it
+  // already has
+  if (!queued) {
+    settleDirect(OUTBOUND_ERROR_LOST);
+    return;
+  }
+  wakeNetworkTask();
+}
+
+void sendAddPointAPI(int amount) {
+  // Counted and shown at once, the Pi catches up with the batch
+  uint16_t op = matchLocalPoint(playerSide, amount, quantumMode);
+  playAnimation(LED_CHANNEL_RGB, LED_PRIORITY_FEEDBACK, pointFeedback);
+
+  if (wifiConnected) {
+    // Flash network activity LED for outgoing data
+    flashNetworkActivity();
+  }
+
+  // Points go through the event journal so a burst of presses within
+  // EVENT_BATCH_WINDOW_MS is sent as a single /events batch
+  matchJournaled(op, journalEvent(JOURNAL_POINT, amount, quantumMode ? JOURNAL_FLAG_QUANTUM : 0));
+  wakeNetworkTask();
+}
+
+void sendResetAPI() {
+  uint16_t op = matchLocalReset();
+
+  JournalSeq seq;
+  if (!wifiConnected || !journalDirect(JOURNAL_RESET, 0, &directEvent, &seq)) {
+    LOG_INFO(LOG_CAT_NET, "WiFi not connected or journal replay pending, journaling reset");
+    matchJournaled(op, journalEvent(JOURNAL_RESET, 0, 0));
+    wakeNetworkTask();
+    return;
+  }
+  directOp = op;
+
+  // Flash network activity LED for outgoing data
+  flashNetworkActivity();
+
+  bool queued;
+  if (outboundWireActive()) {
+    uint8_t frame[WIRE_RESET_SIZE];
+    size_t length = encodeWireReset(playerSide, deviceConfig().tableId, frame, sizeof(frame), &seq);
+    queued = queueOutboundFrame(WIRE_RESET, frame, length, "Reset frame", onResetAck, OUTBOUND_RESENDABLE);
+  } else {
+    char payload[OUTBOUND_BODY_MAX];
+    formatResetBody(payload, sizeof(payload), scorePlayerName(playerSide), deviceConfig().tableId, &seq);
+    queued = queueOutbound("/reset", payload, "Reset API", onResetAck, OUTBOUND_RESENDABLE);
+  }
+
+  if (!queued) {
+    settleDirect(OUTBOUND_ERROR_LOST);
+    return;
+  }
+  wakeNetworkTask();
+}
+
+// The Pi offers binary frames with "wireVersion" and "wirePort" on /status
+static void onPiStatus(int result) {
+  const char* body = outboundResponseBody();
+  uint32_t version = 0;
+  uint32_t port = 0;
+  if (result != 200 || !parseUintField(body, "wireVersion", &version) || version < WIRE_VERSION ||
+      !parseUintField(body, "wirePort", &port) || port == 0 || port > 0xFFFF) {
+    LOG_WARN(LOG_CAT_NET, "Pi doesn't offer binary frames (%d), staying on JSON", result);
+    return;
+  }
+  LOG_INFO(LOG_CAT_NET, "Sending binary frames v%u to port %u", WIRE_VERSION, (unsigned)port);
+  setOutboundWire(port);
+}
+
+void negotiateWireProtocol() {
+  // A reconnect may have brought up a different Pi, ask again
+  setOutboundWire(0);
+  if (deviceConfig().protocol != DEVICE_PROTOCOL_BINARY) {
+    return;
+  }
+  queueOutboundGet("/status", "Status API", onPiStatus);
+  wakeNetworkTask();
+}
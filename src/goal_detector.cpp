@@ -0,0 +1,307 @@
+#include "goal_detector.h"
+#include <string.h>
+
+static GoalDetectorConfig config = {GOAL_GLITCH_US, GOAL_MIN_BREAK_US, GOAL_REARM_US};
+
+// Raw level from the last edge, and the filtered level it has to outlast
+// the glitch filter to become
+static bool rawBroken = false;
+static uint32_t rawSince = 0;
+static bool broken = false;
+
+// Current filtered break
+static uint32_t breakStart = 0;
+static bool confirmed = false;   // Passed the minimum width
+static bool breakIsGoal = false;
+
+// Hysteresis - cleared by a break, set again once the beam has been clear
+// for rearmUs
+static bool armed = true;
+static uint32_t clearSince = 0;
+
+static GoalEvent events[GOAL_EVENT_QUEUE_SIZE];
+static uint8_t eventHead = 0;
+static uint8_t eventCount = 0;
+static GoalDetectorStats stats = {};
+
+static GoalCalibration calibration = {};
+static GoalDetectorConfig configBeforeCalibration;
+static uint32_t phaseStart = 0;
+static uint32_t lastRestore = 0;   // End of the last break seen while calibrating
+
+static const char* const phaseNames[] = {"off", "quiet", "shots", "done", "failed"};
+
+static uint32_t clampUs(uint32_t value, uint32_t low, uint32_t high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+// us left until span has passed since since, 0 once it has
+static uint32_t remaining(uint32_t since, uint32_t span, uint32_t nowMicros) {
+  uint32_t elapsed = nowMicros - since;
+  return elapsed >= span ? 0 : span - elapsed;
+}
+
+static bool calibrating() {
+  return calibration.phase == GOAL_CALIBRATION_QUIET || calibration.phase == GOAL_CALIBRATION_SHOTS;
+}
+
+static void pushEvent(uint8_t type, uint32_t widthMicros) {
+  // Only reachable if the caller stops draining nextGoalEvent()
+  if (eventCount >= GOAL_EVENT_QUEUE_SIZE) {
+    stats.overflows++;
+    return;
+  }
+  GoalEvent* event = &events[(eventHead + eventCount) % GOAL_EVENT_QUEUE_SIZE];
+  event->type = type;
+  event->goal = breakIsGoal;
+  event->startMicros = breakStart;
+  event->widthMicros = widthMicros;
+  eventCount++;
+}
+
+void setGoalDetectorConfig(const GoalDetectorConfig& newConfig) {
+  config = newConfig;
+}
+
+const GoalDetectorConfig& goalDetectorConfig() {
+  return config;
+}
+
+bool validGoalDetectorConfig(const GoalDetectorConfig& candidate) {
+  return candidate.glitchUs <= GOAL_GLITCH_MAX_US &&
+         candidate.minBreakUs >= candidate.glitchUs &&
+         candidate.minBreakUs <= GOAL_MIN_BREAK_MAX_US &&
+         candidate.rearmUs <= GOAL_REARM_MAX_US;
+}
+
+void resetGoalDetector(bool level, uint32_t nowMicros) {
+  rawBroken = level;
+  rawSince = nowMicros;
+  broken = level;
+  // A beam that is already blocked never counts as a goal
+  breakStart = nowMicros;
+  confirmed = level;
+  breakIsGoal = false;
+  armed = !level;
+  clearSince = nowMicros;
+  eventHead = 0;
+  eventCount = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+static void confirmBreak(uint32_t nowMicros) {
+  if (!broken || confirmed) {
+    return;
+  }
+  // A pending restore caps the width at the restore edge
+  uint32_t end = rawBroken ? nowMicros : rawSince;
+  if (end - breakStart < config.minBreakUs) {
+    return;
+  }
+
+  confirmed = true;
+  breakIsGoal = armed && !calibrating();
+  if (breakIsGoal) {
+    stats.goals++;
+  } else if (!armed && !calibrating()) {
+    stats.bounces++;
+  }
+  armed = false;
+  pushEvent(GOAL_EVENT_BREAK, 0);
+}
+
+static void finishCalibration() {
+  GoalDetectorConfig* learned = &calibration.learned;
+
+  // Well above anything the noise produced, but under the shortest shot.
+  // The quiet phase is too short to catch rare shadows, so a quiet table
+  // keeps the default rather than going lower.
+  uint32_t minBreak = calibration.noiseFloorUs * 4;
+  if (minBreak < GOAL_MIN_BREAK_US) {
+    minBreak = GOAL_MIN_BREAK_US;
+  }
+  if (minBreak > calibration.shortestShotUs / 2) {
+    minBreak = calibration.shortestShotUs / 2;
+  }
+  learned->minBreakUs = clampUs(minBreak, learned->glitchUs, GOAL_MIN_BREAK_MAX_US);
+
+  // Half again the longest bounce, so the goal mouth rattle never re-scores
+  if (calibration.longestBounceGapUs > 0) {
+    learned->rearmUs = clampUs(calibration.longestBounceGapUs / 2 * 3, GOAL_REARM_MIN_US, GOAL_REARM_MAX_US);
+  } else {
+    learned->rearmUs = GOAL_REARM_US;
+  }
+
+  config = *learned;
+  calibration.phase = GOAL_CALIBRATION_DONE;
+}
+
+// Called with every break that ends during the shot phase
+static void calibrationBreak(uint32_t startMicros, uint32_t widthMicros) {
+  if (calibration.shots == 0 || startMicros - lastRestore >= GOAL_CALIBRATION_SHOT_GAP_US) {
+    if (calibration.shots == 0 || widthMicros < calibration.shortestShotUs) {
+      calibration.shortestShotUs = widthMicros;
+    }
+    if (calibration.shots < 0xFF) {
+      calibration.shots++;
+    }
+  } else if (startMicros - lastRestore > calibration.longestBounceGapUs) {
+    calibration.longestBounceGapUs = startMicros - lastRestore;
+  }
+  lastRestore = startMicros + widthMicros;
+}
+
+static void endBreak(uint32_t restoreMicros) {
+  if (!confirmed) {
+    stats.shortBreaks++;
+    return;
+  }
+  armed = false;
+  clearSince = restoreMicros;
+  pushEvent(GOAL_EVENT_RESTORE, restoreMicros - breakStart);
+
+  if (calibration.phase == GOAL_CALIBRATION_SHOTS) {
+    calibrationBreak(breakStart, restoreMicros - breakStart);
+  }
+}
+
+static void advanceCalibration(uint32_t nowMicros) {
+  if (calibration.phase == GOAL_CALIBRATION_QUIET) {
+    if (nowMicros - phaseStart < GOAL_CALIBRATION_QUIET_US) {
+      return;
+    }
+    // No rearm while learning, so every bounce shows up as its own break
+    calibration.learned.glitchUs = clampUs(calibration.noiseFloorUs * 2, GOAL_GLITCH_MIN_US, GOAL_GLITCH_MAX_US);
+    config.glitchUs = calibration.learned.glitchUs;
+    config.minBreakUs = GOAL_CALIBRATION_SHOT_MIN_US;
+    config.rearmUs = 0;
+    calibration.phase = GOAL_CALIBRATION_SHOTS;
+    phaseStart = nowMicros;
+    return;
+  }
+
+  if (calibration.phase != GOAL_CALIBRATION_SHOTS) {
+    return;
+  }
+  bool settled = !broken && rawBroken == broken;
+  if (calibration.shots >= GOAL_CALIBRATION_SHOT_COUNT && settled &&
+      nowMicros - lastRestore >= GOAL_CALIBRATION_SHOT_GAP_US) {
+    finishCalibration();
+  } else if (nowMicros - phaseStart >= GOAL_CALIBRATION_TIMEOUT_US) {
+    if (calibration.shots > 0) {
+      finishCalibration();
+    } else {
+      config = configBeforeCalibration;
+      calibration.phase = GOAL_CALIBRATION_FAILED;
+    }
+  }
+}
+
+// Applies everything that has settled by nowMicros
+static void advance(uint32_t nowMicros) {
+  confirmBreak(nowMicros);
+
+  if (rawBroken != broken && nowMicros - rawSince >= config.glitchUs) {
+    broken = rawBroken;
+    if (broken) {
+      breakStart = rawSince;
+      confirmed = false;
+      confirmBreak(nowMicros);
+    } else {
+      endBreak(rawSince);
+    }
+  }
+
+  if (!armed && !broken && nowMicros - clearSince >= config.rearmUs) {
+    armed = true;
+  }
+
+  advanceCalibration(nowMicros);
+}
+
+void goalDetectorEdge(bool level, uint32_t timestampMicros) {
+  stats.edges++;
+  // Bounces can report the same level twice, only act on real transitions
+  if (level == rawBroken) {
+    return;
+  }
+
+  advance(timestampMicros);
+  if (rawBroken != broken) {
+    // The previous change never outlasted the glitch filter
+    stats.glitches++;
+  }
+  if (calibration.phase == GOAL_CALIBRATION_QUIET && rawBroken &&
+      timestampMicros - rawSince > calibration.noiseFloorUs) {
+    calibration.noiseFloorUs = timestampMicros - rawSince;
+  }
+
+  rawBroken = level;
+  rawSince = timestampMicros;
+  advance(timestampMicros);
+}
+
+bool nextGoalEvent(GoalEvent* event, uint32_t nowMicros) {
+  advance(nowMicros);
+  if (eventCount == 0) {
+    return false;
+  }
+  *event = events[eventHead];
+  eventHead = (eventHead + 1) % GOAL_EVENT_QUEUE_SIZE;
+  eventCount--;
+  return true;
+}
+
+static void earliest(uint32_t* wait, uint32_t candidate) {
+  if (candidate < *wait) {
+    *wait = candidate;
+  }
+}
+
+uint32_t goalDetectorTimeout(uint32_t nowMicros) {
+  if (eventCount > 0) {
+    return 0;
+  }
+
+  uint32_t wait = GOAL_DETECTOR_IDLE;
+  if (rawBroken != broken) {
+    earliest(&wait, remaining(rawSince, config.glitchUs, nowMicros));
+  }
+  if (broken && rawBroken && !confirmed) {
+    earliest(&wait, remaining(breakStart, config.minBreakUs, nowMicros));
+  }
+  if (!armed && !broken) {
+    earliest(&wait, remaining(clearSince, config.rearmUs, nowMicros));
+  }
+
+  if (calibration.phase == GOAL_CALIBRATION_QUIET) {
+    earliest(&wait, remaining(phaseStart, GOAL_CALIBRATION_QUIET_US, nowMicros));
+  } else if (calibration.phase == GOAL_CALIBRATION_SHOTS) {
+    earliest(&wait, remaining(phaseStart, GOAL_CALIBRATION_TIMEOUT_US, nowMicros));
+    if (calibration.shots >= GOAL_CALIBRATION_SHOT_COUNT && !broken) {
+      earliest(&wait, remaining(lastRestore, GOAL_CALIBRATION_SHOT_GAP_US, nowMicros));
+    }
+  }
+  return wait;
+}
+
+const GoalDetectorStats& goalDetectorStats() {
+  return stats;
+}
+
+void startGoalCalibration(uint32_t nowMicros) {
+  if (!calibrating()) {
+    configBeforeCalibration = config;
+  }
+  memset(&calibration, 0, sizeof(calibration));
+  calibration.phase = GOAL_CALIBRATION_QUIET;
+  phaseStart = nowMicros;
+}
+
+const GoalCalibration& goalCalibration() {
+  return calibration;
+}
+
+const char* goalCalibrationPhaseName(uint8_t phase) {
+  return phase < sizeof(phaseNames) / sizeof(phaseNames[0]) ? phaseNames[phase] : "";
+}
@@ -0,0 +1,153 @@
+#include "goal_trace.h"
+#include <stdio.h>
+#include <string.h>
+#include "clock_sync.h"
+#include "json_writer.h"
+#include "score_broadcast.h"
+
+static const char* const hopNames[GOAL_HOP_COUNT] = {
+  "break", "sent", "piReceived", "piSent", "ack", "notified", "celebrated"};
+static const char* const viaNames[] = {"", "udp", "http"};
+
+// Ring of the last traces, oldest at head
+static GoalTrace traces[GOAL_TRACE_SLOTS];
+static uint8_t head = 0;
+static uint8_t count = 0;
+
+void resetGoalTraces() {
+  memset(traces, 0, sizeof(traces));
+  head = 0;
+  count = 0;
+}
+
+static GoalTrace* findTrace(uint32_t id) {
+  if (id == 0) {
+    return nullptr;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    GoalTrace* trace = &traces[(head + i) % GOAL_TRACE_SLOTS];
+    if (trace->id == id) {
+      return trace;
+    }
+  }
+  return nullptr;
+}
+
+// Takes the oldest slot once the ring is full
+static GoalTrace* newTrace(uint32_t id, uint8_t scorer) {
+  GoalTrace* trace;
+  if (count < GOAL_TRACE_SLOTS) {
+    trace = &traces[(head + count) % GOAL_TRACE_SLOTS];
+    count++;
+  } else {
+    trace = &traces[head];
+    head = (head + 1) % GOAL_TRACE_SLOTS;
+  }
+  memset(trace, 0, sizeof(*trace));
+  trace->id = id;
+  trace->scorer = scorer;
+  trace->synced = clockSynced();
+  trace->errorUs = clockSyncErrorMicros();
+  return trace;
+}
+
+static void setHop(GoalTrace* trace, uint8_t hop, uint32_t micros) {
+  trace->hops[hop] = micros;
+  trace->seen |= 1 << hop;
+}
+
+// Device time in the trace's clock
+static void setDeviceHop(GoalTrace* trace, uint8_t hop, uint32_t micros) {
+  setHop(trace, hop, trace->synced ? deviceToPiMicros(micros) : micros);
+}
+
+void startGoalTrace(uint32_t id, uint8_t scorer, uint32_t breakMicros) {
+  if (id == 0) {
+    return;
+  }
+  setDeviceHop(newTrace(id, scorer), GOAL_HOP_BREAK, breakMicros);
+}
+
+void traceGoalHop(uint32_t id, uint8_t hop, uint32_t micros) {
+  GoalTrace* trace = findTrace(id);
+  if (trace != nullptr && hop < GOAL_HOP_COUNT) {
+    setDeviceHop(trace, hop, micros);
+  }
+}
+
+void traceGoalNotified(uint32_t id, uint8_t scorer, uint8_t via, uint32_t piReceivedUs, uint32_t piSentUs,
+                       uint32_t arrivedMicros) {
+  if (id == 0) {
+    return;
+  }
+  GoalTrace* trace = findTrace(id);
+  if (trace == nullptr) {
+    trace = newTrace(id, scorer);
+  } else if (trace->seen & (1 << GOAL_HOP_NOTIFIED)) {
+    return;
+  }
+  trace->via = via;
+  setHop(trace, GOAL_HOP_PI_RECEIVED, piReceivedUs);
+  setHop(trace, GOAL_HOP_PI_SENT, piSentUs);
+  setDeviceHop(trace, GOAL_HOP_NOTIFIED, arrivedMicros);
+}
+
+bool goalScoreTrace(uint32_t id, ScoreTrace* score) {
+  const GoalTrace* trace = findTrace(id);
+  if (trace == nullptr) {
+    return false;
+  }
+  const uint8_t timed = (1 << GOAL_HOP_BREAK) | (1 << GOAL_HOP_SENT);
+  score->id = id;
+  score->timed = trace->synced && (trace->seen & timed) == timed;
+  score->breakUs = trace->hops[GOAL_HOP_BREAK];
+  score->sentUs = trace->hops[GOAL_HOP_SENT];
+  return true;
+}
+
+uint8_t goalTraceCount() {
+  return count;
+}
+
+const GoalTrace& goalTrace(uint8_t index) {
+  return traces[(head + index) % GOAL_TRACE_SLOTS];
+}
+
+void writeGoalTraces(GoalTraceSink sink, uint16_t table, const char* side) {
+  char line[GOAL_TRACE_LINE_MAX];
+  char id[TRACE_ID_CHARS + 1];
+  for (uint8_t i = 0; i < count; i++) {
+    const GoalTrace& trace = goalTrace(i);
+    snprintf(id, sizeof(id), "%08x", (unsigned)trace.id);
+
+    JsonWriter json(line, sizeof(line) - 1);
+    json.openObject();
+    json.addUint("table", table);
+    json.addString("side", side);
+    json.addString("trace", id);
+    json.addString("scorer", scorePlayerName(trace.scorer));
+    json.addString("clock", trace.synced ? "pi" : "device");
+    json.addUint("errorUs", trace.errorUs);
+    if (trace.via != GOAL_VIA_NONE) {
+      json.addString("via", goalViaName(trace.via));
+    }
+    for (uint8_t hop = 0; hop < GOAL_HOP_COUNT; hop++) {
+      if (trace.seen & (1 << hop)) {
+        json.addUint(hopNames[hop], trace.hops[hop]);
+      }
+    }
+    json.closeObject();
+
+    size_t length = json.length();
+    line[length++] = '\n';
+    sink(line, length);
+  }
+}
+
+const char* goalHopName(uint8_t hop) {
+  return hop < GOAL_HOP_COUNT ? hopNames[hop] : "?";
+}
+
+const char* goalViaName(uint8_t via) {
+  return via <= GOAL_VIA_HTTP ? viaNames[via] : "?";
+}
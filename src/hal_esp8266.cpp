@@ -0,0 +1,552 @@
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <Updater.h>
+#include <coredecls.h>
+#include <eboot_command.h>
+#include <flash_hal.h>
+#include <lwip/igmp.h>
+#include <lwip/tcp.h>
+#include <lwip/udp.h>
+#include <include/ClientContext.h>
+#include <new>
+#include "hal.h"
+#include "spsc_ring.h"
+
+#define HAL_PIN_COUNT 17
+
+struct HalDatagram {
+  uint8_t length;
+  uint32_t arrivedMicros;
+  uint8_t data[HAL_UDP_DATAGRAM_MAX];
+};
+
+static WiFiClient sockets[HAL_MAX_SOCKETS];
+static bool socketInUse[HAL_MAX_SOCKETS];
+static WiFiServer listeners[HAL_MAX_LISTENERS] = {WiFiServer(0), WiFiServer(0)};
+
+// Raw lwIP connects - WiFiClient::connect() waits for the handshake. The
+// pcb is handed to a ClientContext once it completes and wrapped in the
+// socket's WiFiClient by halTcpConnecting().
+static tcp_pcb* connectingPcbs[HAL_MAX_SOCKETS];
+static ClientContext* connectedContexts[HAL_MAX_SOCKETS];
+static uint8_t listenerCount = 0;
+static volatile bool wakeRequested = false;
+
+// Raw lwIP UDP - the receive callback is the readiness event WiFiUDP hides
+static udp_pcb* udpPcb = nullptr;
+static HalIsr udpOnReceive = nullptr;
+static SpscRing<HalDatagram, HAL_UDP_QUEUE_SIZE> udpDatagrams;
+
+// Pin ISRs as attached, restored after a light sleep
+static HalIsr pinIsrs[HAL_PIN_COUNT];
+static int pinIsrModes[HAL_PIN_COUNT];
+
+// Light sleep - the wake pins trade their ISR for a level interrupt with
+// wake-up enabled, which disarms itself on the first change
+static uint8_t powerMode = HAL_POWER_FULL;
+static uint8_t wakePins[HAL_MAX_WAKE_PINS];
+static uint8_t wakePinCount = 0;
+static int sleepLevels[HAL_MAX_WAKE_PINS];
+static volatile uint32_t wakeMicros[HAL_MAX_WAKE_PINS];
+static volatile uint8_t wokenPins = 0;   // Bit per wake pin
+static uint32_t sleepStartMicros = 0;
+
+// Edge handed to an ISR replayed after light sleep, see halPinEdge()
+static volatile bool replaying = false;
+static int replayLevel = LOW;
+static uint32_t replayMicros = 0;
+
+uint32_t halMillis() {
+  return millis();
+}
+
+uint32_t IRAM_ATTR halMicros() {
+  return micros();
+}
+
+void halDelay(uint32_t ms) {
+  delay(ms);
+}
+
+uint32_t IRAM_ATTR halCycleCount() {
+  return ESP.getCycleCount();
+}
+
+uint32_t halCyclesPerMicro() {
+  return ESP.getCpuFreqMHz();
+}
+
+static void IRAM_ATTR lightWakeIsr(void* arg) {
+  uint8_t index = (uint8_t)(uintptr_t)arg;
+  uint8_t pin = wakePins[index];
+  // A level interrupt fires for as long as the level lasts
+  GPC(pin) &= ~(0xF << GPCI);
+  GPIEC = 1 << pin;
+  wakeMicros[index] = micros();
+  wokenPins |= 1 << index;
+  halWake();
+}
+
+static void beginLightSleep() {
+  wokenPins = 0;
+  sleepStartMicros = micros();
+  for (uint8_t i = 0; i < wakePinCount; i++) {
+    sleepLevels[i] = digitalRead(wakePins[i]);
+    attachInterruptArg(wakePins[i], lightWakeIsr, (void*)(uintptr_t)i, sleepLevels[i] == HIGH ? ONLOW_WE : ONHIGH_WE);
+  }
+}
+
+static void replayEdge(uint8_t pin, int level, uint32_t micros) {
+  replayLevel = level;
+  replayMicros = micros;
+  replaying = true;
+  pinIsrs[pin]();
+  replaying = false;
+}
+
+// Gives the wake pins their ISRs back and replays the edges they missed.
+// Interrupts stay off meanwhile, the ISRs are the only producers of their
+// edge buffers.
+static void endLightSleep() {
+  uint32_t now = micros();
+  noInterrupts();
+  for (uint8_t i = 0; i < wakePinCount; i++) {
+    uint8_t pin = wakePins[i];
+    GPC(pin) &= ~(0xF << GPCI);
+    int level = digitalRead(pin);
+    if (pinIsrs[pin] != nullptr && ((wokenPins & (1 << i)) || level != sleepLevels[i])) {
+      // The CPU ran the wake interrupt HAL_LIGHT_WAKE_US after the change
+      uint32_t changed = (wokenPins & (1 << i)) ? wakeMicros[i] : now;
+      if ((int32_t)(changed - HAL_LIGHT_WAKE_US - sleepStartMicros) > 0) {
+        changed -= HAL_LIGHT_WAKE_US;
+      } else {
+        changed = sleepStartMicros;
+      }
+      replayEdge(pin, sleepLevels[i] == HIGH ? LOW : HIGH, changed);
+      if (level == sleepLevels[i]) {
+        replayEdge(pin, level, now);
+      }
+    }
+    if (pinIsrs[pin] != nullptr) {
+      attachInterrupt(digitalPinToInterrupt(pin), pinIsrs[pin], pinIsrModes[pin]);
+    }
+  }
+  interrupts();
+}
+
+void halSleep(uint32_t maxMs) {
+  if (maxMs == 0) {
+    yield();
+    return;
+  }
+
+  // Suspends the loop task - WiFi and lwIP keep running, and esp_schedule()
+  // from halWake() resumes it early. In WIFI_LIGHT_SLEEP the SDK stops the
+  // CPU in here between beacons.
+  bool light = powerMode == HAL_POWER_LIGHT && maxMs >= HAL_LIGHT_SLEEP_MIN_MS;
+  if (light) {
+    beginLightSleep();
+  }
+  esp_delay(maxMs, []() { return !wakeRequested; });
+  wakeRequested = false;
+  if (light) {
+    endLightSleep();
+  }
+}
+
+void IRAM_ATTR halWake() {
+  wakeRequested = true;
+  esp_schedule();
+}
+
+void halSetPowerMode(uint8_t mode, const uint8_t* pins, uint8_t count) {
+  static const WiFiSleepType_t sleepTypes[] = {WIFI_NONE_SLEEP, WIFI_MODEM_SLEEP, WIFI_LIGHT_SLEEP};
+  if (mode > HAL_POWER_LIGHT) {
+    return;
+  }
+  wakePinCount = count < HAL_MAX_WAKE_PINS ? count : HAL_MAX_WAKE_PINS;
+  memcpy(wakePins, pins, wakePinCount);
+  if (mode != powerMode) {
+    WiFi.setSleepMode(sleepTypes[mode]);
+    powerMode = mode;
+  }
+}
+
+void halPinMode(uint8_t pin, uint8_t mode) {
+  pinMode(pin, mode);
+}
+
+int IRAM_ATTR halDigitalRead(uint8_t pin) {
+  return digitalRead(pin);
+}
+
+void halDigitalWrite(uint8_t pin, uint8_t value) {
+  digitalWrite(pin, value);
+}
+
+void halAnalogWrite(uint8_t pin, int value) {
+  analogWrite(pin, value);
+}
+
+void halAttachInterrupt(uint8_t pin, HalIsr isr, int mode) {
+  if (pin < HAL_PIN_COUNT) {
+    pinIsrs[pin] = isr;
+    pinIsrModes[pin] = mode;
+  }
+  attachInterrupt(digitalPinToInterrupt(pin), isr, mode);
+}
+
+int IRAM_ATTR halPinEdge(uint8_t pin, uint32_t* micros) {
+  if (replaying) {
+    *micros = replayMicros;
+    return replayLevel;
+  }
+  *micros = ::micros();
+  return digitalRead(pin);
+}
+
+uint32_t halRandom() {
+  return ESP.random();
+}
+
+// Room in the UART TX FIFO - Serial.write() busy-waits once that is full
+int halConsoleWritable() {
+  return Serial.availableForWrite();
+}
+
+void halConsoleWrite(const char* data, size_t length) {
+  Serial.write((const uint8_t*)data, length);
+}
+
+// LittleFS is mounted on first use, begin() is a no-op once it is
+static bool mountStorage() {
+  static bool mounted = false;
+  if (!mounted) {
+    mounted = LittleFS.begin();
+  }
+  return mounted;
+}
+
+bool halStorageLoad(const char* path, void* data, size_t size) {
+  if (!mountStorage()) {
+    return false;
+  }
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return false;
+  }
+  bool loaded = file.size() == size && file.read((uint8_t*)data, size) == size;
+  file.close();
+  return loaded;
+}
+
+bool halStorageSave(const char* path, const void* data, size_t size) {
+  if (!mountStorage()) {
+    return false;
+  }
+  File file = LittleFS.open(path, "w");
+  if (!file) {
+    return false;
+  }
+  bool saved = file.write((const uint8_t*)data, size) == size;
+  file.close();
+  return saved;
+}
+
+// Firmware - the running image at 0, the backup slot a third of the way up
+// to the filesystem and the Updater's stage right below it, so images of up
+// to a third of that space (1 MB with the 4m1m layout) fit.
+static uint32_t backupAddress() {
+  return (FS_PHYS_ADDR / 3) & ~(HAL_FLASH_SECTOR_SIZE - 1);
+}
+
+static uint32_t roundToSector(uint32_t size) {
+  return (size + HAL_FLASH_SECTOR_SIZE - 1) & ~(HAL_FLASH_SECTOR_SIZE - 1);
+}
+
+uint32_t halFirmwareSize() {
+  return ESP.getSketchSize();
+}
+
+bool halFirmwareRead(uint32_t offset, uint8_t* data, size_t length) {
+  return ESP.flashRead(offset, data, length);
+}
+
+bool halFirmwareBackup(uint32_t sector) {
+  uint32_t offset = sector * HAL_FLASH_SECTOR_SIZE;
+  if (offset + HAL_FLASH_SECTOR_SIZE > backupAddress() ||
+      !ESP.flashEraseSector((backupAddress() + offset) / HAL_FLASH_SECTOR_SIZE)) {
+    return false;
+  }
+  // Word-aligned pieces, a whole sector on the stack would be too much
+  uint32_t piece[64];
+  for (uint32_t done = 0; done < HAL_FLASH_SECTOR_SIZE; done += sizeof(piece)) {
+    if (!ESP.flashRead(offset + done, piece, sizeof(piece)) ||
+        !ESP.flashWrite(backupAddress() + offset + done, piece, sizeof(piece))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool halFirmwareBegin(uint32_t size) {
+  uint32_t slot = backupAddress();
+  if (ESP.getSketchSize() > slot || size > slot || slot * 2 > FS_PHYS_ADDR - roundToSector(size)) {
+    return false;
+  }
+  return Update.begin(size);
+}
+
+bool halFirmwareWrite(const uint8_t* data, size_t length) {
+  return Update.write(const_cast<uint8_t*>(data), length) == length;
+}
+
+bool halFirmwareEnd() {
+  return Update.end();
+}
+
+// end() drops an unfinished stage but commits a complete one, clearing the
+// boot command undoes that
+void halFirmwareAbort() {
+  if (Update.isRunning()) {
+    Update.end();
+  }
+  eboot_command_clear();
+}
+
+bool halFirmwareRestoreBackup(uint32_t size) {
+  if (size == 0 || size > backupAddress()) {
+    return false;
+  }
+  eboot_command command = {};
+  command.action = ACTION_COPY_RAW;
+  command.args[0] = backupAddress();
+  command.args[1] = 0;
+  command.args[2] = size;
+  eboot_command_write(&command);
+  return true;
+}
+
+void halRestart() {
+  ESP.restart();
+}
+
+bool halNetworkConnected() {
+  return WiFi.status() == WL_CONNECTED;
+}
+
+HalSocket halTcpConnect(const char* host, uint16_t port, uint32_t timeoutMs) {
+  for (HalSocket i = 0; i < HAL_MAX_SOCKETS; i++) {
+    if (socketInUse[i]) {
+      continue;
+    }
+
+    WiFiClient& client = sockets[i];
+    client.setTimeout(timeoutMs);
+    client.setNoDelay(true);
+    if (!client.connect(host, port)) {
+      client.stop();
+      return HAL_INVALID_SOCKET;
+    }
+    // Let lwIP probe an idle connection so a dead peer is noticed
+    client.keepAlive();
+    socketInUse[i] = true;
+    return i;
+  }
+  return HAL_INVALID_SOCKET;
+}
+
+// WiFiClient only lets WiFiServer wrap a ClientContext
+class ConnectedClient : public WiFiClient {
+public:
+  explicit ConnectedClient(ClientContext* context) : WiFiClient(context) {}
+};
+
+static err_t tcpConnected(void* arg, tcp_pcb* pcb, err_t) {
+  HalSocket socket = (HalSocket)(intptr_t)arg;
+  connectingPcbs[socket] = nullptr;
+  connectedContexts[socket] = new (std::nothrow) ClientContext(pcb, nullptr, nullptr);
+  if (connectedContexts[socket] == nullptr) {
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+  return ERR_OK;
+}
+
+// lwIP has already freed the pcb
+static void tcpConnectFailed(void* arg, err_t) {
+  connectingPcbs[(HalSocket)(intptr_t)arg] = nullptr;
+}
+
+HalSocket halTcpConnectStart(const char* host, uint16_t port) {
+  for (HalSocket i = 0; i < HAL_MAX_SOCKETS; i++) {
+    if (socketInUse[i]) {
+      continue;
+    }
+
+    // Only a host name not in the DNS cache waits here
+    IPAddress address;
+    if (!address.fromString(host) && !WiFi.hostByName(host, address)) {
+      return HAL_INVALID_SOCKET;
+    }
+    tcp_pcb* pcb = tcp_new();
+    if (pcb == nullptr) {
+      return HAL_INVALID_SOCKET;
+    }
+    tcp_arg(pcb, (void*)(intptr_t)i);
+    tcp_err(pcb, tcpConnectFailed);
+    if (tcp_connect(pcb, address, port, tcpConnected) != ERR_OK) {
+      tcp_err(pcb, nullptr);
+      tcp_abort(pcb);
+      return HAL_INVALID_SOCKET;
+    }
+    sockets[i] = WiFiClient();
+    connectingPcbs[i] = pcb;
+    socketInUse[i] = true;
+    return i;
+  }
+  return HAL_INVALID_SOCKET;
+}
+
+bool halTcpConnecting(HalSocket socket) {
+  if (connectingPcbs[socket] != nullptr) {
+    return true;
+  }
+  if (connectedContexts[socket] != nullptr) {
+    WiFiClient& client = sockets[socket];
+    client = ConnectedClient(connectedContexts[socket]);
+    connectedContexts[socket] = nullptr;
+    client.setNoDelay(true);
+    client.keepAlive();
+  }
+  return false;
+}
+
+int halTcpWrite(HalSocket socket, const uint8_t* data, size_t length) {
+  return sockets[socket].write(data, length);
+}
+
+int halTcpAvailable(HalSocket socket) {
+  return sockets[socket].available();
+}
+
+int halTcpRead(HalSocket socket, uint8_t* data, size_t length) {
+  return sockets[socket].read(data, length);
+}
+
+bool halTcpConnected(HalSocket socket) {
+  return sockets[socket].connected();
+}
+
+void halTcpClose(HalSocket socket) {
+  tcp_pcb* pcb = connectingPcbs[socket];
+  if (pcb != nullptr) {
+    tcp_err(pcb, nullptr);
+    tcp_abort(pcb);
+    connectingPcbs[socket] = nullptr;
+  }
+  // A context not claimed yet is wrapped first, so stop() frees it
+  halTcpConnecting(socket);
+  sockets[socket].stop();
+  socketInUse[socket] = false;
+}
+
+int halTcpWritable(HalSocket socket) {
+  return sockets[socket].availableForWrite();
+}
+
+int8_t halTcpListen(uint16_t port) {
+  if (listenerCount >= HAL_MAX_LISTENERS) {
+    return -1;
+  }
+  listeners[listenerCount].begin(port);
+  listeners[listenerCount].setNoDelay(true);
+  return listenerCount++;
+}
+
+HalSocket halTcpAccept(int8_t listener) {
+  if (!listeners[listener].hasClient()) {
+    return HAL_INVALID_SOCKET;
+  }
+
+  for (HalSocket i = 0; i < HAL_MAX_SOCKETS; i++) {
+    if (!socketInUse[i]) {
+      sockets[i] = listeners[listener].accept();
+      sockets[i].setNoDelay(true);
+      socketInUse[i] = true;
+      return i;
+    }
+  }
+
+  // Pool exhausted - refuse rather than leave it queued
+  listeners[listener].accept().stop();
+  return HAL_INVALID_SOCKET;
+}
+
+static void udpReceive(void*, udp_pcb*, pbuf* packet, const ip_addr_t*, u16_t) {
+  HalDatagram datagram;
+  datagram.arrivedMicros = micros();
+  datagram.length = pbuf_copy_partial(packet, datagram.data, sizeof(datagram.data), 0);
+  pbuf_free(packet);
+  udpDatagrams.push(datagram);
+  if (udpOnReceive != nullptr) {
+    udpOnReceive();
+  }
+}
+
+bool halUdpListen(const char* group, uint16_t port, HalIsr onReceive) {
+  udpOnReceive = onReceive;
+
+  if (udpPcb == nullptr) {
+    udpPcb = udp_new();
+    if (udpPcb == nullptr) {
+      return false;
+    }
+    if (udp_bind(udpPcb, IP_ADDR_ANY, port) != ERR_OK) {
+      udp_remove(udpPcb);
+      udpPcb = nullptr;
+      return false;
+    }
+    udp_recv(udpPcb, udpReceive, nullptr);
+  }
+
+  if (group == nullptr) {
+    return true;
+  }
+  ip4_addr_t groupAddress;
+  if (!ip4addr_aton(group, &groupAddress)) {
+    return false;
+  }
+  return igmp_joingroup(IP4_ADDR_ANY4, &groupAddress) == ERR_OK;
+}
+
+int halUdpRead(uint8_t* data, size_t size, uint32_t* arrivedMicros) {
+  HalDatagram datagram;
+  if (!udpDatagrams.pop(&datagram)) {
+    return 0;
+  }
+  size_t length = datagram.length < size ? datagram.length : size;
+  memcpy(data, datagram.data, length);
+  *arrivedMicros = datagram.arrivedMicros;
+  return length;
+}
+
+bool halUdpSend(const char* host, uint16_t port, const uint8_t* data, size_t length) {
+  ip_addr_t address;
+  if (udpPcb == nullptr || !ipaddr_aton(host, &address)) {
+    return false;
+  }
+  pbuf* packet = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+  if (packet == nullptr) {
+    return false;
+  }
+  memcpy(packet->payload, data, length);
+  err_t result = udp_sendto(udpPcb, packet, &address, port);
+  pbuf_free(packet);
+  return result == ERR_OK;
+}
+
+#endif
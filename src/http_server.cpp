@@ -0,0 +1,594 @@
+#include "http_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "hal.h"
+#include "log.h"
+#include "scheduler.h"
+
+#define HTTP_READ_CHUNK 64
+#define HTTP_CHUNK_PREFIX 8   // Hex length and CRLF ahead of each chunk
+#define HTTP_PIPELINE_BURST 4  // Requests answered per client per pass
+
+enum HttpClientState : uint8_t {
+  HTTP_CLIENT_FREE,
+  HTTP_CLIENT_REQUEST_LINE,
+  HTTP_CLIENT_HEADERS,
+  HTTP_CLIENT_BODY,
+  HTTP_CLIENT_READY,       // Parsed, waiting for the response buffer
+  HTTP_CLIENT_RESPONDING   // Owns the response buffer until it is written
+};
+
+struct HttpRoute {
+  uint8_t method;
+  const char* path;
+  HttpHandler handler;
+};
+
+struct HttpClient {
+  uint8_t state;
+  HalSocket socket;
+  uint32_t activityMs;      // Accepted, request started or response done
+  uint32_t served;
+  bool keepAlive;
+  bool waitedForBuffer;
+  uint16_t errorStatus;     // Answered by the server itself, then closed
+
+  // Bytes read but not parsed yet - pipelined requests wait here
+  uint8_t input[HTTP_INPUT_MAX];
+  uint8_t inputLength;
+
+  char line[HTTP_LINE_MAX];
+  uint8_t lineLength;
+  bool lineTruncated;
+
+  uint8_t method;
+  char path[HTTP_PATH_MAX];
+  char body[HTTP_BODY_MAX + 1];
+  uint16_t bodyLength;
+  uint16_t contentLength;
+};
+
+static HttpRoute routes[HTTP_MAX_ROUTES];
+static uint8_t routeCount = 0;
+static HttpClient clients[HTTP_MAX_CLIENTS];
+static uint8_t nextClient = 0;   // Round robin start, for fair turns at the buffer
+static int8_t httpListener = -1;
+static HttpServerStats stats = {};
+
+// Shared response buffer, owned by one client from dispatch until written
+static char response[HTTP_RESPONSE_MAX];
+static HttpClient* responder = nullptr;
+static size_t responseStart = 0;
+static size_t responseEnd = 0;
+static uint32_t responseStartedMs = 0;
+
+// The request a handler is answering
+static HttpClient* current = nullptr;
+static bool responded = false;
+static bool streaming = false;
+static bool streamFailed = false;
+static size_t streamLength = 0;
+
+static const char* statusText(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 500: return "Internal Server Error";
+    default: return "";
+  }
+}
+
+static int formatHeader(char* out, size_t size, int status, const char* contentType, long contentLength,
+                        bool keepAlive) {
+  char length[40];
+  if (contentLength < 0) {
+    strcpy(length, "Transfer-Encoding: chunked");
+  } else {
+    snprintf(length, sizeof(length), "Content-Length: %ld", contentLength);
+  }
+  int written = snprintf(out, size,
+                         "HTTP/1.1 %d %s\r\n"
+                         "Content-Type: %s\r\n"
+                         "%s\r\n"
+                         "Connection: %s\r\n"
+                         "\r\n",
+                         status, statusText(status), contentType, length, keepAlive ? "keep-alive" : "close");
+  return (written < 0 || (size_t)written >= size) ? -1 : written;
+}
+
+static void resetRequest(HttpClient* client) {
+  client->state = HTTP_CLIENT_REQUEST_LINE;
+  client->lineLength = 0;
+  client->lineTruncated = false;
+  client->waitedForBuffer = false;
+  client->errorStatus = 0;
+  client->bodyLength = 0;
+  client->contentLength = 0;
+}
+
+static void freeClient(HttpClient* client) {
+  halTcpClose(client->socket);
+  if (responder == client) {
+    responder = nullptr;
+  }
+  client->state = HTTP_CLIENT_FREE;
+  stats.clients--;
+}
+
+// Stops parsing - the rest of the connection is not trusted after an error
+static void failRequest(HttpClient* client, uint16_t status) {
+  client->errorStatus = status;
+  client->keepAlive = false;
+  client->state = HTTP_CLIENT_READY;
+}
+
+// "POST /scoreMade HTTP/1.1"
+static void parseRequestLine(HttpClient* client) {
+  char* method = client->line;
+  char* target = strchr(method, ' ');
+  char* version = target != nullptr ? strchr(target + 1, ' ') : nullptr;
+  if (version == nullptr || strncmp(version + 1, "HTTP/1.", 7) != 0) {
+    failRequest(client, client->lineTruncated ? 414 : 400);
+    return;
+  }
+  *target++ = '\0';
+  *version++ = '\0';
+  if (strlen(target) >= HTTP_PATH_MAX) {
+    failRequest(client, 414);
+    return;
+  }
+
+  client->method = strcmp(method, "GET") == 0    ? HTTP_METHOD_GET
+                   : strcmp(method, "POST") == 0 ? HTTP_METHOD_POST
+                                                 : HTTP_METHOD_OTHER;
+  strcpy(client->path, target);
+  // HTTP/1.1 keeps the connection unless told otherwise, 1.0 closes it
+  client->keepAlive = version[7] == '1';
+  client->state = HTTP_CLIENT_HEADERS;
+}
+
+static void parseHeaderLine(HttpClient* client) {
+  const char* line = client->line;
+  if (strncasecmp(line, "Content-Length:", 15) == 0) {
+    long length = strtol(line + 15, nullptr, 10);
+    if (length < 0 || length > HTTP_BODY_MAX) {
+      failRequest(client, 413);
+      return;
+    }
+    client->contentLength = length;
+  } else if (strncasecmp(line, "Connection:", 11) == 0) {
+    const char* value = line + 11;
+    while (*value == ' ') {
+      value++;
+    }
+    if (strncasecmp(value, "close", 5) == 0) {
+      client->keepAlive = false;
+    } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+      client->keepAlive = true;
+    }
+  } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+    // Nothing the device is sent needs a chunked body
+    failRequest(client, 400);
+  }
+}
+
+static void endHeaders(HttpClient* client) {
+  if (client->contentLength == 0) {
+    client->body[0] = '\0';
+    client->state = HTTP_CLIENT_READY;
+  } else {
+    client->state = HTTP_CLIENT_BODY;
+  }
+}
+
+static void parseByte(HttpClient* client, char c) {
+  if (client->state == HTTP_CLIENT_BODY) {
+    client->body[client->bodyLength++] = c;
+    if (client->bodyLength == client->contentLength) {
+      client->body[client->bodyLength] = '\0';
+      client->state = HTTP_CLIENT_READY;
+    }
+    return;
+  }
+
+  if (c != '\n') {
+    if (c == '\r') {
+      return;
+    }
+    if (client->lineLength < HTTP_LINE_MAX - 1) {
+      client->line[client->lineLength++] = c;
+    } else {
+      client->lineTruncated = true;
+    }
+    return;
+  }
+
+  client->line[client->lineLength] = '\0';
+  if (client->state == HTTP_CLIENT_REQUEST_LINE) {
+    // Stray blank lines between requests are allowed
+    if (client->lineLength > 0) {
+      parseRequestLine(client);
+    }
+  } else if (client->lineLength == 0) {
+    endHeaders(client);
+  } else {
+    parseHeaderLine(client);
+  }
+  client->lineLength = 0;
+  client->lineTruncated = false;
+}
+
+// Parses buffered input up to the end of one request
+static void consumeInput(HttpClient* client) {
+  uint8_t used = 0;
+  while (used < client->inputLength && client->state >= HTTP_CLIENT_REQUEST_LINE &&
+         client->state <= HTTP_CLIENT_BODY) {
+    if (client->state == HTTP_CLIENT_REQUEST_LINE && client->lineLength == 0) {
+      client->activityMs = halMillis();
+    }
+    parseByte(client, client->input[used++]);
+  }
+  memmove(client->input, client->input + used, client->inputLength - used);
+  client->inputLength -= used;
+}
+
+// Writes everything or gives up after HTTP_SEND_TIMEOUT_MS. Only used for
+// streamed pages.
+static bool writeAll(HalSocket socket, const char* data, size_t length) {
+  uint32_t start = halMillis();
+  while (length > 0) {
+    int writable = halTcpWritable(socket);
+    if (writable <= 0) {
+      if (!halTcpConnected(socket) || halMillis() - start > HTTP_SEND_TIMEOUT_MS) {
+        return false;
+      }
+      halDelay(1);
+      continue;
+    }
+    int written = halTcpWrite(socket, (const uint8_t*)data, length < (size_t)writable ? length : writable);
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+static void finishResponse(HttpClient* client) {
+  responder = nullptr;
+  client->served++;
+  client->activityMs = halMillis();
+  if (!client->keepAlive) {
+    freeClient(client);
+    return;
+  }
+
+  bool waiting = client->inputLength > 0 || halTcpAvailable(client->socket) > 0;
+  if (waiting) {
+    stats.pipelined++;
+  }
+  resetRequest(client);
+  consumeInput(client);
+}
+
+// Writes as much of the buffered response as the socket takes right now
+static void flushResponse(HttpClient* client) {
+  while (responseStart < responseEnd) {
+    int writable = halTcpWritable(client->socket);
+    if (writable <= 0) {
+      return;
+    }
+    size_t chunk = responseEnd - responseStart;
+    if (chunk > (size_t)writable) {
+      chunk = writable;
+    }
+    int written = halTcpWrite(client->socket, (const uint8_t*)response + responseStart, chunk);
+    if (written <= 0) {
+      return;
+    }
+    responseStart += written;
+  }
+  finishResponse(client);
+}
+
+static void sendError(int status) {
+  char body[48];
+  snprintf(body, sizeof(body), "{\"error\":\"%s\"}", statusText(status));
+  httpSend(status, "application/json", body);
+  stats.errors++;
+}
+
+void httpSend(int status, const char* contentType, const char* body) {
+  if (current == nullptr || responded) {
+    return;
+  }
+  responded = true;
+
+  char* bodyStart = response + HTTP_HEADER_RESERVE;
+  size_t length = strlen(body);
+  if (length > HTTP_RESPONSE_MAX - HTTP_HEADER_RESERVE) {
+    LOG_ERROR(LOG_CAT_HTTP, "Response of %u bytes doesn't fit", (unsigned)length);
+    status = 500;
+    contentType = "application/json";
+    body = "{\"error\":\"response too large\"}";
+    length = strlen(body);
+    stats.errors++;
+  }
+  if (body != bodyStart) {
+    memmove(bodyStart, body, length);
+  }
+
+  // The header goes right in front of the body
+  char header[HTTP_HEADER_RESERVE];
+  int headerLength = formatHeader(header, sizeof(header), status, contentType, length, current->keepAlive);
+  if (headerLength < 0) {
+    headerLength = 0;
+  }
+  responseStart = HTTP_HEADER_RESERVE - headerLength;
+  responseEnd = HTTP_HEADER_RESERVE + length;
+  memcpy(response + responseStart, header, headerLength);
+}
+
+char* httpResponseBuffer(size_t* size) {
+  *size = HTTP_RESPONSE_MAX - HTTP_HEADER_RESERVE;
+  return response + HTTP_HEADER_RESERVE;
+}
+
+// Sends the staged bytes as one chunk
+static void flushStream() {
+  if (streamLength == 0 || streamFailed) {
+    streamLength = 0;
+    return;
+  }
+  char prefix[HTTP_CHUNK_PREFIX + 1];
+  int prefixLength = snprintf(prefix, sizeof(prefix), "%x\r\n", (unsigned)streamLength);
+  char* chunk = response + HTTP_CHUNK_PREFIX - prefixLength;
+  memcpy(chunk, prefix, prefixLength);
+  memcpy(response + HTTP_CHUNK_PREFIX + streamLength, "\r\n", 2);
+  streamFailed = !writeAll(current->socket, chunk, prefixLength + streamLength + 2);
+  streamLength = 0;
+}
+
+void httpBeginStream(int status, const char* contentType) {
+  if (current == nullptr || responded) {
+    return;
+  }
+  responded = true;
+  streaming = true;
+  streamLength = 0;
+
+  char header[HTTP_HEADER_RESERVE];
+  int headerLength = formatHeader(header, sizeof(header), status, contentType, -1, current->keepAlive);
+  streamFailed = headerLength < 0 || !writeAll(current->socket, header, headerLength);
+}
+
+void httpWrite(const char* data, size_t length) {
+  if (current == nullptr || !streaming) {
+    return;
+  }
+  while (length > 0 && !streamFailed) {
+    size_t room = HTTP_STREAM_CHUNK - streamLength;
+    size_t part = length < room ? length : room;
+    memcpy(response + HTTP_CHUNK_PREFIX + streamLength, data, part);
+    streamLength += part;
+    data += part;
+    length -= part;
+    if (streamLength == HTTP_STREAM_CHUNK) {
+      flushStream();
+    }
+  }
+}
+
+static void endStream() {
+  flushStream();
+  if (!streamFailed) {
+    streamFailed = !writeAll(current->socket, "0\r\n\r\n", 5);
+  }
+}
+
+static void dispatch(HttpClient* client) {
+  responder = client;
+  current = client;
+  responded = false;
+  streaming = false;
+  streamFailed = false;
+  stats.requests++;
+  if (client->served > 0) {
+    stats.keepAliveRequests++;
+  }
+
+  if (client->errorStatus != 0) {
+    LOG_WARN(LOG_CAT_HTTP, "Bad request, answering %u", client->errorStatus);
+    sendError(client->errorStatus);
+  } else {
+    HttpRequest request;
+    char* query = strchr(client->path, '?');
+    if (query != nullptr) {
+      *query++ = '\0';
+    }
+    request.method = client->method;
+    request.path = client->path;
+    request.query = query != nullptr ? query : "";
+    request.body = client->body;
+    request.bodyLength = client->bodyLength;
+
+    bool pathFound = false;
+    for (uint8_t i = 0; i < routeCount; i++) {
+      if (strcmp(routes[i].path, request.path) != 0) {
+        continue;
+      }
+      pathFound = true;
+      if (routes[i].method == request.method) {
+        routes[i].handler(request);
+        break;
+      }
+    }
+    LOG_DEBUG(LOG_CAT_HTTP, "%s %s", client->method == HTTP_METHOD_GET ? "GET" : "POST", request.path);
+
+    if (!responded) {
+      sendError(pathFound ? 405 : 404);
+    }
+  }
+  current = nullptr;
+
+  if (streaming) {
+    // Written out while the handler ran
+    endStream();
+    if (streamFailed) {
+      stats.timeouts++;
+      freeClient(client);
+    } else {
+      finishResponse(client);
+    }
+    return;
+  }
+  client->state = HTTP_CLIENT_RESPONDING;
+  responseStartedMs = halMillis();
+  flushResponse(client);
+}
+
+// Returns true when a request was answered and the next may be ready too
+static bool pollClient(HttpClient* client) {
+  // Requests behind a response in flight stay queued in input
+  if (client->state == HTTP_CLIENT_RESPONDING) {
+    flushResponse(client);
+    if (client->state == HTTP_CLIENT_RESPONDING && halMillis() - responseStartedMs > HTTP_SEND_TIMEOUT_MS) {
+      LOG_WARN(LOG_CAT_HTTP, "Client stopped reading its response, dropping it");
+      stats.timeouts++;
+      freeClient(client);
+      return false;
+    }
+    if (client->state == HTTP_CLIENT_RESPONDING || client->state == HTTP_CLIENT_FREE) {
+      return false;
+    }
+  }
+
+  if (client->state != HTTP_CLIENT_READY) {
+    uint8_t data[HTTP_READ_CHUNK];
+    int available;
+    while (client->state != HTTP_CLIENT_READY && client->inputLength < HTTP_INPUT_MAX &&
+           (available = halTcpAvailable(client->socket)) > 0) {
+      size_t room = HTTP_INPUT_MAX - client->inputLength;
+      size_t wanted = (size_t)available < room ? available : room;
+      int length = halTcpRead(client->socket, data, wanted < HTTP_READ_CHUNK ? wanted : HTTP_READ_CHUNK);
+      if (length <= 0) {
+        break;
+      }
+      memcpy(client->input + client->inputLength, data, length);
+      client->inputLength += length;
+      consumeInput(client);
+    }
+  }
+
+  if (client->state == HTTP_CLIENT_READY) {
+    if (responder == nullptr) {
+      dispatch(client);
+      return client->state != HTTP_CLIENT_FREE && client->state != HTTP_CLIENT_RESPONDING;
+    }
+    if (!client->waitedForBuffer) {
+      client->waitedForBuffer = true;
+      stats.bufferWaits++;
+    }
+    return false;
+  }
+
+  bool idle = client->state == HTTP_CLIENT_REQUEST_LINE && client->lineLength == 0;
+  uint32_t limit = idle ? HTTP_KEEPALIVE_TIMEOUT_MS : HTTP_REQUEST_TIMEOUT_MS;
+  if (halMillis() - client->activityMs > limit) {
+    if (!idle) {
+      LOG_WARN(LOG_CAT_HTTP, "Request timed out");
+      stats.timeouts++;
+    }
+    freeClient(client);
+    return false;
+  }
+  if (!halTcpConnected(client->socket)) {
+    freeClient(client);
+  }
+  return false;
+}
+
+// Pipelined requests are answered back to back, a few per pass so one
+// client can't hold up the others
+static void serviceClient(HttpClient* client) {
+  for (uint8_t i = 0; i < HTTP_PIPELINE_BURST && pollClient(client); i++) {
+  }
+}
+
+// Connections beyond HTTP_MAX_CLIENTS wait in the listen backlog
+static void acceptClients() {
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) {
+    HttpClient* client = &clients[i];
+    if (client->state != HTTP_CLIENT_FREE) {
+      continue;
+    }
+    HalSocket socket = halTcpAccept(httpListener);
+    if (socket == HAL_INVALID_SOCKET) {
+      return;
+    }
+
+    memset(client, 0, sizeof(*client));
+    client->socket = socket;
+    client->activityMs = halMillis();
+    resetRequest(client);
+    stats.connections++;
+    stats.clients++;
+    if (stats.clients > stats.maxClients) {
+      stats.maxClients = stats.clients;
+    }
+  }
+}
+
+static uint32_t runHttpTask() {
+  acceptClients();
+
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) {
+    HttpClient* client = &clients[(nextClient + i) % HTTP_MAX_CLIENTS];
+    if (client->state != HTTP_CLIENT_FREE) {
+      serviceClient(client);
+    }
+  }
+  nextClient = (nextClient + 1) % HTTP_MAX_CLIENTS;
+
+  // Come back soon for responses in flight and requests left after a burst
+  bool busy = false;
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS && !busy; i++) {
+    const HttpClient& client = clients[i];
+    busy = client.state == HTTP_CLIENT_READY || client.state == HTTP_CLIENT_RESPONDING ||
+           (client.state != HTTP_CLIENT_FREE && (client.inputLength > 0 || halTcpAvailable(client.socket) > 0));
+  }
+  if (busy) {
+    return HTTP_FLUSH_POLL_MS;
+  }
+  return stats.clients > 0 ? HTTP_CLIENT_POLL_MS : HTTP_IDLE_POLL_MS;
+}
+
+bool setupHttpServer(uint16_t port) {
+  httpListener = halTcpListen(port);
+  if (httpListener < 0) {
+    LOG_ERROR(LOG_CAT_HTTP, "HTTP listener failed");
+    return false;
+  }
+  schedulerAddTask("http", runHttpTask);
+  LOG_INFO(LOG_CAT_HTTP, "HTTP server started on port %u", port);
+  return true;
+}
+
+void httpOn(HttpMethod method, const char* path, HttpHandler handler) {
+  if (routeCount >= HTTP_MAX_ROUTES) {
+    LOG_ERROR(LOG_CAT_HTTP, "No room for route %s", path);
+    return;
+  }
+  routes[routeCount++] = {method, path, handler};
+}
+
+const HttpServerStats& httpServerStats() {
+  return stats;
+}
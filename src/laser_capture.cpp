@@ -0,0 +1,30 @@
+#include "laser_capture.h"
+#include "spsc_ring.h"
+#include "hal.h"
+
+static uint8_t laserPin;
+static HalIsr laserOnEdge = nullptr;
+static SpscRing<LaserEdge, LASER_EDGE_BUFFER_SIZE> laserEdges;
+
+static void IRAM_ATTR laserEdgeISR() {
+  LaserEdge edge;
+  edge.broken = !halPinEdge(laserPin, &edge.timestamp); // Inverted for break beam
+  laserEdges.push(edge);
+  if (laserOnEdge != nullptr) {
+    laserOnEdge();
+  }
+}
+
+void setupLaserCapture(uint8_t pin, HalIsr onEdge) {
+  laserPin = pin;
+  laserOnEdge = onEdge;
+  halAttachInterrupt(pin, laserEdgeISR, CHANGE);
+}
+
+bool popLaserEdge(LaserEdge* edge) {
+  return laserEdges.pop(edge);
+}
+
+uint32_t laserEdgeOverflows() {
+  return laserEdges.overflows();
+}
@@ -0,0 +1,134 @@
+#include "led_animation.h"
+#include "hal.h"
+#include "scheduler.h"
+
+#define LED_OUTPUT_UNSET 0xFFFFFFFFUL
+
+struct LedLayer {
+  const LedAnimation* animation;  // nullptr when the slot is empty
+  uint32_t startMs;
+};
+
+static LedLayer layers[LED_CHANNEL_COUNT][LED_PRIORITY_COUNT];
+static LedOutput channelOutputs[LED_CHANNEL_COUNT];
+static uint32_t lastOutput[LED_CHANNEL_COUNT];  // Packed RGB last written
+static int8_t animationTask = -1;
+static uint8_t ledBrightness = 255;
+
+// Rounds up, so a color that is on stays on above brightness 0
+static uint8_t dim(uint8_t value) {
+  return ((uint32_t)value * ledBrightness + 254) / 255;
+}
+
+static uint8_t blend(uint8_t from, uint8_t to, uint32_t position, uint32_t duration) {
+  return from + ((int32_t)to - from) * (int32_t)position / (int32_t)duration;
+}
+
+// Color of an animation at elapsed ms, and how long until it next changes
+static uint32_t sampleAnimation(const LedAnimation& animation, uint32_t elapsed, uint32_t* untilChange) {
+  const LedKeyframe* frames = animation.frames;
+  if (animation.totalMs == 0) {
+    *untilChange = SCHEDULER_IDLE;
+    return ((uint32_t)frames[0].red << 16) | ((uint32_t)frames[0].green << 8) | frames[0].blue;
+  }
+
+  uint32_t position = elapsed % animation.totalMs;
+  uint32_t frameStart = 0;
+  uint8_t i = 0;
+  while (i < animation.count - 1 && position >= frameStart + frames[i].durationMs) {
+    frameStart += frames[i].durationMs;
+    i++;
+  }
+
+  const LedKeyframe& frame = frames[i];
+  uint32_t intoFrame = position - frameStart;
+  *untilChange = frame.durationMs - intoFrame;
+
+  uint8_t red = frame.red;
+  uint8_t green = frame.green;
+  uint8_t blue = frame.blue;
+  if (frame.easing == LED_EASE_LINEAR && frame.durationMs > 0) {
+    const LedKeyframe& previous = frames[i == 0 ? animation.count - 1 : i - 1];
+    red = blend(previous.red, frame.red, intoFrame, frame.durationMs);
+    green = blend(previous.green, frame.green, intoFrame, frame.durationMs);
+    blue = blend(previous.blue, frame.blue, intoFrame, frame.durationMs);
+    if (*untilChange > LED_ANIMATION_FRAME_MS) {
+      *untilChange = LED_ANIMATION_FRAME_MS;
+    }
+  }
+  return ((uint32_t)red << 16) | ((uint32_t)green << 8) | blue;
+}
+
+// Drives every channel from its highest active layer, returns ms until the
+// next keyframe change
+static uint32_t runAnimationTask() {
+  uint32_t now = halMillis();
+  uint32_t next = SCHEDULER_IDLE;
+
+  for (uint8_t channel = 0; channel < LED_CHANNEL_COUNT; channel++) {
+    uint32_t color = 0;  // Off when nothing is playing
+
+    for (int8_t priority = LED_PRIORITY_COUNT - 1; priority >= 0; priority--) {
+      LedLayer& layer = layers[channel][priority];
+      if (layer.animation == nullptr) {
+        continue;
+      }
+
+      uint32_t elapsed = now - layer.startMs;
+      const LedAnimation& animation = *layer.animation;
+      if (animation.repeats != LED_REPEAT_FOREVER && elapsed >= animation.totalMs * animation.repeats) {
+        layer.animation = nullptr;
+        continue;
+      }
+
+      uint32_t untilChange;
+      color = sampleAnimation(animation, elapsed, &untilChange);
+      if (untilChange < next) {
+        next = untilChange;
+      }
+      break;
+    }
+
+    if (color != lastOutput[channel] && channelOutputs[channel] != nullptr) {
+      channelOutputs[channel](dim(color >> 16), dim((color >> 8) & 0xFF), dim(color & 0xFF));
+      lastOutput[channel] = color;
+    }
+  }
+
+  return next;
+}
+
+void setupLedAnimations(const LedOutput outputs[LED_CHANNEL_COUNT]) {
+  for (uint8_t channel = 0; channel < LED_CHANNEL_COUNT; channel++) {
+    channelOutputs[channel] = outputs[channel];
+    lastOutput[channel] = LED_OUTPUT_UNSET;
+  }
+  animationTask = schedulerAddTask("leds", runAnimationTask);
+}
+
+void playAnimation(LedChannel channel, LedPriority priority, const LedAnimation& animation) {
+  layers[channel][priority].animation = &animation;
+  layers[channel][priority].startMs = halMillis();
+  schedulerWake(animationTask);
+}
+
+void stopAnimation(LedChannel channel, LedPriority priority) {
+  layers[channel][priority].animation = nullptr;
+  schedulerWake(animationTask);
+}
+
+bool animationActive(LedChannel channel, LedPriority priority) {
+  return layers[channel][priority].animation != nullptr;
+}
+
+void setLedBrightness(uint8_t brightness) {
+  if (brightness == ledBrightness) {
+    return;
+  }
+  ledBrightness = brightness;
+  // Every channel is rewritten at the new brightness
+  for (uint8_t channel = 0; channel < LED_CHANNEL_COUNT; channel++) {
+    lastOutput[channel] = LED_OUTPUT_UNSET;
+  }
+  schedulerWake(animationTask);
+}
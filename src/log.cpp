@@ -0,0 +1,119 @@
+#include "log.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "scheduler.h"
+
+static_assert((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) == 0, "LOG_BUFFER_SIZE must be a power of two");
+
+// Ring positions count every byte ever written, so they wrap together and
+// the buffer index is just the low bits. Lines always end in '\n' and both
+// readers only ever stop on a line boundary.
+static char buffer[LOG_BUFFER_SIZE];
+static uint32_t written = 0;
+static uint32_t oldest = 0;    // First line still held, for GET /log
+static uint32_t drained = 0;   // First byte not yet handed to the UART
+
+static int8_t logTask = -1;
+static LogStats stats = {};
+
+static const char levelLetters[] = {'-', 'E', 'W', 'I', 'D'};
+static const char* const categoryNames[] = {"system", "wifi", "http", "net", "game", "button", "laser", "stream"};
+
+static const char* categoryName(uint8_t category) {
+  for (uint8_t bit = 0; bit < 8; bit++) {
+    if (category & (1 << bit)) {
+      return categoryNames[bit];
+    }
+  }
+  return "";
+}
+
+// Position just past the line that starts at position
+static uint32_t nextLine(uint32_t position) {
+  while (position != written && buffer[position % LOG_BUFFER_SIZE] != '\n') {
+    position++;
+  }
+  return position != written ? position + 1 : position;
+}
+
+// Drops whole lines from the front until length more bytes fit
+static void makeRoom(uint32_t length) {
+  while (written + length - oldest > LOG_BUFFER_SIZE) {
+    oldest = nextLine(oldest);
+  }
+  while (written + length - drained > LOG_BUFFER_SIZE) {
+    drained = nextLine(drained);
+    stats.droppedLines++;
+  }
+}
+
+static uint32_t runLogTask() {
+  int room = halConsoleWritable();
+  while (drained != written && room > 0) {
+    uint32_t offset = drained % LOG_BUFFER_SIZE;
+    uint32_t length = written - drained;
+    if (length > LOG_BUFFER_SIZE - offset) {
+      length = LOG_BUFFER_SIZE - offset;
+    }
+    if (length > (uint32_t)room) {
+      length = room;
+    }
+    halConsoleWrite(buffer + offset, length);
+    drained += length;
+    room -= length;
+  }
+  return drained != written ? LOG_DRAIN_MS : SCHEDULER_IDLE;
+}
+
+void setupLog() {
+  logTask = schedulerAddTask("log", runLogTask);
+}
+
+void logWrite(uint8_t level, uint8_t category, const char* format, ...) {
+  char line[LOG_LINE_MAX];
+  uint32_t now = halMillis();
+  int length = snprintf(line, sizeof(line), "%u.%03u %c %s: ", (unsigned)(now / 1000), (unsigned)(now % 1000),
+                        levelLetters[level < sizeof(levelLetters) ? level : 0], categoryName(category));
+
+  va_list args;
+  va_start(args, format);
+  int message = vsnprintf(line + length, sizeof(line) - length, format, args);
+  va_end(args);
+  if (message > 0) {
+    length += message;
+  }
+  // Keep room for the newline when the message was cut short
+  if ((size_t)length > sizeof(line) - 2) {
+    length = sizeof(line) - 2;
+  }
+  line[length++] = '\n';
+
+  makeRoom(length);
+  uint32_t offset = written % LOG_BUFFER_SIZE;
+  uint32_t first = LOG_BUFFER_SIZE - offset < (uint32_t)length ? LOG_BUFFER_SIZE - offset : length;
+  memcpy(buffer + offset, line, first);
+  memcpy(buffer, line + first, length - first);
+  written += length;
+  stats.lines++;
+
+  schedulerWake(logTask);
+}
+
+const LogStats& logStats() {
+  return stats;
+}
+
+void writeLog(LogSink sink) {
+  uint32_t start = oldest % LOG_BUFFER_SIZE;
+  uint32_t length = written - oldest;
+  if (length > LOG_BUFFER_SIZE - start) {
+    sink(buffer + start, LOG_BUFFER_SIZE - start);
+    length -= LOG_BUFFER_SIZE - start;
+    start = 0;
+  }
+  if (length > 0) {
+    sink(buffer + start, length);
+  }
+}
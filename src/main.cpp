@@ -1,725 +1,729 @@
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
-#include <ESP8266WebServer.h>
-#include <ArduinoJson.h>
-#include <WiFiClient.h>
-
-// Pin definitions
-#define LASER_BREAK_PIN 14
-#define BUTTON_UP_PIN 5
-#define BUTTON_DOWN_PIN 4
-#define BUTTON_QUANTUM_PIN 0
-#define LED_ACTIVITY_PIN 16
-#define LED_BUILTIN_PIN 2  // Built-in blue LED for network activity
-
-// RGB LED pins for status indication
-#define RGB_RED_PIN 15
-#define RGB_GREEN_PIN 12
-#define RGB_BLUE_PIN 13
-
-// Timing constants
-#define BUTTON_DEBOUNCE_MS 500
-#define LASER_COOLDOWN_MS 2000
-#define WIFI_RETRY_DELAY_MS 5000
-#define LED_BLINK_INTERVAL_MS 250
-#define OWN_GOAL_BLINK_INTERVAL_MS 250
-
-// WiFi credentials - UPDATE THESE
-const char* ssid = "Foosball_Table";  // Replace with your Pi's AP SSID
-const char* password = "ilovefoosball";  // Replace with your Pi's AP password
-
-// API configuration
-const char* baseUrl = "http://192.168.4.1:3000";  // Replace with Pi's IP
-// String playerColor = "red";
-String playerColor = "blue";
-
-String opponentColor = (playerColor == "red") ? "blue" : "red";
+#include "game.h"
+#include "hal.h"
+#include "http_server.h"
+#include "outbound.h"
+#include "event_journal.h"
+#include "json_writer.h"
+#include "payloads.h"
+#include "wire_protocol.h"
+#include "clock_sync.h"
+#include "goal_trace.h"
+#include "scheduler.h"
+#include "score_broadcast.h"
+#include "event_stream.h"
+#include "goal_detector.h"
+#include "metrics.h"
+#include "ota_update.h"
+#include "power_state.h"
+#include "log.h"
+#include "device_config.h"
+
+#define WIFI_FAST_TIMEOUT_MS 2000      // Directed association on the cached lease
+#define WIFI_CONNECT_TIMEOUT_MS 10000  // Full scan, association and DHCP
+#define WIFI_BACKOFF_MIN_MS 500        // Doubles after every failed full attempt
+#define WIFI_BACKOFF_MAX_MS 30000
+#define TEST_SCORE_DELAY_MS 5000     // After the first connection
+#define WIFI_CHECK_MS 250         // Link check while connected
+#define WIFI_RECONNECT_POLL_MS 100  // Blink and retry cadence while down
+
+// Last good AP and DHCP lease. RTC memory survives a reset, flash survives
+// a power cut. RTC blocks below 64 are left to the OTA boot loader.
+#define WIFI_CACHE_FILE "/wifi_cache.bin"
+#define WIFI_CACHE_MAGIC 0x31435746UL  // "FWC1"
+#define WIFI_CACHE_RTC_BLOCK 64
+
+#define CONFIG_BODY_MAX 320
+
+// Lets the POST /config response go out before rebooting into a new config
+#define CONFIG_RESTART_DELAY_MS 500
+
+// Recent goals listed in /status, the rest of the match history is left out
+// to keep the page inside HTTP_RESPONSE_MAX
+#define STATUS_GOALS_MAX 8
 
 // Global objects
-ESP8266WebServer server(80);
-WiFiClient wifiClient;
-HTTPClient httpClient;
-
-// State variables
-struct ButtonState {
-  bool currentState;
-  bool lastState;
-  unsigned long lastDebounceTime;
-  bool pressed;
+int8_t restartTask = -1;
+bool restartPending = false;
+
+struct WiFiCache {
+  uint32_t magic;
+  uint32_t credentials;  // Hash of the SSID and password it was learned with
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t checksum;     // RTC memory holds garbage after power-up
 };
 
-ButtonState buttonUp = {false, false, 0, false};
-ButtonState buttonDown = {false, false, 0, false};
-ButtonState buttonQuantum = {false, false, 0, false};
-
-bool lastLaserState = false;
-unsigned long lastLaserBreakTime = 0;
-bool quantumMode = false;
+enum WiFiAttempt : uint8_t {
+  WIFI_ATTEMPT_NONE,   // Backing off until nextWifiAttempt
+  WIFI_ATTEMPT_FAST,   // Cached BSSID, channel and lease, no scan or DHCP
+  WIFI_ATTEMPT_FULL
+};
 
-// LED state variables
-bool ledActivityState = false;
-unsigned long lastLedBlinkTime = 0;
-bool ownGoalBlinking = false;
-unsigned long ownGoalBlinkStartTime = 0;
-bool goalFlashing = false;
-unsigned long goalFlashStartTime = 0;
+struct WiFiLinkStats {
+  uint32_t bootToReadyMs;    // 0 until the first connection
+  uint32_t lastReconnectMs;  // Link lost to ready again
+  uint32_t fastConnects;
+  uint32_t fullConnects;
+  uint32_t failedAttempts;
+};
 
 // WiFi state
-bool wifiConnected = false;
-unsigned long lastWifiRetry = 0;
-bool connectingBlinkState = false;
-unsigned long lastConnectingBlink = 0;
-
-// Network activity LED state
-unsigned long networkActivityTime = 0;
-bool networkActivityLED = false;
+unsigned long wifiConnectedTime = 0;
+unsigned long wifiLostTime = 0;
+bool testScorePending = false;
+
+WiFiCache wifiCache;
+bool wifiCacheValid = false;
+uint8_t wifiAttempt = WIFI_ATTEMPT_NONE;
+unsigned long wifiAttemptStart = 0;
+unsigned long nextWifiAttempt = 0;
+uint8_t wifiFailures = 0;   // Full attempts failed in a row
+WiFiLinkStats wifiLinkStats = {};
 
 // Function declarations
 void setupWiFi();
 void setupServer();
 void handleWiFi();
-void updateButtons();
-void updateButton(ButtonState* button, int pin);
-void handleLaserBreak();
-void handleButtonActions();
-void updateLEDs();
-void triggerOwnGoalBlink();
-void triggerGoalFlash();
-void sendGoalAPI();
-void sendAddPointAPI(int amount);
-void sendResetAPI();
-void setRGBColor(int red, int green, int blue);
-void setStatusColor(String status);
-void flashNetworkActivity();
-void updateNetworkActivityLED();
-void startupBlink();
+bool loadWiFiCache();
+void startWiFiAttempt();
 void sendTestOpponentScore();
 
+uint32_t runWiFiTask() {
+  handleWiFi();
+  if (wifiConnected) {
+    return WIFI_CHECK_MS;
+  }
+  if (wifiAttempt == WIFI_ATTEMPT_NONE) {
+    long wait = (long)(nextWifiAttempt - millis());
+    return wait > 0 ? wait : 0;
+  }
+  return WIFI_RECONNECT_POLL_MS;
+}
+
+// Woken by POST /config once its response has had time to go out
+uint32_t runRestartTask() {
+  if (restartPending) {
+    ESP.restart();
+  }
+  return SCHEDULER_IDLE;
+}
+
 void setup() {
   Serial.begin(115200);
-  Serial.println("FoosHack ESP8266 Starting...");
+  setupLog();
+  LOG_INFO(LOG_CAT_SYSTEM, "FoosHack ESP8266 Starting...");
+
+  // Table, side, WiFi and the Pi's address all come from flash
+  const DeviceConfig& config = deviceConfig();
+  if (!loadDeviceConfig()) {
+    LOG_WARN(LOG_CAT_SYSTEM, "No device config stored, using defaults");
+  }
+  LOG_INFO(LOG_CAT_SYSTEM, "Table %u, %s side, server %s:%u", config.tableId, scorePlayerName(config.side),
+           config.serverHost, config.serverPort);
+
+  // Before anything else can crash, so a new image on trial counts its boots
+  setupOta(config.serverHost, config.serverPort);
 
   // Show startup status - Purple
-  setStatusColor("startup");
-
-  // Initialize pins
-  pinMode(LASER_BREAK_PIN, INPUT_PULLUP);
-  pinMode(BUTTON_UP_PIN, INPUT_PULLUP);
-  pinMode(BUTTON_DOWN_PIN, INPUT_PULLUP);
-  pinMode(BUTTON_QUANTUM_PIN, INPUT_PULLUP);
-  pinMode(LED_ACTIVITY_PIN, OUTPUT);
-  pinMode(LED_BUILTIN_PIN, OUTPUT);
-
-  // Initialize RGB LED pins
-  pinMode(RGB_RED_PIN, OUTPUT);
-  pinMode(RGB_GREEN_PIN, OUTPUT);
-  pinMode(RGB_BLUE_PIN, OUTPUT);
-
-  // Initialize LEDs (off)
-  digitalWrite(LED_ACTIVITY_PIN, LOW);
-  digitalWrite(LED_BUILTIN_PIN, HIGH); // Built-in LED off (inverted logic)
-  setRGBColor(0, 0, 0); // Turn off RGB LED
+  setStatusColor(STATUS_STARTUP);
+
+  // WiFi runs ahead of the game tasks, as in the old loop
+  schedulerAddTask("wifi", runWiFiTask);
+  restartTask = schedulerAddTask("restart", runRestartTask);
+
+  // Initialize pins, laser capture, LEDs and the game tasks
+  setupGame();
 
   // Startup blink sequence - 3 blinks to confirm boot
-  Serial.println("Performing startup blink sequence...");
   startupBlink();
 
-  // Show connecting status - Yellow
-  setStatusColor("connecting");
+  // Show connecting status - Blinking yellow until handleWiFi() sees the link
+  setStatusColor(STATUS_CONNECTING);
+
+  // Initialize outbound request queue and the offline event journal
+  setupOutbound(config.serverHost, config.serverPort);
+  setClockServer(config.serverHost);
+  setupJournal(scorePlayerName(playerSide), scorePlayerName(opponentSide), config.tableId);
 
   // Initialize WiFi
   setupWiFi();
 
-  // Setup HTTP server endpoints
+  // Setup HTTP server endpoints, and the WebSocket event stream beside it
   setupServer();
+  setupEventStream();
 
-  // Show ready status - Player color
-  setStatusColor("ready");
-
-  Serial.println("Setup complete!");
+  LOG_INFO(LOG_CAT_SYSTEM, "Setup complete!");
 }
 
 void loop() {
-  // Handle WiFi connection
-  handleWiFi();
-
-  // Handle HTTP server
-  server.handleClient();
-
-  // Read and debounce buttons
-  updateButtons();
-
-  // Handle laser break detection
-  handleLaserBreak();
-
-  // Handle button actions
-  handleButtonActions();
-
-  // Update LED states
-  updateLEDs();
-
-  // Update network activity LED
-  updateNetworkActivityLED();
-
-  // Small delay to prevent overwhelming the loop
-  delay(10);
+  // Run whatever is signaled or due, then sleep until the next deadline or
+  // until a laser/button interrupt wakes us
+  halSleep(schedulerRun());
 }
 
 void setupWiFi() {
+  const DeviceConfig& config = deviceConfig();
+  char hostname[32];
+  snprintf(hostname, sizeof(hostname), "fooshack-%u-%s", config.tableId, scorePlayerName(config.side));
+
+  // Reconnects are driven from handleWiFi(), and the SDK doesn't need to
+  // rewrite its own flash copy of the credentials on every begin()
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
   WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-  Serial.print("Connecting to WiFi");
-
-  int attempts = 0;
-  bool blinkState = false;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-    // Blink RGB LED yellow and activity LED while connecting
-    if (blinkState) {
-      setRGBColor(255, 255, 0); // Yellow on
-      digitalWrite(LED_ACTIVITY_PIN, HIGH); // Activity LED on
-    } else {
-      setRGBColor(0, 0, 0); // RGB off
-      digitalWrite(LED_ACTIVITY_PIN, LOW); // Activity LED off
-    }
-    blinkState = !blinkState;
+  WiFi.hostname(hostname);
 
-    delay(500);
-    Serial.print(".");
-    attempts++;
-  }
+  wifiCacheValid = loadWiFiCache();
+  startWiFiAttempt();
 
-  // Turn off activity LED after connection attempt
-  digitalWrite(LED_ACTIVITY_PIN, LOW);
-
-  if (WiFi.status() == WL_CONNECTED) {
-    wifiConnected = true;
-    Serial.println();
-    Serial.print("Connected! IP address: ");
-    Serial.println(WiFi.localIP());
-
-    // Wait 5 seconds then send test opponent score
-    Serial.println("Waiting 5 seconds before sending test opponent score...");
-    delay(5000);
-    sendTestOpponentScore();
-  } else {
-    wifiConnected = false;
-    Serial.println();
-    Serial.println("WiFi connection failed!");
-  }
+  // Send a test opponent score once connected
+  testScorePending = true;
 }
 
 void setupServer() {
   // Endpoint to receive opponent score notifications
-  server.on("/scoreMade", HTTP_POST, []() {
-    Serial.println("=== INCOMING API: /scoreMade ===");
-
+  httpOn(HTTP_METHOD_POST, "/scoreMade", [](const HttpRequest& request) {
     // Flash network activity LED for incoming data
     flashNetworkActivity();
 
-    String body = server.arg("plain");
-    Serial.print("Request body: ");
-    Serial.println(body);
-
-    // Parse JSON
-    JsonDocument doc;
-    deserializeJson(doc, body);
-    String scoringPlayer = doc["player"];
-
-    Serial.print("Scoring player: ");
-    Serial.println(scoringPlayer);
-    Serial.print("This device player: ");
-    Serial.println(playerColor);
-
-    // Handle own goal celebration
-    if (scoringPlayer == playerColor) {
-      Serial.println("THIS PLAYER SCORED! Triggering celebration blink sequence");
-      triggerOwnGoalBlink();
-    } else {
-      Serial.println("Opponent scored - no action needed (goal flash already handled by defending side)");
-    }
+    // Parse the player field in place, no copy of the body
+    const char* body = request.body;
+    LOG_DEBUG(LOG_CAT_HTTP, "/scoreMade: %s", body);
 
-    server.send(200, "application/json", "{}");
-    Serial.println("Sent 200 OK response");
-  });
+    char scoringPlayer[PLAYER_NAME_MAX];
+    if (!parsePlayerField(body, scoringPlayer, sizeof(scoringPlayer))) {
+      scoringPlayer[0] = '\0';
+    }
 
-  // Status endpoint
-  server.on("/status", HTTP_GET, []() {
-    Serial.println("=== INCOMING API: /status ===");
+    // Optional "seq" matches the UDP broadcast of the same goal, "boot"
+    // tells a restarted Pi's seqs from old ones
+    uint32_t seq = 0;
+    bool hasSeq = parseUintField(body, "seq", &seq);
+    uint32_t boot = SCORE_BOOT_UNKNOWN;
+    parseUintField(body, "boot", &boot);
+
+    // Optional trace id and the Pi's hop times, see goal_trace.h
+    ScoreMadeTrace trace = {};
+    trace.arrivedMicros = halMicros();
+    if (parseTraceField(body, &trace.id)) {
+      parseUintField(body, "piReceivedUs", &trace.piReceivedUs);
+      parseUintField(body, "piSentUs", &trace.piSentUs);
+    }
+    handleScoreMade(scoringPlayer, hasSeq, seq, boot, trace);
 
-    // Flash network activity LED for incoming data
-    flashNetworkActivity();
+    httpSend(200, "application/json", "{}");
+  });
 
-    JsonDocument doc;
-    doc["player"] = playerColor;
-    doc["wifi"] = wifiConnected;
-    doc["quantumMode"] = quantumMode;
+  // Prometheus scrape target, streamed a chunk at a time
+  httpOn(HTTP_METHOD_GET, "/metrics", [](const HttpRequest&) {
+    httpBeginStream(200, "text/plain; version=0.0.4");
+    writeMetrics(httpWrite);
+  });
 
-    String response;
-    serializeJson(doc, response);
+  // Recent log lines from the RAM ring, oldest first
+  httpOn(HTTP_METHOD_GET, "/log", [](const HttpRequest&) {
+    httpBeginStream(200, "text/plain");
+    writeLog(httpWrite);
+  });
 
-    Serial.print("Sending status response: ");
-    Serial.println(response);
+  // Recent goal traces, one JSON object per line for the trace collector
+  httpOn(HTTP_METHOD_GET, "/traces", [](const HttpRequest&) {
+    httpBeginStream(200, "application/x-ndjson");
+    writeGoalTraces(httpWrite, deviceConfig().tableId, scorePlayerName(playerSide));
+  });
 
-    server.send(200, "application/json", response);
-    Serial.println("Status request completed");
+  // Starts learning the goal detector's thresholds, progress is on /status
+  httpOn(HTTP_METHOD_POST, "/calibrateLaser", [](const HttpRequest&) {
+    LOG_INFO(LOG_CAT_HTTP, "/calibrateLaser");
+    flashNetworkActivity();
+    startLaserCalibration();
+    httpSend(200, "application/json", "{}");
   });
 
-  server.begin();
-  Serial.println("HTTP server started on port 80");
-  Serial.println("Available endpoints:");
-  Serial.println("  POST /scoreMade - Receive opponent score notifications");
-  Serial.println("  GET /status - Device status information");
-}
+  // Firmware update from a file on the Pi, progress is on /status
+  httpOn(HTTP_METHOD_POST, "/ota", [](const HttpRequest& request) {
+    flashNetworkActivity();
+    OtaRequest update;
+    if (!parseOtaRequest(request.body, &update)) {
+      httpSend(400, "application/json", "{\"error\":\"invalid update\"}");
+      return;
+    }
+    if (otaBusy()) {
+      httpSend(409, "application/json", "{\"error\":\"update in progress or on trial\"}");
+      return;
+    }
+    if (!startOtaUpdate(update)) {
+      httpSend(507, "application/json", "{\"error\":\"image does not fit\"}");
+      return;
+    }
+    httpSend(200, "application/json", "{}");
+  });
 
-void handleWiFi() {
-  unsigned long currentTime = millis();
+  // Current device config, without the WiFi password
+  httpOn(HTTP_METHOD_GET, "/config", [](const HttpRequest&) {
+    const DeviceConfig& config = deviceConfig();
+    char response[CONFIG_BODY_MAX];
+    JsonWriter json(response, sizeof(response));
+    json.openObject();
+    json.addUint("table", config.tableId);
+    json.addString("side", scorePlayerName(config.side));
+    json.addString("ssid", config.ssid);
+    json.addString("host", config.serverHost);
+    json.addUint("port", config.serverPort);
+    json.addString("protocol", deviceProtocolName(config.protocol));
+    json.addUint("glitchUs", config.detector.glitchUs);
+    json.addUint("minBreakUs", config.detector.minBreakUs);
+    json.addUint("rearmMs", config.detector.rearmUs / 1000);
+    json.addUint("idleS", config.idleS);
+    json.addUint("sleepS", config.sleepS);
+    json.closeObject();
+    httpSend(200, "application/json", response);
+  });
 
-  if (WiFi.status() != WL_CONNECTED) {
-    if (wifiConnected) {
-      // Just disconnected
-      wifiConnected = false;
-      setStatusColor("disconnected");
+  // Provisioning - updates the fields given and stores the record. Detector
+  // tuning and power timeouts apply at once; anything else reboots into the new config.
+  httpOn(HTTP_METHOD_POST, "/config", [](const HttpRequest& request) {
+    flashNetworkActivity();
+    DeviceConfig config = deviceConfig();
+    if (!parseDeviceConfig(request.body, &config) || !validDeviceConfig(config)) {
+      httpSend(400, "application/json", "{\"error\":\"invalid config\"}");
+      return;
     }
 
-    // Check if we're in reconnection mode
-    if (currentTime - lastWifiRetry < WIFI_RETRY_DELAY_MS) {
-      // Blink yellow while trying to reconnect
-      if (currentTime - lastConnectingBlink > 500) {
-        connectingBlinkState = !connectingBlinkState;
-        if (connectingBlinkState) {
-          setRGBColor(255, 255, 0); // Yellow on
-        } else {
-          setRGBColor(0, 0, 0); // Off
-        }
-        lastConnectingBlink = currentTime;
-      }
-    } else {
-      // Time to retry connection
-      Serial.println("WiFi disconnected, attempting reconnection...");
-      setStatusColor("connecting");
-      WiFi.reconnect();
-      lastWifiRetry = currentTime;
+    DeviceConfigChange change = compareDeviceConfig(deviceConfig(), config);
+    if (change != DEVICE_CONFIG_UNCHANGED && !saveDeviceConfig(config)) {
+      httpSend(500, "application/json", "{\"error\":\"cannot save config\"}");
+      return;
     }
-  } else if (!wifiConnected) {
-    wifiConnected = true;
-    setStatusColor("ready");
-    Serial.println("WiFi reconnected!");
-  }
-}
-
-void updateButtons() {
-  updateButton(&buttonUp, BUTTON_UP_PIN);
-  updateButton(&buttonDown, BUTTON_DOWN_PIN);
-  updateButton(&buttonQuantum, BUTTON_QUANTUM_PIN);
-}
-
-void updateButton(ButtonState* button, int pin) {
-  bool reading = !digitalRead(pin); // Inverted because of pullup
-  unsigned long currentTime = millis();
+    LOG_INFO(LOG_CAT_HTTP, "/config: table %u, %s side, server %s:%u%s", config.tableId,
+             scorePlayerName(config.side), config.serverHost, config.serverPort,
+             change == DEVICE_CONFIG_RESTART ? ", restarting" : "");
+
+    if (change == DEVICE_CONFIG_TUNING) {
+      setGoalDetectorConfig(config.detector);
+      setIdleTimeouts(config.idleS, config.sleepS);
+    } else if (change == DEVICE_CONFIG_RESTART) {
+      restartPending = true;
+      schedulerWake(restartTask, CONFIG_RESTART_DELAY_MS);
+    }
+    httpSend(200, "application/json",
+                change == DEVICE_CONFIG_RESTART ? "{\"restart\":true}" : "{\"restart\":false}");
+  });
 
-  if (reading != button->lastState) {
-    button->lastDebounceTime = currentTime;
-    Serial.print("Button state change detected on pin ");
-    Serial.print(pin);
-    Serial.print(": ");
-    Serial.println(reading ? "PRESSED" : "RELEASED");
-  }
+  // Status endpoint
+  httpOn(HTTP_METHOD_GET, "/status", [](const HttpRequest&) {
+    // Flash network activity LED for incoming data
+    flashNetworkActivity();
 
-  if ((currentTime - button->lastDebounceTime) > BUTTON_DEBOUNCE_MS) {
-    if (reading != button->currentState) {
-      button->currentState = reading;
-
-      if (button->currentState) {
-        button->pressed = true;
-        Serial.print("Button CONFIRMED PRESS on pin ");
-        Serial.print(pin);
-        Serial.print(" after debounce (");
-        Serial.print(currentTime - button->lastDebounceTime);
-        Serial.println("ms)");
+    // Rendered straight into the server's response buffer
+    size_t size;
+    char* response = httpResponseBuffer(&size);
+    JsonWriter json(response, size);
+    json.openObject();
+    json.addUint("table", deviceConfig().tableId);
+    json.addString("player", scorePlayerName(playerSide));
+    json.addBool("wifi", wifiConnected);
+
+    // Boot and reconnect times, the first goal can't be sent before ready
+    json.openObject("wifiLink");
+    json.addUint("bootToReadyMs", wifiLinkStats.bootToReadyMs);
+    json.addUint("lastReconnectMs", wifiLinkStats.lastReconnectMs);
+    json.addUint("fastConnects", wifiLinkStats.fastConnects);
+    json.addUint("fullConnects", wifiLinkStats.fullConnects);
+    json.addUint("failedAttempts", wifiLinkStats.failedAttempts);
+    json.addBool("cached", wifiCacheValid);
+    json.closeObject();
+    json.addBool("quantumMode", quantumMode);
+
+    // Connection reuse to the Pi
+    const OutboundStats& http = outboundStats();
+    json.openObject("connection");
+    json.addUint("requests", http.requests);
+    json.addUint("reuseHits", http.reuseHits);
+    json.addUint("reconnects", http.reconnects);
+    json.addUint("retries", http.retries);
+    json.addUint("bytesSent", http.bytesSent);
+    json.addUint("bytesReceived", http.bytesReceived);
+    json.closeObject();
+
+    // Protocol to the Pi - binary once /status on the Pi offered it
+    json.openObject("wire");
+    json.addString("configured", deviceProtocolName(deviceConfig().protocol));
+    json.addString("active", outboundWireActive() ? "binary" : "json");
+    json.addUint("version", WIRE_VERSION);
+    json.addUint("frames", http.frames);
+    json.addUint("fallbacks", http.wireFallbacks);
+    json.closeObject();
+    json.addUint("journalPending", journalPending());
+    json.addUint("journalDropped", journalDropped());
+
+    // Score broadcast delivery
+    const ScoreReceiverStats& broadcast = scoreReceiverStats();
+    json.openObject("broadcast");
+    json.addUint("received", broadcast.received);
+    json.addUint("delivered", broadcast.delivered);
+    json.addUint("duplicates", broadcast.duplicates);
+    json.addUint("reordered", broadcast.reordered);
+    json.addUint("skipped", broadcast.skipped);
+    json.addUint("otherTable", broadcast.otherTable);
+    json.addUint("restarts", broadcast.restarts);
+    json.closeObject();
+
+    // The score as this device sees it, pending local events included
+    const MatchState& match = matchState();
+    json.openObject("match");
+    json.addUint("version", match.version);
+    json.addUint("serverSeq", match.serverSeq);
+    json.addUint("pending", match.pending);
+    json.addBool("quantum", match.quantum);
+    for (uint8_t side = 0; side < SCORE_PLAYER_COUNT; side++) {
+      json.openObject(scorePlayerName(side));
+      json.addUint("goals", match.sides[side].goals);
+      json.addUint("points", match.sides[side].points);
+      json.addUint("quantumPoints", match.sides[side].quantumPoints);
+      json.closeObject();
+    }
+    json.openArray("goals");
+    for (uint8_t i = 0; i < matchGoalCount() && i < STATUS_GOALS_MAX; i++) {
+      const MatchGoal& goal = matchRecentGoal(i);
+      json.openObject();
+      json.addUint("t", goal.timeMs);
+      json.addString("player", scorePlayerName(goal.player));
+      if (goal.speedKmhX10 > 0) {
+        json.addTenths("speed", goal.speedKmhX10);
       }
+      json.addBool("confirmed", goal.confirmed);
+      json.closeObject();
     }
-  }
-
-  button->lastState = reading;
-}
-
-void handleLaserBreak() {
-  bool currentLaserState = !digitalRead(LASER_BREAK_PIN); // Inverted for break beam
-  unsigned long currentTime = millis();
-
-  // Log laser state changes
-  if (currentLaserState != lastLaserState) {
-    Serial.print("Laser break sensor state change: ");
-    Serial.print(currentLaserState ? "BROKEN" : "RESTORED");
-    Serial.print(" (pin ");
-    Serial.print(LASER_BREAK_PIN);
-    Serial.println(")");
-  }
-
-  // Detect laser break (transition from unbroken to broken)
-  if (currentLaserState && !lastLaserState) {
-    Serial.print("Laser break detected! Checking cooldown... ");
-
-    // Check cooldown period
-    if (currentTime - lastLaserBreakTime > LASER_COOLDOWN_MS) {
-      Serial.println("GOAL CONFIRMED! Sending API call.");
-      Serial.print("Time since last goal: ");
-      Serial.print(currentTime - lastLaserBreakTime);
-      Serial.println("ms");
-
-      sendGoalAPI();
-      lastLaserBreakTime = currentTime;
-
-      // Trigger 2-second solid LED flash
-      Serial.println("Triggering 2-second solid LED flash for goal");
-      triggerGoalFlash();
-    } else {
-      Serial.print("Goal ignored - still in cooldown period. Time remaining: ");
-      Serial.print(LASER_COOLDOWN_MS - (currentTime - lastLaserBreakTime));
-      Serial.println("ms");
+    json.closeArray();
+    json.closeObject();
+
+    // Clock offset to the Pi, for goal traces
+    const ClockSyncStats& clock = clockSyncStats();
+    json.openObject("clock");
+    json.addBool("synced", clock.synced);
+    json.addUint("errorUs", clockSyncErrorMicros());
+    json.addUint("requests", clock.requests);
+    json.addUint("replies", clock.replies);
+    json.addUint("steps", clock.steps);
+    json.closeObject();
+
+    // Low-power idle - seconds in each state, and how fast activity woke it
+    const PowerStats& power = powerStats(halMillis());
+    json.openObject("power");
+    json.addString("state", powerStateName(power.state));
+    for (uint8_t state = 0; state < POWER_STATE_COUNT; state++) {
+      char field[16];
+      snprintf(field, sizeof(field), "%sS", powerStateName(state));
+      json.addUint(field, power.seconds[state]);
     }
-  }
-
-  lastLaserState = currentLaserState;
-}
-
-void handleButtonActions() {
-  // Check for reset combination (Up + Down pressed simultaneously)
-  if (buttonUp.pressed && buttonDown.pressed) {
-    Serial.println("=== RESET COMBINATION DETECTED ===");
-    Serial.println("Both Up and Down buttons pressed simultaneously");
-    Serial.print("Sending reset API for player: ");
-    Serial.println(playerColor);
-    sendResetAPI();
-    buttonUp.pressed = false;
-    buttonDown.pressed = false;
-    return;
-  }
-
-  // Handle individual button presses
-  if (buttonUp.pressed) {
-    Serial.println("=== UP BUTTON ACTION ===");
-    Serial.print("Adding 1 point for player: ");
-    Serial.print(playerColor);
-    Serial.print(", Quantum mode: ");
-    Serial.println(quantumMode ? "ENABLED" : "DISABLED");
-    sendAddPointAPI(1);
-    buttonUp.pressed = false;
-  }
-
-  if (buttonDown.pressed) {
-    Serial.println("=== DOWN BUTTON ACTION ===");
-    Serial.print("Adding 1 point for player: ");
-    Serial.print(playerColor);
-    Serial.print(", Quantum mode: ");
-    Serial.println(quantumMode ? "ENABLED" : "DISABLED");
-    sendAddPointAPI(1);
-    buttonDown.pressed = false;
-  }
-
-  if (buttonQuantum.pressed) {
-    quantumMode = !quantumMode;
-    Serial.println("=== QUANTUM MODE TOGGLE ===");
-    Serial.print("Quantum mode changed to: ");
-    Serial.println(quantumMode ? "ENABLED" : "DISABLED");
-    Serial.println("Showing visual feedback on RGB LED");
-
-    // Flash RGB LED to indicate quantum mode toggle
-    if (quantumMode) {
-      setRGBColor(0, 255, 0); // Green for quantum mode ON
-    } else {
-      setRGBColor(255, 0, 0); // Red for quantum mode OFF
+    json.openObject("wakes");
+    for (uint8_t wake = 0; wake < POWER_WAKE_COUNT; wake++) {
+      json.addUint(powerWakeName(wake), power.wakes[wake]);
     }
-    delay(300);
-    setStatusColor("ready"); // Return to normal status color
-
-    buttonQuantum.pressed = false;
-  }
-}
-
-void updateLEDs() {
-  unsigned long currentTime = millis();
-
-  // Priority order: Goal flash > Own goal blinking
-  
-  // 1. Goal flash (solid LED for 2 seconds after laser break)
-  if (goalFlashing) {
-    if (currentTime - goalFlashStartTime < 2000) { // Flash for 2 seconds
-      digitalWrite(LED_ACTIVITY_PIN, HIGH); // Solid ON
-    } else {
-      goalFlashing = false;
-      digitalWrite(LED_ACTIVITY_PIN, LOW);
+    json.closeObject();
+    json.addUint("lastWakeUs", power.lastWakeUs);
+    json.addUint("maxWakeUs", power.maxWakeUs);
+    json.addUint("wakeGoals", power.wakeGoals);
+    json.closeObject();
+
+    // Event stream subscribers
+    const EventStreamStats& stream = eventStreamStats();
+    json.openObject("stream");
+    json.addUint("clients", stream.clients);
+    json.addUint("connections", stream.connections);
+    json.addUint("published", stream.published);
+    json.addUint("slowConsumerDrops", stream.slowConsumerDrops);
+    json.closeObject();
+
+    // Connections to this server
+    const HttpServerStats& server = httpServerStats();
+    json.openObject("http");
+    json.addUint("clients", server.clients);
+    json.addUint("maxClients", server.maxClients);
+    json.addUint("connections", server.connections);
+    json.addUint("requests", server.requests);
+    json.addUint("keepAlive", server.keepAliveRequests);
+    json.addUint("pipelined", server.pipelined);
+    json.addUint("errors", server.errors);
+    json.addUint("timeouts", server.timeouts);
+    json.closeObject();
+
+    // Goal detector thresholds and what they filtered
+    const GoalDetectorConfig& detector = goalDetectorConfig();
+    const GoalDetectorStats& laser = goalDetectorStats();
+    json.openObject("laser");
+    json.addUint("glitchUs", detector.glitchUs);
+    json.addUint("minBreakUs", detector.minBreakUs);
+    json.addUint("rearmMs", detector.rearmUs / 1000);
+    json.addString("calibration", goalCalibrationPhaseName(goalCalibration().phase));
+    json.addUint("goals", laser.goals);
+    json.addUint("glitches", laser.glitches);
+    json.addUint("shortBreaks", laser.shortBreaks);
+    json.addUint("bounces", laser.bounces);
+    json.closeObject();
+
+    // Most recent shot speeds first, in km/h
+    json.openArray("shotSpeeds");
+    for (uint8_t i = 0; i < shotSpeeds.count; i++) {
+      json.addTenths(nullptr, shotSpeeds.recent(i));
     }
-    return; // Skip other LED states while goal flashing
-  }
-
-  // 2. Own goal celebration blinking (250ms intervals for 2 seconds)
-  if (ownGoalBlinking) {
-    if (currentTime - ownGoalBlinkStartTime < 2000) { // Blink for 2 seconds
-      if (currentTime - lastLedBlinkTime > OWN_GOAL_BLINK_INTERVAL_MS) { // 250ms intervals
-        ledActivityState = !ledActivityState;
-        digitalWrite(LED_ACTIVITY_PIN, ledActivityState);
-        lastLedBlinkTime = currentTime;
+    json.closeArray();
+
+    // Firmware and the last OTA update
+    const OtaStatus& ota = otaStatus();
+    uint8_t firmwareSha1[SHA1_DIGEST_SIZE];
+    json.openObject("ota");
+    json.addString("phase", otaPhaseName(ota.phase));
+    json.addString("boot", otaBootName(ota.boot));
+    if (otaFirmwareSha1(firmwareSha1)) {
+      char hex[SHA1_DIGEST_SIZE * 2 + 1];
+      for (uint8_t i = 0; i < SHA1_DIGEST_SIZE; i++) {
+        snprintf(hex + i * 2, 3, "%02x", firmwareSha1[i]);
       }
-    } else {
-      ownGoalBlinking = false;
-      digitalWrite(LED_ACTIVITY_PIN, LOW);
+      json.addString("firmwareSha1", hex);
     }
-  }
-}
-
+    if (ota.phase != OTA_IDLE) {
+      json.addBool("patch", ota.patch);
+      json.addBool("paused", ota.paused);
+      json.addUint("imageSize", ota.imageSize);
+      json.addUint("backedUp", ota.backedUp);
+      json.addUint("fileSize", ota.fileSize);
+      json.addUint("downloaded", ota.downloaded);
+      json.addUint("written", ota.written);
+      json.addUint("resumes", ota.resumes);
+      json.addUint("pauses", ota.pauses);
+      json.addUint("durationMs", ota.durationMs);
+    }
+    if (ota.error != nullptr) {
+      json.addString("error", ota.error);
+    }
+    json.closeObject();
+
+    // Heap health, to track fragmentation over long sessions
+    json.openObject("heap");
+    json.addUint("free", ESP.getFreeHeap());
+    json.addUint("maxBlock", ESP.getMaxFreeBlockSize());
+    json.addUint("fragmentation", ESP.getHeapFragmentation());
+    json.closeObject();
+    json.closeObject();
+
+    if (json.overflowed()) {
+      LOG_ERROR(LOG_CAT_HTTP, "/status doesn't fit in %u bytes", (unsigned)size);
+      httpSend(500, "application/json", "{\"error\":\"status too large\"}");
+      return;
+    }
+    LOG_DEBUG(LOG_CAT_HTTP, "/status: %s", response);
+    httpSend(200, "application/json", response);
+  });
 
-void sendGoalAPI() {
-  Serial.println("=== SENDING GOAL API ===");
+  setupHttpServer();
+  LOG_INFO(LOG_CAT_HTTP, "Available endpoints:");
+  LOG_INFO(LOG_CAT_HTTP, "  POST /scoreMade - Receive opponent score notifications (UDP fallback)");
+  LOG_INFO(LOG_CAT_HTTP, "  GET /status - Device status information");
+  LOG_INFO(LOG_CAT_HTTP, "  POST /calibrateLaser - Learn goal detection thresholds");
+  LOG_INFO(LOG_CAT_HTTP, "  GET /metrics - Stage timings and counters, Prometheus format");
+  LOG_INFO(LOG_CAT_HTTP, "  GET /log - Recent log lines");
+  LOG_INFO(LOG_CAT_HTTP, "  GET /traces - Recent goal traces, one per line");
+  LOG_INFO(LOG_CAT_HTTP, "  GET/POST /config - Device config and provisioning");
+  LOG_INFO(LOG_CAT_HTTP, "  POST /ota - Firmware update from the Pi");
+  LOG_INFO(LOG_CAT_HTTP, "  WebSocket :81/stream - Live laser, button, quantum and WiFi events");
+}
 
-  if (!wifiConnected) {
-    Serial.println("ERROR: WiFi not connected, cannot send goal API");
-    return;
+// FNV-1a, enough to tell a stale cache from a valid one
+uint32_t hashBytes(uint32_t hash, const void* data, size_t length) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 16777619UL;
   }
+  return hash;
+}
 
-  // Flash network activity LED for outgoing data
-  flashNetworkActivity();
-
-  Serial.print("Connecting to: ");
-  Serial.println(String(baseUrl) + "/score");
-
-  httpClient.begin(wifiClient, String(baseUrl) + "/score");
-  httpClient.addHeader("Content-Type", "application/json");
-
-  JsonDocument doc;
-  doc["player"] = opponentColor;
-
-  String payload;
-  serializeJson(doc, payload);
-
-  Serial.print("Sending payload: ");
-  Serial.println(payload);
-  Serial.print("Opponent scored against player: ");
-  Serial.println(playerColor);
+uint32_t credentialsHash() {
+  const DeviceConfig& config = deviceConfig();
+  uint32_t hash = hashBytes(2166136261UL, config.ssid, strlen(config.ssid) + 1);
+  return hashBytes(hash, config.password, strlen(config.password) + 1);
+}
 
-  int httpResponseCode = httpClient.POST(payload);
+uint32_t wifiCacheChecksum(const WiFiCache& cache) {
+  return hashBytes(2166136261UL, &cache, offsetof(WiFiCache, checksum));
+}
 
-  Serial.print("HTTP Response Code: ");
-  Serial.println(httpResponseCode);
+bool validWiFiCache(const WiFiCache& cache) {
+  return cache.magic == WIFI_CACHE_MAGIC && cache.checksum == wifiCacheChecksum(cache) &&
+         cache.credentials == credentialsHash() && cache.channel != 0;
+}
 
-  if (httpResponseCode > 0) {
-    String response = httpClient.getString();
-    Serial.print("Server Response: ");
-    Serial.println(response);
-  } else {
-    Serial.print("HTTP Error: ");
-    Serial.println(httpResponseCode);
+// RTC memory first - it skips mounting the filesystem after a plain reset
+bool loadWiFiCache() {
+  if (ESP.rtcUserMemoryRead(WIFI_CACHE_RTC_BLOCK, (uint32_t*)&wifiCache, sizeof(wifiCache)) &&
+      validWiFiCache(wifiCache)) {
+    return true;
   }
-
-  httpClient.end();
-  Serial.println("Goal API call completed");
+  return halStorageLoad(WIFI_CACHE_FILE, &wifiCache, sizeof(wifiCache)) && validWiFiCache(wifiCache);
 }
 
-void flashNetworkActivity() {
-  // Flash the built-in LED for network activity (like ethernet port)
-  networkActivityTime = millis();
-  networkActivityLED = true;
-  digitalWrite(LED_BUILTIN_PIN, LOW); // Turn on (inverted logic)
-  Serial.println("Network activity flash");
+// Flash is only rewritten when the AP or lease actually changed
+void storeWiFiCache() {
+  WiFiCache cache = {};
+  cache.magic = WIFI_CACHE_MAGIC;
+  cache.credentials = credentialsHash();
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = WiFi.localIP();
+  cache.gateway = WiFi.gatewayIP();
+  cache.subnet = WiFi.subnetMask();
+  cache.dns = WiFi.dnsIP();
+  cache.checksum = wifiCacheChecksum(cache);
+
+  ESP.rtcUserMemoryWrite(WIFI_CACHE_RTC_BLOCK, (uint32_t*)&cache, sizeof(cache));
+  if (!wifiCacheValid || memcmp(&cache, &wifiCache, sizeof(cache)) != 0) {
+    halStorageSave(WIFI_CACHE_FILE, &cache, sizeof(cache));
+  }
+  wifiCache = cache;
+  wifiCacheValid = true;
 }
 
-void updateNetworkActivityLED() {
-  // Handle network activity LED timing
-  if (networkActivityLED && (millis() - networkActivityTime > 100)) {
-    networkActivityLED = false;
-    digitalWrite(LED_BUILTIN_PIN, HIGH); // Turn off (inverted logic)
-  }
+// Directed association - no scan, no DHCP, the old lease is reused as a
+// static address
+void beginFastConnect() {
+  const DeviceConfig& config = deviceConfig();
+  LOG_INFO(LOG_CAT_WIFI, "Fast connect on channel %u", wifiCache.channel);
+  WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet),
+              IPAddress(wifiCache.dns));
+  WiFi.begin(config.ssid, config.password, wifiCache.channel, wifiCache.bssid, true);
+  wifiAttempt = WIFI_ATTEMPT_FAST;
+  wifiAttemptStart = millis();
 }
 
-void setRGBColor(int red, int green, int blue) {
-  // ESP8266 uses inverted logic for some pins, adjust as needed
-  analogWrite(RGB_RED_PIN, red);
-  analogWrite(RGB_GREEN_PIN, green);
-  analogWrite(RGB_BLUE_PIN, blue);
+void beginFullConnect() {
+  const DeviceConfig& config = deviceConfig();
+  LOG_INFO(LOG_CAT_WIFI, "Connecting to WiFi");
+  WiFi.disconnect();
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());  // Back to DHCP
+  WiFi.begin(config.ssid, config.password);
+  wifiAttempt = WIFI_ATTEMPT_FULL;
+  wifiAttemptStart = millis();
 }
 
-void setStatusColor(String status) {
-  if (status == "startup") {
-    // Purple - Starting up (brighter purple)
-    setRGBColor(255, 0, 255);
-    Serial.println("Status: Startup (Purple)");
-  }
-  else if (status == "connecting") {
-    // Yellow - Connecting to WiFi
-    setRGBColor(255, 255, 0);
-    Serial.println("Status: Connecting (Yellow)");
-  }
-  else if (status == "ready") {
-    // Player color - Ready and connected
-    if (playerColor == "red") {
-      setRGBColor(255, 0, 0);
-      Serial.println("Status: Ready (Red)");
-    } else if (playerColor == "blue") {
-      setRGBColor(0, 0, 255);
-      Serial.println("Status: Ready (Blue)");
-    }
-  }
-  else if (status == "disconnected") {
-    // Orange - WiFi disconnected (brighter orange)
-    setRGBColor(255, 128, 0);
-    Serial.println("Status: Disconnected (Orange)");
-  }
-  else if (status == "error") {
-    // Flashing red - Error state
-    setRGBColor(255, 0, 0);
-    delay(200);
-    setRGBColor(0, 0, 0);
-    delay(200);
-    setRGBColor(255, 0, 0);
-    Serial.println("Status: Error (Flashing Red)");
-  }
-  else if (status == "off") {
-    // Turn off RGB LED
-    setRGBColor(0, 0, 0);
-    Serial.println("Status: Off");
+void startWiFiAttempt() {
+  if (wifiCacheValid) {
+    beginFastConnect();
+  } else {
+    beginFullConnect();
   }
 }
 
-void sendAddPointAPI(int amount) {
-  if (!wifiConnected) {
-    Serial.println("WiFi not connected, cannot send add point API");
-    return;
+void onWiFiConnected(unsigned long currentTime) {
+  if (wifiAttempt == WIFI_ATTEMPT_FAST) {
+    wifiLinkStats.fastConnects++;
+  } else {
+    wifiLinkStats.fullConnects++;
   }
-
-  // Flash network activity LED for outgoing data
-  flashNetworkActivity();
-
-  httpClient.begin(wifiClient, String(baseUrl) + "/point");
-  httpClient.addHeader("Content-Type", "application/json");
-
-  JsonDocument doc;
-  doc["player"] = playerColor;
-  doc["amount"] = amount;
-  doc["quantum"] = quantumMode;
-
-  String payload;
-  serializeJson(doc, payload);
-
-  int httpResponseCode = httpClient.POST(payload);
-
-  if (httpResponseCode > 0) {
-    String response = httpClient.getString();
-    Serial.println("Add point API response: " + String(httpResponseCode));
+  bool firstConnection = wifiLinkStats.bootToReadyMs == 0;
+  uint32_t readyMs = firstConnection ? currentTime : currentTime - wifiLostTime;
+  if (firstConnection) {
+    wifiLinkStats.bootToReadyMs = readyMs;
   } else {
-    Serial.println("Add point API error: " + String(httpResponseCode));
+    wifiLinkStats.lastReconnectMs = readyMs;
   }
-
-  httpClient.end();
+  wifiAttempt = WIFI_ATTEMPT_NONE;
+  wifiFailures = 0;
+  storeWiFiCache();
+
+  wifiConnected = true;
+  wifiConnectedTime = currentTime;
+  setStatusColor(STATUS_READY);
+  confirmOtaUpdate();
+  streamWiFiEvent(true);
+  LOG_INFO(LOG_CAT_WIFI, "WiFi connected! IP address: %s, ready %ums after %s", WiFi.localIP().toString().c_str(),
+           (unsigned)readyMs, firstConnection ? "boot" : "link loss");
+  startJournalReplay();
+  negotiateWireProtocol();
+  wakeNetworkTask();
+  listenForScoreBroadcasts();
 }
 
-void sendTestOpponentScore() {
-  Serial.println("=== SENDING TEST OPPONENT SCORE ===");
+void handleWiFi() {
+  unsigned long currentTime = millis();
 
-  if (!wifiConnected) {
-    Serial.println("ERROR: WiFi not connected, cannot send test opponent score");
+  if (WiFi.status() == WL_CONNECTED) {
+    if (!wifiConnected) {
+      onWiFiConnected(currentTime);
+    } else if (testScorePending && currentTime - wifiConnectedTime >= TEST_SCORE_DELAY_MS) {
+      testScorePending = false;
+      sendTestOpponentScore();
+    }
     return;
   }
 
-  // Flash network activity LED for outgoing data
-  flashNetworkActivity();
-
-  Serial.print("This device player: ");
-  Serial.println(playerColor);
-  Serial.print("Simulating opponent: ");
-  Serial.println(opponentColor);
-  Serial.print("Connecting to: ");
-  Serial.println(String(baseUrl) + "/scoreMade");
-
-  httpClient.begin(wifiClient, String(baseUrl) + "/scoreMade");
-  httpClient.addHeader("Content-Type", "application/json");
-
-  JsonDocument doc;
-  doc["player"] = opponentColor;
-
-  String payload;
-  serializeJson(doc, payload);
-
-  Serial.print("Sending test payload: ");
-  Serial.println(payload);
-
-  int httpResponseCode = httpClient.POST(payload);
-
-  Serial.print("HTTP Response Code: ");
-  Serial.println(httpResponseCode);
+  if (wifiConnected) {
+    // Just disconnected - straight back to the AP we know, no waiting.
+    // Orange until that fails, then the connecting blink.
+    wifiConnected = false;
+    wifiLostTime = currentTime;
+    setStatusColor(STATUS_DISCONNECTED);
+    streamWiFiEvent(false);
+    LOG_WARN(LOG_CAT_WIFI, "WiFi disconnected, attempting reconnection...");
+    startWiFiAttempt();
+    return;
+  }
 
-  if (httpResponseCode > 0) {
-    String response = httpClient.getString();
-    Serial.print("Server Response: ");
-    Serial.println(response);
-  } else {
-    Serial.print("HTTP Error: ");
-    Serial.println(httpResponseCode);
+  if (wifiAttempt == WIFI_ATTEMPT_NONE) {
+    if ((long)(currentTime - nextWifiAttempt) >= 0) {
+      startWiFiAttempt();
+    }
+    return;
   }
 
-  httpClient.end();
-  Serial.println("Test opponent score API call completed");
-  Serial.println("This should trigger the LED blink sequence if successful!");
-}
+  unsigned long timeout = wifiAttempt == WIFI_ATTEMPT_FAST ? WIFI_FAST_TIMEOUT_MS : WIFI_CONNECT_TIMEOUT_MS;
+  if (currentTime - wifiAttemptStart < timeout) {
+    return;
+  }
+  wifiLinkStats.failedAttempts++;
 
-void startupBlink() {
-  Serial.println("Starting LED activity pin blink sequence (3 blinks)");
-
-  for (int i = 0; i < 3; i++) {
-    Serial.print("Blink ");
-    Serial.print(i + 1);
-    Serial.println(" - ON");
-    digitalWrite(LED_ACTIVITY_PIN, HIGH);
-    delay(200);
-
-    Serial.print("Blink ");
-    Serial.print(i + 1);
-    Serial.println(" - OFF");
-    digitalWrite(LED_ACTIVITY_PIN, LOW);
-    delay(200);
+  // The AP may have moved channel or handed out new leases - scan for it
+  if (wifiAttempt == WIFI_ATTEMPT_FAST) {
+    LOG_WARN(LOG_CAT_WIFI, "Fast connect failed, scanning");
+    setStatusColor(STATUS_CONNECTING);
+    beginFullConnect();
+    return;
   }
 
-  Serial.println("Startup blink sequence completed");
+  uint32_t backoff = WIFI_BACKOFF_MIN_MS << (wifiFailures < 6 ? wifiFailures : 6);
+  if (backoff > WIFI_BACKOFF_MAX_MS) {
+    backoff = WIFI_BACKOFF_MAX_MS;
+  }
+  wifiFailures++;
+  LOG_WARN(LOG_CAT_WIFI, "WiFi connection failed, retrying in %ums", (unsigned)backoff);
+  WiFi.disconnect();
+  wifiAttempt = WIFI_ATTEMPT_NONE;
+  nextWifiAttempt = currentTime + backoff;
 }
 
-void sendResetAPI() {
+
+void sendTestOpponentScore() {
   if (!wifiConnected) {
-    Serial.println("WiFi not connected, cannot send reset API");
+    LOG_ERROR(LOG_CAT_NET, "WiFi not connected, cannot send test opponent score");
     return;
   }
 
   // Flash network activity LED for outgoing data
   flashNetworkActivity();
 
-  httpClient.begin(wifiClient, String(baseUrl) + "/reset");
-  httpClient.addHeader("Content-Type", "application/json");
+  char payload[OUTBOUND_BODY_MAX];
+  formatPlayerBody(payload, sizeof(payload), scorePlayerName(opponentSide));
 
-  JsonDocument doc;
-  doc["player"] = playerColor;
+  LOG_INFO(LOG_CAT_NET, "Sending test opponent score as %s: %s", scorePlayerName(opponentSide), payload);
 
-  String payload;
-  serializeJson(doc, payload);
-
-  int httpResponseCode = httpClient.POST(payload);
-
-  if (httpResponseCode > 0) {
-    String response = httpClient.getString();
-    Serial.println("Reset API response: " + String(httpResponseCode));
-  } else {
-    Serial.println("Reset API error: " + String(httpResponseCode));
-  }
-
-  httpClient.end();
+  queueOutbound("/scoreMade", payload, "Test opponent score API");
+  wakeNetworkTask();
 }
 
-void triggerOwnGoalBlink() {
-  Serial.println("Own goal scored! Triggering celebration LED blink");
-  ownGoalBlinking = true;
-  ownGoalBlinkStartTime = millis();
-}
-
-void triggerGoalFlash() {
-  Serial.println("Triggering goal flash - solid LED for 2 seconds");
-  goalFlashing = true;
-  goalFlashStartTime = millis();
-}
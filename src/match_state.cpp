@@ -0,0 +1,256 @@
+#include "match_state.h"
+#include <string.h>
+
+struct MatchOp {
+  uint16_t id;
+  uint8_t type;
+  uint8_t player;
+  uint16_t amount;
+  bool quantum;
+  bool acknowledged;
+  uint32_t acknowledgedMs;
+  uint32_t journalSeq;   // 0 when sent directly
+};
+
+static MatchState state = {};
+
+// Unsettled local ops, oldest first
+static MatchOp ops[MATCH_PENDING_MAX];
+static uint8_t opCount = 0;
+static uint16_t nextOpId = 1;
+
+// Goal history, oldest first
+static MatchGoal goals[MATCH_HISTORY_SIZE];
+static uint8_t goalCount = 0;
+
+static void applyOp(MatchSide sides[SCORE_PLAYER_COUNT], const MatchOp& op) {
+  switch (op.type) {
+    case MATCH_OP_GOAL:
+      sides[op.player].goals++;
+      break;
+    case MATCH_OP_POINT:
+      if (op.quantum) {
+        sides[op.player].quantumPoints += op.amount;
+      } else {
+        sides[op.player].points += op.amount;
+      }
+      break;
+    default:
+      memset(sides, 0, sizeof(MatchSide) * SCORE_PLAYER_COUNT);
+      break;
+  }
+}
+
+// What is shown is always the confirmed state with every pending op on top
+static void recompute() {
+  memcpy(state.sides, state.confirmed, sizeof(state.sides));
+  for (uint8_t i = 0; i < opCount; i++) {
+    applyOp(state.sides, ops[i]);
+  }
+  state.pending = opCount;
+  state.version++;
+}
+
+static void removeOps(uint8_t index, uint8_t count) {
+  memmove(&ops[index], &ops[index + count], (opCount - index - count) * sizeof(MatchOp));
+  opCount -= count;
+}
+
+static int8_t findOp(uint16_t id) {
+  for (uint8_t i = 0; i < opCount; i++) {
+    if (ops[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void addGoal(uint8_t player, uint16_t speedKmhX10, bool confirmed, uint16_t op, uint32_t nowMs) {
+  if (goalCount >= MATCH_HISTORY_SIZE) {
+    memmove(&goals[0], &goals[1], (MATCH_HISTORY_SIZE - 1) * sizeof(MatchGoal));
+    goalCount--;
+  }
+  goals[goalCount++] = {nowMs, speedKmhX10, player, confirmed, op};
+}
+
+static void removeGoal(uint16_t op) {
+  for (uint8_t i = 0; i < goalCount; i++) {
+    if (goals[i].op == op) {
+      memmove(&goals[i], &goals[i + 1], (goalCount - i - 1) * sizeof(MatchGoal));
+      goalCount--;
+      return;
+    }
+  }
+}
+
+// Moves an op into the confirmed state. A reset also retires everything
+// before it, the Pi wiped those along with the score.
+static void foldOp(uint8_t index) {
+  applyOp(state.confirmed, ops[index]);
+  if (ops[index].type == MATCH_OP_RESET) {
+    removeOps(0, index + 1);
+  } else {
+    removeOps(index, 1);
+  }
+}
+
+// Folds every acknowledged op that can be. Nothing behind an unacknowledged
+// reset may fold, the reset would wipe it again on the next recompute.
+static void settle(uint32_t nowMs) {
+  uint8_t i = 0;
+  while (i < opCount) {
+    const MatchOp& op = ops[i];
+    if (!op.acknowledged) {
+      if (op.type == MATCH_OP_RESET) {
+        return;
+      }
+      i++;
+      continue;
+    }
+    bool waitForBroadcast = op.type == MATCH_OP_GOAL && nowMs - op.acknowledgedMs < MATCH_GOAL_SETTLE_MS;
+    if (waitForBroadcast) {
+      i++;
+      continue;
+    }
+    if (op.type == MATCH_OP_RESET) {
+      foldOp(i);
+      i = 0;
+    } else {
+      foldOp(i);
+    }
+  }
+}
+
+static uint16_t addOp(uint8_t type, uint8_t player, uint16_t amount, bool quantum) {
+  // Out of room - the oldest op is assumed to have made it
+  if (opCount >= MATCH_PENDING_MAX) {
+    foldOp(0);
+  }
+
+  MatchOp* op = &ops[opCount++];
+  op->id = nextOpId++;
+  if (nextOpId == MATCH_NO_OP) {
+    nextOpId = 1;
+  }
+  op->type = type;
+  op->player = player < SCORE_PLAYER_COUNT ? player : 0;
+  op->amount = amount;
+  op->quantum = quantum;
+  op->acknowledged = false;
+  op->acknowledgedMs = 0;
+  op->journalSeq = 0;
+  recompute();
+  return op->id;
+}
+
+void resetMatchState() {
+  memset(&state, 0, sizeof(state));
+  opCount = 0;
+  goalCount = 0;
+}
+
+uint16_t matchLocalGoal(uint8_t player, uint16_t speedKmhX10, uint32_t nowMs) {
+  uint16_t id = addOp(MATCH_OP_GOAL, player, 1, false);
+  addGoal(player, speedKmhX10, false, id, nowMs);
+  return id;
+}
+
+uint16_t matchLocalPoint(uint8_t player, uint16_t amount, bool quantum) {
+  return addOp(MATCH_OP_POINT, player, amount, quantum);
+}
+
+uint16_t matchLocalReset() {
+  goalCount = 0;
+  return addOp(MATCH_OP_RESET, 0, 0, false);
+}
+
+void matchSetQuantum(bool quantum) {
+  if (state.quantum != quantum) {
+    state.quantum = quantum;
+    state.version++;
+  }
+}
+
+void matchAcknowledge(uint16_t id, MatchAck ack, uint32_t nowMs) {
+  int8_t index = findOp(id);
+  if (index < 0) {
+    return;
+  }
+
+  if (ack == MATCH_ACK_FAILED) {
+    // Still on its way, the optimistic score stands
+    return;
+  }
+  if (ack == MATCH_ACK_REJECTED) {
+    // The Pi refused it or will never see it, take it back
+    if (ops[index].type == MATCH_OP_GOAL) {
+      removeGoal(id);
+    }
+    removeOps(index, 1);
+  } else {
+    ops[index].acknowledged = true;
+    ops[index].acknowledgedMs = nowMs;
+    settle(nowMs);
+  }
+  recompute();
+}
+
+void matchJournaled(uint16_t id, uint32_t journalSeq) {
+  int8_t index = findOp(id);
+  if (index >= 0) {
+    ops[index].journalSeq = journalSeq;
+  }
+}
+
+void matchJournalResult(uint32_t journalSeq, MatchAck ack, uint32_t nowMs) {
+  for (uint8_t i = 0; i < opCount; i++) {
+    if (ops[i].journalSeq == journalSeq) {
+      matchAcknowledge(ops[i].id, ack, nowMs);
+      return;
+    }
+  }
+}
+
+void matchServerGoal(uint32_t seq, uint8_t player, const uint16_t serverGoals[SCORE_PLAYER_COUNT], uint32_t nowMs) {
+  state.serverSeq = seq;
+  for (uint8_t side = 0; side < SCORE_PLAYER_COUNT; side++) {
+    state.confirmed[side].goals = serverGoals[side];
+  }
+
+  // The announcement of our own pending goal, if there is one
+  for (uint8_t i = 0; i < opCount; i++) {
+    if (ops[i].type == MATCH_OP_GOAL && ops[i].player == player) {
+      for (uint8_t g = 0; g < goalCount; g++) {
+        if (goals[g].op == ops[i].id) {
+          goals[g].confirmed = true;
+        }
+      }
+      removeOps(i, 1);
+      recompute();
+      return;
+    }
+  }
+
+  addGoal(player, 0, true, MATCH_NO_OP, nowMs);
+  recompute();
+}
+
+void updateMatchState(uint32_t nowMs) {
+  uint8_t before = opCount;
+  settle(nowMs);
+  if (opCount != before) {
+    recompute();
+  }
+}
+
+const MatchState& matchState() {
+  return state;
+}
+
+uint8_t matchGoalCount() {
+  return goalCount;
+}
+
+const MatchGoal& matchRecentGoal(uint8_t i) {
+  return goals[goalCount - 1 - i];
+}
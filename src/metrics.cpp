@@ -0,0 +1,211 @@
+#include "metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "game.h"
+#include "scheduler.h"
+#include "outbound.h"
+#include "event_journal.h"
+#include "laser_capture.h"
+#include "button_capture.h"
+#include "button_input.h"
+#include "goal_detector.h"
+#include "score_broadcast.h"
+#include "event_stream.h"
+#include "log.h"
+
+// The CPU clock is fixed at boot, so the divisor is read once
+static uint32_t cyclesPerMicro = 0;
+
+// Page being rendered - lines are packed into chunk and handed to the sink
+// whenever the next one would not fit
+static MetricsSink metricsSink = nullptr;
+static char chunk[METRICS_CHUNK_SIZE];
+static size_t chunkLength = 0;
+
+uint32_t metricsStart() {
+  return halCycleCount();
+}
+
+uint32_t metricsElapsedMicros(uint32_t start) {
+  if (cyclesPerMicro == 0) {
+    cyclesPerMicro = halCyclesPerMicro();
+  }
+  return (halCycleCount() - start) / cyclesPerMicro;
+}
+
+uint32_t LatencySummary::quantile(uint16_t permille) const {
+  if (filled == 0) {
+    return 0;
+  }
+
+  // Nearest rank over a sorted copy - small enough for insertion sort
+  uint32_t sorted[METRICS_SUMMARY_SAMPLES];
+  for (uint8_t i = 0; i < filled; i++) {
+    uint32_t value = samples[i];
+    uint8_t j = i;
+    while (j > 0 && sorted[j - 1] > value) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+  uint32_t rank = ((uint32_t)permille * filled + 999) / 1000;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void flushChunk() {
+  if (chunkLength > 0) {
+    metricsSink(chunk, chunkLength);
+    chunkLength = 0;
+  }
+}
+
+static void emit(const char* format, ...) {
+  char line[METRICS_LINE_MAX];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (length <= 0) {
+    return;
+  }
+  if ((size_t)length >= sizeof(line)) {
+    length = sizeof(line) - 1;
+  }
+
+  if (chunkLength + length > sizeof(chunk)) {
+    flushChunk();
+  }
+  memcpy(chunk + chunkLength, line, length);
+  chunkLength += length;
+}
+
+// Prometheus wants seconds - printed from integer microseconds so no float
+// formatting is needed
+static const char* seconds(char* out, size_t size, uint64_t micros) {
+  snprintf(out, size, "%u.%06u", (unsigned)(micros / 1000000), (unsigned)(micros % 1000000));
+  return out;
+}
+
+static void emitCounter(const char* name, uint32_t value) {
+  emit("# TYPE %s counter\n%s %u\n", name, name, (unsigned)value);
+}
+
+// label is either empty or a complete pair such as task="laser"
+static void emitHistogram(const char* name, const char* label, const MetricHistogram& histogram) {
+  const char* separator = label[0] != '\0' ? "," : "";
+  char value[16];
+
+  uint32_t cumulative = 0;
+  uint32_t bound = METRICS_FIRST_BUCKET_US;
+  for (uint8_t bucket = 0; bucket < METRICS_BUCKET_COUNT; bucket++) {
+    cumulative += histogram.counts[bucket];
+    if (bucket < METRICS_BUCKET_COUNT - 1) {
+      emit("%s_bucket{%s%sle=\"%s\"} %u\n", name, label, separator,
+           seconds(value, sizeof(value), bound), (unsigned)cumulative);
+      bound <<= 2;
+    } else {
+      emit("%s_bucket{%s%sle=\"+Inf\"} %u\n", name, label, separator, (unsigned)cumulative);
+    }
+  }
+  const char* open = label[0] != '\0' ? "{" : "";
+  const char* close = label[0] != '\0' ? "}" : "";
+  emit("%s_sum%s%s%s %s\n", name, open, label, close, seconds(value, sizeof(value), histogram.sumMicros));
+  emit("%s_count%s%s%s %u\n", name, open, label, close, (unsigned)histogram.count);
+}
+
+static void emitSummary(const char* name, const LatencySummary& summary) {
+  static const struct {
+    uint16_t permille;
+    const char* label;
+  } quantiles[] = {{500, "0.5"}, {900, "0.9"}, {990, "0.99"}};
+  char value[16];
+  emit("# TYPE %s summary\n", name);
+  for (const auto& quantile : quantiles) {
+    emit("%s{quantile=\"%s\"} %s\n", name, quantile.label,
+         seconds(value, sizeof(value), summary.quantile(quantile.permille)));
+  }
+  emit("%s_sum %s\n", name, seconds(value, sizeof(value), summary.sumMicros));
+  emit("%s_count %u\n", name, (unsigned)summary.count);
+}
+
+static void emitDropped(const char* what, uint32_t value) {
+  emit("fooshack_dropped_total{what=\"%s\"} %u\n", what, (unsigned)value);
+}
+
+static void emitIgnored(const char* what, uint32_t value) {
+  emit("fooshack_ignored_total{what=\"%s\"} %u\n", what, (unsigned)value);
+}
+
+void writeMetrics(MetricsSink sink) {
+  metricsSink = sink;
+  chunkLength = 0;
+  char value[16];
+  char label[32];
+
+  emit("# TYPE fooshack_uptime_seconds gauge\nfooshack_uptime_seconds %u\n", (unsigned)(halMillis() / 1000));
+
+  // Stage timings - one loop() pass, and every task inside it
+  emit("# TYPE fooshack_loop_seconds histogram\n");
+  emitHistogram("fooshack_loop_seconds", "", schedulerPassTime());
+  emit("# TYPE fooshack_task_seconds histogram\n");
+  for (int8_t task = 0; task < schedulerTaskCount(); task++) {
+    snprintf(label, sizeof(label), "task=\"%s\"", schedulerTaskStats(task).name);
+    emitHistogram("fooshack_task_seconds", label, schedulerTaskStats(task).runTime);
+  }
+  emit("# TYPE fooshack_task_signal_latency_max_seconds gauge\n");
+  for (int8_t task = 0; task < schedulerTaskCount(); task++) {
+    const TaskStats& stats = schedulerTaskStats(task);
+    emit("fooshack_task_signal_latency_max_seconds{task=\"%s\"} %s\n", stats.name,
+         seconds(value, sizeof(value), stats.maxSignalLatencyMicros));
+  }
+
+  // Outbound HTTP to the Pi
+  const OutboundStats& outbound = outboundStats();
+  emit("# TYPE fooshack_outbound_request_seconds histogram\n");
+  emitHistogram("fooshack_outbound_request_seconds", "", outbound.requestTime);
+  emitCounter("fooshack_outbound_requests_total", outbound.requests);
+  emitCounter("fooshack_outbound_reconnects_total", outbound.reconnects);
+  emitCounter("fooshack_outbound_retries_total", outbound.retries);
+  emitCounter("fooshack_outbound_failures_total", outbound.failures);
+  emitCounter("fooshack_outbound_frames_total", outbound.frames);
+  emitCounter("fooshack_outbound_sent_bytes_total", outbound.bytesSent);
+  emitCounter("fooshack_outbound_received_bytes_total", outbound.bytesReceived);
+
+  // Beam break to the Pi's reply to POST /score
+  emitSummary("fooshack_goal_ack_seconds", goalAckLatency);
+
+  const GoalDetectorStats& laser = goalDetectorStats();
+  emitCounter("fooshack_goals_total", laser.goals);
+
+  // First contact edge to the recognized button gesture
+  const ButtonInputStats& buttons = buttonInputStats();
+  emitSummary("fooshack_button_seconds", buttonLatency);
+  emitCounter("fooshack_button_presses_total", buttons.presses);
+
+  // Events lost to full buffers or slow peers
+  const ScoreReceiverStats& broadcast = scoreReceiverStats();
+  emit("# TYPE fooshack_dropped_total counter\n");
+  emitDropped("laser_edges", laserEdgeOverflows());
+  emitDropped("goal_events", laser.overflows);
+  emitDropped("button_edges", buttonEdgeOverflows());
+  emitDropped("button_events", buttons.overflows);
+  emitDropped("outbound_queue", outbound.dropped);
+  emitDropped("journal", journalDropped());
+  emitDropped("broadcast_skipped", broadcast.skipped);
+  emitDropped("stream_slow_consumers", eventStreamStats().slowConsumerDrops);
+  emitDropped("log_lines", logStats().droppedLines);
+
+  // Input deliberately filtered out
+  emit("# TYPE fooshack_ignored_total counter\n");
+  emitIgnored("laser_glitches", laser.glitches);
+  emitIgnored("laser_short_breaks", laser.shortBreaks);
+  emitIgnored("laser_bounces", laser.bounces);
+  emitIgnored("button_bounces", buttons.bounces);
+  emitIgnored("broadcast_duplicates", broadcast.duplicates);
+  emitIgnored("broadcast_malformed", broadcast.malformed);
+
+  flushChunk();
+}
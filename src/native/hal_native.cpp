@@ -0,0 +1,798 @@
+#ifdef NATIVE_BUILD
+
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hal.h"
+#include "sim.h"
+
+#define SIM_PIN_COUNT 17
+#define SIM_SOCKET_WRITABLE 4096  // Reported while the kernel buffer has room
+#define SIM_CONSOLE_WRITABLE 4096
+#define SIM_FIRMWARE_SLOT (1024 * 1024)
+#define SIM_LIGHT_WAKE_JITTER_US 1000  // Wake-ups spread this wide around HAL_LIGHT_WAKE_US
+
+HardwareSerial Serial;
+
+// Virtual clock - only moves in simAdvanceMicros()
+static uint64_t nowMicros = 0;
+static uint32_t randomState = 0x2545F491;
+
+// With simChargeCpuTime(), the host CPU time the firmware uses between
+// sleeps moves the virtual clock too
+static uint32_t cpuScale = 0;
+static uint64_t cpuMarkNanos = 0;
+static uint64_t cpuCarryNanos = 0;
+static uint8_t cpuPaused = 0;  // Nested, while the clock moves for other reasons
+
+// GPIO state
+static int pinLevels[SIM_PIN_COUNT];
+static int analogLevels[SIM_PIN_COUNT];
+static HalIsr pinIsrs[SIM_PIN_COUNT];
+static int pinIsrModes[SIM_PIN_COUNT];
+
+// Scripted input edges, ordered by time (insertion order for equal times)
+struct SimEdge {
+  uint8_t pin;
+  int level;
+};
+static std::multimap<uint64_t, SimEdge> scheduledEdges;
+
+// Set by halWake() from an ISR to end halSleep() at the edge that fired it
+static bool wakeRequested = false;
+
+static uint8_t powerMode = HAL_POWER_FULL;
+static uint8_t wakePins[HAL_MAX_WAKE_PINS];
+static uint8_t wakePinCount = 0;
+
+// Edge handed to an ISR replayed after light sleep, see halPinEdge()
+static bool replaying = false;
+static int replayLevel = LOW;
+static uint32_t replayMicros = 0;
+
+static bool networkConnected = false;
+static int socketFds[HAL_MAX_SOCKETS];
+static bool socketInUse[HAL_MAX_SOCKETS];
+static bool socketOutgoing[HAL_MAX_SOCKETS];    // Opened by halTcpConnect*(), not accepted
+static bool socketConnecting[HAL_MAX_SOCKETS];  // Handshake under way
+static bool socketUnanswered[HAL_MAX_SOCKETS];  // Started while unreachable, never completes
+
+// simSetTcpUnreachable() - connects go unanswered
+static bool tcpUnreachable = false;
+static uint32_t unansweredConnects = 0;
+
+static int listenerFds[HAL_MAX_LISTENERS];
+static uint8_t listenerCount = 0;
+
+// Real UDP socket - halSleep() checks it so a datagram wakes the loop
+static int udpFd = -1;
+static HalIsr udpOnReceive = nullptr;
+
+static void setInputLevel(uint8_t pin, int level) {
+  int previous = pinLevels[pin];
+  pinLevels[pin] = level;
+
+  HalIsr isr = pinIsrs[pin];
+  if (isr == nullptr || previous == level) {
+    return;
+  }
+  int mode = pinIsrModes[pin];
+  if (mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW)) {
+    isr();
+  }
+}
+
+// Simulation controls
+
+void simSeed(uint32_t seed) {
+  randomState = seed != 0 ? seed : 1;
+}
+
+uint64_t simNowMicros() {
+  return nowMicros;
+}
+
+void simAdvanceMicros(uint32_t micros) {
+  uint64_t target = nowMicros + micros;
+
+  while (!scheduledEdges.empty() && scheduledEdges.begin()->first <= target) {
+    auto next = scheduledEdges.begin();
+    nowMicros = next->first;
+    SimEdge edge = next->second;
+    scheduledEdges.erase(next);
+    setInputLevel(edge.pin, edge.level);
+  }
+
+  nowMicros = target;
+}
+
+// This thread's CPU time, so the mock Pi's threads and the host's own
+// scheduling don't count
+static uint64_t threadCpuNanos() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void simChargeCpuTime(uint32_t scale) {
+  cpuScale = scale;
+  cpuMarkNanos = threadCpuNanos();
+  cpuCarryNanos = 0;
+}
+
+// Charges the CPU time used since the last look, scaled, firing any edges
+// due on the way like interrupts in the middle of a task
+static void chargeCpuTime() {
+  if (cpuScale == 0 || cpuPaused > 0) {
+    return;
+  }
+  uint64_t now = threadCpuNanos();
+  cpuCarryNanos += (now - cpuMarkNanos) * cpuScale;
+  cpuMarkNanos = now;
+  if (cpuCarryNanos >= 1000) {
+    cpuPaused++;
+    simAdvanceMicros(cpuCarryNanos / 1000);
+    cpuPaused--;
+    cpuCarryNanos %= 1000;
+  }
+}
+
+// Sleeping costs no CPU time. Neither do calls into the host kernel, whose
+// sockets and files say nothing about lwIP's or the flash's cost.
+static void pauseCpuTime() {
+  chargeCpuTime();
+  cpuPaused++;
+}
+
+static void resumeCpuTime() {
+  if (--cpuPaused == 0) {
+    cpuMarkNanos = threadCpuNanos();
+  }
+}
+
+struct HostCall {
+  HostCall() {
+    pauseCpuTime();
+  }
+  ~HostCall() {
+    resumeCpuTime();
+  }
+};
+
+void simScheduleEdge(uint64_t atMicros, uint8_t pin, int level) {
+  if (pin >= SIM_PIN_COUNT) {
+    return;
+  }
+  scheduledEdges.insert(std::make_pair(atMicros, SimEdge{pin, level}));
+}
+
+size_t simPendingEdges() {
+  return scheduledEdges.size();
+}
+
+void simSetNetworkConnected(bool connected) {
+  networkConnected = connected;
+}
+
+void simSetTcpUnreachable(bool unreachable) {
+  tcpUnreachable = unreachable;
+  if (!unreachable) {
+    return;
+  }
+  // Open connections die with the host, the peer just stops answering
+  for (HalSocket i = 0; i < HAL_MAX_SOCKETS; i++) {
+    if (socketInUse[i] && socketOutgoing[i]) {
+      shutdown(socketFds[i], SHUT_RDWR);
+    }
+  }
+}
+
+uint32_t simUnansweredConnects() {
+  return unansweredConnects;
+}
+
+int simPinOutput(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+int simAnalogOutput(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? analogLevels[pin] : 0;
+}
+
+// Time
+
+uint32_t halMillis() {
+  chargeCpuTime();
+  return (uint32_t)(nowMicros / 1000);
+}
+
+uint32_t halMicros() {
+  chargeCpuTime();
+  return (uint32_t)nowMicros;
+}
+
+void halDelay(uint32_t ms) {
+  pauseCpuTime();
+  simAdvanceMicros(ms * 1000);
+  resumeCpuTime();
+}
+
+// The virtual clock stands still while code runs, so stage timings use the
+// host's clock in nanoseconds instead
+uint32_t halCycleCount() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t halCyclesPerMicro() {
+  return 1000;
+}
+
+static void replayEdge(uint8_t pin, int level, uint32_t micros) {
+  replayLevel = level;
+  replayMicros = micros;
+  replaying = true;
+  pinIsrs[pin]();
+  replaying = false;
+}
+
+static int wakePinIndex(uint8_t pin) {
+  for (uint8_t i = 0; i < wakePinCount; i++) {
+    if (wakePins[i] == pin) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Edges change the pins but run no ISR until the CPU is back, about
+// HAL_LIGHT_WAKE_US after the first wake pin changed. Then the wake pins'
+// ISRs are replayed the way the ESP8266 backend does it.
+static void lightSleep(uint64_t target) {
+  uint64_t sleepStart = nowMicros;
+  int sleepLevels[HAL_MAX_WAKE_PINS];
+  bool changed[HAL_MAX_WAKE_PINS] = {};
+  for (uint8_t i = 0; i < wakePinCount; i++) {
+    sleepLevels[i] = pinLevels[wakePins[i]];
+  }
+
+  bool woken = false;
+  while (!scheduledEdges.empty() && scheduledEdges.begin()->first <= target) {
+    auto next = scheduledEdges.begin();
+    nowMicros = next->first;
+    SimEdge edge = next->second;
+    scheduledEdges.erase(next);
+    pinLevels[edge.pin] = edge.level;
+
+    int index = wakePinIndex(edge.pin);
+    if (index >= 0 && !woken) {
+      woken = true;
+      target = nowMicros + HAL_LIGHT_WAKE_US - SIM_LIGHT_WAKE_JITTER_US / 2 + halRandom() % SIM_LIGHT_WAKE_JITTER_US;
+    }
+    if (index >= 0) {
+      changed[index] = true;
+    }
+  }
+  nowMicros = target;
+
+  for (uint8_t i = 0; i < wakePinCount; i++) {
+    uint8_t pin = wakePins[i];
+    if (!changed[i] || pinIsrs[pin] == nullptr) {
+      continue;
+    }
+    uint64_t at = nowMicros - HAL_LIGHT_WAKE_US > sleepStart ? nowMicros - HAL_LIGHT_WAKE_US : sleepStart;
+    replayEdge(pin, sleepLevels[i] == HIGH ? LOW : HIGH, (uint32_t)at);
+    if (pinLevels[pin] == sleepLevels[i]) {
+      replayEdge(pin, pinLevels[pin], (uint32_t)nowMicros);
+    }
+  }
+}
+
+static void sleepUntil(uint32_t maxMs) {
+  uint64_t target = nowMicros + maxMs * 1000ULL;
+
+  // Stand-in for the lwIP receive callback
+  pollfd udp = {udpFd, POLLIN, 0};
+  if (udpFd >= 0 && udpOnReceive != nullptr && poll(&udp, 1, 0) == 1) {
+    udpOnReceive();
+    return;
+  }
+
+  if (powerMode == HAL_POWER_LIGHT && maxMs >= HAL_LIGHT_SLEEP_MIN_MS) {
+    lightSleep(target);
+    return;
+  }
+
+  while (!scheduledEdges.empty() && scheduledEdges.begin()->first <= target) {
+    auto next = scheduledEdges.begin();
+    nowMicros = next->first;
+    SimEdge edge = next->second;
+    scheduledEdges.erase(next);
+    setInputLevel(edge.pin, edge.level);
+    if (wakeRequested) {
+      return;
+    }
+  }
+
+  nowMicros = target;
+}
+
+void halSleep(uint32_t maxMs) {
+  // Like esp_delay(), a wake raised since the last sleep ends this one at
+  // once - with CPU time charged, edges can fire between passes
+  pauseCpuTime();
+  if (!wakeRequested) {
+    sleepUntil(maxMs);
+  }
+  wakeRequested = false;
+  resumeCpuTime();
+}
+
+void halWake() {
+  wakeRequested = true;
+}
+
+// The radio isn't modelled, only light sleep's effect on the pins
+void halSetPowerMode(uint8_t mode, const uint8_t* pins, uint8_t count) {
+  powerMode = mode;
+  wakePinCount = count < HAL_MAX_WAKE_PINS ? count : HAL_MAX_WAKE_PINS;
+  memcpy(wakePins, pins, wakePinCount);
+}
+
+// GPIO
+
+void halPinMode(uint8_t pin, uint8_t mode) {
+  if (pin < SIM_PIN_COUNT && mode == INPUT_PULLUP) {
+    pinLevels[pin] = HIGH;
+  }
+}
+
+int halDigitalRead(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+void halDigitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < SIM_PIN_COUNT) {
+    pinLevels[pin] = value;
+  }
+}
+
+void halAnalogWrite(uint8_t pin, int value) {
+  if (pin < SIM_PIN_COUNT) {
+    analogLevels[pin] = value;
+  }
+}
+
+void halAttachInterrupt(uint8_t pin, HalIsr isr, int mode) {
+  if (pin < SIM_PIN_COUNT) {
+    pinIsrs[pin] = isr;
+    pinIsrModes[pin] = mode;
+  }
+}
+
+int halPinEdge(uint8_t pin, uint32_t* micros) {
+  if (replaying) {
+    *micros = replayMicros;
+    return replayLevel;
+  }
+  *micros = halMicros();
+  return halDigitalRead(pin);
+}
+
+// System
+
+uint32_t halRandom() {
+  // xorshift32 - deterministic for a given simSeed()
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+// The console only reaches stdout with --verbose
+int halConsoleWritable() {
+  return SIM_CONSOLE_WRITABLE;
+}
+
+void halConsoleWrite(const char* data, size_t length) {
+  HostCall call;
+  if (Serial.echo) {
+    fwrite(data, 1, length, stdout);
+  }
+}
+
+// Storage lives in RAM, so every simulator run starts with blank flash
+static std::map<std::string, std::vector<uint8_t>> storedFiles;
+
+bool halStorageLoad(const char* path, void* data, size_t size) {
+  HostCall call;
+  auto file = storedFiles.find(path);
+  if (file == storedFiles.end() || file->second.size() != size) {
+    return false;
+  }
+  memcpy(data, file->second.data(), size);
+  return true;
+}
+
+bool halStorageSave(const char* path, const void* data, size_t size) {
+  HostCall call;
+  const uint8_t* bytes = (const uint8_t*)data;
+  storedFiles[path].assign(bytes, bytes + size);
+  return true;
+}
+
+// Firmware in RAM, laid out like the device's flash. halRestart() doesn't
+// restart anything, it carries out the boot command and counts.
+enum SimBootCommand : uint8_t {
+  SIM_BOOT_NONE,
+  SIM_BOOT_STAGED,
+  SIM_BOOT_BACKUP
+};
+
+static std::vector<uint8_t> runningImage;
+static std::vector<uint8_t> backupImage(SIM_FIRMWARE_SLOT, 0xFF);
+static std::vector<uint8_t> stagedImage;
+static uint32_t stageSize = 0;
+static bool staging = false;
+static uint8_t bootCommand = SIM_BOOT_NONE;
+static uint32_t restoreSize = 0;
+static uint32_t restarts = 0;
+
+void simSetFirmware(const uint8_t* image, size_t size) {
+  runningImage.assign(image, image + size);
+}
+
+size_t simFirmware(const uint8_t** image) {
+  *image = runningImage.data();
+  return runningImage.size();
+}
+
+uint32_t simRestarts() {
+  return restarts;
+}
+
+uint32_t halFirmwareSize() {
+  return runningImage.size();
+}
+
+bool halFirmwareRead(uint32_t offset, uint8_t* data, size_t length) {
+  if (offset > runningImage.size() || length > runningImage.size() - offset) {
+    return false;
+  }
+  memcpy(data, runningImage.data() + offset, length);
+  return true;
+}
+
+bool halFirmwareBackup(uint32_t sector) {
+  uint32_t offset = sector * HAL_FLASH_SECTOR_SIZE;
+  if (offset + HAL_FLASH_SECTOR_SIZE > SIM_FIRMWARE_SLOT) {
+    return false;
+  }
+  for (uint32_t i = 0; i < HAL_FLASH_SECTOR_SIZE; i++) {
+    backupImage[offset + i] = offset + i < runningImage.size() ? runningImage[offset + i] : 0xFF;
+  }
+  return true;
+}
+
+bool halFirmwareBegin(uint32_t size) {
+  if (runningImage.size() > SIM_FIRMWARE_SLOT || size > SIM_FIRMWARE_SLOT) {
+    return false;
+  }
+  stagedImage.clear();
+  stageSize = size;
+  staging = true;
+  return true;
+}
+
+bool halFirmwareWrite(const uint8_t* data, size_t length) {
+  if (!staging || length > stageSize - stagedImage.size()) {
+    return false;
+  }
+  stagedImage.insert(stagedImage.end(), data, data + length);
+  return true;
+}
+
+bool halFirmwareEnd() {
+  if (!staging || stagedImage.size() != stageSize) {
+    return false;
+  }
+  staging = false;
+  bootCommand = SIM_BOOT_STAGED;
+  return true;
+}
+
+void halFirmwareAbort() {
+  staging = false;
+  bootCommand = SIM_BOOT_NONE;
+}
+
+bool halFirmwareRestoreBackup(uint32_t size) {
+  if (size == 0 || size > SIM_FIRMWARE_SLOT) {
+    return false;
+  }
+  bootCommand = SIM_BOOT_BACKUP;
+  restoreSize = size;
+  return true;
+}
+
+void halRestart() {
+  if (bootCommand == SIM_BOOT_STAGED) {
+    runningImage = stagedImage;
+  } else if (bootCommand == SIM_BOOT_BACKUP) {
+    runningImage.assign(backupImage.begin(), backupImage.begin() + restoreSize);
+  }
+  bootCommand = SIM_BOOT_NONE;
+  restarts++;
+}
+
+// Network - real loopback sockets, never blocking except for halTcpConnect()
+
+bool halNetworkConnected() {
+  return networkConnected;
+}
+
+// Opens a non-blocking socket into a free slot and starts the handshake.
+// *pending is set while it is still under way.
+static HalSocket startConnect(const char* host, uint16_t port, bool* pending) {
+  HalSocket slot = HAL_INVALID_SOCKET;
+  for (HalSocket i = 0; i < HAL_MAX_SOCKETS; i++) {
+    if (!socketInUse[i]) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot == HAL_INVALID_SOCKET) {
+    return HAL_INVALID_SOCKET;
+  }
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, host, &address.sin_addr) != 1) {
+    return HAL_INVALID_SOCKET;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return HAL_INVALID_SOCKET;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  int noDelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  // An unreachable host never answers the SYN, so don't send one
+  *pending = tcpUnreachable;
+  if (!tcpUnreachable && connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+    if (errno != EINPROGRESS) {
+      close(fd);
+      return HAL_INVALID_SOCKET;
+    }
+    *pending = true;
+  }
+
+  socketFds[slot] = fd;
+  socketInUse[slot] = true;
+  socketOutgoing[slot] = true;
+  socketUnanswered[slot] = tcpUnreachable;
+  socketConnecting[slot] = *pending;
+  if (tcpUnreachable) {
+    unansweredConnects++;
+  }
+  return slot;
+}
+
+HalSocket halTcpConnect(const char* host, uint16_t port, uint32_t timeoutMs) {
+  HostCall call;
+  bool pending;
+  HalSocket slot = startConnect(host, port, &pending);
+  if (slot == HAL_INVALID_SOCKET || !pending) {
+    return slot;
+  }
+
+  // Waits out the timeout for an unreachable host too, as poll() would
+  pollfd waitFor = {socketFds[slot], POLLOUT, 0};
+  int error = 0;
+  socklen_t errorLength = sizeof(error);
+  if (socketUnanswered[slot] || poll(&waitFor, 1, timeoutMs) != 1 ||
+      getsockopt(socketFds[slot], SOL_SOCKET, SO_ERROR, &error, &errorLength) < 0 || error != 0) {
+    if (socketUnanswered[slot]) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+    }
+    halTcpClose(slot);
+    return HAL_INVALID_SOCKET;
+  }
+  socketConnecting[slot] = false;
+  return slot;
+}
+
+HalSocket halTcpConnectStart(const char* host, uint16_t port) {
+  HostCall call;
+  bool pending;
+  return startConnect(host, port, &pending);
+}
+
+bool halTcpConnecting(HalSocket socket) {
+  HostCall call;
+  if (!socketConnecting[socket] || socketUnanswered[socket]) {
+    return socketConnecting[socket];
+  }
+  pollfd waitFor = {socketFds[socket], POLLOUT, 0};
+  if (poll(&waitFor, 1, 0) != 1) {
+    return true;
+  }
+  // A refused connection reads as closed from here on
+  socketConnecting[socket] = false;
+  return false;
+}
+
+int halTcpWrite(HalSocket socket, const uint8_t* data, size_t length) {
+  HostCall call;
+  ssize_t written = send(socketFds[socket], data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+  return written < 0 ? 0 : (int)written;
+}
+
+int halTcpAvailable(HalSocket socket) {
+  HostCall call;
+  int available = 0;
+  if (ioctl(socketFds[socket], FIONREAD, &available) < 0) {
+    return 0;
+  }
+  return available;
+}
+
+int halTcpRead(HalSocket socket, uint8_t* data, size_t length) {
+  HostCall call;
+  ssize_t received = recv(socketFds[socket], data, length, MSG_DONTWAIT);
+  return received < 0 ? 0 : (int)received;
+}
+
+bool halTcpConnected(HalSocket socket) {
+  HostCall call;
+  if (socketConnecting[socket]) {
+    return false;
+  }
+  uint8_t peek;
+  ssize_t received = recv(socketFds[socket], &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (received > 0) {
+    return true;
+  }
+  return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void halTcpClose(HalSocket socket) {
+  HostCall call;
+  close(socketFds[socket]);
+  socketInUse[socket] = false;
+  socketConnecting[socket] = false;
+  socketUnanswered[socket] = false;
+}
+
+int halTcpWritable(HalSocket socket) {
+  HostCall call;
+  pollfd writable = {socketFds[socket], POLLOUT, 0};
+  return poll(&writable, 1, 0) == 1 && (writable.revents & POLLOUT) ? SIM_SOCKET_WRITABLE : 0;
+}
+
+int8_t halTcpListen(uint16_t port) {
+  HostCall call;
+  if (listenerCount >= HAL_MAX_LISTENERS) {
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 4) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  listenerFds[listenerCount] = fd;
+  return listenerCount++;
+}
+
+HalSocket halTcpAccept(int8_t listener) {
+  HostCall call;
+  int fd = accept(listenerFds[listener], nullptr, nullptr);
+  if (fd < 0) {
+    return HAL_INVALID_SOCKET;
+  }
+
+  for (HalSocket i = 0; i < HAL_MAX_SOCKETS; i++) {
+    if (!socketInUse[i]) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+      int noDelay = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+      socketFds[i] = fd;
+      socketInUse[i] = true;
+      socketOutgoing[i] = false;
+      return i;
+    }
+  }
+
+  close(fd);
+  return HAL_INVALID_SOCKET;
+}
+
+bool halUdpListen(const char* group, uint16_t port, HalIsr onReceive) {
+  HostCall call;
+  udpOnReceive = onReceive;
+
+  if (udpFd < 0) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+      return false;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+      close(fd);
+      return false;
+    }
+    udpFd = fd;
+  }
+
+  if (group == nullptr) {
+    return true;
+  }
+  // Loopback may not route multicast, unicast to the port still works
+  ip_mreq membership = {};
+  inet_pton(AF_INET, group, &membership.imr_multiaddr);
+  membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(udpFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership));
+  return true;
+}
+
+int halUdpRead(uint8_t* data, size_t size, uint32_t* arrivedMicros) {
+  HostCall call;
+  if (udpFd < 0) {
+    return 0;
+  }
+  ssize_t received = recv(udpFd, data, size, MSG_DONTWAIT | MSG_TRUNC);
+  if (received <= 0) {
+    return 0;
+  }
+  *arrivedMicros = halMicros();
+  return received < (ssize_t)size ? (int)received : (int)size;
+}
+
+bool halUdpSend(const char* host, uint16_t port, const uint8_t* data, size_t length) {
+  HostCall call;
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (udpFd < 0 || !networkConnected || inet_pton(AF_INET, host, &address.sin_addr) != 1) {
+    return false;
+  }
+  return sendto(udpFd, data, length, MSG_DONTWAIT, (sockaddr*)&address, sizeof(address)) == (ssize_t)length;
+}
+
+#endif
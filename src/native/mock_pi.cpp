@@ -0,0 +1,295 @@
+#ifdef NATIVE_BUILD
+
+#include "mock_pi.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <mutex>
+#include <vector>
+#include "wire_protocol.h"
+
+#define MOCK_PI_BACKLOG 64
+#define MOCK_PI_TOKEN_MAX 64
+#define MOCK_PI_BODY_MAX 1024
+
+struct MockClient {
+  int fd;
+  bool wire;
+  std::string buffer;
+};
+
+static const char response[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: application/json\r\n"
+  "Content-Length: 2\r\n"
+  "Connection: keep-alive\r\n"
+  "\r\n"
+  "{}";
+
+static int wireListenFd = -1;
+static uint16_t wireListenPort = 0;
+
+// Held answers, see setMockPiDelay(). Queued by the server thread, sent by
+// the caller of sendMockPiAnswers().
+struct MockAnswer {
+  int fd;
+  bool stamped;
+  uint32_t dueMs;
+  std::string bytes;
+};
+
+static bool delaying = false;
+static uint32_t answerDelayMs = 0;
+static uint32_t stallEvery = 0;
+static uint32_t requestCount = 0;
+static std::atomic<uint32_t> stalls(0);
+static std::mutex answersMutex;
+static std::vector<MockAnswer> heldAnswers;
+
+static uint32_t loseEvery = 0;
+static uint32_t postCount = 0;
+static std::atomic<uint32_t> losses(0);
+
+void setMockPiDelay(uint32_t delayMs, uint32_t every) {
+  delaying = delayMs > 0 || every > 0;
+  answerDelayMs = delayMs;
+  stallEvery = every;
+}
+
+void sendMockPiAnswers(uint32_t nowMs) {
+  std::lock_guard<std::mutex> lock(answersMutex);
+  for (MockAnswer& answer : heldAnswers) {
+    if (!answer.stamped) {
+      answer.stamped = true;
+      answer.dueMs = nowMs + answerDelayMs;
+    }
+  }
+  // In order per connection, so nothing overtakes a held answer
+  for (size_t i = 0; i < heldAnswers.size(); i++) {
+    bool blocked = false;
+    for (size_t j = 0; j < i && !blocked; j++) {
+      blocked = heldAnswers[j].fd == heldAnswers[i].fd;
+    }
+    if (blocked || (int32_t)(nowMs - heldAnswers[i].dueMs) < 0) {
+      continue;
+    }
+    send(heldAnswers[i].fd, heldAnswers[i].bytes.data(), heldAnswers[i].bytes.size(), MSG_NOSIGNAL);
+    heldAnswers.erase(heldAnswers.begin() + i);
+    i--;
+  }
+}
+
+uint32_t mockPiStalls() {
+  return stalls;
+}
+
+void setMockPiLoss(uint32_t every) {
+  loseEvery = every;
+}
+
+uint32_t mockPiLosses() {
+  return losses;
+}
+
+static bool losePost() {
+  if (loseEvery == 0 || ++postCount % loseEvery != 0) {
+    return false;
+  }
+  losses++;
+  return true;
+}
+
+// Answers now, later or never
+static void answer(int fd, const void* data, size_t length) {
+  if (!delaying) {
+    send(fd, data, length, MSG_NOSIGNAL);
+    return;
+  }
+  requestCount++;
+  if (stallEvery > 0 && requestCount % stallEvery == 0) {
+    stalls++;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(answersMutex);
+  heldAnswers.push_back({fd, false, 0, std::string((const char*)data, length)});
+}
+
+static void dropAnswers(int fd) {
+  std::lock_guard<std::mutex> lock(answersMutex);
+  for (size_t i = 0; i < heldAnswers.size(); i++) {
+    if (heldAnswers[i].fd == fd) {
+      heldAnswers.erase(heldAnswers.begin() + i);
+      i--;
+    }
+  }
+}
+
+int openMockPi(const char* address, uint16_t* port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  sockaddr_in bound = {};
+  bound.sin_family = AF_INET;
+  bound.sin_port = htons(*port);
+  if (fd < 0 || inet_pton(AF_INET, address, &bound.sin_addr) != 1 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+      bind(fd, (sockaddr*)&bound, sizeof(bound)) < 0 || listen(fd, MOCK_PI_BACKLOG) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  socklen_t length = sizeof(bound);
+  getsockname(fd, (sockaddr*)&bound, &length);
+  *port = ntohs(bound.sin_port);
+  return fd;
+}
+
+void setMockPiWire(int wireFd, uint16_t wirePort) {
+  wireListenFd = wireFd;
+  wireListenPort = wirePort;
+}
+
+// Splits the request line, passes the body on and answers
+static void handleRequest(int fd, const std::string& request, size_t headerEnd, MockPiHandler handler) {
+  char method[MOCK_PI_TOKEN_MAX] = "";
+  char path[MOCK_PI_TOKEN_MAX] = "";
+  sscanf(request.c_str(), "%63s %63s", method, path);
+  if (handler != nullptr) {
+    handler(method, path, request.substr(headerEnd + 4));
+  }
+
+  if (wireListenFd < 0 || strcmp(method, "GET") != 0 || strcmp(path, "/status") != 0) {
+    answer(fd, response, sizeof(response) - 1);
+    return;
+  }
+  char body[64];
+  int bodyLength = snprintf(body, sizeof(body), "{\"wireVersion\":%u,\"wirePort\":%u}", WIRE_VERSION,
+                            wireListenPort);
+  char status[256];
+  int length = snprintf(status, sizeof(status),
+                        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\n"
+                        "Connection: keep-alive\r\n\r\n%s",
+                        bodyLength, body);
+  answer(fd, status, length);
+}
+
+// Handles every complete request in the buffer. Returns false when a lost
+// POST closes the connection.
+static bool handleHttp(MockClient* client, MockPiHandler handler) {
+  while (true) {
+    size_t headerEnd = client->buffer.find("\r\n\r\n");
+    if (headerEnd == std::string::npos) {
+      break;
+    }
+    size_t lengthAt = client->buffer.find("Content-Length: ");
+    size_t bodyLength = lengthAt < headerEnd ? atoi(client->buffer.c_str() + lengthAt + 16) : 0;
+    size_t total = headerEnd + 4 + bodyLength;
+    if (client->buffer.size() < total) {
+      break;
+    }
+    if (client->buffer.compare(0, 5, "POST ") == 0 && losePost()) {
+      return false;
+    }
+    handleRequest(client->fd, client->buffer.substr(0, total), headerEnd, handler);
+    client->buffer.erase(0, total);
+  }
+  return true;
+}
+
+// Same for frames. Returns false on a frame that can't be decoded, after
+// which the stream can't be resynchronized, and on a lost one.
+static bool handleFrames(MockClient* client, MockPiHandler handler) {
+  while (client->buffer.size() >= WIRE_HEADER_SIZE) {
+    const uint8_t* data = (const uint8_t*)client->buffer.data();
+    WireHeader header;
+    if (!decodeWireHeader(data, client->buffer.size(), &header)) {
+      return false;
+    }
+    size_t total = WIRE_HEADER_SIZE + header.length;
+    if (client->buffer.size() < total) {
+      break;
+    }
+    if (losePost()) {
+      return false;
+    }
+
+    const char* path = "";
+    char body[MOCK_PI_BODY_MAX];
+    int bodyLength = wireFrameToRequest(header, data + WIRE_HEADER_SIZE, &path, body, sizeof(body));
+    if (bodyLength >= 0 && handler != nullptr) {
+      handler("POST", path, std::string(body, bodyLength));
+    }
+
+    uint8_t ack[WIRE_HEADER_SIZE + WIRE_ACK_SIZE];
+    WireHeader ackHeader = {WIRE_VERSION, WIRE_ACK, header.seq, WIRE_ACK_SIZE};
+    encodeWireHeader(ackHeader, ack, sizeof(ack));
+    encodeWireAck(bodyLength >= 0 ? 200 : 400, ack + WIRE_HEADER_SIZE, WIRE_ACK_SIZE);
+    answer(client->fd, ack, sizeof(ack));
+    client->buffer.erase(0, total);
+  }
+  return true;
+}
+
+void runMockPi(int listenFd, MockPiHandler handler, const std::atomic<bool>& running) {
+  // Listeners first, then one entry per client in both
+  std::vector<pollfd> fds = {{listenFd, POLLIN, 0}};
+  std::vector<MockClient> clients = {{listenFd, false, ""}};
+  if (wireListenFd >= 0) {
+    fds.push_back({wireListenFd, POLLIN, 0});
+    clients.push_back({wireListenFd, true, ""});
+  }
+  size_t listeners = fds.size();
+
+  while (running) {
+    if (poll(fds.data(), fds.size(), 50) <= 0) {
+      continue;
+    }
+
+    for (size_t i = 0; i < listeners; i++) {
+      if (fds[i].revents & POLLIN) {
+        int client = accept(fds[i].fd, nullptr, nullptr);
+        if (client >= 0) {
+          fds.push_back({client, POLLIN, 0});
+          clients.push_back({client, clients[i].wire, ""});
+        }
+      }
+    }
+
+    for (size_t i = listeners; i < fds.size(); i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+        continue;
+      }
+      char chunk[1024];
+      ssize_t received = recv(fds[i].fd, chunk, sizeof(chunk), 0);
+      bool open = received > 0;
+      if (open) {
+        clients[i].buffer.append(chunk, received);
+        if (clients[i].wire) {
+          open = handleFrames(&clients[i], handler);
+        } else {
+          open = handleHttp(&clients[i], handler);
+        }
+      }
+      if (!open) {
+        dropAnswers(fds[i].fd);
+        close(fds[i].fd);
+        fds.erase(fds.begin() + i);
+        clients.erase(clients.begin() + i);
+        i--;
+      }
+    }
+  }
+
+  for (size_t i = listeners; i < fds.size(); i++) {
+    dropAnswers(fds[i].fd);
+    close(fds[i].fd);
+  }
+}
+
+#endif
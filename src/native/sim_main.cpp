@@ -0,0 +1,607 @@
+#ifdef NATIVE_BUILD
+
+// Native simulator - runs the firmware's game logic on the host against a
+// virtual clock, scripted laser/button traces and a mock Pi served over
+// loopback. Reports goal/point delivery and per-loop latency.
+//
+//   .pio/build/native/program [--matches N] [--seed N] [--trace FILE] [--verbose]
+//
+// Trace files have one "<micros> <pin> <level>" edge per line, '#' starts a
+// comment. Without --trace, synthetic matches are generated. --calibrate
+// starts goal detector calibration first, for traces that open with one.
+// --binary sets the device to the binary protocol, which the mock Pi
+// offers on a second port. The mock Pi also answers clock exchanges and
+// stamps its goal broadcasts on a clock SIM_PI_CLOCK_OFFSET_US ahead of the
+// virtual one; --traces appends the device's goal traces to FILE after
+// every match, for the trace_collector tool. --pi-delay MS holds each of
+// the mock Pi's answers back MS virtual ms and --pi-stall N leaves every
+// Nth request unanswered; --max-loop-us fails the run if any loop pass
+// took longer than that on the host, the bound a slow Pi must not break.
+// --pi-lose N closes the connection on every Nth POST instead of applying
+// it; every synthetic goal and point must still reach the mock Pi exactly
+// once, which it checks by journal seq like the real Pi.
+// --idle S sets the power
+// state timeouts to S and 2S seconds and leaves the table alone for 3S
+// between matches, so each match starts by waking the device.
+// --pi-restart N restarts the mock Pi's broadcasts after every N goals: a
+// new boot id, and seqs from 1 again. Every goal's broadcast must still be
+// delivered.
+// --pi-unreachable S drops the Pi's host off the network for the first S
+// seconds of every match: connects to it go unanswered and open ones are
+// cut. With --max-loop-us this checks that waiting for a connect never
+// holds up a loop pass.
+
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "game.h"
+#include "hal.h"
+#include "outbound.h"
+#include "event_journal.h"
+#include "laser_capture.h"
+#include "payloads.h"
+#include "scheduler.h"
+#include "score_broadcast.h"
+#include "clock_sync.h"
+#include "goal_trace.h"
+#include "event_stream.h"
+#include "goal_detector.h"
+#include "metrics.h"
+#include "log.h"
+#include "device_config.h"
+#include "power_state.h"
+#include "sim.h"
+#include "mock_pi.h"
+
+#define SIM_LEGACY_PERIOD_MS 10   // The delay() the old loop() ended with
+#define SIM_GOALS_PER_MATCH 10
+#define SIM_PRESSES_PER_MATCH 4
+#define SIM_DRAIN_TIMEOUT_MS 5000
+#define SIM_PI_CLOCK_OFFSET_US 0x9E3779B9UL   // Anything, the offset wraps
+#define SIM_PI_BOOT 0x5EED0001UL
+
+// Counters updated by the mock Pi thread
+static std::atomic<uint32_t> serverRequests(0);
+static std::atomic<uint32_t> serverGoals(0);
+static std::atomic<uint32_t> serverPoints(0);
+static std::atomic<uint32_t> serverDuplicates(0);
+static std::atomic<bool> serverRunning(true);
+
+// The mock Pi's clock, the virtual one plus an offset. Written by the loop,
+// read by the mock Pi thread.
+static std::atomic<uint32_t> piMicros(SIM_PI_CLOCK_OFFSET_US);
+
+// Highest journal seq applied per epoch, as the Pi keeps it. Only the mock
+// Pi thread touches it.
+static std::map<uint32_t, uint32_t> appliedSeqs;
+
+// False for a copy of an event that was already applied. Requests without
+// a seq always apply.
+static bool firstCopy(uint32_t epoch, uint32_t seq) {
+  if (seq == 0) {
+    return true;
+  }
+  uint32_t& applied = appliedSeqs[epoch];
+  if (seq <= applied) {
+    serverDuplicates++;
+    return false;
+  }
+  applied = seq;
+  return true;
+}
+
+static bool firstCopy(const std::string& body) {
+  uint32_t epoch = 0;
+  uint32_t seq = 0;
+  parseUintField(body.c_str(), "epoch", &epoch);
+  parseUintField(body.c_str(), "seq", &seq);
+  return firstCopy(epoch, seq);
+}
+
+// Mock Pi score broadcast - every goal is announced twice, the device
+// should deliver each seq once. The next table's Pi shares the group and
+// port, and announces a goal of its own each time; the device should drop
+// those.
+static int broadcastFd = -1;
+static uint32_t broadcastSeq = 0;
+static uint32_t broadcastsSent = 0;
+static uint32_t broadcastBoot = SIM_PI_BOOT;
+static uint32_t restartEvery = 0;
+static uint32_t piRestarts = 0;
+static uint16_t broadcastScoresSent[SCORE_PLAYER_COUNT];
+
+static void broadcastGoal(const std::string& body) {
+  char player[PLAYER_NAME_MAX];
+  ScorePacket packet = {};
+  if (!parsePlayerField(body.c_str(), player, sizeof(player)) || !parseScorePlayer(player, &packet.player)) {
+    return;
+  }
+  if (restartEvery > 0 && broadcastSeq == restartEvery) {
+    broadcastSeq = 0;
+    broadcastBoot++;
+    piRestarts++;
+  }
+  broadcastScoresSent[packet.player]++;
+  broadcastsSent++;
+  packet.seq = ++broadcastSeq;
+  packet.table = deviceConfig().tableId;
+  packet.boot = broadcastBoot;
+  memcpy(packet.scores, broadcastScoresSent, sizeof(packet.scores));
+  if (parseTraceField(body.c_str(), &packet.trace)) {
+    packet.piReceivedUs = piMicros;
+    packet.piSentUs = piMicros;
+  }
+
+  // Far from this table's seqs and scores, so a leak throws the match
+  // state off
+  ScorePacket neighbour = packet;
+  neighbour.table = packet.table + 1;
+  neighbour.seq = packet.seq + 0x80000000UL;
+  neighbour.boot = ~packet.boot;
+  neighbour.scores[SCORE_PLAYER_RED] += 100;
+  neighbour.trace = 0;
+
+  uint8_t datagram[SCORE_PACKET_SIZE];
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(SCORE_BROADCAST_PORT);
+  encodeScorePacket(packet, datagram, sizeof(datagram));
+  for (int copy = 0; copy < 2; copy++) {
+    sendto(broadcastFd, datagram, sizeof(datagram), 0, (sockaddr*)&address, sizeof(address));
+  }
+  encodeScorePacket(neighbour, datagram, sizeof(datagram));
+  sendto(broadcastFd, datagram, sizeof(datagram), 0, (sockaddr*)&address, sizeof(address));
+}
+
+// Counts what the device delivered to the mock Pi. Like a Pi serving
+// several tables, it only takes goals, resets and events with this
+// device's table.
+static void handleMockRequest(const char*, const char* path, const std::string& body) {
+  serverRequests++;
+  uint32_t table = SCORE_TABLE_ANY;
+  parseUintField(body.c_str(), "table", &table);
+  if (table != deviceConfig().tableId) {
+    return;
+  }
+  if (strcmp(path, "/score") == 0) {
+    if (firstCopy(body)) {
+      serverGoals++;
+      broadcastGoal(body);
+    }
+  } else if (strcmp(path, "/reset") == 0) {
+    firstCopy(body);
+  } else if (strcmp(path, "/events") == 0) {
+    uint32_t epoch = 0;
+    parseUintField(body.c_str(), "epoch", &epoch);
+    // One {"seq":N,...,"type":"..."} object per event
+    size_t position = 0;
+    while ((position = body.find("{\"seq\":", position)) != std::string::npos) {
+      uint32_t seq = strtoul(body.c_str() + position + 7, nullptr, 10);
+      size_t type = body.find("\"type\":\"", position);
+      position++;
+      if (type == std::string::npos || !firstCopy(epoch, seq)) {
+        continue;
+      }
+      if (body.compare(type + 8, 4, "goal") == 0) {
+        // Announced like one from /score, the event's own "player" is next
+        serverGoals++;
+        broadcastGoal(body.substr(type));
+      } else if (body.compare(type + 8, 5, "point") == 0) {
+        serverPoints++;
+      }
+    }
+  }
+}
+
+// Synthetic match - goals with realistic beam-break widths and button
+// presses with contact bounce. Returns the match end time.
+static uint64_t scheduleMatch(uint64_t start, uint32_t* goals, uint32_t* points) {
+  uint64_t t = start;
+
+  for (int i = 0; i < SIM_GOALS_PER_MATCH; i++) {
+    t += 2500000 + halRandom() % 4000000;          // 2.5-6.5 s between goals
+    uint32_t width = 1500 + halRandom() % 20000;   // ~6-80 km/h shots
+    simScheduleEdge(t, LASER_BREAK_PIN, LOW);      // Beam broken
+    simScheduleEdge(t + width, LASER_BREAK_PIN, HIGH);
+    (*goals)++;
+
+    if (i < SIM_PRESSES_PER_MATCH) {
+      // Up tap with a few ms of bounce on press and release
+      uint64_t press = t + 1000000;
+      simScheduleEdge(press, BUTTON_UP_PIN, LOW);
+      simScheduleEdge(press + 800, BUTTON_UP_PIN, HIGH);
+      simScheduleEdge(press + 1500, BUTTON_UP_PIN, LOW);
+      simScheduleEdge(press + 120000, BUTTON_UP_PIN, HIGH);
+      simScheduleEdge(press + 120600, BUTTON_UP_PIN, LOW);
+      simScheduleEdge(press + 121000, BUTTON_UP_PIN, HIGH);
+      (*points)++;
+    }
+  }
+
+  return t + 1000000;
+}
+
+static uint64_t loadTrace(const char* path, uint64_t start) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "Cannot open trace %s\n", path);
+    exit(1);
+  }
+
+  uint64_t end = start;
+  char line[128];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    unsigned long long at;
+    unsigned int pin;
+    int level;
+    if (line[0] == '#' || sscanf(line, "%llu %u %d", &at, &pin, &level) != 3) {
+      continue;
+    }
+    simScheduleEdge(start + at, pin, level);
+    end = std::max(end, (uint64_t)(start + at));
+  }
+  fclose(file);
+  return end + 1000000;
+}
+
+// Mock Pi's side of the clock exchange, answered between loop passes so
+// the virtual clock stands still meanwhile
+static int clockFd = -1;
+
+static void answerClockRequests() {
+  uint8_t request[CLOCK_PACKET_SIZE];
+  uint8_t reply[CLOCK_PACKET_SIZE];
+  sockaddr_in from = {};
+  socklen_t fromLength = sizeof(from);
+  ssize_t length;
+  while ((length = recvfrom(clockFd, request, sizeof(request), MSG_DONTWAIT, (sockaddr*)&from, &fromLength)) > 0) {
+    size_t replyLength = answerClockRequest(request, length, piMicros, piMicros, reply, sizeof(reply));
+    if (replyLength > 0) {
+      sendto(clockFd, reply, replyLength, 0, (sockaddr*)&from, fromLength);
+    }
+    fromLength = sizeof(from);
+  }
+}
+
+static FILE* tracesFile = nullptr;
+
+static void writeTraceLine(const char* text, size_t length) {
+  fwrite(text, 1, length, tracesFile);
+}
+
+// One loop() pass, timed on the host clock. Every pass is a wake-up.
+static std::vector<uint32_t> loopNanos;
+static bool legacyLoop = false;
+static bool realtime = false;
+static std::chrono::steady_clock::time_point realtimeStart;
+
+static void runLoop() {
+  auto begin = std::chrono::steady_clock::now();
+  uint32_t sleepMs = SIM_LEGACY_PERIOD_MS;
+  if (legacyLoop) {
+    schedulerRunAll();
+  } else {
+    sleepMs = schedulerRun();
+  }
+  auto end = std::chrono::steady_clock::now();
+  loopNanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+  piMicros = (uint32_t)simNowMicros() + SIM_PI_CLOCK_OFFSET_US;
+  answerClockRequests();
+  sendMockPiAnswers(simNowMicros() / 1000);
+
+  // Give the mock Pi thread a chance to answer while a request is in flight
+  if (outboundPending() > 0) {
+    std::this_thread::yield();
+  }
+  if (legacyLoop) {
+    halDelay(sleepMs);
+  } else {
+    halSleep(sleepMs);
+  }
+
+  if (realtime) {
+    std::this_thread::sleep_until(realtimeStart + std::chrono::microseconds(simNowMicros()));
+  }
+  piMicros = (uint32_t)simNowMicros() + SIM_PI_CLOCK_OFFSET_US;
+}
+
+int main(int argc, char** argv) {
+  int matches = 1000;
+  uint32_t seed = 1;
+  const char* trace = nullptr;
+  const char* tracesPath = nullptr;
+  uint16_t streamPort = 0;
+  bool calibrate = false;
+  bool metrics = false;
+  bool binary = false;
+  uint32_t idleS = 0;
+  uint32_t piDelayMs = 0;
+  uint32_t piStallEvery = 0;
+  uint32_t piLoseEvery = 0;
+  uint32_t maxLoopUs = 0;
+  uint32_t unreachableS = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--matches") == 0 && i + 1 < argc) {
+      matches = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace = argv[++i];
+    } else if (strcmp(argv[i], "--legacy-loop") == 0) {
+      legacyLoop = true;
+    } else if (strcmp(argv[i], "--stream-port") == 0 && i + 1 < argc) {
+      streamPort = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--realtime") == 0) {
+      realtime = true;
+    } else if (strcmp(argv[i], "--calibrate") == 0) {
+      calibrate = true;
+    } else if (strcmp(argv[i], "--metrics") == 0) {
+      metrics = true;
+    } else if (strcmp(argv[i], "--binary") == 0) {
+      binary = true;
+    } else if (strcmp(argv[i], "--traces") == 0 && i + 1 < argc) {
+      tracesPath = argv[++i];
+    } else if (strcmp(argv[i], "--pi-delay") == 0 && i + 1 < argc) {
+      piDelayMs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--pi-stall") == 0 && i + 1 < argc) {
+      piStallEvery = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--pi-lose") == 0 && i + 1 < argc) {
+      piLoseEvery = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--max-loop-us") == 0 && i + 1 < argc) {
+      maxLoopUs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--idle") == 0 && i + 1 < argc) {
+      idleS = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--pi-restart") == 0 && i + 1 < argc) {
+      restartEvery = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--pi-unreachable") == 0 && i + 1 < argc) {
+      unreachableS = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      Serial.echo = true;
+    } else {
+      fprintf(stderr, "Usage: %s [--matches N] [--seed N] [--trace FILE] [--legacy-loop]\n"
+                      "       [--stream-port N] [--realtime] [--calibrate] [--metrics] [--binary]\n"
+                      "       [--traces FILE] [--pi-delay MS] [--pi-stall N] [--pi-lose N]\n"
+                      "       [--max-loop-us US] [--idle S] [--pi-restart N] [--pi-unreachable S]\n"
+                      "       [--verbose]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  uint16_t port = 0;
+  int listenFd = openMockPi("127.0.0.1", &port);
+  if (listenFd < 0) {
+    fprintf(stderr, "Cannot start mock server\n");
+    return 1;
+  }
+  uint16_t wirePort = 0;
+  int wireFd = -1;
+  if (binary) {
+    wireFd = openMockPi("127.0.0.1", &wirePort);
+    setMockPiWire(wireFd, wirePort);
+  }
+  setMockPiDelay(piDelayMs, piStallEvery);
+  setMockPiLoss(piLoseEvery);
+  broadcastFd = socket(AF_INET, SOCK_DGRAM, 0);
+  clockFd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in clockAddress = {};
+  clockAddress.sin_family = AF_INET;
+  clockAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  clockAddress.sin_port = htons(CLOCK_SYNC_PORT);
+  if (bind(clockFd, (sockaddr*)&clockAddress, sizeof(clockAddress)) < 0) {
+    fprintf(stderr, "Cannot bind the clock port %u, traces stay in device time\n", CLOCK_SYNC_PORT);
+  }
+  if (tracesPath != nullptr && (tracesFile = fopen(tracesPath, "a")) == nullptr) {
+    fprintf(stderr, "Cannot open %s\n", tracesPath);
+    return 1;
+  }
+  std::thread server(runMockPi, listenFd, handleMockRequest, std::cref(serverRunning));
+
+  // Same bring-up as setup(), minus the ESP8266 WiFi and web server
+  simSeed(seed);
+  setupLog();
+  loadDeviceConfig();
+  setupGame();
+  setupOutbound("127.0.0.1", port);
+  setClockServer("127.0.0.1");
+  setupJournal(scorePlayerName(playerSide), scorePlayerName(opponentSide), deviceConfig().tableId);
+  if (binary) {
+    DeviceConfig config = deviceConfig();
+    config.protocol = DEVICE_PROTOCOL_BINARY;
+    saveDeviceConfig(config);
+  }
+  if (idleS > 0) {
+    setIdleTimeouts(idleS, idleS * 2);
+  }
+  simSetNetworkConnected(true);
+  wifiConnected = true;
+  negotiateWireProtocol();
+  listenForScoreBroadcasts();
+  if (streamPort != 0) {
+    setupEventStream(streamPort);
+  }
+  setStatusColor(STATUS_READY);
+  if (calibrate) {
+    startLaserCalibration();
+  }
+  realtimeStart = std::chrono::steady_clock::now() - std::chrono::microseconds(simNowMicros());
+
+  uint32_t goals = 0;
+  uint32_t points = 0;
+  auto wallStart = std::chrono::steady_clock::now();
+
+  if (trace != nullptr) {
+    matches = 1;
+    uint64_t end = loadTrace(trace, simNowMicros());
+    while (simNowMicros() < end) {
+      runLoop();
+    }
+  } else {
+    for (int match = 0; match < matches; match++) {
+      // Long enough to step all the way down
+      uint64_t idleEnd = simNowMicros() + idleS * 3000000ULL;
+      while (simNowMicros() < idleEnd) {
+        runLoop();
+      }
+      uint64_t reachableAt = simNowMicros() + unreachableS * 1000000ULL;
+      simSetTcpUnreachable(unreachableS > 0);
+      uint64_t end = scheduleMatch(simNowMicros(), &goals, &points);
+      while (simNowMicros() < end) {
+        if (simNowMicros() >= reachableAt) {
+          simSetTcpUnreachable(false);
+        }
+        runLoop();
+      }
+      if (tracesFile != nullptr) {
+        writeGoalTraces(writeTraceLine, deviceConfig().tableId, scorePlayerName(playerSide));
+      }
+    }
+  }
+
+  // Let the last requests reach the mock Pi
+  auto drainStart = std::chrono::steady_clock::now();
+  while ((outboundPending() > 0 || journalPending() > 0) &&
+         std::chrono::steady_clock::now() - drainStart < std::chrono::milliseconds(SIM_DRAIN_TIMEOUT_MS)) {
+    runLoop();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  if (tracesFile != nullptr) {
+    writeGoalTraces(writeTraceLine, deviceConfig().tableId, scorePlayerName(playerSide));
+    fclose(tracesFile);
+  }
+
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  serverRunning = false;
+  server.join();
+  close(listenFd);
+  if (wireFd >= 0) {
+    close(wireFd);
+  }
+
+  std::vector<uint32_t> sorted = loopNanos;
+  std::sort(sorted.begin(), sorted.end());
+  uint64_t total = 0;
+  for (uint32_t nanos : sorted) {
+    total += nanos;
+  }
+
+  printf("Loop mode:        %s\n", legacyLoop ? "legacy 10 ms tick" : "scheduler");
+  printf("Matches:          %d\n", matches);
+  printf("Simulated time:   %.1f s in %.2f s wall\n", simNowMicros() / 1e6, wallSeconds);
+  printf("Loop iterations:  %zu (%.1f wake-ups/s)\n", sorted.size(), sorted.size() / (simNowMicros() / 1e6));
+  printf("Loop latency:     avg %.2f us, p50 %.2f us, p99 %.2f us, max %.2f us\n",
+         total / 1000.0 / sorted.size(),
+         sorted[sorted.size() / 2] / 1000.0,
+         sorted[sorted.size() * 99 / 100] / 1000.0,
+         sorted.back() / 1000.0);
+  if (trace == nullptr) {
+    printf("Goals:            %u injected, %u received, %u duplicates dropped\n", goals, serverGoals.load(),
+           serverDuplicates.load());
+    printf("Points:           %u injected, %u received\n", points, serverPoints.load());
+  } else {
+    printf("Goals received:   %u\n", serverGoals.load());
+    printf("Points received:  %u\n", serverPoints.load());
+  }
+  const OutboundStats& outbound = outboundStats();
+  printf("Requests:         %u (%u reconnects, %u failed)\n", serverRequests.load(), outbound.reconnects,
+         outbound.failures);
+  if (piDelayMs > 0 || piStallEvery > 0 || piLoseEvery > 0) {
+    printf("Slow Pi:          answers held %u ms, %u requests never answered, %u lost\n", piDelayMs,
+           mockPiStalls(), mockPiLosses());
+  }
+  if (unreachableS > 0) {
+    printf("Unreachable Pi:   first %u s of every match, %u connects unanswered\n", unreachableS,
+           simUnansweredConnects());
+  }
+  printf("Protocol:         %s, %u frames, %u bytes sent, %u received\n",
+         outboundWireActive() ? "binary" : "json", outbound.frames, outbound.bytesSent, outbound.bytesReceived);
+  printf("Laser overflows:  %u\n", laserEdgeOverflows());
+  const GoalDetectorConfig& detector = goalDetectorConfig();
+  const GoalDetectorStats& laser = goalDetectorStats();
+  printf("Goal detector:    glitch %u us, min break %u us, rearm %u ms, calibration %s\n",
+         detector.glitchUs, detector.minBreakUs, detector.rearmUs / 1000,
+         goalCalibrationPhaseName(goalCalibration().phase));
+  printf("Filtered:         %u glitches, %u short breaks, %u bounces\n",
+         laser.glitches, laser.shortBreaks, laser.bounces);
+  if (streamPort != 0) {
+    const EventStreamStats& stream = eventStreamStats();
+    printf("Event stream:     %u published, %u connections, %u slow consumers dropped\n",
+           stream.published, stream.connections, stream.slowConsumerDrops);
+  }
+  const ScoreReceiverStats& broadcast = scoreReceiverStats();
+  printf("Broadcasts:       %u sent, %u received, %u delivered, %u duplicates, %u skipped, %u other table\n",
+         broadcastsSent * 3, broadcast.received, broadcast.delivered, broadcast.duplicates, broadcast.skipped,
+         broadcast.otherTable);
+  if (restartEvery > 0) {
+    printf("Pi restarts:      %u, %u seen by the receiver\n", piRestarts, broadcast.restarts);
+  }
+  const ClockSyncStats& clock = clockSyncStats();
+  printf("Clock sync:       %u requests, %u replies, %s, offset off by %d us (bound %u us)\n", clock.requests,
+         clock.replies, clock.synced ? "synced" : "not synced",
+         (int)(clock.offsetUs - SIM_PI_CLOCK_OFFSET_US), clockSyncErrorMicros());
+  uint32_t complete = 0;
+  for (uint8_t i = 0; i < goalTraceCount(); i++) {
+    // The sim's device is never the scoring side, so it doesn't celebrate
+    complete += (goalTrace(i).seen & ~(1 << GOAL_HOP_CELEBRATED)) == (1 << GOAL_HOP_CELEBRATED) - 1;
+  }
+  const PowerStats& power = powerStats(halMillis());
+  printf("Power:            active %u s, idle %u s, sleep %u s; woken by laser %u, button %u, goal %u\n",
+         power.seconds[POWER_ACTIVE], power.seconds[POWER_IDLE], power.seconds[POWER_SLEEP],
+         power.wakes[POWER_WAKE_LASER], power.wakes[POWER_WAKE_BUTTON], power.wakes[POWER_WAKE_GOAL]);
+  printf("Wake-to-ready:    last %u us, max %u us, %u goals scored on the waking break\n", power.lastWakeUs,
+         power.maxWakeUs, power.wakeGoals);
+  printf("Goal traces:      %u of the last %u with every hop up to notified\n", complete, goalTraceCount());
+  const MatchState& match = matchState();
+  printf("Match state:      red %u - blue %u goals, %u points, %u pending, version %u, server seq %u\n",
+         match.sides[SCORE_PLAYER_RED].goals, match.sides[SCORE_PLAYER_BLUE].goals,
+         match.sides[playerSide].points + match.sides[playerSide].quantumPoints, match.pending,
+         (unsigned)match.version, (unsigned)match.serverSeq);
+
+  printf("Tasks:\n");
+  for (int8_t task = 0; task < schedulerTaskCount(); task++) {
+    const TaskStats& stats = schedulerTaskStats(task);
+    printf("  %-10s %8u runs, %7u signals, max signal latency %u us, max run %u us\n",
+           stats.name, stats.runs, stats.signals, stats.maxSignalLatencyMicros, stats.runTime.maxMicros);
+  }
+
+  // No pass may wait on the Pi, however slow it is
+  bool bounded = true;
+  if (maxLoopUs > 0) {
+    bounded = sorted.back() / 1000 <= maxLoopUs;
+    printf("Loop bound:       max %.2f us, limit %u us: %s\n", sorted.back() / 1000.0, maxLoopUs,
+           bounded ? "PASS" : "FAIL");
+  }
+
+  // Whatever failed on the way, each goal and point counts once on both ends
+  bool delivered = true;
+  if (trace == nullptr) {
+    uint32_t matchGoals = match.sides[SCORE_PLAYER_RED].goals + match.sides[SCORE_PLAYER_BLUE].goals;
+    delivered = serverGoals == goals && serverPoints == points && matchGoals == goals && match.pending == 0 &&
+                broadcast.delivered == goals;
+    printf("Delivery:         %u of %u goals on the Pi, %u in the match state, %u broadcast, %u pending: %s\n",
+           serverGoals.load(), goals, matchGoals, broadcast.delivered, match.pending, delivered ? "PASS" : "FAIL");
+  }
+
+  // The page GET /metrics serves
+  if (metrics) {
+    printf("Metrics:\n");
+    writeMetrics([](const char* text, size_t length) {
+      fwrite(text, 1, length, stdout);
+    });
+  }
+
+  return bounded && delivered ? 0 : 1;
+}
+
+#endif
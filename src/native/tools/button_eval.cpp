@@ -0,0 +1,470 @@
+#ifdef NATIVE_BUILD
+
+// Button input tests - replays labelled button traces through the
+// firmware's debounce and gesture recognizer and checks every gesture comes
+// out as labelled, with nothing extra. Reports the latency from the first
+// contact edge to each gesture, next to the old polled 500 ms debounce.
+//
+//   .pio/build/button_eval/program TRACE...
+//   .pio/build/button_eval/program --generate FILE [--seed N] [--presses N]
+//
+// Traces use the simulator's "<micros> <pin> <level>" lines (level 0 is
+// pressed), so the same file can be played with the native env's --trace.
+// Labels are "#<gesture> <micros> <button>" comment lines, with the time of
+// the press's first contact edge - the first pressed button's for a chord.
+// Gestures are tap, double-tap, long-press and chord (button "up+down").
+//
+// --generate writes a synthetic trace with contact bounce on press and
+// release, chatter while held, interference spikes on idle lines, quick
+// taps, double taps, loose chords and long presses.
+
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "button_input.h"
+
+// BUTTON_*_PIN in game.h, in ButtonId order
+static const unsigned buttonPins[BUTTON_COUNT] = {5, 4, 0};
+
+#define CHORD_BUTTONS (BUTTON_BIT(BUTTON_UP) | BUTTON_BIT(BUTTON_DOWN))
+#define LONG_PRESS_BUTTONS BUTTON_BIT(BUTTON_QUANTUM)
+#define MATCH_WINDOW_US 1000     // Label to the detected press's first edge
+#define DRAIN_US 3000000UL       // Time given to settle after the last edge
+#define LEGACY_DEBOUNCE_US 500000UL  // What updateButton() used to wait
+#define LEGACY_POLL_US 10000UL       // ...polled at BUTTON_POLL_MS
+
+struct TraceEdge {
+  uint32_t micros;
+  uint8_t button;
+  bool pressed;
+};
+
+struct Gesture {
+  uint8_t gesture;
+  uint8_t button;      // First pressed, for a chord
+  uint32_t startMicros;
+};
+
+struct Trace {
+  std::vector<TraceEdge> edges;
+  std::vector<Gesture> labels;
+};
+
+struct Score {
+  uint32_t hits;
+  uint32_t missed;
+  uint32_t extra;
+};
+
+static int findButton(const char* name) {
+  if (strcmp(name, "up+down") == 0) {
+    return BUTTON_UP;
+  }
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    if (strcmp(name, buttonName(i)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int findGesture(const char* name) {
+  for (uint8_t i = 0; i <= BUTTON_GESTURE_CHORD; i++) {
+    if (strcmp(name, buttonGestureName(i)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool loadTrace(const char* path, Trace* trace) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "Cannot open trace %s\n", path);
+    return false;
+  }
+
+  char line[128];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    unsigned long long at;
+    unsigned int pin;
+    int level;
+    char gesture[16];
+    char button[16];
+    if (line[0] == '#') {
+      int gestureId;
+      int buttonId;
+      if (sscanf(line, "#%15s %llu %15s", gesture, &at, button) == 3 && (gestureId = findGesture(gesture)) >= 0 &&
+          (buttonId = findButton(button)) >= 0) {
+        trace->labels.push_back({(uint8_t)gestureId, (uint8_t)buttonId, (uint32_t)at});
+      }
+      continue;
+    }
+    if (sscanf(line, "%llu %u %d", &at, &pin, &level) != 3) {
+      continue;
+    }
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      if (buttonPins[i] == pin) {
+        trace->edges.push_back({(uint32_t)at, i, level == 0});  // Inverted because of pullup
+      }
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// Each label can be matched by one detection at most
+static Score scoreGestures(const std::vector<Gesture>& labels, const std::vector<Gesture>& detected,
+                           bool verbose) {
+  Score score = {};
+  std::vector<bool> matched(labels.size(), false);
+  for (const Gesture& found : detected) {
+    bool hit = false;
+    for (size_t i = 0; i < labels.size() && !hit; i++) {
+      const Gesture& label = labels[i];
+      uint32_t distance = found.startMicros > label.startMicros ? found.startMicros - label.startMicros
+                                                                : label.startMicros - found.startMicros;
+      // A chord's first button is whichever contact closed first
+      bool sameButton = label.button == found.button || label.gesture == BUTTON_GESTURE_CHORD;
+      if (!matched[i] && label.gesture == found.gesture && sameButton && distance <= MATCH_WINDOW_US) {
+        matched[i] = true;
+        hit = true;
+      }
+    }
+    if (hit) {
+      score.hits++;
+    } else {
+      score.extra++;
+      if (verbose) {
+        printf("  unexpected %s %s at %u us\n", buttonGestureName(found.gesture), buttonName(found.button),
+               found.startMicros);
+      }
+    }
+  }
+  for (size_t i = 0; i < labels.size(); i++) {
+    if (!matched[i]) {
+      score.missed++;
+      if (verbose) {
+        printf("  missed %s %s at %u us\n", buttonGestureName(labels[i].gesture), buttonName(labels[i].button),
+               labels[i].startMicros);
+      }
+    }
+  }
+  return score;
+}
+
+static void collect(std::vector<Gesture>* detected, std::vector<uint32_t> latencies[], uint32_t nowMicros) {
+  ButtonEvent event;
+  while (nextButtonEvent(&event, nowMicros)) {
+    detected->push_back({event.gesture, event.button, event.atMicros - event.latencyMicros});
+    latencies[event.gesture].push_back(event.latencyMicros);
+  }
+}
+
+static std::vector<Gesture> runRecognizer(const Trace& trace, std::vector<uint32_t> latencies[]) {
+  std::vector<Gesture> detected;
+  resetButtonInput(CHORD_BUTTONS, LONG_PRESS_BUTTONS, 0, 0);
+
+  // Drained at every edge and whenever the recognizer asks to be woken,
+  // as the button task does
+  uint32_t now = 0;
+  for (const TraceEdge& edge : trace.edges) {
+    uint32_t timeout;
+    while ((timeout = buttonInputTimeout(now)) != BUTTON_INPUT_IDLE && now + timeout < edge.micros) {
+      now += timeout;
+      collect(&detected, latencies, now);
+    }
+    buttonInputEdge(edge.button, edge.pressed, edge.micros);
+    now = edge.micros;
+    collect(&detected, latencies, now);
+  }
+  collect(&detected, latencies, now + DRAIN_US);
+  return detected;
+}
+
+// What updateButton() and handleButtonActions() did before - a press only
+// counts once the contact has held for the whole debounce, and up + down
+// only reset when both land in the same pass
+static std::vector<Gesture> runLegacy(const Trace& trace) {
+  std::vector<Gesture> detected;
+  bool raw[BUTTON_COUNT] = {};
+  bool lastState[BUTTON_COUNT] = {};
+  bool current[BUTTON_COUNT] = {};
+  uint32_t changed[BUTTON_COUNT] = {};
+  uint32_t start[BUTTON_COUNT] = {};
+  size_t next = 0;
+  uint32_t end = trace.edges.empty() ? 0 : trace.edges.back().micros + DRAIN_US;
+
+  for (uint32_t now = 0; now < end; now += LEGACY_POLL_US) {
+    while (next < trace.edges.size() && trace.edges[next].micros <= now) {
+      raw[trace.edges[next].button] = trace.edges[next].pressed;
+      next++;
+    }
+    bool pressed[BUTTON_COUNT] = {};
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      if (raw[i] != lastState[i]) {
+        changed[i] = now;
+        if (raw[i] && !current[i]) {
+          start[i] = now;
+        }
+      }
+      if (now - changed[i] > LEGACY_DEBOUNCE_US && raw[i] != current[i]) {
+        current[i] = raw[i];
+        pressed[i] = current[i];
+      }
+      lastState[i] = raw[i];
+    }
+
+    if (pressed[BUTTON_UP] && pressed[BUTTON_DOWN]) {
+      detected.push_back({BUTTON_GESTURE_CHORD, BUTTON_UP, start[BUTTON_UP]});
+      pressed[BUTTON_UP] = pressed[BUTTON_DOWN] = false;
+    }
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      if (pressed[i]) {
+        detected.push_back({BUTTON_GESTURE_TAP, i, start[i]});
+      }
+    }
+  }
+  return detected;
+}
+
+// The old code only knew taps and the reset combo
+static Score scoreLegacy(const Trace& trace) {
+  std::vector<Gesture> labels;
+  for (const Gesture& label : trace.labels) {
+    if (label.gesture == BUTTON_GESTURE_TAP || label.gesture == BUTTON_GESTURE_CHORD) {
+      labels.push_back(label);
+    }
+  }
+  // Presses are only seen at poll times, so match on count and kind alone
+  std::vector<Gesture> detected = runLegacy(trace);
+  Score score = {};
+  for (uint8_t gesture : {BUTTON_GESTURE_TAP, BUTTON_GESTURE_CHORD}) {
+    for (uint8_t button = 0; button < BUTTON_COUNT; button++) {
+      auto same = [&](const Gesture& g) { return g.gesture == gesture && g.button == button; };
+      uint32_t expected = std::count_if(labels.begin(), labels.end(), same);
+      uint32_t found = std::count_if(detected.begin(), detected.end(), same);
+      score.hits += std::min(expected, found);
+      score.missed += expected > found ? expected - found : 0;
+      score.extra += found > expected ? found - expected : 0;
+    }
+  }
+  return score;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, int percent) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+static void printScore(const char* name, const Score& score) {
+  printf("  %-11s %u hit, %u missed, %u unexpected\n", name, score.hits, score.missed, score.extra);
+}
+
+// Synthetic trace generation
+
+struct Generator {
+  std::mt19937 random;
+  std::vector<TraceEdge> edges;
+  std::vector<Gesture> labels;
+  bool tapped[BUTTON_COUNT] = {};
+  uint32_t lastTap[BUTTON_COUNT] = {};
+
+  explicit Generator(uint32_t seed) : random(seed) {}
+
+  uint32_t between(uint32_t low, uint32_t high) { return low + random() % (high - low + 1); }
+
+  // Contact bounce - a burst of short opens and closes before it settles
+  uint32_t bounce(uint8_t button, uint32_t t, bool settled) {
+    uint32_t bursts = random() % 100 < 20 ? 0 : between(1, 6);
+    for (uint32_t i = 0; i < bursts; i++) {
+      uint32_t level = between(20, 900);
+      edges.push_back({t, button, settled});
+      edges.push_back({t + level, button, !settled});
+      t += level + between(20, 700);
+    }
+    edges.push_back({t, button, settled});
+    return t;
+  }
+
+  // One press held for holdUs, returns the time of its first edge
+  uint32_t press(uint8_t button, uint32_t t, uint32_t holdUs) {
+    bounce(button, t, true);
+    // Chatter from a worn contact while held
+    uint32_t chatter = random() % 100 < 15 ? between(1, 3) : 0;
+    for (uint32_t i = 0; i < chatter; i++) {
+      uint32_t at = t + between(15000, holdUs - 10000);
+      edges.push_back({at, button, false});
+      edges.push_back({at + between(50, 400), button, true});
+    }
+    bounce(button, t + holdUs, false);
+    return t;
+  }
+
+  void label(uint8_t gesture, uint8_t button, uint32_t t) { labels.push_back({gesture, button, t}); }
+
+  void tap(uint8_t button, uint32_t t) {
+    label(BUTTON_GESTURE_TAP, button, t);
+    if (tapped[button] && t - lastTap[button] <= BUTTON_DOUBLE_TAP_US) {
+      label(BUTTON_GESTURE_DOUBLE_TAP, button, t);
+      tapped[button] = false;
+      return;
+    }
+    tapped[button] = true;
+    lastTap[button] = t;
+  }
+};
+
+static int generateTrace(const char* path, uint32_t seed, uint32_t presses) {
+  Generator gen(seed);
+  uint32_t t = 500000;
+  uint32_t spikes = 0;
+
+  for (uint32_t i = 0; i < presses; i++) {
+    uint32_t kind = gen.random() % 100;
+    if (kind < 45) {
+      // A run of point taps on up or down, some quick enough to double tap.
+      // Gaps stay clear of the double tap window's edge either way.
+      uint8_t button = gen.random() % 2 == 0 ? BUTTON_UP : BUTTON_DOWN;
+      uint32_t taps = gen.between(1, 4);
+      for (uint32_t n = 0; n < taps; n++) {
+        gen.press(button, t, gen.between(40000, 150000));
+        gen.tap(button, t);
+        t += gen.random() % 100 < 50 ? gen.between(180000, 320000) : gen.between(500000, 900000);
+      }
+    } else if (kind < 65) {
+      // Quantum tap, let go well before a long press
+      uint32_t hold = gen.between(50000, 900000);
+      gen.press(BUTTON_QUANTUM, t, hold);
+      gen.tap(BUTTON_QUANTUM, t);
+      t += hold + gen.between(500000, 800000);
+    } else if (kind < 75) {
+      gen.press(BUTTON_QUANTUM, t, gen.between(1700000, 2600000));
+      gen.label(BUTTON_GESTURE_LONG_PRESS, BUTTON_QUANTUM, t);
+      gen.tapped[BUTTON_QUANTUM] = false;
+      t += gen.between(2700000, 3500000);
+    } else {
+      // Up and down together for a reset, pressed up to 35 ms apart
+      uint8_t first = gen.random() % 2 == 0 ? BUTTON_UP : BUTTON_DOWN;
+      uint8_t second = first == BUTTON_UP ? BUTTON_DOWN : BUTTON_UP;
+      uint32_t offset = gen.between(0, 35000);
+      gen.press(first, t, gen.between(150000, 600000));
+      gen.press(second, t + offset, gen.between(150000, 600000));
+      gen.label(BUTTON_GESTURE_CHORD, first, t);
+      gen.tapped[BUTTON_UP] = gen.tapped[BUTTON_DOWN] = false;
+      t += gen.between(800000, 1500000);
+    }
+
+    // Interference on an idle line now and then, far too short to count
+    if (gen.random() % 100 < 30) {
+      uint8_t button = gen.random() % BUTTON_COUNT;
+      uint32_t at = t - gen.between(100000, 150000);
+      uint32_t count = gen.between(1, 5);
+      for (uint32_t n = 0; n < count; n++) {
+        uint32_t width = gen.between(5, 2000);
+        gen.edges.push_back({at, button, true});
+        gen.edges.push_back({at + width, button, false});
+        at += width + gen.between(200, 3000);
+      }
+      spikes++;
+    }
+  }
+
+  std::stable_sort(gen.edges.begin(), gen.edges.end(),
+                   [](const TraceEdge& a, const TraceEdge& b) { return a.micros < b.micros; });
+  std::stable_sort(gen.labels.begin(), gen.labels.end(),
+                   [](const Gesture& a, const Gesture& b) { return a.startMicros < b.startMicros; });
+
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    return 1;
+  }
+  fprintf(file, "# Synthetic button trace, seed %u: %zu gestures with contact bounce, chatter and spikes\n", seed,
+          gen.labels.size());
+  fprintf(file, "# <micros> <pin> <level>, level 0 is pressed. #<gesture> <micros> <button> labels a gesture.\n");
+  size_t label = 0;
+  for (const TraceEdge& edge : gen.edges) {
+    while (label < gen.labels.size() && gen.labels[label].startMicros <= edge.micros) {
+      const Gesture& g = gen.labels[label++];
+      fprintf(file, "#%s %u %s\n", buttonGestureName(g.gesture), g.startMicros,
+              g.gesture == BUTTON_GESTURE_CHORD ? "up+down" : buttonName(g.button));
+    }
+    fprintf(file, "%u %u %d\n", edge.micros, buttonPins[edge.button], edge.pressed ? 0 : 1);
+  }
+  fclose(file);
+  printf("Wrote %s: %zu gestures, %zu edges, %u interference bursts\n", path, gen.labels.size(), gen.edges.size(),
+         spikes);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const char* generatePath = nullptr;
+  uint32_t seed = 1;
+  uint32_t presses = 60;
+  bool verbose = false;
+  std::vector<const char*> paths;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+      generatePath = argv[++i];
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--presses") == 0 && i + 1 < argc) {
+      presses = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      verbose = true;
+    } else if (argv[i][0] != '-') {
+      paths.push_back(argv[i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--verbose] TRACE...\n"
+                      "       %s --generate FILE [--seed N] [--presses N]\n",
+              argv[0], argv[0]);
+      return 1;
+    }
+  }
+
+  if (generatePath != nullptr) {
+    return generateTrace(generatePath, seed, presses);
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "No trace files given\n");
+    return 1;
+  }
+
+  bool passed = true;
+  std::vector<uint32_t> latencies[BUTTON_GESTURE_CHORD + 1];
+  for (const char* path : paths) {
+    Trace trace;
+    if (!loadTrace(path, &trace)) {
+      return 1;
+    }
+    printf("%s: %zu edges, %zu labelled gestures\n", path, trace.edges.size(), trace.labels.size());
+
+    Score score = scoreGestures(trace.labels, runRecognizer(trace, latencies), verbose);
+    const ButtonInputStats& stats = buttonInputStats();
+    printf("Filtered:     %u bounces in %u edges, longest debounce %u us\n", stats.bounces, stats.edges,
+           stats.maxDebounceMicros);
+    printScore("recognizer", score);
+    printScore("legacy", scoreLegacy(trace));
+    passed &= score.missed == 0 && score.extra == 0;
+  }
+
+  printf("%-12s %7s %9s %9s %9s\n", "Latency", "Count", "p50 ms", "p90 ms", "max ms");
+  for (uint8_t gesture = 0; gesture <= BUTTON_GESTURE_CHORD; gesture++) {
+    std::vector<uint32_t>& sorted = latencies[gesture];
+    std::sort(sorted.begin(), sorted.end());
+    printf("%-12s %7zu %9.1f %9.1f %9.1f\n", buttonGestureName(gesture), sorted.size(), percentile(sorted, 50) / 1e3,
+           percentile(sorted, 90) / 1e3, sorted.empty() ? 0 : sorted.back() / 1e3);
+  }
+  printf("%s\n", passed ? "PASS" : "FAIL");
+  return passed ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifdef NATIVE_BUILD
+
+// Point press serializer, before and after the /events batching: pushes
+// synthetic presses through each and reports the cost per press.
+//
+//   .pio/build/events_bench/program [--events N] [--burst N] [--rounds N]
+//
+// Before   one POST /point per press, as the old sendAddPointAPI() built
+//          it: a heap-allocated JSON document serialized into a String,
+//          and ESP8266HTTPClient's request header assembled from Strings.
+//          ArduinoJson isn't a dependency any more, so std::string stands
+//          in for both; the allocations are the point.
+// After    the journal's path: presses in bursts of --burst (default 4),
+//          each burst one formatEventsBody() batch of up to
+//          JOURNAL_BATCH_MAX events plus formatRequestHeader(), into
+//          fixed buffers.
+//
+// Both run --rounds times (default 5) over --events presses (default 10k)
+// and the fastest round counts. Heap allocations are counted through a
+// replaced operator new. The host's allocator is far cheaper than the
+// ESP8266's, so time per press understates what the heap-free path saves
+// there; bytes, requests and allocations carry over as they are.
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "event_journal.h"
+#include "payloads.h"
+
+#define BENCH_HOST "192.168.1.10"
+#define BENCH_PORT 5000
+#define BENCH_TABLE 2
+
+static uint64_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* block = malloc(size > 0 ? size : 1);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+void operator delete(void* block) noexcept {
+  free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+  free(block);
+}
+
+struct BenchResult {
+  uint64_t nanos;
+  uint64_t bytes;      // Request header and body
+  uint32_t requests;
+  uint64_t allocations;
+};
+
+static volatile uint32_t sink = 0;
+
+static uint64_t nowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// What serializeJson() produced for the old JsonDocument
+static std::string legacyBody(const JournalEvent& event) {
+  std::string body = "{\"player\":\"";
+  body += "blue";
+  body += "\",\"amount\":";
+  body += std::to_string(event.value);
+  body += ",\"quantum\":";
+  body += (event.flags & JOURNAL_FLAG_QUANTUM) ? "true" : "false";
+  body += "}";
+  return body;
+}
+
+// ESP8266HTTPClient::sendHeader() for POST(payload)
+static std::string legacyHeader(const std::string& url, size_t bodyLength) {
+  std::string header = "POST ";
+  header += url;
+  header += " HTTP/1.1\r\nHost: ";
+  header += BENCH_HOST;
+  header += ":";
+  header += std::to_string(BENCH_PORT);
+  header += "\r\nUser-Agent: ESP8266HTTPClient\r\nConnection: close\r\n"
+            "Accept-Encoding: identity;q=1,chunked;q=0.1,*;q=0\r\n";
+  header += "Content-Type: application/json\r\n";
+  header += "Content-Length: ";
+  header += std::to_string(bodyLength);
+  header += "\r\n\r\n";
+  return header;
+}
+
+static BenchResult runLegacy(const std::vector<JournalEvent>& events) {
+  BenchResult result = {};
+  uint64_t allocationsBefore = allocations;
+  uint64_t start = nowNanos();
+  for (const JournalEvent& event : events) {
+    // String(baseUrl) + "/point", which HTTPClient::begin() splits up again
+    std::string url = std::string("http://" BENCH_HOST ":5000") + "/point";
+    std::string body = legacyBody(event);
+    std::string header = legacyHeader(url.substr(url.find('/', 7)), body.size());
+    result.bytes += header.size() + body.size();
+    result.requests++;
+    sink += header[0] + body[body.size() - 1];
+  }
+  result.nanos = nowNanos() - start;
+  result.allocations = allocations - allocationsBefore;
+  return result;
+}
+
+static BenchResult runBatched(const std::vector<JournalEvent>& events, uint32_t burst) {
+  static char body[96 + JOURNAL_BATCH_MAX * 112];  // The journal's replayBody
+  char header[160];
+  BenchResult result = {};
+  uint64_t allocationsBefore = allocations;
+  uint64_t start = nowNanos();
+  size_t next = 0;
+  while (next < events.size()) {
+    size_t burstEnd = std::min(events.size(), next + burst);
+    while (next < burstEnd) {
+      uint8_t count = (uint8_t)std::min<size_t>(burstEnd - next, JOURNAL_BATCH_MAX);
+      int length = formatEventsBody(body, sizeof(body), "blue", "red", BENCH_TABLE, 0x5EED, events[next].timestamp,
+                                    &events[next], count);
+      int headerLength = formatRequestHeader(header, sizeof(header), "/events", BENCH_HOST, BENCH_PORT, length);
+      result.bytes += headerLength + length;
+      result.requests++;
+      sink += header[0] + body[length - 1];
+      next += count;
+    }
+  }
+  result.nanos = nowNanos() - start;
+  result.allocations = allocations - allocationsBefore;
+  return result;
+}
+
+static BenchResult fastest(const BenchResult& a, const BenchResult& b) {
+  return b.nanos < a.nanos ? b : a;
+}
+
+static void printResult(const char* name, const BenchResult& result, size_t events) {
+  printf("%-9s %8.1f %10.1f %10u %10.2f\n", name, (double)result.nanos / events, (double)result.bytes / events,
+         result.requests, (double)result.allocations / events);
+}
+
+int main(int argc, char** argv) {
+  uint32_t eventCount = 10000;
+  uint32_t burst = 4;
+  uint32_t rounds = 5;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+      eventCount = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc) {
+      burst = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+      rounds = strtoul(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: %s [--events N] [--burst N] [--rounds N]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (eventCount == 0 || burst == 0 || rounds == 0) {
+    fprintf(stderr, "--events, --burst and --rounds must be at least 1\n");
+    return 1;
+  }
+
+  // Presses ~60 ms apart within a burst, every fifth one in quantum mode
+  std::vector<JournalEvent> events(eventCount);
+  uint32_t t = 1000;
+  for (uint32_t i = 0; i < eventCount; i++) {
+    t += i % burst == 0 ? 5000 : 60;
+    events[i] = {i + 1, t, JOURNAL_POINT, (uint8_t)(i % 5 == 0 ? JOURNAL_FLAG_QUANTUM : 0), 1};
+  }
+
+  BenchResult legacy = runLegacy(events);
+  BenchResult batched = runBatched(events, burst);
+  for (uint32_t round = 1; round < rounds; round++) {
+    legacy = fastest(legacy, runLegacy(events));
+    batched = fastest(batched, runBatched(events, burst));
+  }
+
+  printf("%u presses in bursts of %u, fastest of %u rounds\n\n", eventCount, burst, rounds);
+  printf("%-9s %8s %10s %10s %10s\n", "", "ns/press", "bytes/press", "requests", "allocs/press");
+  printResult("before", legacy, eventCount);
+  printResult("after", batched, eventCount);
+  printf("\nAfter against before: %.2fx the time, %.2fx the bytes, %.2fx the requests\n",
+         (double)batched.nanos / std::max<uint64_t>(legacy.nanos, 1),
+         (double)batched.bytes / std::max<uint64_t>(legacy.bytes, 1),
+         (double)batched.requests / std::max<uint32_t>(legacy.requests, 1));
+  return 0;
+}
+
+#endif
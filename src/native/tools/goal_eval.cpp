@@ -0,0 +1,369 @@
+#ifdef NATIVE_BUILD
+
+// Goal detector evaluation - replays labelled beam traces through the
+// firmware's goal detector and reports precision and recall, next to the
+// old single-edge detector with its fixed 2 s cooldown.
+//
+//   .pio/build/goal_eval/program [--calibrate] [--glitch-us N] [--min-break-us N]
+//                                [--rearm-ms N] [--require PERCENT] TRACE...
+//   .pio/build/goal_eval/program --generate FILE [--seed N] [--goals N]
+//
+// Traces use the simulator's "<micros> <pin> <level>" lines, so the same
+// file can be played with the native env's --trace. Only laser pin edges
+// are read. Ground truth is one "#goal <micros>" line per real goal, which
+// the simulator skips as a comment.
+//
+// --calibrate runs the detector's calibration over the trace first and
+// evaluates with what it learned; the trace has to open with a quiet stretch
+// and a few goals for that. --require fails the run when precision or
+// recall is below PERCENT. --generate writes a synthetic trace with ambient
+// flicker, glitches inside breaks, goal mouth bounces, balls stopping in the
+// beam and quick follow-up goals.
+
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "goal_detector.h"
+
+#define LASER_PIN 14                  // LASER_BREAK_PIN in game.h
+#define LEGACY_COOLDOWN_US 2000000UL  // The cooldown the goal detector replaced
+#define MATCH_WINDOW_US 20000         // Detected goal to label distance
+#define DRAIN_US 5000000UL            // Time given to settle after the last edge
+
+struct TraceEdge {
+  uint32_t micros;
+  bool broken;
+};
+
+struct Trace {
+  std::vector<TraceEdge> edges;
+  std::vector<uint32_t> goals;
+};
+
+struct Score {
+  uint32_t truePositives;
+  uint32_t falsePositives;
+  uint32_t falseNegatives;
+
+  double precision() const {
+    uint32_t detected = truePositives + falsePositives;
+    return detected == 0 ? 1.0 : (double)truePositives / detected;
+  }
+  double recall() const {
+    uint32_t labelled = truePositives + falseNegatives;
+    return labelled == 0 ? 1.0 : (double)truePositives / labelled;
+  }
+  void add(const Score& other) {
+    truePositives += other.truePositives;
+    falsePositives += other.falsePositives;
+    falseNegatives += other.falseNegatives;
+  }
+};
+
+static bool loadTrace(const char* path, Trace* trace) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "Cannot open trace %s\n", path);
+    return false;
+  }
+
+  char line[128];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    unsigned long long at;
+    unsigned int pin;
+    int level;
+    if (sscanf(line, "#goal %llu", &at) == 1) {
+      trace->goals.push_back((uint32_t)at);
+    } else if (line[0] != '#' && sscanf(line, "%llu %u %d", &at, &pin, &level) == 3 && pin == LASER_PIN) {
+      trace->edges.push_back({(uint32_t)at, level == 0});  // Inverted for break beam
+    }
+  }
+  fclose(file);
+
+  std::sort(trace->goals.begin(), trace->goals.end());
+  return true;
+}
+
+// Each label can be matched by one detection at most
+static Score scoreDetections(const std::vector<uint32_t>& labels, const std::vector<uint32_t>& detected) {
+  Score score = {};
+  std::vector<bool> matched(labels.size(), false);
+  for (uint32_t at : detected) {
+    bool hit = false;
+    for (size_t i = 0; i < labels.size() && !hit; i++) {
+      uint32_t distance = at > labels[i] ? at - labels[i] : labels[i] - at;
+      if (!matched[i] && distance <= MATCH_WINDOW_US) {
+        matched[i] = true;
+        hit = true;
+      }
+    }
+    if (hit) {
+      score.truePositives++;
+    } else {
+      score.falsePositives++;
+    }
+  }
+  score.falseNegatives = std::count(matched.begin(), matched.end(), false);
+  return score;
+}
+
+static std::vector<uint32_t> runDetector(const Trace& trace) {
+  std::vector<uint32_t> detected;
+  resetGoalDetector(false, 0);
+
+  uint32_t now = 0;
+  GoalEvent event;
+  for (const TraceEdge& edge : trace.edges) {
+    goalDetectorEdge(edge.broken, edge.micros);
+    now = edge.micros;
+    while (nextGoalEvent(&event, now)) {
+      if (event.type == GOAL_EVENT_BREAK && event.goal) {
+        detected.push_back(event.startMicros);
+      }
+    }
+  }
+  while (nextGoalEvent(&event, now + DRAIN_US)) {
+    if (event.type == GOAL_EVENT_BREAK && event.goal) {
+      detected.push_back(event.startMicros);
+    }
+  }
+  return detected;
+}
+
+// What handleLaserBreak() did before the goal detector - every break edge
+// outside the cooldown is a goal
+static std::vector<uint32_t> runLegacy(const Trace& trace) {
+  std::vector<uint32_t> detected;
+  bool lastBroken = false;
+  bool cooldown = false;
+  uint32_t lastGoal = 0;
+  for (const TraceEdge& edge : trace.edges) {
+    if (edge.broken == lastBroken) {
+      continue;
+    }
+    lastBroken = edge.broken;
+    if (edge.broken && (!cooldown || edge.micros - lastGoal > LEGACY_COOLDOWN_US)) {
+      detected.push_back(edge.micros);
+      lastGoal = edge.micros;
+      cooldown = true;
+    }
+  }
+  return detected;
+}
+
+static bool calibrate(const Trace& trace) {
+  resetGoalDetector(false, 0);
+  startGoalCalibration(0);
+
+  GoalEvent event;
+  uint32_t now = 0;
+  for (const TraceEdge& edge : trace.edges) {
+    goalDetectorEdge(edge.broken, edge.micros);
+    now = edge.micros;
+    while (nextGoalEvent(&event, now)) {
+    }
+    if (goalCalibration().phase >= GOAL_CALIBRATION_DONE) {
+      break;
+    }
+  }
+  while (nextGoalEvent(&event, now + GOAL_CALIBRATION_SHOT_GAP_US)) {
+  }
+
+  const GoalCalibration& calibration = goalCalibration();
+  printf("Calibration:  %s after %u shots, noise floor %u us, shortest shot %u us, longest bounce gap %u ms\n",
+         goalCalibrationPhaseName(calibration.phase), calibration.shots, calibration.noiseFloorUs,
+         calibration.shortestShotUs, calibration.longestBounceGapUs / 1000);
+  return calibration.phase == GOAL_CALIBRATION_DONE;
+}
+
+static void printScore(const char* name, const Score& score) {
+  printf("  %-9s precision %5.1f%%  recall %5.1f%%  (%u hit, %u false, %u missed)\n", name,
+         score.precision() * 100, score.recall() * 100,
+         score.truePositives, score.falsePositives, score.falseNegatives);
+}
+
+// Synthetic trace generation
+
+struct Pulse {
+  uint32_t start;
+  uint32_t width;
+};
+
+static void addBreak(std::vector<Pulse>* pulses, std::mt19937& random, uint32_t start, uint32_t width) {
+  // A glitch inside some breaks - the beam shows for a moment at the ball's edge
+  if (width > 1000 && random() % 100 < 30) {
+    uint32_t at = 300 + random() % (width - 600);
+    uint32_t gap = 20 + random() % 180;
+    pulses->push_back({start, at});
+    pulses->push_back({start + at + gap, width - at - gap});
+    return;
+  }
+  pulses->push_back({start, width});
+}
+
+static int generateTrace(const char* path, uint32_t seed, uint32_t goals) {
+  std::mt19937 random(seed);
+  std::vector<Pulse> pulses;
+  std::vector<uint32_t> labels;
+
+  uint32_t t = GOAL_CALIBRATION_QUIET_US + 1000000;  // Room for a calibration quiet phase
+  for (uint32_t i = 0; i < goals; i++) {
+    // Mostly a few seconds apart, some straight after the previous goal.
+    // The opening goals stay apart so calibration can tell them from bounces.
+    bool quick = i > GOAL_CALIBRATION_SHOT_COUNT && random() % 100 < 20;
+    t += quick ? 600000 + random() % 1200000 : 3000000 + random() % 7000000;
+    labels.push_back(t);
+
+    uint32_t width;
+    if (random() % 100 < 10) {
+      width = 150000 + random() % 250000;     // Ball stopped in the beam
+    } else {
+      uint32_t speedKmhX10 = 50 + random() % 550;
+      width = 35 * 36000 / speedKmhX10;        // BALL_DIAMETER_MM, see shot_speed.h
+    }
+    addBreak(&pulses, random, t, width);
+    t += width;
+
+    // Bounces in the goal mouth
+    uint32_t bounces = random() % 4;
+    for (uint32_t b = 0; b < bounces; b++) {
+      t += 30000 + random() % 220000;
+      uint32_t bounceWidth = 1000 + random() % 14000;
+      addBreak(&pulses, random, t, bounceWidth);
+      t += bounceWidth;
+    }
+  }
+  uint32_t end = t + 2000000;
+
+  // Ambient flicker in the clear stretches, now and then in mains-rate bursts,
+  // plus the odd longer shadow from a hand reaching over the goal
+  std::vector<Pulse> flicker;
+  for (uint32_t at = random() % 2000000; at < end; at += 200000 + random() % 4000000) {
+    uint32_t count = random() % 100 < 10 ? 3 + random() % 4 : 1;
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t width = random() % 100 < 5 ? 300 + random() % 600 : 5 + random() % 245;
+      flicker.push_back({at + i * 10000, width});
+    }
+  }
+  for (const Pulse& noise : flicker) {
+    bool overlaps = false;
+    for (const Pulse& pulse : pulses) {
+      if (noise.start + noise.width + 1000 > pulse.start && noise.start < pulse.start + pulse.width + 1000) {
+        overlaps = true;
+        break;
+      }
+    }
+    if (!overlaps) {
+      pulses.push_back(noise);
+    }
+  }
+  std::sort(pulses.begin(), pulses.end(), [](const Pulse& a, const Pulse& b) { return a.start < b.start; });
+
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    return 1;
+  }
+  fprintf(file, "# Synthetic goal detector trace, seed %u: %u goals with flicker, glitches and bounces\n",
+          seed, goals);
+  fprintf(file, "# <micros> <pin> <level>, level 0 is beam broken. #goal marks a real goal.\n");
+  size_t label = 0;
+  for (const Pulse& pulse : pulses) {
+    while (label < labels.size() && labels[label] <= pulse.start) {
+      fprintf(file, "#goal %u\n", labels[label++]);
+    }
+    fprintf(file, "%u %u 0\n%u %u 1\n", pulse.start, LASER_PIN, pulse.start + pulse.width, LASER_PIN);
+  }
+  fclose(file);
+  printf("Wrote %s: %u goals, %zu beam breaks\n", path, goals, pulses.size());
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  GoalDetectorConfig config = goalDetectorConfig();
+  bool calibrateFirst = false;
+  double required = 0;
+  const char* generatePath = nullptr;
+  uint32_t seed = 1;
+  uint32_t goals = 30;
+  std::vector<const char*> paths;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--calibrate") == 0) {
+      calibrateFirst = true;
+    } else if (strcmp(argv[i], "--glitch-us") == 0 && i + 1 < argc) {
+      config.glitchUs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--min-break-us") == 0 && i + 1 < argc) {
+      config.minBreakUs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--rearm-ms") == 0 && i + 1 < argc) {
+      config.rearmUs = strtoul(argv[++i], nullptr, 10) * 1000;
+    } else if (strcmp(argv[i], "--require") == 0 && i + 1 < argc) {
+      required = atof(argv[++i]) / 100;
+    } else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+      generatePath = argv[++i];
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--goals") == 0 && i + 1 < argc) {
+      goals = strtoul(argv[++i], nullptr, 10);
+    } else if (argv[i][0] != '-') {
+      paths.push_back(argv[i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--calibrate] [--glitch-us N] [--min-break-us N] [--rearm-ms N] [--require PERCENT] TRACE...\n"
+                      "       %s --generate FILE [--seed N] [--goals N]\n",
+              argv[0], argv[0]);
+      return 1;
+    }
+  }
+
+  if (generatePath != nullptr) {
+    return generateTrace(generatePath, seed, goals);
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "No trace files given\n");
+    return 1;
+  }
+  if (!validGoalDetectorConfig(config)) {
+    fprintf(stderr, "Invalid detector settings\n");
+    return 1;
+  }
+
+  Score detectorTotal = {};
+  Score legacyTotal = {};
+  for (const char* path : paths) {
+    Trace trace;
+    if (!loadTrace(path, &trace)) {
+      return 1;
+    }
+    printf("%s: %zu edges, %zu labelled goals\n", path, trace.edges.size(), trace.goals.size());
+
+    setGoalDetectorConfig(config);
+    if (calibrateFirst && !calibrate(trace)) {
+      setGoalDetectorConfig(config);
+    }
+    const GoalDetectorConfig& used = goalDetectorConfig();
+    printf("Settings:     glitch %u us, min break %u us, rearm %u ms\n",
+           used.glitchUs, used.minBreakUs, used.rearmUs / 1000);
+
+    Score detector = scoreDetections(trace.goals, runDetector(trace));
+    Score legacy = scoreDetections(trace.goals, runLegacy(trace));
+    const GoalDetectorStats& stats = goalDetectorStats();
+    printf("Filtered:     %u glitches, %u short breaks, %u bounces\n",
+           stats.glitches, stats.shortBreaks, stats.bounces);
+    printScore("detector", detector);
+    printScore("legacy", legacy);
+    detectorTotal.add(detector);
+    legacyTotal.add(legacy);
+  }
+
+  if (paths.size() > 1) {
+    printf("All traces:\n");
+    printScore("detector", detectorTotal);
+    printScore("legacy", legacyTotal);
+  }
+  return detectorTotal.precision() >= required && detectorTotal.recall() >= required ? 0 : 1;
+}
+
+#endif
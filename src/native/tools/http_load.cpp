@@ -0,0 +1,341 @@
+#ifdef NATIVE_BUILD
+
+// Load test for the device's HTTP server. By default the firmware's own
+// server (http_server.cpp) runs in this process on the native HAL, paced to
+// wall-clock time like the simulator's --realtime mode, with a /status page
+// of the device's size and a /scoreMade handler. --host points the clients
+// at a real device instead.
+//
+//   .pio/build/http_load/program [--clients N] [--requests N] [--pipeline N]
+//                                [--no-keepalive] [--host ADDR --port N]
+//
+// Half the clients poll GET /status, the other half push POST /scoreMade.
+// Each sends --pipeline requests back to back on a kept-alive connection
+// before reading the answers; --no-keepalive opens a connection per request
+// instead. Prints requests/s and latency percentiles per endpoint.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hal.h"
+#include "http_server.h"
+#include "json_writer.h"
+#include "payloads.h"
+#include "scheduler.h"
+#include "sim.h"
+
+#define LOAD_DEFAULT_PORT 8080
+#define LOAD_REQUEST_MAX 160
+
+struct ClientResult {
+  bool status;                 // GET /status, otherwise POST /scoreMade
+  std::vector<uint32_t> latencyMicros;
+  uint32_t failed = 0;
+};
+
+struct LoadConfig {
+  sockaddr_in address;
+  const char* host;
+  uint16_t port;
+  int requests;        // Per client
+  int pipeline;
+  bool keepAlive;
+};
+
+static std::atomic<int> clientsRunning(0);
+static uint32_t scoreMadeReceived = 0;
+
+static uint64_t nowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Device side
+
+// Roughly the size and shape of the firmware's /status page
+static void handleStatus(const HttpRequest&) {
+  size_t size;
+  char* response = httpResponseBuffer(&size);
+  JsonWriter json(response, size);
+  json.openObject();
+  json.addUint("table", 1);
+  json.addString("player", "red");
+  json.addBool("wifi", true);
+  json.addUint("uptimeMs", halMillis());
+  json.addUint("scoreMade", scoreMadeReceived);
+  const char* groups[] = {"wifiLink", "connection", "broadcast", "stream", "laser", "heap", "http"};
+  for (const char* group : groups) {
+    json.openObject(group);
+    for (uint32_t i = 0; i < 6; i++) {
+      char name[16];
+      snprintf(name, sizeof(name), "counter%u", (unsigned)i);
+      json.addUint(name, halMillis() + i);
+    }
+    json.closeObject();
+  }
+  json.openArray("goals");
+  for (uint32_t i = 0; i < 10; i++) {
+    json.openObject();
+    json.addUint("t", 1000 * i);
+    json.addString("player", i % 2 == 0 ? "red" : "blue");
+    json.addTenths("speed", 250 + i);
+    json.addBool("confirmed", true);
+    json.closeObject();
+  }
+  json.closeArray();
+  json.closeObject();
+  httpSend(200, "application/json", response);
+}
+
+static void handleScoreMade(const HttpRequest& request) {
+  char player[PLAYER_NAME_MAX];
+  uint32_t seq = 0;
+  if (!parsePlayerField(request.body, player, sizeof(player)) || !parseUintField(request.body, "seq", &seq)) {
+    httpSend(400, "application/json", "{\"error\":\"bad score\"}");
+    return;
+  }
+  scoreMadeReceived++;
+  httpSend(200, "application/json", "{}");
+}
+
+// The firmware's loop(), with the virtual clock held to wall-clock time
+static void runDevice(uint64_t startMicros) {
+  while (clientsRunning > 0) {
+    halSleep(schedulerRun());
+    std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+      std::chrono::microseconds(startMicros + simNowMicros())));
+  }
+}
+
+// Client side
+
+static bool sendAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+// Reads one response, returns its status code or -1 when the connection died
+static int readResponse(int fd, std::string* received) {
+  while (true) {
+    size_t headerEnd = received->find("\r\n\r\n");
+    if (headerEnd != std::string::npos) {
+      int status = 0;
+      sscanf(received->c_str(), "HTTP/1.%*d %d", &status);
+      size_t lengthAt = received->find("Content-Length: ");
+      size_t bodyLength = lengthAt < headerEnd ? atoi(received->c_str() + lengthAt + 16) : 0;
+      size_t total = headerEnd + 4 + bodyLength;
+      if (received->size() >= total) {
+        received->erase(0, total);
+        return status;
+      }
+    }
+
+    char chunk[1024];
+    ssize_t length = recv(fd, chunk, sizeof(chunk), 0);
+    if (length <= 0) {
+      return -1;
+    }
+    received->append(chunk, length);
+  }
+}
+
+static int openConnection(const sockaddr_in& address) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int noDelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  if (fd >= 0 && connect(fd, (const sockaddr*)&address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int formatRequest(char* out, size_t size, const LoadConfig& config, bool status, uint32_t seq) {
+  const char* connection = config.keepAlive ? "keep-alive" : "close";
+  if (status) {
+    return snprintf(out, size, "GET /status HTTP/1.1\r\nHost: %s:%u\r\nConnection: %s\r\n\r\n", config.host,
+                    config.port, connection);
+  }
+  char body[48];
+  int bodyLength = snprintf(body, sizeof(body), "{\"player\":\"blue\",\"seq\":%u}", (unsigned)seq);
+  return snprintf(out, size,
+                  "POST /scoreMade HTTP/1.1\r\nHost: %s:%u\r\nConnection: %s\r\n"
+                  "Content-Type: application/json\r\nContent-Length: %d\r\n\r\n%s",
+                  config.host, config.port, connection, bodyLength, body);
+}
+
+static void runClient(const LoadConfig& config, int index, ClientResult* result) {
+  int fd = -1;
+  std::string received;
+  uint32_t seq = index * 1000000;
+  int depth = config.keepAlive ? config.pipeline : 1;
+
+  for (int done = 0; done < config.requests;) {
+    if (fd < 0 && (fd = openConnection(config.address)) < 0) {
+      result->failed += config.requests - done;
+      break;
+    }
+
+    // A burst of requests, then their answers in order
+    int burst = std::min(depth, config.requests - done);
+    std::string requests;
+    for (int i = 0; i < burst; i++) {
+      char request[LOAD_REQUEST_MAX];
+      requests.append(request, formatRequest(request, sizeof(request), config, result->status, ++seq));
+    }
+    uint64_t sent = nowMicros();
+    bool alive = sendAll(fd, requests.data(), requests.size());
+    for (int i = 0; i < burst; i++) {
+      int status = alive ? readResponse(fd, &received) : -1;
+      if (status == 200) {
+        result->latencyMicros.push_back(nowMicros() - sent);
+      } else {
+        result->failed++;
+        alive = false;
+      }
+    }
+    done += burst;
+
+    if (!alive || !config.keepAlive) {
+      close(fd);
+      fd = -1;
+      received.clear();
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  clientsRunning--;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, int percent) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+int main(int argc, char** argv) {
+  int clients = HTTP_MAX_CLIENTS;
+  int requests = 500;
+  int pipeline = 1;
+  bool keepAlive = true;
+  const char* host = nullptr;
+  uint16_t port = LOAD_DEFAULT_PORT;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+      clients = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+      requests = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+      pipeline = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--no-keepalive") == 0) {
+      keepAlive = false;
+    } else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) {
+      host = argv[++i];
+    } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--clients N] [--requests N] [--pipeline N] [--no-keepalive]\n"
+                      "          [--host ADDR --port N]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  bool local = host == nullptr;
+  if (local) {
+    host = "127.0.0.1";
+    if (!setupHttpServer(port)) {
+      fprintf(stderr, "Cannot listen on port %u\n", port);
+      return 1;
+    }
+    httpOn(HTTP_METHOD_GET, "/status", handleStatus);
+    httpOn(HTTP_METHOD_POST, "/scoreMade", handleScoreMade);
+  }
+
+  LoadConfig config = {};
+  config.address.sin_family = AF_INET;
+  config.address.sin_port = htons(port);
+  if (inet_pton(AF_INET, host, &config.address.sin_addr) != 1) {
+    fprintf(stderr, "Bad host address %s\n", host);
+    return 1;
+  }
+  config.host = host;
+  config.port = port;
+  config.requests = requests;
+  config.pipeline = pipeline;
+  config.keepAlive = keepAlive;
+
+  std::vector<ClientResult> results(clients);
+  std::vector<std::thread> threads;
+  clientsRunning = clients;
+  uint64_t start = nowMicros();
+  for (int i = 0; i < clients; i++) {
+    results[i].status = i % 2 == 0;
+    threads.emplace_back(runClient, std::cref(config), i, &results[i]);
+  }
+  if (local) {
+    runDevice(start - simNowMicros());
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double seconds = (nowMicros() - start) / 1e6;
+
+  printf("Target:           %s:%u%s\n", host, port, local ? " (firmware server, native HAL)" : "");
+  printf("Clients:          %d, %d requests each, pipeline %d, %s\n", clients, requests, keepAlive ? pipeline : 1,
+         keepAlive ? "keep-alive" : "connection per request");
+  printf("%-12s %8s %7s %9s %9s %9s %9s %9s\n", "Endpoint", "Count", "Failed", "Req/s", "p50 us", "p90 us",
+         "p99 us", "max us");
+  uint32_t failed = 0;
+  for (int status = 1; status >= 0; status--) {
+    std::vector<uint32_t> sorted;
+    uint32_t endpointFailed = 0;
+    for (const ClientResult& result : results) {
+      if (result.status == (status == 1)) {
+        sorted.insert(sorted.end(), result.latencyMicros.begin(), result.latencyMicros.end());
+        endpointFailed += result.failed;
+      }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    uint32_t count = sorted.size() + endpointFailed;
+    if (count == 0) {
+      continue;
+    }
+    printf("%-12s %8u %7u %9.0f %9u %9u %9u %9u\n", status == 1 ? "/status" : "/scoreMade", count,
+           endpointFailed, count / seconds, percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+           sorted.empty() ? 0 : sorted.back());
+    failed += endpointFailed;
+  }
+
+  if (local) {
+    const HttpServerStats& stats = httpServerStats();
+    printf("Server:           %u connections (max %u at once), %u requests, %u kept alive, %u pipelined\n",
+           stats.connections, stats.maxClients, stats.requests, stats.keepAliveRequests, stats.pipelined);
+    printf("                  %u buffer waits, %u errors, %u timeouts, %u scores received\n", stats.bufferWaits,
+           stats.errors, stats.timeouts, scoreMadeReceived);
+  }
+  return failed > 0 ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifdef NATIVE_BUILD
+
+// Event journal tests - a full journal while a replay batch is in flight.
+// Goals journaled offline fill the ring, the first batch goes out to a mock
+// Pi that holds its answer, and more goals arrive meanwhile. The events
+// overwritten to make room must be the oldest ones outside the batch: the
+// Pi may be applying the batch, and a batch event reported as not
+// delivered would roll back a goal the Pi counted.
+//
+//   .pio/build/journal_test/program
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include "event_journal.h"
+#include "outbound.h"
+#include "hal.h"
+#include "sim.h"
+#include "mock_pi.h"
+
+#define TEST_TABLE 1
+#define TEST_HOLD_MS 1000          // Mock Pi answers held until released
+#define TEST_OVERFLOW 3            // Goals journaled past capacity
+#define TEST_WAIT_MS 2000          // Host time to wait for the loopback
+
+static bool passed = true;
+static std::atomic<bool> serverRunning(true);
+static std::atomic<uint32_t> eventsReceived(0);
+static std::map<uint32_t, bool> results;  // seq -> delivered
+
+static void check(bool condition, const char* what) {
+  printf("  %-56s %s\n", what, condition ? "ok" : "FAILED");
+  passed &= condition;
+}
+
+static void handleMockRequest(const char*, const char*, const std::string& body) {
+  size_t position = 0;
+  while ((position = body.find("{\"seq\":", position)) != std::string::npos) {
+    eventsReceived++;
+    position++;
+  }
+}
+
+static void onResult(uint32_t seq, bool delivered) {
+  if (results.count(seq) > 0) {
+    printf("  seq %u reported twice\n", (unsigned)seq);
+    passed = false;
+  }
+  results[seq] = delivered;
+}
+
+// Runs the outbound state machine until done() or TEST_WAIT_MS of host
+// time, with the virtual clock standing still. The mock Pi's answers are
+// held unless answer is set.
+template <typename Done>
+static bool pump(bool answer, Done done) {
+  static uint32_t answerMs = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (!done()) {
+    if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(TEST_WAIT_MS)) {
+      return false;
+    }
+    updateOutbound();
+    if (answer) {
+      answerMs += TEST_HOLD_MS;
+    }
+    sendMockPiAnswers(answerMs);
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return true;
+}
+
+static bool reported(uint32_t first, uint32_t last, bool delivered) {
+  for (uint32_t seq = first; seq <= last; seq++) {
+    auto result = results.find(seq);
+    if (result == results.end() || result->second != delivered) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void testOverflowDuringReplay() {
+  printf("Full journal with a batch in flight\n");
+  for (uint32_t i = 0; i < JOURNAL_CAPACITY; i++) {
+    journalEvent(JOURNAL_GOAL, 0, 0);
+  }
+  updateJournal(false);
+  check(journalPending() == JOURNAL_CAPACITY && results.empty(), "offline goals fill the journal");
+
+  // Seqs start at 1, so the batch is 1..JOURNAL_BATCH_MAX
+  updateJournal(true);
+  bool sent = pump(false, [] { return eventsReceived >= JOURNAL_BATCH_MAX; });
+  check(sent && eventsReceived == JOURNAL_BATCH_MAX, "first batch reaches the Pi, answer held");
+
+  for (uint32_t i = 0; i < TEST_OVERFLOW; i++) {
+    journalEvent(JOURNAL_GOAL, 0, 0);
+  }
+  check(results.size() == TEST_OVERFLOW &&
+        reported(JOURNAL_BATCH_MAX + 1, JOURNAL_BATCH_MAX + TEST_OVERFLOW, false),
+        "the oldest goals after the batch are overwritten");
+  check(journalDropped() == TEST_OVERFLOW && journalPending() == JOURNAL_CAPACITY, "counted as dropped");
+
+  bool answered = pump(true, [] { return results.size() == TEST_OVERFLOW + JOURNAL_BATCH_MAX; });
+  check(answered && reported(1, JOURNAL_BATCH_MAX, true), "every batch goal is delivered");
+  check(journalPending() == JOURNAL_CAPACITY - JOURNAL_BATCH_MAX, "the rest stay journaled");
+
+  // The next batch starts right after the overwritten goals
+  updateJournal(true);
+  uint32_t before = eventsReceived;
+  answered = pump(true, [] { return results.size() == TEST_OVERFLOW + 2 * JOURNAL_BATCH_MAX; });
+  uint32_t next = JOURNAL_BATCH_MAX + TEST_OVERFLOW + 1;
+  check(answered && eventsReceived - before == JOURNAL_BATCH_MAX &&
+        reported(next, next + JOURNAL_BATCH_MAX - 1, true), "the next batch picks up after them");
+}
+
+int main() {
+  uint16_t port = 0;
+  int listenFd = openMockPi("127.0.0.1", &port);
+  if (listenFd < 0) {
+    fprintf(stderr, "Cannot start mock server\n");
+    return 1;
+  }
+  setMockPiDelay(TEST_HOLD_MS, 0);
+  std::thread server(runMockPi, listenFd, handleMockRequest, std::cref(serverRunning));
+
+  simSetNetworkConnected(true);
+  setupOutbound("127.0.0.1", port);
+  setupJournal("red", "blue", TEST_TABLE);
+  setJournalResultHandler(onResult);
+
+  testOverflowDuringReplay();
+
+  serverRunning = false;
+  server.join();
+  printf("\n%s\n", passed ? "PASS" : "FAIL");
+  return passed ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,235 @@
+#ifdef NATIVE_BUILD
+
+// Loop benchmark - the cooperative scheduler against the fixed 10 ms loop it
+// replaced. Both run the firmware's own tasks, brought up as in setup() and
+// talking to a mock Pi on loopback, over the same scripted goals and button
+// taps.
+//
+//   .pio/build/loop_bench/program [--seconds N] [--seed N] [--cpu-scale N] [--runs N]
+//
+// The virtual clock is charged the host CPU time each task takes, times
+// --cpu-scale (BENCH_CPU_SCALE by default, roughly how much slower the
+// ESP8266 runs the same code), so an edge that arrives while other tasks
+// run waits for them. Latency is the scheduler's own, from the ISR's
+// schedulerSignal() to the task's dispatch. Host interrupts and page faults
+// only ever add to it, so each mode keeps the best of --runs runs.
+//
+// Wake-ups are loop passes per simulated second. Each run is its own
+// process, since tasks can't be taken off the scheduler again. Fails unless
+// the scheduler wakes less often than the legacy loop, both score every
+// goal, and the laser and button tasks are dispatched within
+// SCHEDULER_LATENCY_BOUND_US of every edge.
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "game.h"
+#include "hal.h"
+#include "outbound.h"
+#include "event_journal.h"
+#include "match_state.h"
+#include "scheduler.h"
+#include "score_broadcast.h"
+#include "device_config.h"
+#include "log.h"
+#include "sim.h"
+#include "mock_pi.h"
+
+#define BENCH_LEGACY_PERIOD_MS 10   // The delay() the old loop() ended with
+#define BENCH_CPU_SCALE 40
+#define BENCH_RUNS 3
+#define SCHEDULER_LATENCY_BOUND_US 1000
+
+struct BenchResult {
+  uint32_t passes;
+  uint32_t goals;
+  uint32_t laserLatencyUs;
+  uint32_t buttonLatencyUs;
+  double seconds;
+};
+
+static std::atomic<bool> serverRunning(true);
+
+static void handleMockRequest(const char*, const char*, const std::string&) {
+}
+
+static const TaskStats* findTask(const char* name) {
+  for (int8_t task = 0; task < schedulerTaskCount(); task++) {
+    if (strcmp(schedulerTaskStats(task).name, name) == 0) {
+      return &schedulerTaskStats(task);
+    }
+  }
+  return nullptr;
+}
+
+// A goal every 2.5-6.5 s, 1.5-21.5 ms in the beam, and an up tap with
+// contact bounce after every other one. Returns the goals scheduled.
+static uint32_t scheduleShots(uint64_t start, uint64_t end) {
+  uint32_t goals = 0;
+  for (uint64_t t = start + 2500000 + halRandom() % 4000000; t < end; t += 2500000 + halRandom() % 4000000) {
+    simScheduleEdge(t, LASER_BREAK_PIN, LOW);
+    simScheduleEdge(t + 1500 + halRandom() % 20000, LASER_BREAK_PIN, HIGH);
+    if (goals % 2 == 0) {
+      uint64_t press = t + 1000000;
+      simScheduleEdge(press, BUTTON_UP_PIN, LOW);
+      simScheduleEdge(press + 800, BUTTON_UP_PIN, HIGH);
+      simScheduleEdge(press + 1500, BUTTON_UP_PIN, LOW);
+      simScheduleEdge(press + 120000, BUTTON_UP_PIN, HIGH);
+    }
+    goals++;
+  }
+  return goals;
+}
+
+static BenchResult runMode(bool legacy, uint32_t seconds, uint32_t seed, uint32_t cpuScale) {
+  uint16_t port = 0;
+  int listenFd = openMockPi("127.0.0.1", &port);
+  if (listenFd < 0) {
+    _exit(1);
+  }
+  std::thread server(runMockPi, listenFd, handleMockRequest, std::cref(serverRunning));
+
+  // Same bring-up as the simulator
+  simSeed(seed);
+  setupLog();
+  loadDeviceConfig();
+  setupGame();
+  setupOutbound("127.0.0.1", port);
+  setupJournal(scorePlayerName(playerSide), scorePlayerName(opponentSide), deviceConfig().tableId);
+  simSetNetworkConnected(true);
+  wifiConnected = true;
+
+  BenchResult result = {};
+  uint64_t start = simNowMicros();
+  uint64_t end = start + seconds * 1000000ULL;
+  uint32_t goals = scheduleShots(start, end);
+
+  simChargeCpuTime(cpuScale);
+  while (simNowMicros() < end) {
+    if (legacy) {
+      schedulerRunAll();
+      halDelay(BENCH_LEGACY_PERIOD_MS);
+    } else {
+      uint32_t sleepMs = schedulerRun();
+      // Give the mock Pi thread a chance to answer while a request is in flight
+      if (outboundPending() > 0) {
+        std::this_thread::yield();
+      }
+      halSleep(sleepMs);
+    }
+    result.passes++;
+  }
+  simChargeCpuTime(0);
+
+  serverRunning = false;
+  server.join();
+
+  const MatchState& match = matchState();
+  const TaskStats* laser = findTask("laser");
+  const TaskStats* buttons = findTask("buttons");
+  result.goals = match.sides[SCORE_PLAYER_RED].goals + match.sides[SCORE_PLAYER_BLUE].goals;
+  result.laserLatencyUs = laser->maxSignalLatencyMicros;
+  result.buttonLatencyUs = buttons->maxSignalLatencyMicros;
+  result.seconds = (simNowMicros() - start) / 1e6;
+  // Every goal scored, or the latencies measured nothing
+  if (result.goals != goals) {
+    result.goals = 0;
+  }
+  return result;
+}
+
+// Runs one mode in a child process and reads its result back
+static bool benchRun(bool legacy, uint32_t seconds, uint32_t seed, uint32_t cpuScale, BenchResult* result) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  pid_t child = fork();
+  if (child < 0) {
+    return false;
+  }
+  if (child == 0) {
+    close(fds[0]);
+    BenchResult measured = runMode(legacy, seconds, seed, cpuScale);
+    ssize_t written = write(fds[1], &measured, sizeof(measured));
+    _exit(written == sizeof(measured) ? 0 : 1);
+  }
+  close(fds[1]);
+  bool complete = read(fds[0], result, sizeof(*result)) == sizeof(*result);
+  close(fds[0]);
+  int status;
+  waitpid(child, &status, 0);
+  return complete && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static uint32_t worstLatency(const BenchResult& result) {
+  return result.laserLatencyUs > result.buttonLatencyUs ? result.laserLatencyUs : result.buttonLatencyUs;
+}
+
+// The run with the lowest worst-case latency
+static bool benchMode(bool legacy, uint32_t seconds, uint32_t seed, uint32_t cpuScale, uint32_t runs,
+                      BenchResult* best) {
+  for (uint32_t run = 0; run < runs; run++) {
+    BenchResult result;
+    if (!benchRun(legacy, seconds, seed, cpuScale, &result)) {
+      return false;
+    }
+    if (run == 0 || worstLatency(result) < worstLatency(*best)) {
+      *best = result;
+    }
+  }
+  return true;
+}
+
+static void printResult(const char* name, const BenchResult& result) {
+  printf("%-18s %10.1f %6u %10u %11u\n", name, result.passes / result.seconds, result.goals, result.laserLatencyUs,
+         result.buttonLatencyUs);
+}
+
+int main(int argc, char** argv) {
+  uint32_t seconds = 600;
+  uint32_t seed = 1;
+  uint32_t cpuScale = BENCH_CPU_SCALE;
+  uint32_t runs = BENCH_RUNS;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--cpu-scale") == 0 && i + 1 < argc) {
+      cpuScale = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = strtoul(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: %s [--seconds N] [--seed N] [--cpu-scale N] [--runs N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  BenchResult legacy;
+  BenchResult scheduler;
+  if (runs == 0 || !benchMode(true, seconds, seed, cpuScale, runs, &legacy) ||
+      !benchMode(false, seconds, seed, cpuScale, runs, &scheduler)) {
+    fprintf(stderr, "Benchmark run failed\n");
+    return 1;
+  }
+
+  printf("%u simulated seconds, seed %u, CPU time x%u, best of %u runs\n\n", seconds, seed, cpuScale, runs);
+  printf("%-18s %10s %6s %10s %11s\n", "", "wake-ups/s", "goals", "laser us", "buttons us");
+  printResult("legacy 10 ms loop", legacy);
+  printResult("scheduler", scheduler);
+
+  bool passed = scheduler.passes < legacy.passes && scheduler.goals > 0 && scheduler.goals == legacy.goals &&
+                scheduler.laserLatencyUs < SCHEDULER_LATENCY_BOUND_US &&
+                scheduler.buttonLatencyUs < SCHEDULER_LATENCY_BOUND_US;
+  printf("\n%s\n", passed ? "PASS" : "FAIL");
+  return passed ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,544 @@
+#ifdef NATIVE_BUILD
+
+// Match replay and load test for the Pi's scoreboard API. Requests are
+// built with the firmware's own payload code (payloads.h) and sent on
+// keep-alive connections the way outbound.cpp sends them.
+//
+//   .pio/build/match_replay/program --record FILE [--listen-port N]
+//   .pio/build/match_replay/program --replay FILE [--tables N] [--speed 1|10|max]
+//                                   [--threads N] [--host ADDR --port N]
+//   .pio/build/match_replay/program --load N [--matches N] [--seed N] [--speed 1|10|max]
+//                                   [--threads N] [--direct-points] [--host ADDR --port N]
+//
+// --record stands in for the Pi (point a device's config "host" at this
+// machine) and writes every request it receives as a "<ms> <path> <body>"
+// line. --replay sends a recording from --tables simulated tables at once,
+// --load generates N tables of seeded synthetic matches instead: goals
+// (/score, and /scoreMade as the Pi's fallback notification), point
+// batches (/events, or /point with --direct-points) and a /reset per match.
+//
+// Without --host requests go to a mock Pi in this process. Tables are run
+// by a pool of --threads workers, one table per worker at a time, so paced
+// runs need as many threads as tables to keep every table on schedule.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "payloads.h"
+#include "json_writer.h"
+#include "score_broadcast.h"
+#include "mock_pi.h"
+
+#define REPLAY_DEFAULT_PORT 3000
+#define REPLAY_BODY_MAX 1024
+#define REPLAY_HEADER_MAX 160
+#define REPLAY_PATH_MAX 64
+#define REPLAY_GOALS_PER_MATCH 10
+#define REPLAY_MATCH_GAP_MS 10000
+#define REPLAY_POINT_BATCH_MAX 3
+
+struct TimedRequest {
+  uint32_t atMs;       // From the start of the table's script
+  std::string path;
+  std::string body;
+};
+
+typedef std::vector<TimedRequest> TableScript;
+
+struct EndpointStats {
+  std::vector<uint32_t> latencyMicros;
+  uint32_t failed = 0;
+};
+
+typedef std::map<std::string, EndpointStats> EndpointMap;
+
+static std::atomic<bool> running(true);
+static std::atomic<uint32_t> mockRequests(0);
+
+static uint64_t nowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void stopRunning(int) {
+  running = false;
+}
+
+// Recording
+
+static FILE* recordFile = nullptr;
+static uint64_t recordStart = 0;
+
+static void recordRequest(const char*, const char* path, const std::string& body) {
+  mockRequests++;
+  std::string line = body;
+  std::replace(line.begin(), line.end(), '\r', ' ');
+  std::replace(line.begin(), line.end(), '\n', ' ');
+  fprintf(recordFile, "%u %s %s\n", (unsigned)((nowMicros() - recordStart) / 1000), path, line.c_str());
+  fflush(recordFile);
+  printf("%s %s\n", path, line.c_str());
+}
+
+static void countRequest(const char*, const char*, const std::string&) {
+  mockRequests++;
+}
+
+static int runRecord(const char* path, uint16_t port) {
+  recordFile = fopen(path, "w");
+  if (recordFile == nullptr) {
+    perror(path);
+    return 1;
+  }
+  int listenFd = openMockPi("0.0.0.0", &port);
+  if (listenFd < 0) {
+    perror("listen");
+    return 1;
+  }
+
+  signal(SIGINT, stopRunning);
+  signal(SIGTERM, stopRunning);
+  fprintf(recordFile, "# <ms> <path> <body>, recorded on port %u\n", port);
+  printf("Recording requests on port %u to %s, Ctrl-C to stop\n", port, path);
+  recordStart = nowMicros();
+  runMockPi(listenFd, recordRequest, running);
+
+  close(listenFd);
+  fclose(recordFile);
+  printf("Recorded %u requests\n", mockRequests.load());
+  return 0;
+}
+
+static bool loadRecording(const char* path, TableScript* script) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    perror(path);
+    return false;
+  }
+
+  char line[REPLAY_BODY_MAX + 64];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    unsigned int atMs;
+    char endpoint[REPLAY_PATH_MAX];
+    int bodyStart = 0;
+    if (line[0] == '#' || sscanf(line, "%u %63s %n", &atMs, endpoint, &bodyStart) != 2) {
+      continue;
+    }
+    std::string body = line + bodyStart;
+    while (!body.empty() && (body.back() == '\n' || body.back() == '\r')) {
+      body.pop_back();
+    }
+    script->push_back({atMs, endpoint, body});
+  }
+  fclose(file);
+  return true;
+}
+
+// Synthetic matches
+
+// One device's journal - epoch and seq as event_journal.cpp keeps them
+struct SimDevice {
+  uint8_t side;
+  uint16_t table;
+  uint32_t epoch;
+  uint32_t nextSeq;
+};
+
+static void addRequest(TableScript* script, uint32_t atMs, const char* path, const char* body) {
+  script->push_back({atMs, path, body});
+}
+
+static void addPoints(TableScript* script, SimDevice* device, uint32_t atMs, uint8_t count, bool quantum,
+                      bool directPoints) {
+  char body[REPLAY_BODY_MAX];
+  const char* player = scorePlayerName(device->side);
+  const char* opponent = scorePlayerName(1 - device->side);
+
+  if (directPoints) {
+    // The API's single point call, which the firmware no longer makes
+    for (uint8_t i = 0; i < count; i++) {
+      JsonWriter json(body, sizeof(body));
+      json.openObject();
+      json.addString("player", player);
+      json.addUint("amount", 1);
+      json.addBool("quantum", quantum);
+      json.closeObject();
+      addRequest(script, atMs + i * 200, "/point", body);
+    }
+    return;
+  }
+
+  // A burst of presses goes out as one batch, as the journal sends it
+  JournalEvent events[REPLAY_POINT_BATCH_MAX];
+  for (uint8_t i = 0; i < count; i++) {
+    events[i] = {device->nextSeq++, atMs + i * 50, JOURNAL_POINT, (uint8_t)(quantum ? JOURNAL_FLAG_QUANTUM : 0), 1};
+  }
+  uint32_t sentMs = atMs + (count - 1) * 50 + 150;
+  formatEventsBody(body, sizeof(body), player, opponent, device->table, device->epoch, sentMs, events, count);
+  addRequest(script, sentMs, "/events", body);
+}
+
+static TableScript generateTable(uint32_t seed, uint16_t table, int matches, bool directPoints) {
+  std::mt19937 random(seed);
+  SimDevice devices[SCORE_PLAYER_COUNT] = {
+    {SCORE_PLAYER_RED, table, (uint32_t)random(), 1}, {SCORE_PLAYER_BLUE, table, (uint32_t)random(), 1}};
+  TableScript script;
+  char body[REPLAY_BODY_MAX];
+  uint32_t t = 0;
+  uint32_t broadcastSeq = 0;
+  uint32_t boot = random() | 1;  // Never SCORE_BOOT_UNKNOWN
+
+  for (int match = 0; match < matches; match++) {
+    for (int goal = 0; goal < REPLAY_GOALS_PER_MATCH; goal++) {
+      t += 2500 + random() % 4000;   // 2.5-6.5 s between goals
+      uint8_t scorer = random() % SCORE_PLAYER_COUNT;
+      uint16_t speed = random() % 4 == 0 ? 0 : 60 + random() % 740;
+
+      // The defending side's laser reports the goal, the Pi tells the scorer
+      formatScoreBody(body, sizeof(body), scorePlayerName(scorer), table, speed);
+      addRequest(&script, t, "/score", body);
+      JsonWriter json(body, sizeof(body));
+      json.openObject();
+      json.addString("player", scorePlayerName(scorer));
+      json.addUint("seq", ++broadcastSeq);
+      json.addUint("boot", boot);
+      json.closeObject();
+      addRequest(&script, t + 5, "/scoreMade", body);
+
+      if (random() % 3 == 0) {
+        SimDevice* device = &devices[random() % SCORE_PLAYER_COUNT];
+        uint8_t presses = 1 + random() % REPLAY_POINT_BATCH_MAX;
+        addPoints(&script, device, t + 1000, presses, random() % 4 == 0, directPoints);
+      }
+    }
+
+    t += REPLAY_MATCH_GAP_MS / 2;
+    formatPlayerBody(body, sizeof(body), scorePlayerName(devices[match % SCORE_PLAYER_COUNT].side));
+    addRequest(&script, t, "/reset", body);
+    t += REPLAY_MATCH_GAP_MS / 2;
+  }
+
+  // Batches may have been generated past the next goal
+  std::stable_sort(script.begin(), script.end(), [](const TimedRequest& a, const TimedRequest& b) {
+    return a.atMs < b.atMs;
+  });
+  return script;
+}
+
+// Keep-alive client
+
+struct Connection {
+  int fd = -1;
+  std::string received;
+};
+
+static void closeConnection(Connection* connection) {
+  if (connection->fd >= 0) {
+    close(connection->fd);
+  }
+  connection->fd = -1;
+  connection->received.clear();
+}
+
+static bool openConnection(Connection* connection, const sockaddr_in& address) {
+  connection->fd = socket(AF_INET, SOCK_STREAM, 0);
+  int noDelay = 1;
+  setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  if (connection->fd < 0 || connect(connection->fd, (const sockaddr*)&address, sizeof(address)) < 0) {
+    closeConnection(connection);
+    return false;
+  }
+  return true;
+}
+
+static bool sendAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+// Reads one response, returns its status code or -1 when the connection died
+static int readResponse(Connection* connection) {
+  while (true) {
+    size_t headerEnd = connection->received.find("\r\n\r\n");
+    if (headerEnd != std::string::npos) {
+      int status = 0;
+      sscanf(connection->received.c_str(), "HTTP/1.%*d %d", &status);
+      size_t lengthAt = connection->received.find("Content-Length: ");
+      size_t bodyLength = lengthAt < headerEnd ? atoi(connection->received.c_str() + lengthAt + 16) : 0;
+      size_t total = headerEnd + 4 + bodyLength;
+      if (connection->received.size() >= total) {
+        connection->received.erase(0, total);
+        return status;
+      }
+    }
+
+    char chunk[512];
+    ssize_t length = recv(connection->fd, chunk, sizeof(chunk), 0);
+    if (length <= 0) {
+      return -1;
+    }
+    connection->received.append(chunk, length);
+  }
+}
+
+// Sends one request, reconnecting once if the kept-alive connection died
+static int exchange(Connection* connection, const sockaddr_in& address, const char* host, uint16_t port,
+                    const TimedRequest& request) {
+  char header[REPLAY_HEADER_MAX];
+  int headerLength = formatRequestHeader(header, sizeof(header), request.path.c_str(), host, port,
+                                         request.body.size());
+  if (headerLength < 0) {
+    return -1;
+  }
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (connection->fd < 0 && !openConnection(connection, address)) {
+      return -1;
+    }
+    if (sendAll(connection->fd, header, headerLength) &&
+        sendAll(connection->fd, request.body.data(), request.body.size())) {
+      int status = readResponse(connection);
+      if (status >= 0) {
+        return status;
+      }
+    }
+    closeConnection(connection);
+  }
+  return -1;
+}
+
+// Thread pool
+
+struct RunConfig {
+  sockaddr_in address;
+  const char* host;
+  uint16_t port;
+  double speed;        // 0 sends as fast as answers come back
+};
+
+static void runWorker(const RunConfig& config, const std::vector<TableScript>& tables,
+                      std::atomic<size_t>* nextTable, uint64_t start, EndpointMap* stats) {
+  size_t table;
+  while (running && (table = nextTable->fetch_add(1)) < tables.size()) {
+    Connection connection;
+    for (const TimedRequest& request : tables[table]) {
+      if (config.speed > 0) {
+        uint64_t due = start + (uint64_t)(request.atMs * 1000.0 / config.speed);
+        uint64_t now = nowMicros();
+        if (due > now) {
+          std::this_thread::sleep_for(std::chrono::microseconds(due - now));
+        }
+      }
+
+      uint64_t sent = nowMicros();
+      int status = exchange(&connection, config.address, config.host, config.port, request);
+      EndpointStats& endpoint = (*stats)[request.path];
+      if (status >= 200 && status < 300) {
+        endpoint.latencyMicros.push_back(nowMicros() - sent);
+      } else {
+        endpoint.failed++;
+      }
+    }
+    closeConnection(&connection);
+  }
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, int percent) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+static int runTables(const std::vector<TableScript>& tables, const char* host, uint16_t port, double speed,
+                     int threads, const char* mode) {
+  uint16_t mockPort = 0;
+  int mockFd = -1;
+  std::thread mock;
+  if (host == nullptr) {
+    mockFd = openMockPi("127.0.0.1", &mockPort);
+    if (mockFd < 0) {
+      fprintf(stderr, "Cannot start mock server\n");
+      return 1;
+    }
+    mock = std::thread(runMockPi, mockFd, countRequest, std::cref(running));
+    host = "127.0.0.1";
+    port = mockPort;
+  }
+
+  RunConfig config = {};
+  config.address.sin_family = AF_INET;
+  config.address.sin_port = htons(port);
+  if (inet_pton(AF_INET, host, &config.address.sin_addr) != 1) {
+    fprintf(stderr, "Bad host address %s\n", host);
+    return 1;
+  }
+  config.host = host;
+  config.port = port;
+  config.speed = speed;
+
+  if (speed > 0 && threads < (int)tables.size()) {
+    fprintf(stderr, "Warning: %zu tables on %d threads, later tables will start late\n", tables.size(), threads);
+  }
+
+  signal(SIGINT, stopRunning);
+  std::vector<EndpointMap> workerStats(threads);
+  std::vector<std::thread> workers;
+  std::atomic<size_t> nextTable(0);
+  uint64_t start = nowMicros();
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back(runWorker, std::cref(config), std::cref(tables), &nextTable, start, &workerStats[i]);
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  double seconds = (nowMicros() - start) / 1e6;
+
+  if (mockFd >= 0) {
+    running = false;
+    mock.join();
+    close(mockFd);
+  }
+
+  // Merge the per-thread results
+  EndpointMap endpoints;
+  uint32_t sent = 0;
+  uint32_t failed = 0;
+  for (EndpointMap& worker : workerStats) {
+    for (auto& entry : worker) {
+      EndpointStats& merged = endpoints[entry.first];
+      merged.latencyMicros.insert(merged.latencyMicros.end(), entry.second.latencyMicros.begin(),
+                                  entry.second.latencyMicros.end());
+      merged.failed += entry.second.failed;
+      sent += entry.second.latencyMicros.size() + entry.second.failed;
+      failed += entry.second.failed;
+    }
+  }
+
+  char speedName[16] = "max";
+  if (speed > 0) {
+    snprintf(speedName, sizeof(speedName), "%gx", speed);
+  }
+  printf("Mode:             %s, %zu tables on %d threads, speed %s\n", mode, tables.size(), threads, speedName);
+  printf("Target:           %s:%u%s\n", host, port, mockFd >= 0 ? " (mock Pi)" : "");
+  printf("Requests:         %u sent, %u failed in %.2f s (%.0f req/s)\n", sent, failed, seconds, sent / seconds);
+  if (mockFd >= 0) {
+    printf("Mock Pi:          %u received\n", mockRequests.load());
+  }
+  printf("%-12s %8s %7s %9s %9s %9s %9s %9s\n", "Endpoint", "Count", "Failed", "Req/s", "p50 us", "p90 us",
+         "p99 us", "max us");
+  for (auto& entry : endpoints) {
+    std::vector<uint32_t>& sorted = entry.second.latencyMicros;
+    std::sort(sorted.begin(), sorted.end());
+    uint32_t count = sorted.size() + entry.second.failed;
+    printf("%-12s %8u %7u %9.0f %9u %9u %9u %9u\n", entry.first.c_str(), count, entry.second.failed,
+           count / seconds, percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+           sorted.empty() ? 0 : sorted.back());
+  }
+  return failed > 0 ? 1 : 0;
+}
+
+static bool parseSpeed(const char* value, double* speed) {
+  if (strcmp(value, "max") == 0) {
+    *speed = 0;
+    return true;
+  }
+  *speed = atof(value);
+  return *speed > 0;
+}
+
+int main(int argc, char** argv) {
+  const char* recordPath = nullptr;
+  const char* replayPath = nullptr;
+  uint16_t listenPort = REPLAY_DEFAULT_PORT;
+  int loadTables = 0;
+  int tableCount = 1;
+  int matches = 1;
+  uint32_t seed = 1;
+  double speed = 0;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  bool directPoints = false;
+  const char* host = nullptr;
+  uint16_t port = REPLAY_DEFAULT_PORT;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (strcmp(argv[i], "--listen-port") == 0 && i + 1 < argc) {
+      listenPort = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replayPath = argv[++i];
+    } else if (strcmp(argv[i], "--tables") == 0 && i + 1 < argc) {
+      tableCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+      loadTables = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--matches") == 0 && i + 1 < argc) {
+      matches = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc && parseSpeed(argv[i + 1], &speed)) {
+      i++;
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--direct-points") == 0) {
+      directPoints = true;
+    } else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) {
+      host = argv[++i];
+    } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else {
+      recordPath = replayPath = nullptr;
+      loadTables = 0;
+      break;
+    }
+  }
+
+  if (recordPath != nullptr) {
+    return runRecord(recordPath, listenPort);
+  }
+
+  std::vector<TableScript> tables;
+  if (replayPath != nullptr) {
+    TableScript script;
+    if (!loadRecording(replayPath, &script)) {
+      return 1;
+    }
+    tables.assign(std::max(1, tableCount), script);
+    return runTables(tables, host, port, speed, threads, "replay");
+  }
+  if (loadTables > 0) {
+    for (int table = 0; table < loadTables; table++) {
+      tables.push_back(generateTable(seed + table, table + 1, matches, directPoints));
+    }
+    return runTables(tables, host, port, speed, threads, "load");
+  }
+
+  fprintf(stderr, "Usage: %s --record FILE [--listen-port N]\n"
+                  "       %s --replay FILE [--tables N] [--speed 1|10|max] [--threads N] [--host ADDR --port N]\n"
+                  "       %s --load N [--matches N] [--seed N] [--speed 1|10|max] [--threads N]\n"
+                  "          [--direct-points] [--host ADDR --port N]\n",
+          argv[0], argv[0], argv[0]);
+  return 1;
+}
+
+#endif
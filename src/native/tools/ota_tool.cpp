@@ -0,0 +1,677 @@
+#ifdef NATIVE_BUILD
+
+// OTA updates from the Pi's side - delta patches between firmware images,
+// a file server for them, and an end-to-end test of the firmware's update
+// task (ota_update.cpp) on the native HAL.
+//
+//   .pio/build/ota_tool/program --diff OLD NEW PATCH
+//   .pio/build/ota_tool/program --apply OLD PATCH NEW
+//   .pio/build/ota_tool/program --serve DIR [--port N]
+//   .pio/build/ota_tool/program --test [--verbose]
+//
+// --diff writes a patch (see firmware_patch.h) and prints the POST /ota body
+// that installs it; --apply runs it through the firmware's decoder. --serve
+// answers GET with Range, as the device needs to resume a download.
+//
+// --test updates a simulated device over loopback on the virtual clock:
+// full images and patches, a connection dropped mid-download, play during
+// the download, a corrupt image, a patch for another image, and new images
+// that never get ready - by timeout and by crashing - which have to roll
+// back. The device's flash and storage live in RAM and survive its
+// simulated restarts.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "firmware_patch.h"
+#include "hal.h"
+#include "log.h"
+#include "ota_update.h"
+#include "scheduler.h"
+#include "sha1.h"
+#include "sim.h"
+
+#define TOOL_HOST "127.0.0.1"
+#define TOOL_DEFAULT_PORT 8088
+#define TOOL_MATCH_MIN 16          // Shorter runs cost more as a COPY than as literals
+#define TOOL_CANDIDATES 8          // Earlier base offsets tried per hash
+#define TOOL_IMAGE_SIZE 320000
+#define TOOL_POLL_REAL_US 200      // Wall-clock time per device pass, for the server thread
+#define TOOL_TIMEOUT_MS 600000     // Virtual
+#define TOOL_PASS_MS 10
+
+typedef std::vector<uint8_t> Bytes;
+typedef std::function<bool(const std::string& path, Bytes* data)> FileLookup;
+
+// Patches
+
+static uint64_t blockHash(const uint8_t* data) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint8_t i = 0; i < TOOL_MATCH_MIN; i++) {
+    hash = (hash ^ data[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static size_t matchLength(const Bytes& base, size_t baseOffset, const Bytes& target, size_t targetOffset) {
+  size_t length = 0;
+  while (baseOffset + length < base.size() && targetOffset + length < target.size() &&
+         base[baseOffset + length] == target[targetOffset + length]) {
+    length++;
+  }
+  return length;
+}
+
+static void appendOp(Bytes* patch, const uint8_t* op, size_t length) {
+  patch->insert(patch->end(), op, op + length);
+}
+
+static void flushLiterals(Bytes* patch, const Bytes& target, size_t start, size_t end) {
+  if (end == start) {
+    return;
+  }
+  uint8_t op[16];
+  appendOp(patch, op, encodeFirmwarePatchInsert(end - start, op, sizeof(op)));
+  patch->insert(patch->end(), target.begin() + start, target.begin() + end);
+}
+
+// Greedy: at each target offset the longest base match among the hashed
+// candidates and the offset that continues the previous COPY, which picks
+// the image back up after a changed address or constant
+static Bytes makePatch(const Bytes& base, const Bytes& target) {
+  std::unordered_map<uint64_t, std::vector<uint32_t>> index;
+  for (size_t offset = 0; offset + TOOL_MATCH_MIN <= base.size(); offset++) {
+    std::vector<uint32_t>& offsets = index[blockHash(&base[offset])];
+    if (offsets.size() < TOOL_CANDIDATES) {
+      offsets.push_back(offset);
+    }
+  }
+
+  uint8_t digest[SHA1_DIGEST_SIZE];
+  sha1Digest(base.data(), base.size(), digest);
+  Bytes patch(FIRMWARE_PATCH_HEADER_SIZE);
+  encodeFirmwarePatchHeader(base.size(), digest, target.size(), patch.data(), patch.size());
+
+  long delta = 0;   // Base offset minus target offset of the last COPY
+  size_t literalStart = 0;
+  size_t offset = 0;
+  while (offset < target.size()) {
+    size_t bestOffset = 0;
+    size_t bestLength = 0;
+    long continued = (long)offset + delta;
+    if (continued >= 0 && (size_t)continued < base.size()) {
+      bestOffset = continued;
+      bestLength = matchLength(base, continued, target, offset);
+    }
+    if (offset + TOOL_MATCH_MIN <= target.size()) {
+      auto found = index.find(blockHash(&target[offset]));
+      if (found != index.end()) {
+        for (uint32_t candidate : found->second) {
+          size_t length = matchLength(base, candidate, target, offset);
+          if (length > bestLength) {
+            bestOffset = candidate;
+            bestLength = length;
+          }
+        }
+      }
+    }
+
+    if (bestLength < TOOL_MATCH_MIN) {
+      offset++;
+      continue;
+    }
+    flushLiterals(&patch, target, literalStart, offset);
+    uint8_t op[16];
+    appendOp(&patch, op, encodeFirmwarePatchCopy(bestOffset, bestLength, op, sizeof(op)));
+    delta = (long)bestOffset - (long)offset;
+    offset += bestLength;
+    literalStart = offset;
+  }
+  flushLiterals(&patch, target, literalStart, target.size());
+  return patch;
+}
+
+// The firmware's decoder, fed in network-sized pieces
+static const Bytes* applyBase = nullptr;
+static Bytes* applyTarget = nullptr;
+
+static bool readApplyBase(uint32_t offset, uint8_t* data, size_t length) {
+  if (offset > applyBase->size() || length > applyBase->size() - offset) {
+    return false;
+  }
+  memcpy(data, applyBase->data() + offset, length);
+  return true;
+}
+
+static bool writeApplyTarget(const uint8_t* data, size_t length) {
+  applyTarget->insert(applyTarget->end(), data, data + length);
+  return true;
+}
+
+static bool applyPatch(const Bytes& base, const Bytes& patch, Bytes* target, const char** error) {
+  applyBase = &base;
+  applyTarget = target;
+  target->clear();
+  FirmwarePatch state;
+  beginFirmwarePatch(&state, readApplyBase, writeApplyTarget);
+  size_t offset = 0;
+  while (state.state != FIRMWARE_PATCH_DONE && state.state != FIRMWARE_PATCH_FAILED) {
+    size_t piece = std::min<size_t>(1460, patch.size() - offset);
+    bool busy = firmwarePatchBusy(state);
+    size_t used = feedFirmwarePatch(&state, patch.data() + offset, piece, OTA_CHUNK_SIZE);
+    offset += used;
+    if (used == 0 && !busy) {
+      state.error = "patch ended early";
+      break;
+    }
+  }
+  *error = state.error;
+  return state.state == FIRMWARE_PATCH_DONE && offset == patch.size();
+}
+
+static std::string hexSha1(const Bytes& data) {
+  uint8_t digest[SHA1_DIGEST_SIZE];
+  sha1Digest(data.data(), data.size(), digest);
+  char hex[SHA1_DIGEST_SIZE * 2 + 1];
+  for (uint8_t i = 0; i < SHA1_DIGEST_SIZE; i++) {
+    snprintf(hex + i * 2, 3, "%02x", digest[i]);
+  }
+  return hex;
+}
+
+static std::string requestBody(const std::string& path, const Bytes& image, bool patch) {
+  char body[256];
+  snprintf(body, sizeof(body), "{\"path\":\"%s\",\"format\":\"%s\",\"size\":%zu,\"sha1\":\"%s\"}", path.c_str(),
+           patch ? "patch" : "full", image.size(), hexSha1(image).c_str());
+  return body;
+}
+
+static bool readFile(const char* path, Bytes* data) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  uint8_t buffer[4096];
+  size_t length;
+  data->clear();
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data->insert(data->end(), buffer, buffer + length);
+  }
+  fclose(file);
+  return true;
+}
+
+static bool writeFile(const char* path, const Bytes& data) {
+  FILE* file = fopen(path, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && written;
+}
+
+// File server - one client at a time, Connection: close
+
+static std::atomic<bool> serverRunning(true);
+static std::atomic<long> dropAfter(-1);      // Body bytes before the next response is cut off
+static std::atomic<uint32_t> rangeRequests(0);
+static std::atomic<uint64_t> bytesServed(0);
+
+static bool sendAll(int fd, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+static void serveClient(int fd, const FileLookup& lookup) {
+  std::string request;
+  char buffer[512];
+  while (request.find("\r\n\r\n") == std::string::npos && request.size() < 4096) {
+    pollfd readable = {fd, POLLIN, 0};
+    if (poll(&readable, 1, 1000) != 1) {
+      return;
+    }
+    ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      return;
+    }
+    request.append(buffer, received);
+  }
+
+  char path[256] = "";
+  sscanf(request.c_str(), "GET %255s", path);
+  long from = -1;
+  size_t range = request.find("Range: bytes=");
+  if (range != std::string::npos) {
+    from = atol(request.c_str() + range + 13);
+    rangeRequests++;
+  }
+
+  Bytes file;
+  char header[256];
+  if (!lookup(path, &file)) {
+    int length = snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    sendAll(fd, (const uint8_t*)header, length);
+    return;
+  }
+  if (from >= (long)file.size()) {
+    int length = snprintf(header, sizeof(header), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n");
+    sendAll(fd, (const uint8_t*)header, length);
+    return;
+  }
+
+  size_t start = from > 0 ? from : 0;
+  size_t length = file.size() - start;
+  int headerLength =
+    from >= 0 ? snprintf(header, sizeof(header),
+                         "HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\nContent-Range: bytes %zu-%zu/%zu\r\n"
+                         "Connection: close\r\n\r\n",
+                         length, start, file.size() - 1, file.size())
+              : snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                         length);
+  long cut = dropAfter.exchange(-1);
+  size_t sending = cut >= 0 && (size_t)cut < length ? cut : length;
+  if (sendAll(fd, (const uint8_t*)header, headerLength) && sendAll(fd, file.data() + start, sending)) {
+    bytesServed += sending;
+  }
+}
+
+static int openServer(const char* host, uint16_t* port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(*port);
+  inet_pton(AF_INET, host, &address.sin_addr);
+  socklen_t length = sizeof(address);
+  if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 4) < 0 ||
+      getsockname(fd, (sockaddr*)&address, &length) < 0) {
+    close(fd);
+    return -1;
+  }
+  *port = ntohs(address.sin_port);
+  return fd;
+}
+
+static void runServer(int listenFd, FileLookup lookup) {
+  while (serverRunning) {
+    pollfd waiting = {listenFd, POLLIN, 0};
+    if (poll(&waiting, 1, 50) != 1) {
+      continue;
+    }
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd >= 0) {
+      serveClient(fd, lookup);
+      close(fd);
+    }
+  }
+}
+
+// Test
+
+static std::unordered_map<std::string, Bytes> served;
+static uint16_t serverPort = 0;
+static int failures = 0;
+
+// Deterministic stand-in for a firmware image
+static Bytes makeImage(uint32_t seed) {
+  Bytes image(TOOL_IMAGE_SIZE);
+  uint32_t state = seed;
+  for (size_t i = 0; i < image.size(); i++) {
+    state = state * 1103515245 + 12345;
+    image[i] = state >> 16;
+  }
+  return image;
+}
+
+// A new build of the same code - a function grows, one goes, literals and
+// call targets move and something is appended
+static Bytes nextBuild(const Bytes& image, uint32_t seed) {
+  Bytes next = image;
+  uint32_t state = seed;
+  auto random = [&state]() {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+  };
+  size_t grow = next.size() * 3 / 10;
+  Bytes added(1500 + random() % 1000);
+  for (uint8_t& byte : added) {
+    byte = random();
+  }
+  next.insert(next.begin() + grow, added.begin(), added.end());
+  size_t cut = next.size() * 7 / 10;
+  next.erase(next.begin() + cut, next.begin() + cut + 800 + random() % 600);
+  for (int i = 0; i < 120; i++) {
+    size_t at = random() % (next.size() - 4) & ~3u;
+    next[at] ^= 1 + random() % 255;
+  }
+  for (int i = 0; i < 2048; i++) {
+    next.push_back(random());
+  }
+  return next;
+}
+
+// The firmware's loop(), until done() or the virtual timeout. Real time
+// passes too, so the server thread keeps up. With eachPass the loop wakes
+// at least every TOOL_PASS_MS to run it.
+static bool runDevice(const std::function<bool()>& done, uint32_t timeoutMs = TOOL_TIMEOUT_MS,
+                      const std::function<void()>& eachPass = nullptr) {
+  uint64_t end = simNowMicros() + timeoutMs * 1000ULL;
+  while (!done()) {
+    if (simNowMicros() >= end) {
+      return false;
+    }
+    if (eachPass) {
+      eachPass();
+    }
+    uint32_t wait = std::min<uint32_t>(schedulerRun(), (end - simNowMicros()) / 1000 + 1);
+    halSleep(eachPass ? std::min<uint32_t>(wait, TOOL_PASS_MS) : wait);
+    std::this_thread::sleep_for(std::chrono::microseconds(TOOL_POLL_REAL_US));
+  }
+  return true;
+}
+
+static Bytes runningImage() {
+  const uint8_t* image;
+  size_t size = simFirmware(&image);
+  return Bytes(image, image + size);
+}
+
+// Boots the simulated device: the OTA module starts over from its record
+static void boot() {
+  setupOta(TOOL_HOST, serverPort);
+}
+
+static bool postUpdate(const std::string& body) {
+  OtaRequest request;
+  return parseOtaRequest(body.c_str(), &request) && startOtaUpdate(request);
+}
+
+static void report(const char* name, bool passed, const char* detail) {
+  printf("%-34s %-5s %s\n", name, passed ? "PASS" : "FAIL", detail);
+  if (!passed) {
+    failures++;
+  }
+}
+
+// Posts the update, lets it stage and restart, then boots the new image and
+// reaches ready. Returns false with the reason in detail.
+static bool installUpdate(const std::string& body, const Bytes& expected, char* detail, size_t size,
+                          const std::function<void()>& eachPass = nullptr) {
+  uint32_t restarts = simRestarts();
+  if (!postUpdate(body)) {
+    snprintf(detail, size, "update refused");
+    return false;
+  }
+  if (!runDevice([&] { return simRestarts() != restarts || otaStatus().phase == OTA_FAILED; }, TOOL_TIMEOUT_MS,
+                 eachPass)) {
+    snprintf(detail, size, "timed out in %s", otaPhaseName(otaStatus().phase));
+    return false;
+  }
+  if (otaStatus().phase == OTA_FAILED) {
+    snprintf(detail, size, "failed: %s", otaStatus().error);
+    return false;
+  }
+  OtaStatus finished = otaStatus();
+  boot();
+  if (runningImage() != expected || otaStatus().boot != OTA_BOOT_TRIAL) {
+    snprintf(detail, size, "restarted into the wrong image");
+    return false;
+  }
+  confirmOtaUpdate();
+  snprintf(detail, size, "%u B sent for %u B in %.2fs, %u resumes, %u pauses", (unsigned)finished.fileSize,
+           (unsigned)finished.imageSize, finished.durationMs / 1000.0, (unsigned)finished.resumes,
+           (unsigned)finished.pauses);
+  return otaStatus().boot == OTA_BOOT_CONFIRMED;
+}
+
+static int runTests() {
+  uint16_t port = 0;
+  int listenFd = openServer(TOOL_HOST, &port);
+  if (listenFd < 0) {
+    fprintf(stderr, "Cannot start the file server\n");
+    return 1;
+  }
+  serverPort = port;
+  std::thread server(runServer, listenFd, [](const std::string& path, Bytes* data) {
+    auto found = served.find(path);
+    if (found == served.end()) {
+      return false;
+    }
+    *data = found->second;
+    return true;
+  });
+
+  std::vector<Bytes> builds = {makeImage(1)};
+  for (uint32_t i = 1; i <= 7; i++) {
+    builds.push_back(nextBuild(builds.back(), 100 + i));
+  }
+  for (size_t i = 0; i < builds.size(); i++) {
+    served["/fw/v" + std::to_string(i) + ".bin"] = builds[i];
+  }
+  for (size_t i = 1; i < builds.size(); i++) {
+    served["/fw/v" + std::to_string(i) + ".patch"] = makePatch(builds[i - 1], builds[i]);
+  }
+
+  simSetNetworkConnected(true);
+  simSetFirmware(builds[0].data(), builds[0].size());
+  boot();
+  char detail[160];
+
+  printf("%-34s %-5s %s\n", "Scenario", "", "Detail");
+  bool passed = installUpdate(requestBody("/fw/v1.bin", builds[1], false), builds[1], detail, sizeof(detail));
+  report("full image", passed, detail);
+
+  passed = installUpdate(requestBody("/fw/v2.patch", builds[2], true), builds[2], detail, sizeof(detail));
+  report("delta patch", passed, detail);
+
+  // Cut off a third of the way in, the rest comes with Range
+  dropAfter = TOOL_IMAGE_SIZE / 3;
+  uint32_t ranges = rangeRequests;
+  passed = installUpdate(requestBody("/fw/v3.bin", builds[3], false), builds[3], detail, sizeof(detail)) &&
+           rangeRequests > ranges;
+  report("connection dropped, resumed", passed, detail);
+
+  // A goal or button press every second for 5 s once the download runs; no
+  // flash write may happen from the first one until OTA_QUIET_MS after the last
+  uint64_t nextPlay = 0;
+  uint64_t lastPlay = 0;
+  uint8_t plays = 0;
+  uint32_t writtenAtPlay = 0;
+  bool wroteDuringPlay = false;
+  auto play = [&]() {
+    const OtaStatus& status = otaStatus();
+    uint64_t now = simNowMicros();
+    if (plays == 0 && status.phase == OTA_DOWNLOAD && status.written > 50000) {
+      nextPlay = now;
+      writtenAtPlay = status.written;
+    }
+    if (plays < 6 && nextPlay != 0 && now >= nextPlay) {
+      otaPlayActivity(halMillis());
+      plays++;
+      lastPlay = now;
+      nextPlay += 1000000;
+    }
+    if (plays > 0 && now + TOOL_PASS_MS * 1000 < lastPlay + OTA_QUIET_MS * 1000ULL &&
+        status.written != writtenAtPlay) {
+      wroteDuringPlay = true;
+    }
+  };
+  passed = installUpdate(requestBody("/fw/v4.patch", builds[4], true), builds[4], detail, sizeof(detail), play) &&
+           plays == 6 && !wroteDuringPlay;
+  report("play during the download", passed, detail);
+
+  // Corrupt image - staged nothing, the next restart changes nothing
+  Bytes before = runningImage();
+  std::string body = requestBody("/fw/v5.bin", builds[5], false);
+  body.replace(body.find("\"sha1\":\"") + 8, 4, "0000");
+  postUpdate(body);
+  runDevice([] { return otaStatus().phase == OTA_FAILED || otaStatus().phase == OTA_STAGED; });
+  snprintf(detail, sizeof(detail), "%s", otaStatus().error != nullptr ? otaStatus().error : "accepted");
+  halRestart();
+  report("SHA-1 mismatch", otaStatus().phase == OTA_FAILED && runningImage() == before, detail);
+  boot();
+
+  // v6's patch applies to v5, not to v4 which is running
+  postUpdate(requestBody("/fw/v6.patch", builds[6], true));
+  runDevice([] { return otaStatus().phase == OTA_FAILED || otaStatus().phase == OTA_STAGED; });
+  snprintf(detail, sizeof(detail), "%s, %u B staged", otaStatus().error != nullptr ? otaStatus().error : "accepted",
+           (unsigned)otaStatus().written);
+  report("patch for another image", otaStatus().phase == OTA_FAILED && otaStatus().written == 0, detail);
+
+  // Never gets ready: rolled back after OTA_TRIAL_MS
+  uint32_t restarts = simRestarts();
+  postUpdate(requestBody("/fw/v5.bin", builds[5], false));
+  runDevice([&] { return simRestarts() != restarts || otaStatus().phase == OTA_FAILED; });
+  boot();
+  bool onTrial = runningImage() == builds[5] && otaStatus().boot == OTA_BOOT_TRIAL;
+  uint64_t trialStart = simNowMicros();
+  restarts = simRestarts();
+  runDevice([&] { return simRestarts() != restarts; }, OTA_TRIAL_MS * 2);
+  uint32_t trialMs = (simNowMicros() - trialStart) / 1000;
+  boot();
+  snprintf(detail, sizeof(detail), "rolled back after %ums, boot %s", (unsigned)trialMs,
+           otaBootName(otaStatus().boot));
+  report("new image never ready", onTrial && runningImage() == builds[4] && otaStatus().boot == OTA_BOOT_ROLLED_BACK,
+         detail);
+
+  // Crashes before ready: rolled back on its OTA_TRIAL_BOOTS'th boot
+  restarts = simRestarts();
+  postUpdate(requestBody("/fw/v5.bin", builds[5], false));
+  runDevice([&] { return simRestarts() != restarts || otaStatus().phase == OTA_FAILED; });
+  uint8_t boots = 0;
+  while (runningImage() == builds[5] && boots < OTA_TRIAL_BOOTS + 1) {
+    boot();
+    boots++;
+  }
+  boot();
+  snprintf(detail, sizeof(detail), "rolled back on boot %u, boot %s", boots, otaBootName(otaStatus().boot));
+  report("new image crashing", boots == OTA_TRIAL_BOOTS && runningImage() == builds[4] &&
+                                 otaStatus().boot == OTA_BOOT_ROLLED_BACK, detail);
+
+  printf("\nPatch sizes, %u B images:\n", TOOL_IMAGE_SIZE);
+  for (size_t i = 1; i < builds.size(); i++) {
+    const Bytes& patch = served["/fw/v" + std::to_string(i) + ".patch"];
+    printf("  v%zu -> v%zu  %7zu B  %5.1f%% of the image\n", i - 1, i, patch.size(),
+           100.0 * patch.size() / builds[i].size());
+  }
+  printf("Server: %llu bytes, %u Range requests\n", (unsigned long long)bytesServed.load(), rangeRequests.load());
+
+  serverRunning = false;
+  server.join();
+  close(listenFd);
+  printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+  return failures == 0 ? 0 : 1;
+}
+
+static int usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s --diff OLD NEW PATCH\n"
+          "       %s --apply OLD PATCH NEW\n"
+          "       %s --serve DIR [--port N]\n"
+          "       %s --test [--verbose]\n",
+          program, program, program, program);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc == 5 && strcmp(argv[1], "--diff") == 0) {
+    Bytes base, target;
+    if (!readFile(argv[2], &base) || !readFile(argv[3], &target)) {
+      fprintf(stderr, "Cannot read %s or %s\n", argv[2], argv[3]);
+      return 1;
+    }
+    Bytes patch = makePatch(base, target);
+    Bytes check;
+    const char* error = nullptr;
+    if (!applyPatch(base, patch, &check, &error) || check != target) {
+      fprintf(stderr, "Patch doesn't reproduce %s: %s\n", argv[3], error != nullptr ? error : "differs");
+      return 1;
+    }
+    if (!writeFile(argv[4], patch)) {
+      fprintf(stderr, "Cannot write %s\n", argv[4]);
+      return 1;
+    }
+    printf("%zu B patch for a %zu B image (%.1f%%)\n", patch.size(), target.size(),
+           100.0 * patch.size() / target.size());
+    // Served from the patch's directory by --serve
+    const char* name = strrchr(argv[4], '/');
+    std::string path = std::string("/") + (name != nullptr ? name + 1 : argv[4]);
+    printf("POST /ota %s\n", requestBody(path, target, true).c_str());
+    return 0;
+  }
+
+  if (argc == 5 && strcmp(argv[1], "--apply") == 0) {
+    Bytes base, patch, target;
+    const char* error = nullptr;
+    if (!readFile(argv[2], &base) || !readFile(argv[3], &patch)) {
+      fprintf(stderr, "Cannot read %s or %s\n", argv[2], argv[3]);
+      return 1;
+    }
+    if (!applyPatch(base, patch, &target, &error)) {
+      fprintf(stderr, "Patch failed: %s\n", error != nullptr ? error : "trailing bytes");
+      return 1;
+    }
+    if (!writeFile(argv[4], target)) {
+      fprintf(stderr, "Cannot write %s\n", argv[4]);
+      return 1;
+    }
+    printf("%zu B image, SHA-1 %s\n", target.size(), hexSha1(target).c_str());
+    return 0;
+  }
+
+  if ((argc == 3 || argc == 5) && strcmp(argv[1], "--serve") == 0) {
+    uint16_t port = TOOL_DEFAULT_PORT;
+    if (argc == 5) {
+      if (strcmp(argv[3], "--port") != 0) {
+        return usage(argv[0]);
+      }
+      port = atoi(argv[4]);
+    }
+    int listenFd = openServer("0.0.0.0", &port);
+    if (listenFd < 0) {
+      fprintf(stderr, "Cannot listen on port %u\n", port);
+      return 1;
+    }
+    std::string root = argv[2];
+    printf("Serving %s on port %u\n", root.c_str(), port);
+    runServer(listenFd, [root](const std::string& path, Bytes* data) {
+      return path.find("..") == std::string::npos && readFile((root + path).c_str(), data);
+    });
+    return 0;
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--test") == 0) {
+    if (argc == 3 && strcmp(argv[2], "--verbose") == 0) {
+      Serial.echo = true;
+    } else if (argc != 2) {
+      return usage(argv[0]);
+    }
+    setupLog();
+    return runTests();
+  }
+
+  return usage(argv[0]);
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifdef NATIVE_BUILD
+
+// Score receiver tests - the seq tracking in score_broadcast.cpp across Pi
+// restarts. A restarted Pi counts from 1 again: under a new boot id its
+// goals must be delivered at once, and without one once the seq is more
+// than SCORE_SEQ_DUPLICATE_WINDOW behind. Late copies from the same boot
+// must still be dropped.
+//
+//   .pio/build/score_receiver_test/program
+
+#include <stdio.h>
+#include "score_broadcast.h"
+
+#define BOOT_A 0x1234ABCDUL
+#define BOOT_B 0x9876FEDCUL
+
+static bool passed = true;
+static uint32_t nowMs = 0;
+
+static void check(bool condition, const char* what) {
+  printf("  %-56s %s\n", what, condition ? "ok" : "FAILED");
+  passed &= condition;
+}
+
+static void send(uint32_t seq, uint32_t boot) {
+  ScorePacket packet = {};
+  packet.seq = seq;
+  packet.player = seq % SCORE_PLAYER_COUNT;
+  packet.table = SCORE_TABLE_ANY;
+  packet.boot = boot;
+  acceptScorePacket(packet, nowMs);
+}
+
+// Seqs delivered since the last call, waiting out any reorder window
+static uint32_t drain() {
+  nowMs += SCORE_REORDER_WINDOW_MS;
+  uint32_t delivered = 0;
+  ScorePacket packet;
+  while (nextScorePacket(&packet, nowMs)) {
+    delivered++;
+  }
+  return delivered;
+}
+
+static void sendRun(uint32_t first, uint32_t last, uint32_t boot) {
+  for (uint32_t seq = first; seq <= last; seq++) {
+    send(seq, boot);
+    drain();
+  }
+}
+
+static void testBootId() {
+  printf("With a boot id\n");
+  resetScoreReceiver();
+  sendRun(1, 100, BOOT_A);
+
+  send(1, BOOT_B);
+  check(drain() == 1, "seq 1 under a new boot id is delivered");
+  send(2, BOOT_B);
+  check(drain() == 1, "and the seqs after it");
+  send(2, BOOT_B);
+  check(drain() == 0, "copies after the restart are dropped");
+  send(99, BOOT_A);
+  check(drain() == 1, "the old boot id is a restart too");
+  send(99, BOOT_A);
+  send(40, BOOT_A);
+  check(drain() == 0, "copies far behind under the same boot id are dropped");
+  check(scoreReceiverStats().restarts == 2, "two restarts counted");
+}
+
+static void testWithoutBootId() {
+  printf("Without a boot id\n");
+  resetScoreReceiver();
+  sendRun(1, 100, SCORE_BOOT_UNKNOWN);
+
+  send(100, SCORE_BOOT_UNKNOWN);
+  send(101 - SCORE_SEQ_DUPLICATE_WINDOW, SCORE_BOOT_UNKNOWN);
+  check(drain() == 0, "late copies inside the window are dropped");
+  send(1, SCORE_BOOT_UNKNOWN);
+  check(drain() == 1, "seq 1 far behind is a restart");
+  send(2, SCORE_BOOT_UNKNOWN);
+  send(2, SCORE_BOOT_UNKNOWN);
+  check(drain() == 1, "seqs after it once each");
+  check(scoreReceiverStats().restarts == 1, "one restart counted");
+}
+
+static void testPacketLayout() {
+  printf("Packet\n");
+  ScorePacket packet = {};
+  packet.seq = 7;
+  packet.table = 3;
+  packet.boot = BOOT_A;
+  uint8_t datagram[SCORE_PACKET_SIZE];
+  ScorePacket decoded;
+  bool ok = encodeScorePacket(packet, datagram, sizeof(datagram)) == SCORE_PACKET_SIZE &&
+            decodeScorePacket(datagram, sizeof(datagram), &decoded);
+  check(ok && decoded.boot == BOOT_A && decoded.table == 3, "boot id survives encode and decode");
+
+  datagram[2] = 2;
+  ok = decodeScorePacket(datagram, SCORE_PACKET_V2_SIZE, &decoded);
+  check(ok && decoded.boot == SCORE_BOOT_UNKNOWN, "version 2 has no boot id");
+}
+
+int main() {
+  testBootId();
+  testWithoutBootId();
+  testPacketLayout();
+  printf("\n%s\n", passed ? "PASS" : "FAIL");
+  return passed ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,248 @@
+#ifdef NATIVE_BUILD
+
+// Score broadcast sender - sends the Pi's goal datagrams from a Linux host,
+// and measures delivery latency over loopback through the firmware's own
+// receiver (dedupe and reorder included).
+//
+//   .pio/build/score_sender/program --player red [--table N] [--seq N] [--boot N]
+//                                   [--red N] [--blue N] [--group ADDR] [--port N]
+//                                   [--copies N]
+//   .pio/build/score_sender/program --loopback-test [--count N] [--interval-us N]
+//                                   [--copies N] [--shuffle] [--loss PERCENT]
+//
+// --copies sends every datagram more than once, the way the Pi should to
+// ride out WiFi loss. --shuffle swaps neighbouring packets and --loss drops
+// a share of them, to exercise the reorder window. --table defaults to 1,
+// DEFAULT_TABLE_ID in device_config.h. --boot defaults to SENDER_BOOT, so
+// runs by hand look like one Pi; change it to play a restarted one.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "score_broadcast.h"
+
+#define LOOPBACK_DRAIN_MS 200
+#define SENDER_TABLE 1
+#define SENDER_BOOT 1
+
+static uint64_t nowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool sendPacket(int fd, const sockaddr_in& address, const ScorePacket& packet, int copies) {
+  uint8_t datagram[SCORE_PACKET_SIZE];
+  encodeScorePacket(packet, datagram, sizeof(datagram));
+  for (int i = 0; i < copies; i++) {
+    if (sendto(fd, datagram, sizeof(datagram), 0, (const sockaddr*)&address, sizeof(address)) < 0) {
+      perror("sendto");
+      return false;
+    }
+  }
+  return true;
+}
+
+// Receiver side of the loopback test - records when each seq is delivered
+static std::vector<uint64_t> deliveredAt;
+static std::atomic<bool> receiving(true);
+
+static void runReceiver(int fd) {
+  while (receiving) {
+    uint32_t now = nowNanos() / 1000000;
+    uint32_t timeout = scoreReorderTimeout(now);
+    pollfd ready = {fd, POLLIN, 0};
+    poll(&ready, 1, timeout < 10 ? timeout : 10);
+
+    uint8_t datagram[64];
+    ssize_t length;
+    now = nowNanos() / 1000000;
+    while ((length = recv(fd, datagram, sizeof(datagram), MSG_DONTWAIT)) > 0) {
+      acceptScoreDatagram(datagram, length, now);
+    }
+
+    ScorePacket packet;
+    while (nextScorePacket(&packet, now)) {
+      if (packet.seq < deliveredAt.size()) {
+        deliveredAt[packet.seq] = nowNanos();
+      }
+    }
+  }
+}
+
+static int runLoopbackTest(uint32_t count, uint32_t intervalUs, int copies, bool shuffle, int lossPercent) {
+  int receiveFd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;  // Any free port
+  if (receiveFd < 0 || bind(receiveFd, (sockaddr*)&address, sizeof(address)) < 0) {
+    perror("bind");
+    return 1;
+  }
+  socklen_t length = sizeof(address);
+  getsockname(receiveFd, (sockaddr*)&address, &length);
+
+  std::vector<uint64_t> sentAt(count + 1, 0);
+  deliveredAt.assign(count + 1, 0);
+  resetScoreReceiver();
+  setScoreReceiverTable(SENDER_TABLE);
+  std::thread receiver(runReceiver, receiveFd);
+
+  // Send order - seq 1..count, optionally with neighbours swapped. Seq 1
+  // stays first since the first packet sets the receiver's baseline.
+  std::vector<uint32_t> order;
+  for (uint32_t seq = 1; seq <= count; seq++) {
+    order.push_back(seq);
+  }
+  if (shuffle) {
+    for (size_t i = 1; i + 1 < order.size(); i += 2) {
+      std::swap(order[i], order[i + 1]);
+    }
+  }
+  std::mt19937 random(1);
+
+  int sendFd = socket(AF_INET, SOCK_DGRAM, 0);
+  uint16_t scores[SCORE_PLAYER_COUNT] = {};
+  uint32_t dropped = 0;
+  for (uint32_t seq : order) {
+    ScorePacket packet = {};
+    packet.seq = seq;
+    packet.table = SENDER_TABLE;
+    packet.boot = SENDER_BOOT;
+    packet.player = seq % SCORE_PLAYER_COUNT;
+    scores[packet.player]++;
+    memcpy(packet.scores, scores, sizeof(scores));
+
+    sentAt[seq] = nowNanos();
+    if ((int)(random() % 100) < lossPercent) {
+      dropped++;
+    } else if (!sendPacket(sendFd, address, packet, copies)) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(intervalUs));
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(LOOPBACK_DRAIN_MS));
+  receiving = false;
+  receiver.join();
+  close(sendFd);
+  close(receiveFd);
+
+  std::vector<uint64_t> latencies;
+  for (uint32_t seq = 1; seq <= count; seq++) {
+    if (deliveredAt[seq] != 0) {
+      latencies.push_back(deliveredAt[seq] - sentAt[seq]);
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  const ScoreReceiverStats& stats = scoreReceiverStats();
+  printf("Packets:     %u sent x%d%s, %u dropped on purpose\n", count, copies, shuffle ? " (shuffled)" : "", dropped);
+  printf("Receiver:    %u received, %u delivered, %u duplicates, %u reordered, %u skipped\n",
+         stats.received, stats.delivered, stats.duplicates, stats.reordered, stats.skipped);
+  if (!latencies.empty()) {
+    printf("Latency:     p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           latencies[latencies.size() / 2] / 1000.0,
+           latencies[latencies.size() * 99 / 100] / 1000.0,
+           latencies.back() / 1000.0);
+  }
+  return stats.delivered + dropped == count ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  const char* group = SCORE_BROADCAST_GROUP;
+  uint16_t port = SCORE_BROADCAST_PORT;
+  const char* player = nullptr;
+  ScorePacket packet = {};
+  packet.seq = 1;
+  packet.table = SENDER_TABLE;
+  packet.boot = SENDER_BOOT;
+  int copies = 1;
+  bool loopbackTest = false;
+  uint32_t count = 1000;
+  uint32_t intervalUs = 1000;
+  bool shuffle = false;
+  int lossPercent = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--player") == 0 && i + 1 < argc) {
+      player = argv[++i];
+    } else if (strcmp(argv[i], "--table") == 0 && i + 1 < argc) {
+      packet.table = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seq") == 0 && i + 1 < argc) {
+      packet.seq = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--boot") == 0 && i + 1 < argc) {
+      packet.boot = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--red") == 0 && i + 1 < argc) {
+      packet.scores[SCORE_PLAYER_RED] = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--blue") == 0 && i + 1 < argc) {
+      packet.scores[SCORE_PLAYER_BLUE] = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--group") == 0 && i + 1 < argc) {
+      group = argv[++i];
+    } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--copies") == 0 && i + 1 < argc) {
+      copies = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--loopback-test") == 0) {
+      loopbackTest = true;
+    } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+      count = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--interval-us") == 0 && i + 1 < argc) {
+      intervalUs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--shuffle") == 0) {
+      shuffle = true;
+    } else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) {
+      lossPercent = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s --player red|blue [--table N] [--seq N] [--boot N] [--red N] [--blue N]\n"
+                      "          [--group ADDR] [--port N] [--copies N]\n"
+                      "       %s --loopback-test [--count N] [--interval-us N] [--copies N] [--shuffle] [--loss PERCENT]\n",
+              argv[0], argv[0]);
+      return 1;
+    }
+  }
+
+  if (loopbackTest) {
+    return runLoopbackTest(count, intervalUs, copies, shuffle, lossPercent);
+  }
+
+  if (player == nullptr || !parseScorePlayer(player, &packet.player)) {
+    fprintf(stderr, "--player must be red or blue\n");
+    return 1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  unsigned char ttl = 1;  // Stay on the table's AP
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  int broadcast = 1;
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, group, &address.sin_addr) != 1) {
+    fprintf(stderr, "Bad address %s\n", group);
+    return 1;
+  }
+
+  bool sent = sendPacket(fd, address, packet, copies);
+  close(fd);
+  if (sent) {
+    printf("Sent seq %u (boot %u): %s scored on table %u, red %u - blue %u to %s:%u\n", packet.seq, packet.boot,
+           player, packet.table, packet.scores[SCORE_PLAYER_RED], packet.scores[SCORE_PLAYER_BLUE], group, port);
+  }
+  return sent ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifdef NATIVE_BUILD
+
+// Shot speed tests - shotSpeedKmhX10() at the edges of its range, then
+// labelled traces replayed through the goal detector the way game.cpp does
+// it: each goal's speed comes from the width of the break that scored it.
+//
+//   .pio/build/shot_speed_test/program [TRACE...]
+//
+// Traces are goal_eval's, with the expected speed after each goal label:
+// "#goal <micros> <km/h x10>". Goals labelled without a speed are skipped,
+// so every detected goal that has one must match it exactly.
+
+#include <stdio.h>
+#include <vector>
+#include "goal_detector.h"
+#include "shot_speed.h"
+
+#define LASER_PIN 14                  // LASER_BREAK_PIN in game.h
+#define MATCH_WINDOW_US 20000         // Detected goal to label distance, as in goal_eval
+#define DRAIN_US 5000000UL
+
+struct TraceEdge {
+  uint32_t micros;
+  bool broken;
+};
+
+struct SpeedLabel {
+  uint32_t micros;
+  uint16_t speed;
+  bool seen;
+};
+
+static bool passed = true;
+
+static void check(bool condition, const char* what) {
+  printf("  %-52s %s\n", what, condition ? "ok" : "FAILED");
+  passed &= condition;
+}
+
+static void checkSpeed(uint32_t widthMicros, uint16_t expected, const char* why) {
+  char what[96];
+  uint16_t speed = shotSpeedKmhX10(widthMicros);
+  snprintf(what, sizeof(what), "%6u us -> %5u (%s)", widthMicros, speed, why);
+  check(speed == expected, what);
+}
+
+static void testWidths() {
+  printf("Pulse widths\n");
+  checkSpeed(0, 0, "no pulse");
+  checkSpeed(1, 0xFFFF, "clamped");
+  checkSpeed(19, 0xFFFF, "clamped");
+  checkSpeed(20, 63000, "fastest unclamped");
+  checkSpeed(GOAL_MIN_BREAK_US, 1260, "detector's shortest break");
+  checkSpeed(2519, 500, "rounds down");
+  checkSpeed(2521, 500, "rounds up");
+  checkSpeed(SHOT_MAX_PULSE_US, 8, "slowest shot");
+  checkSpeed(SHOT_MAX_PULSE_US + 1, 0, "stopped in the beam");
+  checkSpeed(0xFFFFFFFFUL, 0, "stopped in the beam");
+}
+
+static void testHistory() {
+  printf("Speed history\n");
+  ShotSpeedHistory history = {};
+  for (uint16_t i = 1; i <= SHOT_SPEED_HISTORY + 3; i++) {
+    history.add(i * 10);
+  }
+  bool newestFirst = true;
+  for (uint8_t i = 0; i < history.count; i++) {
+    newestFirst &= history.recent(i) == (SHOT_SPEED_HISTORY + 3 - i) * 10;
+  }
+  check(history.count == SHOT_SPEED_HISTORY, "keeps the last SHOT_SPEED_HISTORY shots");
+  check(newestFirst, "newest first after wrapping");
+}
+
+static bool loadTrace(const char* path, std::vector<TraceEdge>* edges, std::vector<SpeedLabel>* labels) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "Cannot open trace %s\n", path);
+    return false;
+  }
+  char line[128];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    unsigned long long at;
+    unsigned int pin;
+    unsigned int speed;
+    int level;
+    if (sscanf(line, "#goal %llu %u", &at, &speed) == 2) {
+      labels->push_back({(uint32_t)at, (uint16_t)speed, false});
+    } else if (line[0] != '#' && sscanf(line, "%llu %u %d", &at, &pin, &level) == 3 && pin == LASER_PIN) {
+      edges->push_back({(uint32_t)at, level == 0});  // Inverted for break beam
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// Matches a goal's break to its label and checks the speed
+static void scoreGoal(std::vector<SpeedLabel>* labels, uint32_t startMicros, uint32_t widthMicros,
+                      uint32_t* matched, uint32_t* wrong) {
+  uint16_t speed = shotSpeedKmhX10(widthMicros);
+  for (SpeedLabel& label : *labels) {
+    uint32_t distance = startMicros > label.micros ? startMicros - label.micros : label.micros - startMicros;
+    if (!label.seen && distance <= MATCH_WINDOW_US) {
+      label.seen = true;
+      (*matched)++;
+      if (speed != label.speed) {
+        printf("    goal at %u us: %u us wide, %u, expected %u\n", startMicros, widthMicros, speed, label.speed);
+        (*wrong)++;
+      }
+      return;
+    }
+  }
+}
+
+static void testTrace(const char* path) {
+  printf("Trace %s\n", path);
+  std::vector<TraceEdge> edges;
+  std::vector<SpeedLabel> labels;
+  if (!loadTrace(path, &edges, &labels)) {
+    passed = false;
+    return;
+  }
+
+  resetGoalDetector(false, 0);
+  bool goalPending = false;
+  uint32_t goalStart = 0;
+  uint32_t matched = 0;
+  uint32_t wrong = 0;
+  uint32_t now = 0;
+  GoalEvent event;
+  for (size_t i = 0; i <= edges.size(); i++) {
+    if (i < edges.size()) {
+      goalDetectorEdge(edges[i].broken, edges[i].micros);
+      now = edges[i].micros;
+    } else {
+      now += DRAIN_US;
+    }
+    while (nextGoalEvent(&event, now)) {
+      if (event.type == GOAL_EVENT_BREAK) {
+        goalPending = event.goal;
+        goalStart = event.startMicros;
+      } else if (goalPending && event.startMicros == goalStart) {
+        scoreGoal(&labels, event.startMicros, event.widthMicros, &matched, &wrong);
+        goalPending = false;
+      }
+    }
+  }
+
+  char what[96];
+  snprintf(what, sizeof(what), "%u of %zu labelled goals detected", matched, labels.size());
+  check(matched == labels.size(), what);
+  snprintf(what, sizeof(what), "%u with the labelled speed", matched - wrong);
+  check(wrong == 0, what);
+}
+
+int main(int argc, char** argv) {
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      fprintf(stderr, "Usage: %s [TRACE...]\n", argv[0]);
+      return 1;
+    }
+    paths.push_back(argv[i]);
+  }
+
+  testWidths();
+  testHistory();
+  for (const char* path : paths) {
+    testTrace(path);
+  }
+
+  printf("%s\n", passed ? "PASS" : "FAIL");
+  return passed ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,711 @@
+#ifdef NATIVE_BUILD
+
+// Goal traces across devices - collects what each device serves on
+// GET /traces (see goal_trace.h), merges the records of a goal into one
+// timeline from the beam break on one device to the celebration on the
+// other, and breaks the latency down by hop.
+//
+//   .pio/build/trace_collector/program --fetch HOST[:PORT]... [--out FILE] [--every SECONDS]
+//   .pio/build/trace_collector/program --report FILE... [--timelines N]
+//   .pio/build/trace_collector/program --clock-server [--port N]
+//   .pio/build/trace_collector/program --clock-test [--seed N]
+//
+// --fetch appends each device's traces to FILE, or stdout, once or every
+// few seconds until interrupted. Devices keep their last traces, so the
+// same goal shows up in several fetches; --report keeps one record per
+// device and goal. It prints the last N timelines (default 5) and the
+// per-hop breakdown over every goal. Hops between devices and the Pi are
+// only as good as the clock sync, the bound is printed next to them.
+//
+// --clock-server answers the devices' clock exchanges (clock_sync.h) the
+// way the Pi does, for a bench without one. --clock-test runs the
+// firmware's estimator against asymmetric, jittery WiFi delays, a drifting
+// crystal and a Pi restart, and checks the error stays within its bound.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "clock_sync.h"
+#include "goal_trace.h"
+#include "payloads.h"
+
+#define COLLECT_DEFAULT_PORT 80
+#define COLLECT_TIMEOUT_S 3
+#define COLLECT_LINE_MAX 512
+#define COLLECT_TIMELINES 5
+#define CLOCK_TEST_SECONDS 900
+#define CLOCK_TEST_DRIFT_PPM 20.0
+#define CLOCK_TEST_RESTART_S 450        // The Pi's clock starts over here
+#define CLOCK_TEST_LOSS_PERCENT 3       // Requests or answers lost on the air
+
+static volatile sig_atomic_t running = 1;
+
+static void stopRunning(int) {
+  running = 0;
+}
+
+static uint64_t nowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Fetching
+
+static bool sendAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+// Undoes Transfer-Encoding: chunked, false if the body is cut short
+static bool dechunk(const std::string& body, std::string* out) {
+  size_t at = 0;
+  while (at < body.size()) {
+    size_t lineEnd = body.find("\r\n", at);
+    if (lineEnd == std::string::npos) {
+      return false;
+    }
+    size_t length = strtoul(body.c_str() + at, nullptr, 16);
+    if (length == 0) {
+      return true;
+    }
+    at = lineEnd + 2;
+    if (at + length > body.size()) {
+      return false;
+    }
+    out->append(body, at, length);
+    at += length + 2;
+  }
+  return false;
+}
+
+// GET /traces from one device, the body in traces
+static bool fetchTraces(const std::string& target, std::string* traces, std::string* error) {
+  std::string host = target;
+  std::string port = std::to_string(COLLECT_DEFAULT_PORT);
+  size_t colon = target.rfind(':');
+  if (colon != std::string::npos) {
+    host = target.substr(0, colon);
+    port = target.substr(colon + 1);
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* address = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &address) != 0) {
+    *error = "unknown host";
+    return false;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout = {COLLECT_TIMEOUT_S, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  bool connected = fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+  freeaddrinfo(address);
+  if (!connected) {
+    *error = "cannot connect";
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+
+  std::string request = "GET /traces HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+  std::string received;
+  if (sendAll(fd, request.c_str(), request.size())) {
+    char chunk[1024];
+    ssize_t length;
+    while ((length = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+      received.append(chunk, length);
+    }
+  }
+  close(fd);
+
+  size_t headerEnd = received.find("\r\n\r\n");
+  int status = 0;
+  sscanf(received.c_str(), "HTTP/1.%*d %d", &status);
+  if (headerEnd == std::string::npos || status != 200) {
+    *error = status != 0 ? "status " + std::to_string(status) : "no response";
+    return false;
+  }
+  std::string header = received.substr(0, headerEnd);
+  std::string body = received.substr(headerEnd + 4);
+  if (header.find("chunked") != std::string::npos) {
+    if (!dechunk(body, traces)) {
+      *error = "response cut short";
+      return false;
+    }
+  } else {
+    *traces = body;
+  }
+  return true;
+}
+
+static int runFetch(const std::vector<std::string>& targets, const char* outPath, int everySeconds) {
+  FILE* out = stdout;
+  if (outPath != nullptr) {
+    out = fopen(outPath, "a");
+    if (out == nullptr) {
+      fprintf(stderr, "Cannot open %s\n", outPath);
+      return 1;
+    }
+  }
+  signal(SIGINT, stopRunning);
+  signal(SIGTERM, stopRunning);
+
+  int failures = 0;
+  while (running) {
+    for (const std::string& target : targets) {
+      std::string traces, error;
+      if (!fetchTraces(target, &traces, &error)) {
+        fprintf(stderr, "%s: %s\n", target.c_str(), error.c_str());
+        failures++;
+        continue;
+      }
+      fwrite(traces.data(), 1, traces.size(), out);
+      fflush(out);
+      if (out != stdout) {
+        size_t lines = std::count(traces.begin(), traces.end(), '\n');
+        printf("%s: %zu traces\n", target.c_str(), lines);
+      }
+    }
+    if (everySeconds <= 0) {
+      break;
+    }
+    for (int i = 0; i < everySeconds * 10 && running; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  return everySeconds <= 0 && failures > 0 ? 1 : 0;
+}
+
+// Reports
+
+// One device's record of a goal, a line of GET /traces
+struct DeviceTrace {
+  uint32_t table = 0;
+  std::string side;
+  uint32_t id = 0;
+  std::string scorer;
+  std::string via;
+  bool piClock = false;
+  uint32_t errorUs = 0;
+  uint8_t seen = 0;
+  uint32_t hops[GOAL_HOP_COUNT] = {};
+
+  bool has(uint8_t hop) const {
+    return seen & (1 << hop);
+  }
+  std::string name() const {
+    return std::to_string(table) + "/" + side;
+  }
+};
+
+// All records of one goal
+struct Goal {
+  uint32_t id = 0;
+  std::vector<DeviceTrace> devices;
+  const DeviceTrace* sender = nullptr;     // Saw the beam break
+  const DeviceTrace* receiver = nullptr;   // Celebrated, or failing that was notified
+  const DeviceTrace* pi = nullptr;         // Has the Pi's stamps
+};
+
+enum Segment {
+  SEGMENT_DETECT,      // break -> sent, on the sender
+  SEGMENT_UPLINK,      // sent -> piReceived
+  SEGMENT_PI,          // piReceived -> piSent
+  SEGMENT_DOWNLINK,    // piSent -> notified
+  SEGMENT_CELEBRATE,   // notified -> celebrated, on the receiver
+  SEGMENT_TOTAL,       // break -> celebrated
+  SEGMENT_ACK,         // sent -> ack, on the sender
+  SEGMENT_COUNT
+};
+
+static const char* const segmentNames[SEGMENT_COUNT] = {
+  "detect", "uplink", "pi", "downlink", "celebrate", "total", "ack"};
+
+// The end of the chain of segments that add up to the total
+#define SEGMENT_CHAIN_END SEGMENT_TOTAL
+
+struct SegmentTimes {
+  std::vector<int32_t> micros;
+  uint32_t maxErrorUs = 0;
+};
+
+static bool parseDeviceTrace(const char* line, DeviceTrace* trace) {
+  char text[16];
+  if (!parseStringField(line, "trace", text, sizeof(text))) {
+    return false;
+  }
+  trace->id = strtoul(text, nullptr, 16);
+  if (trace->id == 0 || !parseUintField(line, "table", &trace->table) ||
+      !parseStringField(line, "side", text, sizeof(text))) {
+    return false;
+  }
+  trace->side = text;
+  if (parseStringField(line, "scorer", text, sizeof(text))) {
+    trace->scorer = text;
+  }
+  if (parseStringField(line, "via", text, sizeof(text))) {
+    trace->via = text;
+  }
+  trace->piClock = parseStringField(line, "clock", text, sizeof(text)) && strcmp(text, "pi") == 0;
+  parseUintField(line, "errorUs", &trace->errorUs);
+  for (uint8_t hop = 0; hop < GOAL_HOP_COUNT; hop++) {
+    if (parseUintField(line, goalHopName(hop), &trace->hops[hop])) {
+      trace->seen |= 1 << hop;
+    }
+  }
+  return true;
+}
+
+static int hopCount(const DeviceTrace& trace) {
+  return __builtin_popcount(trace.seen);
+}
+
+// Reads every file, keeping the most complete record per device and goal,
+// goals in the order first seen
+static bool loadGoals(const std::vector<std::string>& paths, std::vector<Goal>* goals, uint32_t* lines) {
+  typedef std::tuple<uint32_t, std::string, uint32_t> RecordKey;
+  std::map<RecordKey, DeviceTrace> records;
+  std::vector<uint32_t> order;
+  std::map<uint32_t, bool> known;
+
+  for (const std::string& path : paths) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == nullptr) {
+      fprintf(stderr, "Cannot read %s\n", path.c_str());
+      return false;
+    }
+    char line[COLLECT_LINE_MAX];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+      DeviceTrace trace;
+      if (!parseDeviceTrace(line, &trace)) {
+        continue;
+      }
+      (*lines)++;
+      RecordKey key(trace.table, trace.side, trace.id);
+      auto found = records.find(key);
+      if (found == records.end() || hopCount(trace) > hopCount(found->second)) {
+        records[key] = trace;
+      }
+      if (!known[trace.id]) {
+        known[trace.id] = true;
+        order.push_back(trace.id);
+      }
+    }
+    fclose(file);
+  }
+
+  std::map<uint32_t, size_t> index;
+  for (uint32_t id : order) {
+    index[id] = goals->size();
+    goals->emplace_back();
+    goals->back().id = id;
+  }
+  for (const auto& record : records) {
+    (*goals)[index[record.second.id]].devices.push_back(record.second);
+  }
+  for (Goal& goal : *goals) {
+    for (const DeviceTrace& device : goal.devices) {
+      if (device.has(GOAL_HOP_BREAK) && goal.sender == nullptr) {
+        goal.sender = &device;
+      }
+      if (device.has(GOAL_HOP_CELEBRATED)) {
+        goal.receiver = &device;
+      } else if (device.has(GOAL_HOP_NOTIFIED) && goal.receiver == nullptr) {
+        goal.receiver = &device;
+      }
+      if (device.has(GOAL_HOP_PI_RECEIVED) && device.has(GOAL_HOP_PI_SENT) && goal.pi == nullptr) {
+        goal.pi = &device;
+      }
+    }
+  }
+  return true;
+}
+
+// The Pi's stamps are in its clock in every record
+static bool isPiHop(uint8_t hop) {
+  return hop == GOAL_HOP_PI_RECEIVED || hop == GOAL_HOP_PI_SENT;
+}
+
+// Time from hop a on one record to hop b on another, false when either is
+// missing or the two aren't in the same clock
+static bool hopSpan(const DeviceTrace* from, uint8_t a, const DeviceTrace* to, uint8_t b, int32_t* micros) {
+  if (from == nullptr || to == nullptr || !from->has(a) || !to->has(b)) {
+    return false;
+  }
+  bool sameDevice = from == to && !isPiHop(a) && !isPiHop(b);
+  bool bothPi = (isPiHop(a) || from->piClock) && (isPiHop(b) || to->piClock);
+  if (!sameDevice && !bothPi) {
+    return false;
+  }
+  *micros = (int32_t)(to->hops[b] - from->hops[a]);
+  return true;
+}
+
+// Clock error in a span, from the device hops converted to the Pi's clock
+static uint32_t spanError(const DeviceTrace* from, uint8_t a, const DeviceTrace* to, uint8_t b) {
+  if (from == to && !isPiHop(a) && !isPiHop(b)) {
+    return 0;
+  }
+  return (isPiHop(a) ? 0 : from->errorUs) + (isPiHop(b) ? 0 : to->errorUs);
+}
+
+static void addSpan(SegmentTimes* times, const DeviceTrace* from, uint8_t a, const DeviceTrace* to, uint8_t b) {
+  int32_t micros;
+  if (hopSpan(from, a, to, b, &micros)) {
+    times->micros.push_back(micros);
+    times->maxErrorUs = std::max(times->maxErrorUs, spanError(from, a, to, b));
+  }
+}
+
+static void addGoal(const Goal& goal, SegmentTimes* segments) {
+  addSpan(&segments[SEGMENT_DETECT], goal.sender, GOAL_HOP_BREAK, goal.sender, GOAL_HOP_SENT);
+  addSpan(&segments[SEGMENT_UPLINK], goal.sender, GOAL_HOP_SENT, goal.pi, GOAL_HOP_PI_RECEIVED);
+  addSpan(&segments[SEGMENT_PI], goal.pi, GOAL_HOP_PI_RECEIVED, goal.pi, GOAL_HOP_PI_SENT);
+  addSpan(&segments[SEGMENT_DOWNLINK], goal.pi, GOAL_HOP_PI_SENT, goal.receiver, GOAL_HOP_NOTIFIED);
+  addSpan(&segments[SEGMENT_CELEBRATE], goal.receiver, GOAL_HOP_NOTIFIED, goal.receiver, GOAL_HOP_CELEBRATED);
+  addSpan(&segments[SEGMENT_TOTAL], goal.sender, GOAL_HOP_BREAK, goal.receiver, GOAL_HOP_CELEBRATED);
+  addSpan(&segments[SEGMENT_ACK], goal.sender, GOAL_HOP_SENT, goal.sender, GOAL_HOP_ACK);
+}
+
+struct TimelineEntry {
+  int32_t micros;
+  std::string what;
+};
+
+static void printTimeline(const Goal& goal) {
+  printf("\nGoal %08x", (unsigned)goal.id);
+  if (goal.sender != nullptr) {
+    printf(" for %s, scored on %s", goal.sender->scorer.c_str(), goal.sender->name().c_str());
+  }
+  printf("\n");
+
+  // Relative to the break where it's in the Pi's clock, else to the Pi
+  const DeviceTrace* base = goal.sender;
+  uint8_t baseHop = GOAL_HOP_BREAK;
+  if (base == nullptr || !base->piClock) {
+    base = goal.pi;
+    baseHop = GOAL_HOP_PI_RECEIVED;
+  }
+  if (base == nullptr) {
+    base = &goal.devices.front();
+    baseHop = 0;
+    while (!base->has(baseHop)) {
+      baseHop++;
+    }
+  }
+
+  std::vector<TimelineEntry> entries;
+  std::vector<std::string> unplaced;
+  if (goal.pi != nullptr) {
+    for (uint8_t hop : {GOAL_HOP_PI_RECEIVED, GOAL_HOP_PI_SENT}) {
+      int32_t micros;
+      if (hopSpan(base, baseHop, goal.pi, hop, &micros)) {
+        entries.push_back({micros, std::string("pi        ") + goalHopName(hop)});
+      }
+    }
+  }
+  for (const DeviceTrace& device : goal.devices) {
+    for (uint8_t hop = 0; hop < GOAL_HOP_COUNT; hop++) {
+      if (!device.has(hop) || isPiHop(hop)) {
+        continue;
+      }
+      std::string what = device.name();
+      what.resize(std::max<size_t>(what.size(), 9), ' ');
+      what += std::string(" ") + goalHopName(hop);
+      if (hop == GOAL_HOP_NOTIFIED && !device.via.empty()) {
+        what += " (" + device.via + ")";
+      }
+      int32_t micros;
+      if (hopSpan(base, baseHop, &device, hop, &micros)) {
+        uint32_t error = spanError(base, baseHop, &device, hop);
+        if (error > 0) {
+          what += "  +-" + std::to_string(error) + " us";
+        }
+        entries.push_back({micros, what});
+      } else {
+        unplaced.push_back(what);
+      }
+    }
+  }
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const TimelineEntry& a, const TimelineEntry& b) { return a.micros < b.micros; });
+  for (const TimelineEntry& entry : entries) {
+    printf("  %+9.2f ms  %s\n", entry.micros / 1000.0, entry.what.c_str());
+  }
+  for (const std::string& what : unplaced) {
+    printf("          ?     %s  (device clock, not synced)\n", what.c_str());
+  }
+}
+
+static double percentileMs(const std::vector<int32_t>& sorted, int percent) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)] / 1000.0;
+}
+
+static double meanMs(const std::vector<int32_t>& values) {
+  double sum = 0;
+  for (int32_t value : values) {
+    sum += value;
+  }
+  return values.empty() ? 0 : sum / values.size() / 1000.0;
+}
+
+static int runReport(const std::vector<std::string>& paths, int timelines) {
+  std::vector<Goal> goals;
+  uint32_t lines = 0;
+  if (!loadGoals(paths, &goals, &lines)) {
+    return 1;
+  }
+  uint32_t complete = 0;
+  uint32_t unsynced = 0;
+  for (const Goal& goal : goals) {
+    int32_t micros;
+    if (hopSpan(goal.sender, GOAL_HOP_BREAK, goal.receiver, GOAL_HOP_CELEBRATED, &micros)) {
+      complete++;
+    }
+    for (const DeviceTrace& device : goal.devices) {
+      if (!device.piClock) {
+        unsynced++;
+        break;
+      }
+    }
+  }
+  printf("%u records, %zu goals, %u from break to celebration, %u with a device not synced\n", lines,
+         goals.size(), complete, unsynced);
+  if (goals.empty()) {
+    return 1;
+  }
+
+  size_t first = goals.size() > (size_t)timelines ? goals.size() - timelines : 0;
+  for (size_t i = first; i < goals.size(); i++) {
+    printTimeline(goals[i]);
+  }
+
+  SegmentTimes segments[SEGMENT_COUNT];
+  for (const Goal& goal : goals) {
+    addGoal(goal, segments);
+  }
+  double chainMs = 0;
+  for (int segment = 0; segment < SEGMENT_CHAIN_END; segment++) {
+    chainMs += meanMs(segments[segment].micros);
+  }
+
+  printf("\n%-10s %6s %9s %9s %9s %9s %6s %10s\n", "Hop", "Goals", "p50 ms", "p90 ms", "max ms", "mean ms",
+         "share", "clock +-ms");
+  for (int segment = 0; segment < SEGMENT_COUNT; segment++) {
+    std::vector<int32_t>& micros = segments[segment].micros;
+    std::sort(micros.begin(), micros.end());
+    if (segment == SEGMENT_CHAIN_END) {
+      printf("\n");
+    }
+    char share[16] = "";
+    if (segment < SEGMENT_CHAIN_END && chainMs > 0) {
+      snprintf(share, sizeof(share), "%5.1f%%", 100.0 * meanMs(micros) / chainMs);
+    }
+    printf("%-10s %6zu %9.2f %9.2f %9.2f %9.2f %6s %10.2f\n", segmentNames[segment], micros.size(),
+           percentileMs(micros, 50), percentileMs(micros, 90), micros.empty() ? 0 : micros.back() / 1000.0,
+           meanMs(micros), share, segments[segment].maxErrorUs / 1000.0);
+  }
+  return 0;
+}
+
+// Clock
+
+static int runClockServer(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (fd < 0 || bind(fd, (const sockaddr*)&address, sizeof(address)) < 0) {
+    fprintf(stderr, "Cannot bind UDP port %u\n", port);
+    return 1;
+  }
+  printf("Answering clock exchanges on UDP port %u\n", port);
+
+  uint32_t answered = 0;
+  while (true) {
+    uint8_t request[64];
+    sockaddr_in from = {};
+    socklen_t fromLength = sizeof(from);
+    ssize_t length = recvfrom(fd, request, sizeof(request), 0, (sockaddr*)&from, &fromLength);
+    uint32_t receivedMicros = (uint32_t)nowMicros();
+    if (length <= 0) {
+      continue;
+    }
+    uint8_t reply[CLOCK_PACKET_SIZE];
+    size_t replyLength = answerClockRequest(request, length, receivedMicros, (uint32_t)nowMicros(), reply,
+                                            sizeof(reply));
+    if (replyLength > 0) {
+      sendto(fd, reply, replyLength, 0, (const sockaddr*)&from, fromLength);
+      if (++answered % 600 == 1) {
+        printf("%u exchanges, last from %s\n", answered, inet_ntoa(from.sin_addr));
+        fflush(stdout);
+      }
+    }
+  }
+}
+
+// Simulated WiFi leg: a floor, scheduling jitter, and now and then a long
+// wait for retries or the power-save beacon
+static double airMicros(std::mt19937& random) {
+  std::exponential_distribution<double> jitter(1.0 / 1500);
+  std::uniform_real_distribution<double> unit(0, 1);
+  double micros = 1200 + jitter(random);
+  if (unit(random) < 0.08) {
+    micros += 20000 + unit(random) * 100000;
+  }
+  return micros;
+}
+
+static int runClockTest(uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> unit(0, 1);
+  std::uniform_int_distribution<uint32_t> anyMicros;
+
+  // Both clocks start anywhere in 32 bits, the device's runs fast
+  double drift = CLOCK_TEST_DRIFT_PPM / 1e6;
+  uint32_t deviceStart = anyMicros(random);
+  uint32_t piStart = anyMicros(random);
+  auto deviceClock = [&](double t) { return (uint32_t)(deviceStart + (uint64_t)(t * (1 + drift))); };
+  auto piClock = [&](double t) { return (uint32_t)(piStart + (uint64_t)t); };
+
+  resetClockSync();
+  std::vector<uint32_t> errors;
+  uint32_t outOfBound = 0;
+  uint32_t lost = 0;
+  uint32_t worstBound = 0;
+  // A sample is up to CLOCK_SYNC_SAMPLES exchanges old, the drift since adds up
+  uint32_t driftAllowance = (uint32_t)(CLOCK_SYNC_SAMPLES * CLOCK_SYNC_INTERVAL_MS * 1000.0 * drift) + 1;
+  bool restarted = false;
+
+  for (uint32_t second = 0; second < CLOCK_TEST_SECONDS; second++) {
+    double t = second * 1e6 + unit(random) * 1000;
+    if (second == CLOCK_TEST_RESTART_S && !restarted) {
+      piStart = anyMicros(random);
+      restarted = true;
+    }
+    uint8_t request[CLOCK_PACKET_SIZE];
+    uint8_t reply[CLOCK_PACKET_SIZE];
+    startClockExchange(deviceClock(t), request, sizeof(request));
+
+    double arrives = t + airMicros(random);
+    double answers = arrives + 50 + unit(random) * 400;
+    double back = answers + airMicros(random);
+    if (unit(random) * 100 < CLOCK_TEST_LOSS_PERCENT) {
+      lost++;
+      continue;
+    }
+    answerClockRequest(request, sizeof(request), piClock(arrives), piClock(answers), reply, sizeof(reply));
+    acceptClockReply(reply, sizeof(reply), deviceClock(back));
+
+    // Checked half a second later, between exchanges
+    double check = back + 500000;
+    uint32_t error = (uint32_t)abs((int32_t)(deviceToPiMicros(deviceClock(check)) - piClock(check)));
+    uint32_t bound = clockSyncErrorMicros();
+    errors.push_back(error);
+    worstBound = std::max(worstBound, bound);
+    if (error > bound + driftAllowance) {
+      outOfBound++;
+    }
+  }
+
+  const ClockSyncStats& stats = clockSyncStats();
+  std::sort(errors.begin(), errors.end());
+  auto at = [&](int percent) { return errors[std::min(errors.size() - 1, errors.size() * percent / 100)]; };
+  printf("%u exchanges, %u replies, %u lost, %u stale, %u clock steps\n", stats.requests, stats.replies, lost,
+         stats.stale, stats.steps);
+  printf("Offset error: p50 %u us, p90 %u us, p99 %u us, max %u us\n", at(50), at(90), at(99), errors.back());
+  printf("Reported bound: up to %u us, plus %u us drift over the sample window\n", worstBound, driftAllowance);
+  printf("%u checks out of bound\n", outOfBound);
+  bool pass = outOfBound == 0 && stats.steps == 1;
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
+
+static int usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s --fetch HOST[:PORT]... [--out FILE] [--every SECONDS]\n"
+          "       %s --report FILE... [--timelines N]\n"
+          "       %s --clock-server [--port N]\n"
+          "       %s --clock-test [--seed N]\n",
+          program, program, program, program);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    return usage(argv[0]);
+  }
+  const char* mode = argv[1];
+  std::vector<std::string> arguments;
+  const char* outPath = nullptr;
+  int every = 0;
+  int timelines = COLLECT_TIMELINES;
+  uint16_t port = CLOCK_SYNC_PORT;
+  uint32_t seed = 1;
+  for (int i = 2; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--out") == 0 && hasValue) {
+      outPath = argv[++i];
+    } else if (strcmp(argv[i], "--every") == 0 && hasValue) {
+      every = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--timelines") == 0 && hasValue) {
+      timelines = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--port") == 0 && hasValue) {
+      port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+      seed = strtoul(argv[++i], nullptr, 10);
+    } else if (argv[i][0] == '-') {
+      return usage(argv[0]);
+    } else {
+      arguments.push_back(argv[i]);
+    }
+  }
+
+  if (strcmp(mode, "--fetch") == 0 && !arguments.empty()) {
+    return runFetch(arguments, outPath, every);
+  }
+  if (strcmp(mode, "--report") == 0 && !arguments.empty()) {
+    return runReport(arguments, timelines);
+  }
+  if (strcmp(mode, "--clock-server") == 0 && arguments.empty()) {
+    return runClockServer(port);
+  }
+  if (strcmp(mode, "--clock-test") == 0 && arguments.empty()) {
+    return runClockTest(seed);
+  }
+  return usage(argv[0]);
+}
+
+#endif
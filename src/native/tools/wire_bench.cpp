@@ -0,0 +1,284 @@
+#ifdef NATIVE_BUILD
+
+// Binary frames against the JSON requests they replace, for the messages
+// the device sends the Pi: a goal (sendGoalAPI(), POST /score), a reset
+// (POST /reset) and a batch of points from the journal (POST /events).
+//
+//   .pio/build/wire_bench/program [--iterations N] [--requests N]
+//
+// Encode cost   building the body and HTTP header the way outbound.cpp
+//               does, against encoding the payload and frame header. Every
+//               frame is also run through the reference decoder, which has
+//               to give back the JSON body byte for byte.
+// Bytes on air  request plus response, and with per-segment overhead
+//               (802.11 data header, LLC/SNAP, FCS, IPv4 and TCP) for the
+//               segments the firmware writes - the HTTP header and body are
+//               two writes, a frame is one. TCP acks are the same either way
+//               and left out; the HTTP response is the mock Pi's.
+// Latency       the firmware's outbound queue on the native HAL against the
+//               mock Pi over loopback, queueing to onComplete.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "event_journal.h"
+#include "hal.h"
+#include "mock_pi.h"
+#include "outbound.h"
+#include "payloads.h"
+#include "score_broadcast.h"
+#include "sim.h"
+#include "wire_protocol.h"
+
+#define BENCH_HOST "127.0.0.1"
+#define BENCH_SEGMENT_OVERHEAD 78   // 802.11 24 + QoS 2 + LLC/SNAP 8 + FCS 4, IPv4 20, TCP 20
+#define BENCH_BATCH_POINTS 4
+#define BENCH_TABLE 2
+#define BENCH_BODY_MAX 1024
+
+enum BenchMessage {
+  BENCH_GOAL,
+  BENCH_RESET,
+  BENCH_EVENTS,
+  BENCH_MESSAGE_COUNT
+};
+
+static const char* const messageNames[BENCH_MESSAGE_COUNT] = {"goal", "reset", "events x4"};
+
+struct Encoded {
+  int requestBytes;
+  int segments;
+  std::string body;        // JSON body, or the frame's payload
+};
+
+static JournalEvent batch[BENCH_BATCH_POINTS];
+static std::atomic<bool> serverRunning(true);
+static std::atomic<uint32_t> serverRequests(0);
+static volatile uint32_t sink = 0;
+
+static uint64_t nowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void countRequest(const char*, const char*, const std::string&) {
+  serverRequests++;
+}
+
+// What sendGoalAPI(), sendResetAPI() and the journal build, then what
+// sendOutbound() puts in front of it
+static const JournalSeq benchSeq = {0x5EED, 1234};
+
+static Encoded encodeJson(int message, uint16_t port) {
+  char body[BENCH_BODY_MAX];
+  char header[160];
+  const char* path;
+  int length;
+  switch (message) {
+    case BENCH_GOAL:
+      path = "/score";
+      length = formatScoreBody(body, sizeof(body), "red", BENCH_TABLE, 246, nullptr, &benchSeq);
+      break;
+    case BENCH_RESET:
+      path = "/reset";
+      length = formatResetBody(body, sizeof(body), "blue", BENCH_TABLE, &benchSeq);
+      break;
+    default:
+      path = "/events";
+      length = formatEventsBody(body, sizeof(body), "blue", "red", BENCH_TABLE, 0x5EED, 123456, batch, BENCH_BATCH_POINTS);
+      break;
+  }
+  int headerLength = formatRequestHeader(header, sizeof(header), path, BENCH_HOST, port, length);
+  return {headerLength + length, 2, std::string(body, length)};
+}
+
+static uint8_t frameType(int message) {
+  return message == BENCH_GOAL ? WIRE_GOAL : message == BENCH_RESET ? WIRE_RESET : WIRE_EVENTS;
+}
+
+static Encoded encodeFrame(int message, uint32_t seq) {
+  uint8_t frame[WIRE_HEADER_SIZE + WIRE_PAYLOAD_MAX];
+  uint8_t* payload = frame + WIRE_HEADER_SIZE;
+  size_t length;
+  switch (message) {
+    case BENCH_GOAL:
+      length = encodeWireGoal(SCORE_PLAYER_RED, BENCH_TABLE, 246, payload, WIRE_PAYLOAD_MAX, nullptr, &benchSeq);
+      break;
+    case BENCH_RESET:
+      length = encodeWireReset(SCORE_PLAYER_BLUE, BENCH_TABLE, payload, WIRE_PAYLOAD_MAX, &benchSeq);
+      break;
+    default:
+      length = encodeWireEvents(SCORE_PLAYER_BLUE, BENCH_TABLE, 0x5EED, 123456, batch, BENCH_BATCH_POINTS,
+                                payload, WIRE_PAYLOAD_MAX);
+      break;
+  }
+  WireHeader header = {WIRE_VERSION, frameType(message), seq, (uint16_t)length};
+  encodeWireHeader(header, frame, sizeof(frame));
+  return {(int)(WIRE_HEADER_SIZE + length), 1, std::string((const char*)payload, length)};
+}
+
+static double nanosPerEncode(int message, bool frames, int iterations, uint16_t port) {
+  uint64_t start = nowNanos();
+  for (int i = 0; i < iterations; i++) {
+    sink += frames ? encodeFrame(message, i).requestBytes : encodeJson(message, port).requestBytes;
+  }
+  return (double)(nowNanos() - start) / iterations;
+}
+
+// The reference decoder has to turn each frame back into the JSON body
+static bool decodesToJson(int message, uint16_t port) {
+  Encoded json = encodeJson(message, port);
+  Encoded frame = encodeFrame(message, 1);
+  WireHeader header = {WIRE_VERSION, frameType(message), 1, (uint16_t)frame.body.size()};
+  const char* path;
+  char body[BENCH_BODY_MAX];
+  int length = wireFrameToRequest(header, (const uint8_t*)frame.body.data(), &path, body, sizeof(body));
+  return length >= 0 && json.body == std::string(body, length);
+}
+
+// Latency through outbound.cpp
+
+static uint32_t completed = 0;
+static int lastResult = 0;
+
+static void onComplete(int result) {
+  completed++;
+  lastResult = result;
+}
+
+static bool queueMessage(int message, bool frames) {
+  static uint8_t payload[WIRE_PAYLOAD_MAX];
+  static char body[BENCH_BODY_MAX];
+  if (frames) {
+    Encoded frame = encodeFrame(message, 0);
+    memcpy(payload, frame.body.data(), frame.body.size());
+    return queueOutboundFrameBuffer(frameType(message), payload, frame.body.size(), "Bench frame", onComplete);
+  }
+  static const char* const paths[BENCH_MESSAGE_COUNT] = {"/score", "/reset", "/events"};
+  Encoded json = encodeJson(message, 0);
+  memcpy(body, json.body.c_str(), json.body.size() + 1);
+  return queueOutboundBuffer(paths[message], body, "Bench request", onComplete);
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, int percent) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+// One request in flight at a time, as the device sends them
+static std::vector<uint32_t> measureLatency(int message, bool frames, int requests, uint32_t* failed) {
+  std::vector<uint32_t> latencies;
+  for (int i = 0; i < requests; i++) {
+    uint32_t before = completed;
+    uint64_t start = nowNanos();
+    if (!queueMessage(message, frames)) {
+      (*failed)++;
+      continue;
+    }
+    while (completed == before) {
+      updateOutbound();
+    }
+    if (lastResult != 200) {
+      (*failed)++;
+      continue;
+    }
+    latencies.push_back((nowNanos() - start) / 1000);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  return latencies;
+}
+
+int main(int argc, char** argv) {
+  int iterations = 200000;
+  int requests = 2000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+      requests = std::max(1, atoi(argv[++i]));
+    } else {
+      fprintf(stderr, "Usage: %s [--iterations N] [--requests N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  for (uint8_t i = 0; i < BENCH_BATCH_POINTS; i++) {
+    batch[i] = {1000u + i, 60000u + 150u * i, JOURNAL_POINT, (uint8_t)(i % 2 ? JOURNAL_FLAG_QUANTUM : 0), 1};
+  }
+
+  uint16_t port = 0;
+  uint16_t wirePort = 0;
+  int listenFd = openMockPi(BENCH_HOST, &port);
+  int wireFd = openMockPi(BENCH_HOST, &wirePort);
+  if (listenFd < 0 || wireFd < 0) {
+    fprintf(stderr, "Cannot start mock server\n");
+    return 1;
+  }
+  setMockPiWire(wireFd, wirePort);
+  std::thread server(runMockPi, listenFd, countRequest, std::cref(serverRunning));
+
+  // One request up front opens the connection and measures the mock Pi's
+  // answer to a JSON request
+  simSetNetworkConnected(true);
+  setupOutbound(BENCH_HOST, port);
+  uint32_t failed = 0;
+  uint32_t receivedBefore = outboundStats().bytesReceived;
+  measureLatency(BENCH_GOAL, false, 1, &failed);
+  int httpResponseBytes = outboundStats().bytesReceived - receivedBefore;
+  const int ackBytes = WIRE_HEADER_SIZE + WIRE_ACK_SIZE;
+
+  printf("Encode cost (%d iterations) and bytes per message, request + response\n", iterations);
+  printf("%-10s %10s %10s %8s %8s %10s %10s %7s\n", "Message", "JSON ns", "Frame ns", "JSON B", "Frame B",
+         "JSON air", "Frame air", "Decoded");
+  bool decoded = true;
+  for (int message = 0; message < BENCH_MESSAGE_COUNT; message++) {
+    Encoded json = encodeJson(message, port);
+    Encoded frame = encodeFrame(message, 1);
+    int jsonBytes = json.requestBytes + httpResponseBytes;
+    int frameBytes = frame.requestBytes + ackBytes;
+    int jsonAir = jsonBytes + (json.segments + 1) * BENCH_SEGMENT_OVERHEAD;
+    int frameAir = frameBytes + (frame.segments + 1) * BENCH_SEGMENT_OVERHEAD;
+    bool same = decodesToJson(message, port);
+    decoded = decoded && same;
+    printf("%-10s %10.1f %10.1f %8d %8d %10d %10d %7s\n", messageNames[message],
+           nanosPerEncode(message, false, iterations, port), nanosPerEncode(message, true, iterations, port),
+           jsonBytes, frameBytes, jsonAir, frameAir, same ? "same" : "DIFFERS");
+  }
+
+  printf("\nLatency through outbound.cpp to the mock Pi on loopback (%d requests each)\n", requests);
+  printf("%-10s %-6s %8s %9s %9s %9s %9s\n", "Message", "Proto", "Failed", "p50 us", "p90 us", "p99 us",
+         "max us");
+  for (int message = 0; message < BENCH_MESSAGE_COUNT; message++) {
+    for (int frames = 0; frames <= 1; frames++) {
+      setOutboundWire(frames ? wirePort : 0);
+      uint32_t messageFailed = 0;
+      std::vector<uint32_t> sorted = measureLatency(message, frames, requests, &messageFailed);
+      printf("%-10s %-6s %8u %9u %9u %9u %9u\n", messageNames[message], frames ? "frame" : "json", messageFailed,
+             percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+             sorted.empty() ? 0 : sorted.back());
+      failed += messageFailed;
+    }
+  }
+
+  const OutboundStats& stats = outboundStats();
+  printf("\nOutbound:         %u requests, %u frames, %u reconnects, %u bytes sent, %u received\n",
+         stats.requests, stats.frames, stats.reconnects, stats.bytesSent, stats.bytesReceived);
+  printf("Mock Pi:          %u requests decoded\n", serverRequests.load());
+
+  serverRunning = false;
+  server.join();
+  close(listenFd);
+  close(wireFd);
+  return failed > 0 || !decoded ? 1 : 0;
+}
+
+#endif
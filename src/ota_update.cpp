@@ -0,0 +1,603 @@
+#include "ota_update.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "firmware_patch.h"
+#include "hal.h"
+#include "log.h"
+#include "payloads.h"
+#include "scheduler.h"
+
+#define OTA_RECORD_MAGIC 0x3141544FUL  // "OTA1"
+
+struct OtaRecord {
+  uint32_t magic;
+  uint8_t boot;        // OtaBoot
+  uint8_t trialBoots;
+  uint16_t reserved;
+  uint32_t backupSize;
+  uint8_t backupSha1[SHA1_DIGEST_SIZE];
+  uint8_t imageSha1[SHA1_DIGEST_SIZE];
+};
+
+enum OtaResponse : uint8_t {
+  OTA_RESPONSE_STATUS,
+  OTA_RESPONSE_HEADERS,
+  OTA_RESPONSE_BODY
+};
+
+static const char* const phaseNames[] = {"idle", "backup", "download", "staged", "failed"};
+static const char* const bootNames[] = {"normal", "trial", "confirmed", "rolled back"};
+
+static int8_t otaTask = -1;
+static const char* otaHost = nullptr;
+static uint16_t otaPort = 0;
+static OtaRecord record;
+static OtaStatus status = {};
+static OtaRequest current;
+
+// Trial of a new image
+static bool trialRunning = false;
+static uint32_t trialDeadline = 0;
+
+// Play activity
+static bool playSeen = false;
+static uint32_t lastPlayMs = 0;
+
+// Hash of whichever image is being read or written
+static Sha1 hash;
+static uint8_t runningSha1[SHA1_DIGEST_SIZE];
+static bool runningSha1Known = false;
+static uint32_t startMs = 0;
+static uint32_t stagedMs = 0;
+
+// Download
+static HalSocket downloadSocket = HAL_INVALID_SOCKET;
+static uint8_t response = OTA_RESPONSE_STATUS;
+static int responseStatus = 0;
+static long responseLength = -1;
+static char line[OTA_LINE_MAX];
+static uint8_t lineLength = 0;
+static uint32_t lastDataMs = 0;
+static uint32_t retryAt = 0;
+static uint8_t chunk[OTA_CHUNK_SIZE];
+static size_t chunkLength = 0;
+static size_t chunkUsed = 0;
+static FirmwarePatch patch;
+
+static bool reached(uint32_t now, uint32_t at) {
+  return (int32_t)(now - at) >= 0;
+}
+
+static void saveRecord() {
+  if (!halStorageSave(OTA_STATE_FILE, &record, sizeof(record))) {
+    LOG_ERROR(LOG_CAT_SYSTEM, "OTA: failed to save state");
+  }
+}
+
+static void closeDownload() {
+  if (downloadSocket != HAL_INVALID_SOCKET) {
+    halTcpClose(downloadSocket);
+    downloadSocket = HAL_INVALID_SOCKET;
+  }
+}
+
+static void failUpdate(const char* error) {
+  closeDownload();
+  halFirmwareAbort();
+  status.phase = OTA_FAILED;
+  status.paused = false;
+  status.error = error;
+  LOG_ERROR(LOG_CAT_SYSTEM, "OTA: %s failed: %s", current.path, error);
+}
+
+static void rollBack(const char* reason) {
+  trialRunning = false;
+  LOG_ERROR(LOG_CAT_SYSTEM, "OTA: new image %s, restoring the previous one", reason);
+  if (!halFirmwareRestoreBackup(record.backupSize)) {
+    // Nothing to come back to, the new image stays
+    LOG_ERROR(LOG_CAT_SYSTEM, "OTA: no backup to restore");
+    record.boot = OTA_BOOT_NORMAL;
+    saveRecord();
+    return;
+  }
+  record.boot = OTA_BOOT_ROLLED_BACK;
+  saveRecord();
+  halRestart();
+}
+
+static bool hexDigest(const char* text, uint8_t digest[SHA1_DIGEST_SIZE]) {
+  for (uint8_t i = 0; i < SHA1_DIGEST_SIZE * 2; i++) {
+    char c = text[i];
+    uint8_t nibble;
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      nibble = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    digest[i / 2] = i % 2 == 0 ? nibble << 4 : digest[i / 2] | nibble;
+  }
+  return text[SHA1_DIGEST_SIZE * 2] == '\0';
+}
+
+// Remaining quiet time before flash work may go on, 0 once play stopped
+static uint32_t quietLeft(uint32_t now) {
+  if (!playSeen || now - lastPlayMs >= OTA_QUIET_MS) {
+    return 0;
+  }
+  return OTA_QUIET_MS - (now - lastPlayMs);
+}
+
+// Image bytes, from the download or the patch
+static bool writeImage(const uint8_t* data, size_t length) {
+  if (!halFirmwareWrite(data, length)) {
+    return false;
+  }
+  sha1Update(&hash, data, length);
+  status.written += length;
+  return true;
+}
+
+// Backup
+
+static uint32_t runBackup() {
+  uint32_t size = halFirmwareSize();
+  uint32_t offset = status.backedUp;
+  if (!halFirmwareBackup(offset / HAL_FLASH_SECTOR_SIZE)) {
+    failUpdate("backup failed");
+    return SCHEDULER_IDLE;
+  }
+
+  // Hashed from the running image while it is in the cache anyway
+  uint32_t end = offset + HAL_FLASH_SECTOR_SIZE < size ? offset + HAL_FLASH_SECTOR_SIZE : size;
+  uint8_t piece[FIRMWARE_PATCH_PIECE];
+  for (uint32_t at = offset; at < end; at += sizeof(piece)) {
+    size_t length = end - at < sizeof(piece) ? end - at : sizeof(piece);
+    if (!halFirmwareRead(at, piece, length)) {
+      failUpdate("cannot read the running image");
+      return SCHEDULER_IDLE;
+    }
+    sha1Update(&hash, piece, length);
+  }
+  status.backedUp = end;
+  if (end < size) {
+    return OTA_CHUNK_INTERVAL_MS;
+  }
+
+  sha1Finish(&hash, runningSha1);
+  runningSha1Known = true;
+  record.backupSize = size;
+  memcpy(record.backupSha1, runningSha1, SHA1_DIGEST_SIZE);
+
+  // The new image is hashed as it is staged
+  sha1Begin(&hash);
+  beginFirmwarePatch(&patch, halFirmwareRead, writeImage);
+  status.phase = OTA_DOWNLOAD;
+  LOG_INFO(LOG_CAT_SYSTEM, "OTA: %u byte image backed up, downloading %s", (unsigned)size, current.path);
+  return 0;
+}
+
+// Download
+
+static bool connectDownload(uint32_t now) {
+  if (status.connections >= OTA_MAX_CONNECTIONS) {
+    failUpdate("too many dropped connections");
+    return false;
+  }
+  status.connections++;
+  uint16_t port = current.port != 0 ? current.port : otaPort;
+  downloadSocket = halTcpConnect(otaHost, port, OTA_CONNECT_TIMEOUT_MS);
+  if (downloadSocket == HAL_INVALID_SOCKET) {
+    LOG_WARN(LOG_CAT_SYSTEM, "OTA: cannot reach %s:%u, retrying", otaHost, port);
+    retryAt = now + OTA_RETRY_MS;
+    return false;
+  }
+
+  // Resumes from the first byte not received yet
+  char request[OTA_PATH_MAX + 128];
+  int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s:%u\r\n", current.path, otaHost,
+                        port);
+  if (status.downloaded > 0) {
+    length += snprintf(request + length, sizeof(request) - length, "Range: bytes=%u-\r\n",
+                       (unsigned)status.downloaded);
+    status.resumes++;
+    LOG_INFO(LOG_CAT_SYSTEM, "OTA: resuming at byte %u", (unsigned)status.downloaded);
+  }
+  length += snprintf(request + length, sizeof(request) - length, "Connection: close\r\n\r\n");
+  if (halTcpWrite(downloadSocket, (const uint8_t*)request, length) != length) {
+    closeDownload();
+    retryAt = now + OTA_RETRY_MS;
+    return false;
+  }
+
+  response = OTA_RESPONSE_STATUS;
+  responseStatus = 0;
+  responseLength = -1;
+  lineLength = 0;
+  lastDataMs = now;
+  return true;
+}
+
+// One header line at a time, false until a whole one arrived
+static bool readLine() {
+  uint8_t c;
+  while (halTcpRead(downloadSocket, &c, 1) == 1) {
+    if (c == '\n') {
+      if (lineLength > 0 && line[lineLength - 1] == '\r') {
+        lineLength--;
+      }
+      line[lineLength] = '\0';
+      lineLength = 0;
+      return true;
+    }
+    if (lineLength < sizeof(line) - 1) {
+      line[lineLength++] = (char)c;
+    }
+  }
+  return false;
+}
+
+// Status line and headers - 200 for the whole file, 206 for the rest of it
+static bool readHeaders() {
+  while (response != OTA_RESPONSE_BODY && readLine()) {
+    if (response == OTA_RESPONSE_STATUS) {
+      const char* code = strchr(line, ' ');
+      responseStatus = code != nullptr ? atoi(code + 1) : 0;
+      response = OTA_RESPONSE_HEADERS;
+    } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      responseLength = atol(line + 15);
+    } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+      failUpdate("chunked response");
+      return false;
+    } else if (line[0] == '\0') {
+      response = OTA_RESPONSE_BODY;
+    }
+  }
+  if (response != OTA_RESPONSE_BODY) {
+    return false;
+  }
+
+  int expected = status.downloaded == 0 ? 200 : 206;
+  if (responseStatus != expected) {
+    failUpdate(responseStatus == 200 ? "the Pi ignored the Range request" : "the Pi refused the download");
+    return false;
+  }
+  if (responseLength <= 0) {
+    failUpdate("no Content-Length");
+    return false;
+  }
+  if (status.downloaded == 0) {
+    status.fileSize = responseLength;
+    if (!current.patch && status.fileSize != current.size) {
+      failUpdate("image size differs from the request");
+      return false;
+    }
+  } else if (status.downloaded + responseLength != status.fileSize) {
+    failUpdate("file changed while resuming");
+    return false;
+  }
+  return true;
+}
+
+// A patch has to start from the image it was made against
+static bool checkPatchBase() {
+  if (patch.baseSize != halFirmwareSize() || memcmp(patch.baseSha1, runningSha1, SHA1_DIGEST_SIZE) != 0) {
+    failUpdate("patch is for another image");
+    return false;
+  }
+  if (patch.targetSize != current.size) {
+    failUpdate("patch makes an image of another size");
+    return false;
+  }
+  return true;
+}
+
+static bool applyChunk() {
+  if (!current.patch) {
+    if (status.written + chunkLength > current.size || !writeImage(chunk, chunkLength)) {
+      failUpdate("cannot write the image");
+      return false;
+    }
+    chunkUsed = chunkLength;
+    return true;
+  }
+
+  bool headerRead = firmwarePatchHeaderRead(patch);
+  chunkUsed += feedFirmwarePatch(&patch, chunk + chunkUsed, chunkLength - chunkUsed, OTA_CHUNK_SIZE);
+  if (patch.state == FIRMWARE_PATCH_FAILED) {
+    failUpdate(patch.error);
+    return false;
+  }
+  if (!headerRead && firmwarePatchHeaderRead(patch) && !checkPatchBase()) {
+    return false;
+  }
+  if (patch.state == FIRMWARE_PATCH_DONE && chunkUsed < chunkLength) {
+    failUpdate("bytes after the patch's end");
+    return false;
+  }
+  return true;
+}
+
+// Checks the image and leaves it for the boot loader, with what the trial
+// needs to come back from it
+static void stageImage(uint32_t now) {
+  closeDownload();
+  uint8_t digest[SHA1_DIGEST_SIZE];
+  sha1Finish(&hash, digest);
+  if (memcmp(digest, current.sha1, SHA1_DIGEST_SIZE) != 0) {
+    failUpdate("SHA-1 mismatch");
+    return;
+  }
+  if (!halFirmwareEnd()) {
+    failUpdate("cannot stage the image");
+    return;
+  }
+
+  record.magic = OTA_RECORD_MAGIC;
+  record.boot = OTA_BOOT_TRIAL;
+  record.trialBoots = 0;
+  memcpy(record.imageSha1, digest, SHA1_DIGEST_SIZE);
+  if (!halStorageSave(OTA_STATE_FILE, &record, sizeof(record))) {
+    // No trial without the record, so no update either
+    failUpdate("cannot save OTA state");
+    return;
+  }
+  status.phase = OTA_STAGED;
+  status.durationMs = now - startMs;
+  stagedMs = now;
+  LOG_INFO(LOG_CAT_SYSTEM, "OTA: %u byte image from %u bytes staged in %ums, %u resumes",
+           (unsigned)status.written, (unsigned)status.fileSize, (unsigned)status.durationMs,
+           (unsigned)status.resumes);
+}
+
+// Nothing to do until the Pi sends more, unless it dropped the connection
+// or stalled - then start again where it stopped
+static uint32_t waitForData(uint32_t now) {
+  bool dropped = halTcpAvailable(downloadSocket) == 0 && !halTcpConnected(downloadSocket);
+  if (!dropped && now - lastDataMs < OTA_STALL_MS) {
+    return OTA_POLL_MS;
+  }
+  LOG_WARN(LOG_CAT_SYSTEM, "OTA: download %s at byte %u", dropped ? "dropped" : "stalled",
+           (unsigned)status.downloaded);
+  closeDownload();
+  retryAt = now + OTA_RETRY_MS;
+  return OTA_RETRY_MS;
+}
+
+static uint32_t runDownload(uint32_t now) {
+  if (downloadSocket == HAL_INVALID_SOCKET) {
+    if (!reached(now, retryAt) || !halNetworkConnected()) {
+      return OTA_POLL_MS;
+    }
+    if (!connectDownload(now)) {
+      return status.phase == OTA_DOWNLOAD ? OTA_RETRY_MS : SCHEDULER_IDLE;
+    }
+  }
+  if (response != OTA_RESPONSE_BODY) {
+    if (!readHeaders()) {
+      return status.phase == OTA_DOWNLOAD ? waitForData(now) : SCHEDULER_IDLE;
+    }
+    lastDataMs = now;
+  }
+
+  // The last chunk, or a patch's COPY, goes on before anything new is read
+  if (chunkUsed < chunkLength || firmwarePatchBusy(patch)) {
+    if (!applyChunk()) {
+      return SCHEDULER_IDLE;
+    }
+  } else if (status.downloaded < status.fileSize) {
+    uint32_t left = status.fileSize - status.downloaded;
+    int length = halTcpRead(downloadSocket, chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+    if (length <= 0) {
+      return waitForData(now);
+    }
+    chunkLength = length;
+    chunkUsed = 0;
+    status.downloaded += length;
+    lastDataMs = now;
+    if (!applyChunk()) {
+      return SCHEDULER_IDLE;
+    }
+  }
+
+  if (status.downloaded < status.fileSize || chunkUsed < chunkLength || firmwarePatchBusy(patch)) {
+    return OTA_CHUNK_INTERVAL_MS;
+  }
+  if (status.written != current.size) {
+    failUpdate("file ended before the image did");
+    return SCHEDULER_IDLE;
+  }
+  stageImage(now);
+  return status.phase == OTA_STAGED ? OTA_RESTART_DELAY_MS : SCHEDULER_IDLE;
+}
+
+static uint32_t runUpdate(uint32_t now) {
+  if (status.phase != OTA_BACKUP && status.phase != OTA_DOWNLOAD && status.phase != OTA_STAGED) {
+    return SCHEDULER_IDLE;
+  }
+
+  uint32_t quiet = quietLeft(now);
+  if (quiet > 0) {
+    if (!status.paused) {
+      status.paused = true;
+      status.pauses++;
+      LOG_INFO(LOG_CAT_SYSTEM, "OTA: paused for play");
+    }
+    return quiet;
+  }
+  if (status.paused) {
+    status.paused = false;
+    // Time spent paused is not a stall
+    lastDataMs = now;
+  }
+
+  switch (status.phase) {
+    case OTA_BACKUP:
+      return runBackup();
+    case OTA_DOWNLOAD:
+      return runDownload(now);
+    default:
+      if (now - stagedMs < OTA_RESTART_DELAY_MS) {
+        return OTA_RESTART_DELAY_MS - (now - stagedMs);
+      }
+      LOG_INFO(LOG_CAT_SYSTEM, "OTA: restarting into the new image");
+      halRestart();
+      status.phase = OTA_IDLE;
+      return SCHEDULER_IDLE;
+  }
+}
+
+// Update work, and the trial's deadline
+static uint32_t runOtaTask() {
+  uint32_t now = halMillis();
+  if (trialRunning && reached(now, trialDeadline)) {
+    rollBack("didn't get ready in time");
+  }
+
+  uint32_t wait = runUpdate(now);
+  if (trialRunning && trialDeadline - now < wait) {
+    wait = trialDeadline - now;
+  }
+  return wait;
+}
+
+void setupOta(const char* host, uint16_t port) {
+  otaHost = host;
+  otaPort = port;
+  if (otaTask < 0) {
+    otaTask = schedulerAddTask("ota", runOtaTask);
+  }
+  closeDownload();
+  status = {};
+  trialRunning = false;
+  runningSha1Known = false;
+
+  if (!halStorageLoad(OTA_STATE_FILE, &record, sizeof(record)) || record.magic != OTA_RECORD_MAGIC) {
+    memset(&record, 0, sizeof(record));
+    record.magic = OTA_RECORD_MAGIC;
+  }
+  status.boot = record.boot;
+
+  if (record.boot == OTA_BOOT_CONFIRMED) {
+    memcpy(runningSha1, record.imageSha1, SHA1_DIGEST_SIZE);
+    runningSha1Known = true;
+  } else if (record.boot == OTA_BOOT_ROLLED_BACK) {
+    memcpy(runningSha1, record.backupSha1, SHA1_DIGEST_SIZE);
+    runningSha1Known = true;
+    LOG_WARN(LOG_CAT_SYSTEM, "OTA: back on the previous image after a failed update");
+  }
+  if (record.boot != OTA_BOOT_TRIAL) {
+    return;
+  }
+
+  // Counted before anything else can crash
+  record.trialBoots++;
+  status.trialBoots = record.trialBoots;
+  if (record.trialBoots >= OTA_TRIAL_BOOTS) {
+    rollBack("restarted before getting ready");
+    status.boot = record.boot;
+    return;
+  }
+  saveRecord();
+  memcpy(runningSha1, record.imageSha1, SHA1_DIGEST_SIZE);
+  runningSha1Known = true;
+  trialRunning = true;
+  trialDeadline = halMillis() + OTA_TRIAL_MS;
+  schedulerWake(otaTask, OTA_TRIAL_MS);
+  LOG_WARN(LOG_CAT_SYSTEM, "OTA: trial boot %u of a new image, rolled back unless ready within %us",
+           record.trialBoots, OTA_TRIAL_MS / 1000);
+}
+
+bool parseOtaRequest(const char* body, OtaRequest* request) {
+  char digest[SHA1_DIGEST_SIZE * 2 + 1];
+  char format[8];
+  uint32_t port = 0;
+  memset(request, 0, sizeof(*request));
+  if (!parseStringField(body, "path", request->path, sizeof(request->path)) || request->path[0] != '/' ||
+      !parseUintField(body, "size", &request->size) || request->size == 0 ||
+      !parseStringField(body, "sha1", digest, sizeof(digest)) || !hexDigest(digest, request->sha1)) {
+    return false;
+  }
+  if (parseStringField(body, "format", format, sizeof(format))) {
+    if (strcmp(format, "patch") == 0) {
+      request->patch = true;
+    } else if (strcmp(format, "full") != 0) {
+      return false;
+    }
+  }
+  if (parseUintField(body, "port", &port)) {
+    if (port == 0 || port > 65535) {
+      return false;
+    }
+    request->port = port;
+  }
+  return true;
+}
+
+bool otaBusy() {
+  return trialRunning || status.phase == OTA_BACKUP || status.phase == OTA_DOWNLOAD || status.phase == OTA_STAGED;
+}
+
+bool startOtaUpdate(const OtaRequest& request) {
+  if (otaBusy() || !halFirmwareBegin(request.size)) {
+    return false;
+  }
+  current = request;
+  uint8_t boot = status.boot;
+  uint8_t trialBoots = status.trialBoots;
+  status = {};
+  status.boot = boot;
+  status.trialBoots = trialBoots;
+  status.phase = OTA_BACKUP;
+  status.patch = request.patch;
+  status.imageSize = request.size;
+  chunkLength = 0;
+  chunkUsed = 0;
+  retryAt = halMillis();
+  startMs = halMillis();
+  sha1Begin(&hash);
+  LOG_INFO(LOG_CAT_SYSTEM, "OTA: %s %s, %u byte image", request.patch ? "patch" : "image", request.path,
+           (unsigned)request.size);
+  schedulerWake(otaTask);
+  return true;
+}
+
+void otaPlayActivity(uint32_t nowMs) {
+  playSeen = true;
+  lastPlayMs = nowMs;
+}
+
+void confirmOtaUpdate() {
+  if (!trialRunning) {
+    return;
+  }
+  trialRunning = false;
+  record.boot = OTA_BOOT_CONFIRMED;
+  status.boot = record.boot;
+  saveRecord();
+  LOG_INFO(LOG_CAT_SYSTEM, "OTA: new image ready after %u boot(s), keeping it", record.trialBoots);
+}
+
+const OtaStatus& otaStatus() {
+  return status;
+}
+
+bool otaFirmwareSha1(uint8_t digest[SHA1_DIGEST_SIZE]) {
+  if (!runningSha1Known) {
+    return false;
+  }
+  memcpy(digest, runningSha1, SHA1_DIGEST_SIZE);
+  return true;
+}
+
+const char* otaPhaseName(uint8_t phase) {
+  return phase <= OTA_FAILED ? phaseNames[phase] : "?";
+}
+
+const char* otaBootName(uint8_t boot) {
+  return boot <= OTA_BOOT_ROLLED_BACK ? bootNames[boot] : "?";
+}
@@ -0,0 +1,514 @@
+#include "outbound.h"
+#include "hal.h"
+#include "log.h"
+#include "payloads.h"
+#include "wire_protocol.h"
+
+static HalSocket outboundSocket = HAL_INVALID_SOCKET;
+static bool socketWire = false;           // Open to the wire port, not the HTTP one
+static const char* outboundHost = nullptr;
+static uint16_t outboundPort = 0;
+static uint16_t wirePort = 0;
+static uint32_t wireSeq = 0;
+
+// Fixed-size FIFO of pending requests
+static OutboundRequest outboundQueue[OUTBOUND_QUEUE_SIZE];
+static uint8_t outboundHead = 0;
+static uint8_t outboundCount = 0;
+
+// State of the request at the head of the queue
+static OutboundState outboundState = OUTBOUND_IDLE;
+static unsigned long outboundStartTime = 0;
+static unsigned long connectStartTime = 0;
+static uint32_t outboundStartMicros = 0;
+static bool outboundReused = false;       // Sent on a connection that was already open
+static bool outboundRetried = false;
+static bool responseStarted = false;      // At least one response byte received
+static int responseStatus = 0;
+static long responseBodyRemaining = -1;   // -1 = no Content-Length, read until close
+static bool responseKeepAlive = true;
+
+// Current response line being assembled, or the ack frame
+static char responseLine[OUTBOUND_LINE_MAX];
+static uint8_t responseLineLength = 0;
+static char responseBody[OUTBOUND_RESPONSE_MAX];
+static uint16_t responseBodyLength = 0;
+
+static OutboundStats stats = {};
+
+void setupOutbound(const char* host, uint16_t port) {
+  outboundHost = host;
+  outboundPort = port;
+}
+
+static void closeOutboundSocket() {
+  if (outboundSocket != HAL_INVALID_SOCKET) {
+    halTcpClose(outboundSocket);
+    outboundSocket = HAL_INVALID_SOCKET;
+  }
+}
+
+static bool outboundSocketConnected() {
+  return outboundSocket != HAL_INVALID_SOCKET && halTcpConnected(outboundSocket);
+}
+
+static int outboundAvailable() {
+  return outboundSocket != HAL_INVALID_SOCKET ? halTcpAvailable(outboundSocket) : 0;
+}
+
+static int outboundReadByte() {
+  uint8_t c;
+  if (halTcpRead(outboundSocket, &c, 1) != 1) {
+    return -1;
+  }
+  stats.bytesReceived++;
+  return c;
+}
+
+static OutboundRequest* reserveOutbound(const char* path, const char* label, OutboundResend resend,
+                                       unsigned long timeoutMs) {
+  if (outboundCount >= OUTBOUND_QUEUE_SIZE) {
+    LOG_WARN(LOG_CAT_NET, "Outbound queue full, dropping %s", label);
+    stats.dropped++;
+    return nullptr;
+  }
+
+  OutboundRequest* request = &outboundQueue[(outboundHead + outboundCount) % OUTBOUND_QUEUE_SIZE];
+  request->kind = OUTBOUND_POST;
+  request->wireType = 0;
+  request->resendable = resend == OUTBOUND_RESENDABLE;
+  request->bodyLength = 0;
+  strncpy(request->path, path, OUTBOUND_PATH_MAX - 1);
+  request->path[OUTBOUND_PATH_MAX - 1] = '\0';
+  request->body[0] = '\0';
+  request->externalBody = nullptr;
+  request->label = label;
+  request->timeoutMs = timeoutMs;
+  request->onComplete = nullptr;
+  outboundCount++;
+
+  return request;
+}
+
+bool queueOutbound(const char* path, const char* body, const char* label,
+                   OutboundCallback onComplete, OutboundResend resend, unsigned long timeoutMs) {
+  OutboundRequest* request = reserveOutbound(path, label, resend, timeoutMs);
+  if (request == nullptr) {
+    return false;
+  }
+
+  strncpy(request->body, body, OUTBOUND_BODY_MAX - 1);
+  request->body[OUTBOUND_BODY_MAX - 1] = '\0';
+  request->onComplete = onComplete;
+  return true;
+}
+
+bool queueOutboundBuffer(const char* path, const char* body, const char* label,
+                         OutboundCallback onComplete, OutboundResend resend, unsigned long timeoutMs) {
+  OutboundRequest* request = reserveOutbound(path, label, resend, timeoutMs);
+  if (request == nullptr) {
+    return false;
+  }
+
+  request->externalBody = body;
+  request->onComplete = onComplete;
+  return true;
+}
+
+bool queueOutboundGet(const char* path, const char* label, OutboundCallback onComplete,
+                      unsigned long timeoutMs) {
+  OutboundRequest* request = reserveOutbound(path, label, OUTBOUND_RESENDABLE, timeoutMs);
+  if (request == nullptr) {
+    return false;
+  }
+
+  request->kind = OUTBOUND_GET;
+  request->onComplete = onComplete;
+  return true;
+}
+
+bool queueOutboundFrame(uint8_t type, const uint8_t* payload, size_t length, const char* label,
+                        OutboundCallback onComplete, OutboundResend resend, unsigned long timeoutMs) {
+  // Larger payloads go through queueOutboundFrameBuffer()
+  if (length > OUTBOUND_BODY_MAX) {
+    return false;
+  }
+  OutboundRequest* request = reserveOutbound("", label, resend, timeoutMs);
+  if (request == nullptr) {
+    return false;
+  }
+
+  request->kind = OUTBOUND_FRAME;
+  request->wireType = type;
+  request->bodyLength = length;
+  memcpy(request->body, payload, length);
+  request->onComplete = onComplete;
+  return true;
+}
+
+bool queueOutboundFrameBuffer(uint8_t type, const uint8_t* payload, size_t length, const char* label,
+                              OutboundCallback onComplete, OutboundResend resend, unsigned long timeoutMs) {
+  OutboundRequest* request = reserveOutbound("", label, resend, timeoutMs);
+  if (request == nullptr) {
+    return false;
+  }
+
+  request->kind = OUTBOUND_FRAME;
+  request->wireType = type;
+  request->bodyLength = length;
+  request->externalBody = (const char*)payload;
+  request->onComplete = onComplete;
+  return true;
+}
+
+uint8_t outboundPending() {
+  return outboundCount;
+}
+
+const char* outboundResponseBody() {
+  return responseBody;
+}
+
+void setOutboundWire(uint16_t port) {
+  wirePort = port;
+}
+
+bool outboundWireActive() {
+  return wirePort != 0;
+}
+
+const OutboundStats& outboundStats() {
+  return stats;
+}
+
+bool outboundRejected(int result) {
+  return result >= 400 && result < 500 && result != 408 && result != 429;
+}
+
+static void completeOutbound(int result) {
+  OutboundRequest* request = &outboundQueue[outboundHead];
+
+  // Keep the connection for the next request unless it is no longer framed
+  if (result <= 0 || !responseKeepAlive) {
+    closeOutboundSocket();
+  }
+  stats.requestTime.observe(halMicros() - outboundStartMicros);
+  if (result <= 0) {
+    stats.failures++;
+  }
+
+  responseBody[responseBodyLength] = '\0';
+  LOG_DEBUG(LOG_CAT_NET, "%s %s: %d (%ums%s)", request->label, result > 0 ? "response" : "error", result,
+            (unsigned)(halMillis() - outboundStartTime), outboundReused ? ", reused connection" : "");
+
+  OutboundCallback onComplete = request->onComplete;
+
+  outboundHead = (outboundHead + 1) % OUTBOUND_QUEUE_SIZE;
+  outboundCount--;
+  outboundState = OUTBOUND_IDLE;
+
+  if (onComplete != nullptr) {
+    onComplete(result);
+  }
+}
+
+static void failConnect() {
+  if (socketWire) {
+    LOG_WARN(LOG_CAT_NET, "Wire port %u unreachable, back to JSON", wirePort);
+    wirePort = 0;
+    stats.wireFallbacks++;
+  }
+  completeOutbound(OUTBOUND_ERROR_CONNECT);
+}
+
+// A reused connection that dies before any response byte was most likely
+// closed by the Pi while idle - resend once on a fresh connection. The Pi
+// may still have applied the request, so only if it can see it twice.
+static bool retryOnFreshConnection() {
+  if (!outboundReused || responseStarted || outboundRetried || !outboundQueue[outboundHead].resendable) {
+    return false;
+  }
+
+  LOG_WARN(LOG_CAT_NET, "Stale keep-alive connection, reconnecting");
+  closeOutboundSocket();
+  outboundRetried = true;
+  outboundReused = false;
+  stats.retries++;
+  outboundState = OUTBOUND_CONNECTING;
+  return true;
+}
+
+// Header and payload in one write, so a frame goes out as one segment
+static bool sendFrame(const OutboundRequest* request, const uint8_t* payload) {
+  uint8_t frame[WIRE_HEADER_SIZE + WIRE_PAYLOAD_MAX];
+  if (request->bodyLength > WIRE_PAYLOAD_MAX) {
+    return false;
+  }
+  WireHeader header = {WIRE_VERSION, request->wireType, ++wireSeq, request->bodyLength};
+  encodeWireHeader(header, frame, sizeof(frame));
+  memcpy(frame + WIRE_HEADER_SIZE, payload, request->bodyLength);
+
+  int length = WIRE_HEADER_SIZE + request->bodyLength;
+  stats.bytesSent += length;
+  return halTcpWrite(outboundSocket, frame, length) == length;
+}
+
+static bool sendOutbound() {
+  OutboundRequest* request = &outboundQueue[outboundHead];
+  const char* body = request->externalBody != nullptr ? request->externalBody : request->body;
+  if (request->kind == OUTBOUND_FRAME) {
+    return sendFrame(request, (const uint8_t*)body);
+  }
+  char header[160];
+
+  size_t bodyLength = request->kind == OUTBOUND_GET ? 0 : strlen(body);
+  int headerLength = request->kind == OUTBOUND_GET
+                       ? formatGetHeader(header, sizeof(header), request->path, outboundHost, outboundPort)
+                       : formatRequestHeader(header, sizeof(header), request->path, outboundHost, outboundPort,
+                                             bodyLength);
+  if (headerLength < 0) {
+    return false;
+  }
+
+  stats.bytesSent += headerLength + bodyLength;
+  if (halTcpWrite(outboundSocket, (const uint8_t*)header, headerLength) != headerLength) {
+    return false;
+  }
+  return halTcpWrite(outboundSocket, (const uint8_t*)body, bodyLength) == (int)bodyLength;
+}
+
+// Collects the Pi's ack frame in responseLine. Returns its status once
+// complete, otherwise 0.
+static int readAck(int* budget) {
+  while (*budget > 0 && outboundAvailable() > 0) {
+    int c = outboundReadByte();
+    (*budget)--;
+    if (c < 0) {
+      break;
+    }
+    responseStarted = true;
+    responseLine[responseLineLength++] = (char)c;
+
+    WireHeader header;
+    if (responseLineLength < WIRE_HEADER_SIZE) {
+      continue;
+    }
+    if (!decodeWireHeader((const uint8_t*)responseLine, responseLineLength, &header) ||
+        header.type != WIRE_ACK || header.length != WIRE_ACK_SIZE) {
+      return OUTBOUND_ERROR_BAD_RESPONSE;
+    }
+    if (responseLineLength < WIRE_HEADER_SIZE + WIRE_ACK_SIZE) {
+      continue;
+    }
+    uint16_t status;
+    if (header.seq != wireSeq ||
+        !decodeWireAck((const uint8_t*)responseLine + WIRE_HEADER_SIZE, WIRE_ACK_SIZE, &status) || status == 0) {
+      return OUTBOUND_ERROR_BAD_RESPONSE;
+    }
+    return status;
+  }
+
+  return 0;
+}
+
+// Reads one response line per call. Returns true once a full line (without
+// the trailing CR/LF) is in responseLine.
+static bool readResponseLine(int* budget) {
+  while (*budget > 0 && outboundAvailable() > 0) {
+    int c = outboundReadByte();
+    (*budget)--;
+    if (c < 0) {
+      break;
+    }
+    responseStarted = true;
+
+    if (c == '\n') {
+      if (responseLineLength > 0 && responseLine[responseLineLength - 1] == '\r') {
+        responseLineLength--;
+      }
+      responseLine[responseLineLength] = '\0';
+      responseLineLength = 0;
+      return true;
+    }
+
+    // Over-long header lines are truncated, we only care about short ones
+    if (responseLineLength < sizeof(responseLine) - 1) {
+      responseLine[responseLineLength++] = (char)c;
+    }
+  }
+
+  return false;
+}
+
+static void handleHeaderLine() {
+  if (strncasecmp(responseLine, "Content-Length:", 15) == 0) {
+    responseBodyRemaining = atol(responseLine + 15);
+  } else if (strncasecmp(responseLine, "Connection:", 11) == 0) {
+    const char* value = responseLine + 11;
+    while (*value == ' ') {
+      value++;
+    }
+    if (strncasecmp(value, "close", 5) == 0) {
+      responseKeepAlive = false;
+    }
+  } else if (strncasecmp(responseLine, "Transfer-Encoding:", 18) == 0) {
+    // Chunked bodies are not parsed, so the connection can't be reused
+    responseKeepAlive = false;
+  }
+}
+
+// Advances response parsing within a fixed per-pass byte budget. Returns the
+// final result once the whole response has been consumed, otherwise 0.
+static int readResponse() {
+  int budget = OUTBOUND_READ_CHUNK;
+  if (outboundQueue[outboundHead].kind == OUTBOUND_FRAME) {
+    return readAck(&budget);
+  }
+
+  while (budget > 0) {
+    if (outboundState == OUTBOUND_WAITING) {
+      if (!readResponseLine(&budget)) {
+        return 0;
+      }
+      // "HTTP/1.1 200 OK"
+      const char* code = strchr(responseLine, ' ');
+      responseStatus = code != nullptr ? atoi(code + 1) : 0;
+      if (responseStatus <= 0) {
+        return OUTBOUND_ERROR_BAD_RESPONSE;
+      }
+      outboundState = OUTBOUND_HEADERS;
+    } else if (outboundState == OUTBOUND_HEADERS) {
+      if (!readResponseLine(&budget)) {
+        return 0;
+      }
+      if (responseLine[0] != '\0') {
+        handleHeaderLine();
+        continue;
+      }
+      // Blank line - end of headers
+      if (responseBodyRemaining < 0) {
+        // Unframed body, can't tell where the next response would start
+        responseKeepAlive = false;
+        return responseStatus;
+      }
+      outboundState = OUTBOUND_BODY;
+    } else {
+      // Read the body through so the connection is positioned at the next
+      // response, keeping its start for onComplete
+      while (responseBodyRemaining > 0 && budget > 0 && outboundAvailable() > 0) {
+        int c = outboundReadByte();
+        if (c < 0) {
+          break;
+        }
+        if (responseBodyLength < sizeof(responseBody) - 1) {
+          responseBody[responseBodyLength++] = (char)c;
+        }
+        responseBodyRemaining--;
+        budget--;
+      }
+      return responseBodyRemaining == 0 ? responseStatus : 0;
+    }
+  }
+
+  return 0;
+}
+
+void updateOutbound() {
+  unsigned long currentTime = halMillis();
+
+  switch (outboundState) {
+    case OUTBOUND_IDLE:
+      if (outboundCount == 0 || !halNetworkConnected()) {
+        return;
+      }
+      outboundStartTime = currentTime;
+      outboundStartMicros = halMicros();
+      outboundRetried = false;
+      outboundState = OUTBOUND_CONNECTING;
+      stats.requests++;
+      if (outboundQueue[outboundHead].kind == OUTBOUND_FRAME) {
+        stats.frames++;
+      }
+      break;
+
+    case OUTBOUND_CONNECTING: {
+      responseStarted = false;
+      responseStatus = 0;
+      responseBodyRemaining = -1;
+      responseKeepAlive = true;
+      responseLineLength = 0;
+      responseBodyLength = 0;
+
+      // Frames and HTTP requests each need the connection to their own port
+      bool wire = outboundQueue[outboundHead].kind == OUTBOUND_FRAME;
+      if (outboundSocketConnected() && socketWire == wire) {
+        outboundReused = true;
+        stats.reuseHits++;
+        outboundState = OUTBOUND_SENDING;
+      } else {
+        outboundReused = false;
+        closeOutboundSocket();
+        if (wire && wirePort == 0) {
+          // Queued before the wire port failed
+          completeOutbound(OUTBOUND_ERROR_CONNECT);
+          return;
+        }
+        outboundSocket = halTcpConnectStart(outboundHost, wire ? wirePort : outboundPort);
+        socketWire = wire;
+        if (outboundSocket == HAL_INVALID_SOCKET) {
+          failConnect();
+          return;
+        }
+        stats.reconnects++;
+        connectStartTime = currentTime;
+        outboundState = OUTBOUND_OPENING;
+      }
+      break;
+    }
+
+    // Polled like the response, a Pi that doesn't answer the SYN only costs
+    // OUTBOUND_CONNECT_TIMEOUT_MS of this request's time
+    case OUTBOUND_OPENING:
+      if (halTcpConnecting(outboundSocket)) {
+        if (currentTime - connectStartTime > OUTBOUND_CONNECT_TIMEOUT_MS) {
+          LOG_WARN(LOG_CAT_NET, "%s: no answer from %s", outboundQueue[outboundHead].label, outboundHost);
+          failConnect();
+        }
+        return;
+      }
+      if (!halTcpConnected(outboundSocket)) {
+        failConnect();
+        return;
+      }
+      outboundState = OUTBOUND_SENDING;
+      break;
+
+    case OUTBOUND_SENDING:
+      if (!sendOutbound()) {
+        if (!retryOnFreshConnection()) {
+          completeOutbound(OUTBOUND_ERROR_LOST);
+        }
+        return;
+      }
+      outboundState = OUTBOUND_WAITING;
+      break;
+
+    case OUTBOUND_WAITING:
+    case OUTBOUND_HEADERS:
+    case OUTBOUND_BODY: {
+      int result = readResponse();
+      if (result != 0) {
+        completeOutbound(result);
+      } else if (currentTime - outboundStartTime > outboundQueue[outboundHead].timeoutMs) {
+        completeOutbound(OUTBOUND_ERROR_TIMEOUT);
+      } else if (!outboundSocketConnected() && outboundAvailable() == 0) {
+        if (outboundState == OUTBOUND_BODY && responseBodyRemaining <= 0) {
+          completeOutbound(responseStatus);
+        } else if (!retryOnFreshConnection()) {
+          completeOutbound(responseStatus > 0 ? responseStatus : OUTBOUND_ERROR_LOST);
+        }
+      }
+      break;
+    }
+  }
+}
@@ -0,0 +1,217 @@
+#include "payloads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json_writer.h"
+
+// Preformatted templates for the outbound bodies
+static const char SCORE_SPEED_TEMPLATE[] = "{\"player\":\"%s\",\"speed\":%u.%u}";
+static const char PLAYER_TEMPLATE[] = "{\"player\":\"%s\"}";
+
+static int checkedLength(int written, size_t size) {
+  return (written < 0 || (size_t)written >= size) ? -1 : written;
+}
+
+static void addTable(JsonWriter& json, uint16_t table) {
+  if (table != SCORE_TABLE_ANY) {
+    json.addUint("table", table);
+  }
+}
+
+static void addJournalSeq(JsonWriter& json, const JournalSeq* seq) {
+  if (seq != nullptr && seq->seq != 0) {
+    json.addUint("epoch", seq->epoch);
+    json.addUint("seq", seq->seq);
+  }
+}
+
+int formatScoreBody(char* out, size_t size, const char* player, uint16_t table, uint16_t speedKmhX10,
+                    const ScoreTrace* trace, const JournalSeq* seq) {
+  bool traced = trace != nullptr && trace->id != 0;
+  if (traced || (seq != nullptr && seq->seq != 0) || table != SCORE_TABLE_ANY) {
+    JsonWriter json(out, size);
+    json.openObject();
+    json.addString("player", player);
+    addTable(json, table);
+    addJournalSeq(json, seq);
+    if (speedKmhX10 > 0) {
+      json.addTenths("speed", speedKmhX10);
+    }
+    if (traced) {
+      char id[TRACE_ID_CHARS + 1];
+      snprintf(id, sizeof(id), "%08x", (unsigned)trace->id);
+      json.addString("trace", id);
+      if (trace->timed) {
+        json.addUint("breakUs", trace->breakUs);
+        json.addUint("sentUs", trace->sentUs);
+      }
+    }
+    json.closeObject();
+    return json.overflowed() ? -1 : (int)json.length();
+  }
+  if (speedKmhX10 == 0) {
+    return formatPlayerBody(out, size, player);
+  }
+  return checkedLength(snprintf(out, size, SCORE_SPEED_TEMPLATE, player,
+                                speedKmhX10 / 10, speedKmhX10 % 10), size);
+}
+
+int formatResetBody(char* out, size_t size, const char* player, uint16_t table, const JournalSeq* seq) {
+  if ((seq == nullptr || seq->seq == 0) && table == SCORE_TABLE_ANY) {
+    return formatPlayerBody(out, size, player);
+  }
+  JsonWriter json(out, size);
+  json.openObject();
+  json.addString("player", player);
+  addTable(json, table);
+  addJournalSeq(json, seq);
+  json.closeObject();
+  return json.overflowed() ? -1 : (int)json.length();
+}
+
+int formatPlayerBody(char* out, size_t size, const char* player) {
+  return checkedLength(snprintf(out, size, PLAYER_TEMPLATE, player), size);
+}
+
+static void writeEvent(JsonWriter& json, const JournalEvent* event, const char* player, const char* opponent) {
+  json.openObject();
+  json.addUint("seq", event->seq);
+  json.addUint("t", event->timestamp);
+  switch (event->type) {
+    case JOURNAL_GOAL:
+      json.addString("type", "goal");
+      json.addString("player", opponent);
+      if (event->value > 0) {
+        json.addTenths("speed", event->value);
+      }
+      break;
+    case JOURNAL_POINT:
+      json.addString("type", "point");
+      json.addString("player", player);
+      json.addUint("amount", event->value);
+      json.addBool("quantum", event->flags & JOURNAL_FLAG_QUANTUM);
+      break;
+    default:
+      json.addString("type", "reset");
+      json.addString("player", player);
+      break;
+  }
+  json.closeObject();
+}
+
+int formatEventsBody(char* out, size_t size, const char* player, const char* opponent, uint16_t table,
+                     uint32_t epoch, uint32_t now, const JournalEvent* events, uint8_t count) {
+  JsonWriter json(out, size);
+  json.openObject();
+  json.addString("player", player);
+  addTable(json, table);
+  json.addUint("epoch", epoch);
+  json.addUint("now", now);
+  json.openArray("events");
+  for (uint8_t i = 0; i < count; i++) {
+    writeEvent(json, &events[i], player, opponent);
+  }
+  json.closeArray();
+  json.closeObject();
+  return json.overflowed() ? -1 : (int)json.length();
+}
+
+int formatRequestHeader(char* out, size_t size, const char* path, const char* host, uint16_t port,
+                        size_t bodyLength) {
+  return checkedLength(snprintf(out, size,
+    "POST %s HTTP/1.1\r\n"
+    "Host: %s:%u\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: %u\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+    path, host, port, (unsigned int)bodyLength), size);
+}
+
+int formatGetHeader(char* out, size_t size, const char* path, const char* host, uint16_t port) {
+  return checkedLength(snprintf(out, size,
+    "GET %s HTTP/1.1\r\n"
+    "Host: %s:%u\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+    path, host, port), size);
+}
+
+static const char* skipSpaces(const char* p) {
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+    p++;
+  }
+  return p;
+}
+
+// Start of the field's value, or nullptr when the key isn't there
+static const char* findField(const char* body, const char* field) {
+  size_t fieldLength = strlen(field);
+  const char* p = body;
+  while ((p = strstr(p, field)) != nullptr) {
+    // Must be the whole quoted key, not part of a longer one
+    if (p > body && p[-1] == '"' && p[fieldLength] == '"') {
+      break;
+    }
+    p += fieldLength;
+  }
+  if (p == nullptr) {
+    return nullptr;
+  }
+
+  p = skipSpaces(p + fieldLength + 1);
+  if (*p != ':') {
+    return nullptr;
+  }
+  return skipSpaces(p + 1);
+}
+
+bool hasJsonField(const char* body, const char* field) {
+  return findField(body, field) != nullptr;
+}
+
+bool parseStringField(const char* body, const char* field, char* value, size_t size) {
+  const char* p = findField(body, field);
+  if (p == nullptr || *p != '"') {
+    return false;
+  }
+  p++;
+
+  const char* end = strchr(p, '"');
+  if (end == nullptr || (size_t)(end - p) >= size) {
+    return false;
+  }
+
+  memcpy(value, p, end - p);
+  value[end - p] = '\0';
+  return true;
+}
+
+bool parsePlayerField(const char* body, char* player, size_t size) {
+  return parseStringField(body, "player", player, size);
+}
+
+bool parseUintField(const char* body, const char* field, uint32_t* value) {
+  const char* p = findField(body, field);
+  if (p == nullptr || *p < '0' || *p > '9') {
+    return false;
+  }
+
+  uint32_t result = 0;
+  while (*p >= '0' && *p <= '9') {
+    result = result * 10 + (*p - '0');
+    p++;
+  }
+  *value = result;
+  return true;
+}
+
+bool parseTraceField(const char* body, uint32_t* id) {
+  char text[TRACE_ID_CHARS + 1];
+  if (!parseStringField(body, "trace", text, sizeof(text))) {
+    return false;
+  }
+  char* end;
+  *id = strtoul(text, &end, 16);
+  return *end == '\0' && end != text && *id != 0;
+}
@@ -0,0 +1,117 @@
+#include "power_state.h"
+#include <string.h>
+
+static const char* const stateNames[POWER_STATE_COUNT] = {"active", "idle", "sleep"};
+static const char* const wakeNames[POWER_WAKE_COUNT] = {"laser", "button", "goal"};
+
+static uint32_t idleTimeoutMs = 0;
+static uint32_t sleepTimeoutMs = 0;
+static uint32_t lastActivityMs = 0;
+static uint32_t stateSinceMs = 0;    // Counted into stats up to here
+static uint32_t stateCarryMs[POWER_STATE_COUNT];
+static PowerStats stats = {};
+
+// Adds the time since stateSinceMs to the current state
+static void countStateTime(uint32_t nowMs) {
+  uint32_t& carry = stateCarryMs[stats.state];
+  carry += nowMs - stateSinceMs;
+  stats.seconds[stats.state] += carry / 1000;
+  carry %= 1000;
+  stateSinceMs = nowMs;
+}
+
+static void enterState(uint8_t state, uint32_t nowMs) {
+  countStateTime(nowMs);
+  stats.state = state;
+  stats.entered[state]++;
+}
+
+void resetPowerState(uint32_t idleMs, uint32_t sleepMs, uint32_t nowMs) {
+  memset(&stats, 0, sizeof(stats));
+  memset(stateCarryMs, 0, sizeof(stateCarryMs));
+  setPowerTimeouts(idleMs, sleepMs);
+  lastActivityMs = nowMs;
+  stateSinceMs = nowMs;
+  stats.state = POWER_ACTIVE;
+  stats.entered[POWER_ACTIVE] = 1;
+}
+
+void setPowerTimeouts(uint32_t idleMs, uint32_t sleepMs) {
+  idleTimeoutMs = idleMs;
+  sleepTimeoutMs = sleepMs;
+}
+
+uint8_t powerActivity(uint8_t wake, uint32_t nowMs) {
+  lastActivityMs = nowMs;
+  uint8_t left = stats.state;
+  if (left != POWER_ACTIVE) {
+    enterState(POWER_ACTIVE, nowMs);
+    if (wake < POWER_WAKE_COUNT) {
+      stats.wakes[wake]++;
+    }
+  }
+  return left;
+}
+
+// Where the device belongs after inactiveMs without activity
+static uint8_t stateFor(uint32_t inactiveMs) {
+  if (sleepTimeoutMs != 0 && inactiveMs >= sleepTimeoutMs) {
+    return POWER_SLEEP;
+  }
+  if (idleTimeoutMs != 0 && inactiveMs >= idleTimeoutMs) {
+    return POWER_IDLE;
+  }
+  return POWER_ACTIVE;
+}
+
+uint8_t updatePowerState(uint32_t nowMs, bool busy) {
+  uint8_t target = stateFor(nowMs - lastActivityMs);
+  // Only ever steps down here, activity is what steps up
+  if (!busy && target > stats.state) {
+    enterState(target, nowMs);
+  }
+  return stats.state;
+}
+
+uint32_t powerStateTimeout(uint32_t nowMs) {
+  uint32_t inactiveMs = nowMs - lastActivityMs;
+  uint32_t wait = POWER_TIMEOUT_NONE;
+  if (stats.state < POWER_IDLE && idleTimeoutMs != 0) {
+    wait = idleTimeoutMs > inactiveMs ? idleTimeoutMs - inactiveMs : 0;
+  }
+  if (stats.state < POWER_SLEEP && sleepTimeoutMs != 0) {
+    uint32_t sleepWait = sleepTimeoutMs > inactiveMs ? sleepTimeoutMs - inactiveMs : 0;
+    if (sleepWait < wait) {
+      wait = sleepWait;
+    }
+  }
+  return wait;
+}
+
+void powerWakeReady(uint32_t eventMicros, uint32_t readyMicros) {
+  stats.lastWakeUs = readyMicros - eventMicros;
+  if (stats.lastWakeUs > stats.maxWakeUs) {
+    stats.maxWakeUs = stats.lastWakeUs;
+  }
+}
+
+void powerWakeGoal() {
+  stats.wakeGoals++;
+}
+
+uint8_t powerState() {
+  return stats.state;
+}
+
+const PowerStats& powerStats(uint32_t nowMs) {
+  countStateTime(nowMs);
+  return stats;
+}
+
+const char* powerStateName(uint8_t state) {
+  return state < POWER_STATE_COUNT ? stateNames[state] : "?";
+}
+
+const char* powerWakeName(uint8_t wake) {
+  return wake < POWER_WAKE_COUNT ? wakeNames[wake] : "?";
+}
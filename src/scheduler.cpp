@@ -0,0 +1,228 @@
+#include "scheduler.h"
+#include "hal.h"
+#include "log.h"
+
+struct Task {
+  TaskFunction function;
+  uint32_t due;            // halMillis() of the next timed run
+  uint32_t wanted;         // What the task asked for, due before slack
+  bool armed;              // Waiting on the timer wheel
+  bool ready;              // Due now, run on this pass
+  int8_t next;             // Next task in the same wheel slot
+  volatile bool signaled;
+  volatile uint32_t signalMicros;
+};
+
+static Task tasks[SCHEDULER_MAX_TASKS];
+static TaskStats stats[SCHEDULER_MAX_TASKS];
+static uint8_t taskCount = 0;
+static MetricHistogram passTime = {};
+
+// Timer wheel - one slot per millisecond, each slot a linked list of tasks.
+// Deadlines further out than one revolution just stay in their slot until
+// the wheel comes round to them at the right time.
+static int8_t wheel[SCHEDULER_WHEEL_SLOTS];
+static bool wheelInitialized = false;
+static uint32_t wheelTime = 0;  // Last millisecond processed
+static uint32_t slackMs = 0;
+
+static void initWheel() {
+  for (uint8_t i = 0; i < SCHEDULER_WHEEL_SLOTS; i++) {
+    wheel[i] = -1;
+  }
+  wheelTime = halMillis();
+  wheelInitialized = true;
+}
+
+static void unlinkTask(int8_t task) {
+  if (!tasks[task].armed) {
+    return;
+  }
+
+  int8_t* link = &wheel[tasks[task].due % SCHEDULER_WHEEL_SLOTS];
+  while (*link != -1) {
+    if (*link == task) {
+      *link = tasks[task].next;
+      break;
+    }
+    link = &tasks[*link].next;
+  }
+  tasks[task].armed = false;
+}
+
+static void armTask(int8_t task, uint32_t now, uint32_t delayMs) {
+  unlinkTask(task);
+  if (delayMs == SCHEDULER_IDLE) {
+    return;
+  }
+
+  Task* t = &tasks[task];
+  t->wanted = now + delayMs;
+  t->due = t->wanted;
+  if (slackMs > 0 && delayMs > 0) {
+    t->due += (slackMs - t->due % slackMs) % slackMs;
+  }
+  if (delayMs == 0 || (int32_t)(t->due - wheelTime) <= 0) {
+    t->ready = true;
+    return;
+  }
+
+  uint8_t slot = t->due % SCHEDULER_WHEEL_SLOTS;
+  t->next = wheel[slot];
+  wheel[slot] = task;
+  t->armed = true;
+}
+
+// Moves every task whose deadline has passed off the wheel and marks it ready
+static void advanceWheel(uint32_t now) {
+  uint32_t elapsed = now - wheelTime;
+  uint32_t steps = elapsed < SCHEDULER_WHEEL_SLOTS ? elapsed : SCHEDULER_WHEEL_SLOTS;
+
+  for (uint32_t i = 1; i <= steps; i++) {
+    int8_t* link = &wheel[(wheelTime + i) % SCHEDULER_WHEEL_SLOTS];
+    while (*link != -1) {
+      Task* t = &tasks[*link];
+      if ((int32_t)(t->due - now) <= 0) {
+        int8_t task = *link;
+        *link = t->next;
+        t->armed = false;
+        tasks[task].ready = true;
+      } else {
+        link = &t->next;
+      }
+    }
+  }
+
+  wheelTime = now;
+}
+
+int8_t schedulerAddTask(const char* name, TaskFunction function) {
+  if (!wheelInitialized) {
+    initWheel();
+  }
+  if (taskCount >= SCHEDULER_MAX_TASKS) {
+    LOG_ERROR(LOG_CAT_SYSTEM, "Scheduler full, cannot add task %s", name);
+    return -1;
+  }
+
+  int8_t task = taskCount++;
+  tasks[task].function = function;
+  tasks[task].ready = true;  // First run on the next pass
+  stats[task].name = name;
+  return task;
+}
+
+void IRAM_ATTR schedulerSignal(int8_t task) {
+  if (task < 0) {
+    return;
+  }
+  if (!tasks[task].signaled) {
+    tasks[task].signalMicros = halMicros();
+    tasks[task].signaled = true;
+  }
+  stats[task].signals++;
+  halWake();
+}
+
+void schedulerWake(int8_t task, uint32_t delayMs) {
+  if (task < 0) {
+    return;
+  }
+
+  Task* t = &tasks[task];
+  uint32_t now = halMillis();
+  if (t->ready) {
+    return;
+  }
+  if (t->armed && (int32_t)(t->due - (now + delayMs)) <= 0) {
+    return;  // Already due sooner
+  }
+  armTask(task, now, delayMs);
+}
+
+void schedulerSetSlack(uint32_t slack) {
+  slackMs = slack;
+  // Re-arm at what each task asked for, under the new slack
+  uint32_t now = halMillis();
+  for (int8_t task = 0; task < taskCount; task++) {
+    if (tasks[task].armed) {
+      int32_t remaining = (int32_t)(tasks[task].wanted - now);
+      armTask(task, now, remaining > 0 ? remaining : 0);
+    }
+  }
+}
+
+static void dispatchTask(int8_t task) {
+  Task* t = &tasks[task];
+
+  if (t->signaled) {
+    uint32_t latency = halMicros() - t->signalMicros;
+    if (latency > stats[task].maxSignalLatencyMicros) {
+      stats[task].maxSignalLatencyMicros = latency;
+    }
+    // Cleared before running so a signal raised during the run isn't lost
+    t->signaled = false;
+  }
+  t->ready = false;
+  unlinkTask(task);
+
+  uint32_t start = metricsStart();
+  uint32_t delayMs = t->function();
+  stats[task].runTime.observe(metricsElapsedMicros(start));
+  stats[task].runs++;
+  armTask(task, halMillis(), delayMs);
+}
+
+uint32_t schedulerRun() {
+  uint32_t start = metricsStart();
+  advanceWheel(halMillis());
+
+  for (int8_t task = 0; task < taskCount; task++) {
+    if (tasks[task].signaled || tasks[task].ready) {
+      dispatchTask(task);
+    }
+  }
+  passTime.observe(metricsElapsedMicros(start));
+
+  // Sleep until the earliest deadline, or not at all if work is waiting
+  uint32_t now = halMillis();
+  uint32_t sleepMs = SCHEDULER_MAX_SLEEP_MS;
+  for (int8_t task = 0; task < taskCount; task++) {
+    const Task* t = &tasks[task];
+    if (t->signaled || t->ready) {
+      return 0;
+    }
+    if (t->armed) {
+      int32_t remaining = (int32_t)(t->due - now);
+      if (remaining <= 0) {
+        return 0;
+      }
+      if ((uint32_t)remaining < sleepMs) {
+        sleepMs = remaining;
+      }
+    }
+  }
+  return sleepMs;
+}
+
+void schedulerRunAll() {
+  uint32_t start = metricsStart();
+  advanceWheel(halMillis());
+
+  for (int8_t task = 0; task < taskCount; task++) {
+    dispatchTask(task);
+  }
+  passTime.observe(metricsElapsedMicros(start));
+}
+
+uint8_t schedulerTaskCount() {
+  return taskCount;
+}
+
+const TaskStats& schedulerTaskStats(int8_t task) {
+  return stats[task];
+}
+
+const MetricHistogram& schedulerPassTime() {
+  return passTime;
+}
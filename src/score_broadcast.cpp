@@ -0,0 +1,240 @@
+#include "score_broadcast.h"
+#include <string.h>
+
+struct HeldPacket {
+  bool valid;
+  ScorePacket packet;
+  uint32_t arrivedMs;
+};
+
+static const char* const playerNames[SCORE_PLAYER_COUNT] = {"red", "blue"};
+
+static uint16_t receiverTable = SCORE_TABLE_ANY;
+static bool synced = false;
+static uint32_t syncedBoot = SCORE_BOOT_UNKNOWN;
+static uint32_t nextSeq = 0;
+// One spare slot - when it fills, the gap is skipped on the next delivery
+// instead of waiting out the window
+static HeldPacket held[SCORE_REORDER_SLOTS + 1];
+static ScoreReceiverStats stats = {};
+
+const char* scorePlayerName(uint8_t player) {
+  return player < SCORE_PLAYER_COUNT ? playerNames[player] : "";
+}
+
+bool parseScorePlayer(const char* name, uint8_t* player) {
+  for (uint8_t i = 0; i < SCORE_PLAYER_COUNT; i++) {
+    if (strcmp(name, playerNames[i]) == 0) {
+      *player = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void putUint16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+static void putUint32(uint8_t* out, uint32_t value) {
+  putUint16(out, value & 0xFFFF);
+  putUint16(out + 2, value >> 16);
+}
+
+static uint16_t getUint16(const uint8_t* data) {
+  return data[0] | (data[1] << 8);
+}
+
+static uint32_t getUint32(const uint8_t* data) {
+  return getUint16(data) | ((uint32_t)getUint16(data + 2) << 16);
+}
+
+size_t encodeScorePacket(const ScorePacket& packet, uint8_t* out, size_t size) {
+  if (size < SCORE_PACKET_SIZE) {
+    return 0;
+  }
+  out[0] = 'F';
+  out[1] = 'S';
+  out[2] = SCORE_PACKET_VERSION;
+  out[3] = packet.player;
+  putUint32(out + 4, packet.seq);
+  putUint16(out + 8, packet.scores[SCORE_PLAYER_RED]);
+  putUint16(out + 10, packet.scores[SCORE_PLAYER_BLUE]);
+  putUint32(out + 12, packet.trace);
+  putUint32(out + 16, packet.piReceivedUs);
+  putUint32(out + 20, packet.piSentUs);
+  putUint16(out + 24, packet.table);
+  putUint32(out + 26, packet.boot);
+  return SCORE_PACKET_SIZE;
+}
+
+bool decodeScorePacket(const uint8_t* data, size_t length, ScorePacket* packet) {
+  if (length < SCORE_PACKET_V1_SIZE || data[0] != 'F' || data[1] != 'S' || data[2] == 0 ||
+      data[2] > SCORE_PACKET_VERSION || data[3] >= SCORE_PLAYER_COUNT) {
+    return false;
+  }
+  bool traced = data[2] >= 2;
+  bool tabled = data[2] >= 3;
+  if ((traced && length < SCORE_PACKET_V2_SIZE) || (tabled && length < SCORE_PACKET_SIZE)) {
+    return false;
+  }
+  packet->player = data[3];
+  packet->seq = getUint32(data + 4);
+  packet->scores[SCORE_PLAYER_RED] = getUint16(data + 8);
+  packet->scores[SCORE_PLAYER_BLUE] = getUint16(data + 10);
+  packet->trace = traced ? getUint32(data + 12) : 0;
+  packet->piReceivedUs = traced ? getUint32(data + 16) : 0;
+  packet->piSentUs = traced ? getUint32(data + 20) : 0;
+  packet->table = tabled ? getUint16(data + 24) : SCORE_TABLE_ANY;
+  packet->boot = tabled ? getUint32(data + 26) : SCORE_BOOT_UNKNOWN;
+  return true;
+}
+
+void resetScoreReceiver() {
+  synced = false;
+  memset(held, 0, sizeof(held));
+  memset(&stats, 0, sizeof(stats));
+}
+
+void setScoreReceiverTable(uint16_t table) {
+  receiverTable = table;
+}
+
+bool scorePacketForTable(const ScorePacket& packet) {
+  return packet.table == SCORE_TABLE_ANY || receiverTable == SCORE_TABLE_ANY || packet.table == receiverTable;
+}
+
+static void clearHeld() {
+  for (uint8_t i = 0; i <= SCORE_REORDER_SLOTS; i++) {
+    held[i].valid = false;
+  }
+}
+
+static uint8_t heldCount() {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i <= SCORE_REORDER_SLOTS; i++) {
+    count += held[i].valid;
+  }
+  return count;
+}
+
+// Lowest held seq, or -1 when nothing is held
+static int8_t lowestHeld() {
+  int8_t lowest = -1;
+  for (int8_t i = 0; i <= SCORE_REORDER_SLOTS; i++) {
+    if (held[i].valid &&
+        (lowest < 0 || (int32_t)(held[i].packet.seq - held[lowest].packet.seq) < 0)) {
+      lowest = i;
+    }
+  }
+  return lowest;
+}
+
+// Gives up on the missing seqs below the lowest held packet
+static void skipToLowestHeld() {
+  int8_t lowest = lowestHeld();
+  if (lowest >= 0) {
+    stats.skipped += held[lowest].packet.seq - nextSeq;
+    nextSeq = held[lowest].packet.seq;
+  }
+}
+
+void acceptScorePacket(const ScorePacket& packet, uint32_t nowMs) {
+  // Another table's seqs would look like a Pi restart
+  if (!scorePacketForTable(packet)) {
+    stats.otherTable++;
+    return;
+  }
+  stats.received++;
+
+  // A restarted sender counts from 1 again. Its boot id says so; without
+  // one, only a seq too far behind to be a late copy does.
+  int32_t ahead = (int32_t)(packet.seq - nextSeq);
+  bool restarted = packet.boot == SCORE_BOOT_UNKNOWN ? ahead < -SCORE_SEQ_DUPLICATE_WINDOW
+                                                     : packet.boot != syncedBoot;
+  restarted = restarted || ahead > SCORE_SEQ_RESTART_GAP;
+  if (!synced || restarted) {
+    stats.restarts += synced;
+    synced = true;
+    syncedBoot = packet.boot;
+    nextSeq = packet.seq;
+    clearHeld();
+    ahead = 0;
+  }
+
+  if (ahead < 0) {
+    stats.duplicates++;
+    return;
+  }
+
+  int8_t freeSlot = -1;
+  for (int8_t i = 0; i <= SCORE_REORDER_SLOTS; i++) {
+    if (held[i].valid && held[i].packet.seq == packet.seq) {
+      stats.duplicates++;
+      return;
+    }
+    if (!held[i].valid && freeSlot < 0) {
+      freeSlot = i;
+    }
+  }
+
+  // Only reachable if the caller stops draining nextScorePacket()
+  if (freeSlot < 0) {
+    stats.skipped++;
+    return;
+  }
+
+  if (ahead > 0) {
+    stats.reordered++;
+  }
+  held[freeSlot].valid = true;
+  held[freeSlot].packet = packet;
+  held[freeSlot].arrivedMs = nowMs;
+}
+
+void acceptScoreDatagram(const uint8_t* data, size_t length, uint32_t nowMs) {
+  ScorePacket packet;
+  if (!decodeScorePacket(data, length, &packet)) {
+    stats.malformed++;
+    return;
+  }
+  acceptScorePacket(packet, nowMs);
+}
+
+bool nextScorePacket(ScorePacket* packet, uint32_t nowMs) {
+  int8_t lowest = lowestHeld();
+  if (lowest < 0) {
+    return false;
+  }
+
+  if (held[lowest].packet.seq != nextSeq) {
+    bool windowOver = nowMs - held[lowest].arrivedMs >= SCORE_REORDER_WINDOW_MS;
+    if (!windowOver && heldCount() <= SCORE_REORDER_SLOTS) {
+      return false;
+    }
+    skipToLowestHeld();
+  }
+
+  *packet = held[lowest].packet;
+  held[lowest].valid = false;
+  nextSeq++;
+  stats.delivered++;
+  return true;
+}
+
+uint32_t scoreReorderTimeout(uint32_t nowMs) {
+  int8_t lowest = lowestHeld();
+  if (lowest < 0) {
+    return SCORE_REORDER_IDLE;
+  }
+  if (held[lowest].packet.seq == nextSeq || heldCount() > SCORE_REORDER_SLOTS) {
+    return 0;
+  }
+  uint32_t waited = nowMs - held[lowest].arrivedMs;
+  return waited >= SCORE_REORDER_WINDOW_MS ? 0 : SCORE_REORDER_WINDOW_MS - waited;
+}
+
+const ScoreReceiverStats& scoreReceiverStats() {
+  return stats;
+}
@@ -0,0 +1,114 @@
+#include "sha1.h"
+#include <string.h>
+
+static uint32_t rotateLeft(uint32_t value, uint8_t bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+static void processBlock(const uint8_t* block, uint32_t state[5]) {
+  uint32_t w[80];
+  for (uint8_t i = 0; i < 16; i++) {
+    w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+           ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+  }
+  for (uint8_t i = 16; i < 80; i++) {
+    w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  for (uint8_t i = 0; i < 80; i++) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rotateLeft(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+void sha1Begin(Sha1* sha1) {
+  sha1->state[0] = 0x67452301;
+  sha1->state[1] = 0xEFCDAB89;
+  sha1->state[2] = 0x98BADCFE;
+  sha1->state[3] = 0x10325476;
+  sha1->state[4] = 0xC3D2E1F0;
+  sha1->blockLength = 0;
+  sha1->length = 0;
+}
+
+void sha1Update(Sha1* sha1, const uint8_t* data, size_t length) {
+  sha1->length += length;
+
+  // Top up a partial block first, then whole blocks straight from the input
+  if (sha1->blockLength > 0) {
+    size_t take = SHA1_BLOCK_SIZE - sha1->blockLength;
+    if (take > length) {
+      take = length;
+    }
+    memcpy(sha1->block + sha1->blockLength, data, take);
+    sha1->blockLength += take;
+    data += take;
+    length -= take;
+    if (sha1->blockLength < SHA1_BLOCK_SIZE) {
+      return;
+    }
+    processBlock(sha1->block, sha1->state);
+    sha1->blockLength = 0;
+  }
+  for (; length >= SHA1_BLOCK_SIZE; data += SHA1_BLOCK_SIZE, length -= SHA1_BLOCK_SIZE) {
+    processBlock(data, sha1->state);
+  }
+  memcpy(sha1->block, data, length);
+  sha1->blockLength = length;
+}
+
+void sha1Finish(Sha1* sha1, uint8_t digest[SHA1_DIGEST_SIZE]) {
+  // Final block(s) - 0x80, zero padding, then the length in bits
+  uint8_t* block = sha1->block;
+  uint8_t used = sha1->blockLength;
+  memset(block + used, 0, SHA1_BLOCK_SIZE - used);
+  block[used] = 0x80;
+  if (used >= 56) {
+    processBlock(block, sha1->state);
+    memset(block, 0, SHA1_BLOCK_SIZE);
+  }
+  uint64_t bits = sha1->length * 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    block[63 - i] = bits >> (i * 8);
+  }
+  processBlock(block, sha1->state);
+
+  for (uint8_t i = 0; i < 5; i++) {
+    digest[i * 4] = sha1->state[i] >> 24;
+    digest[i * 4 + 1] = sha1->state[i] >> 16;
+    digest[i * 4 + 2] = sha1->state[i] >> 8;
+    digest[i * 4 + 3] = sha1->state[i];
+  }
+}
+
+void sha1Digest(const uint8_t* data, size_t length, uint8_t digest[SHA1_DIGEST_SIZE]) {
+  Sha1 sha1;
+  sha1Begin(&sha1);
+  sha1Update(&sha1, data, length);
+  sha1Finish(&sha1, digest);
+}
@@ -0,0 +1,240 @@
+#include "wire_protocol.h"
+#include <string.h>
+#include "score_broadcast.h"
+
+static const char* const typeNames[] = {"?", "goal", "reset", "events", "ack"};
+
+static void putUint16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+static void putUint32(uint8_t* out, uint32_t value) {
+  putUint16(out, value & 0xFFFF);
+  putUint16(out + 2, value >> 16);
+}
+
+static uint16_t getUint16(const uint8_t* data) {
+  return data[0] | (data[1] << 8);
+}
+
+static uint32_t getUint32(const uint8_t* data) {
+  return getUint16(data) | ((uint32_t)getUint16(data + 2) << 16);
+}
+
+size_t encodeWireHeader(const WireHeader& header, uint8_t* out, size_t size) {
+  if (size < WIRE_HEADER_SIZE) {
+    return 0;
+  }
+  out[0] = 'F';
+  out[1] = 'W';
+  out[2] = header.version;
+  out[3] = header.type;
+  putUint32(out + 4, header.seq);
+  putUint16(out + 8, header.length);
+  return WIRE_HEADER_SIZE;
+}
+
+static void putJournalSeq(uint8_t* out, const JournalSeq* seq) {
+  putUint32(out, seq != nullptr ? seq->epoch : 0);
+  putUint32(out + 4, seq != nullptr ? seq->seq : 0);
+}
+
+size_t encodeWireGoal(uint8_t player, uint16_t table, uint16_t speedKmhX10, uint8_t* out, size_t size,
+                      const ScoreTrace* trace, const JournalSeq* seq) {
+  bool traced = trace != nullptr && trace->id != 0;
+  size_t length = traced ? WIRE_GOAL_TRACED_SIZE : WIRE_GOAL_SIZE;
+  if (size < length) {
+    return 0;
+  }
+  out[0] = player;
+  putUint16(out + 1, table);
+  putUint16(out + 3, speedKmhX10);
+  putJournalSeq(out + 5, seq);
+  if (traced) {
+    putUint32(out + 13, trace->id);
+    out[17] = trace->timed;
+    putUint32(out + 18, trace->breakUs);
+    putUint32(out + 22, trace->sentUs);
+  }
+  return length;
+}
+
+size_t encodeWireReset(uint8_t player, uint16_t table, uint8_t* out, size_t size, const JournalSeq* seq) {
+  if (size < WIRE_RESET_SIZE) {
+    return 0;
+  }
+  out[0] = player;
+  putUint16(out + 1, table);
+  putJournalSeq(out + 3, seq);
+  return WIRE_RESET_SIZE;
+}
+
+size_t encodeWireEvents(uint8_t player, uint16_t table, uint32_t epoch, uint32_t now, const JournalEvent* events,
+                        uint8_t count, uint8_t* out, size_t size) {
+  size_t length = WIRE_EVENTS_HEADER_SIZE + (size_t)count * WIRE_EVENT_SIZE;
+  if (count > WIRE_EVENTS_MAX || size < length) {
+    return 0;
+  }
+  out[0] = player;
+  out[1] = count;
+  putUint16(out + 2, table);
+  putUint32(out + 4, epoch);
+  putUint32(out + 8, now);
+  uint8_t* record = out + WIRE_EVENTS_HEADER_SIZE;
+  for (uint8_t i = 0; i < count; i++) {
+    putUint32(record, events[i].seq);
+    putUint32(record + 4, events[i].timestamp);
+    record[8] = events[i].type;
+    record[9] = events[i].flags;
+    putUint16(record + 10, events[i].value);
+    record += WIRE_EVENT_SIZE;
+  }
+  return length;
+}
+
+size_t encodeWireAck(uint16_t status, uint8_t* out, size_t size) {
+  if (size < WIRE_ACK_SIZE) {
+    return 0;
+  }
+  putUint16(out, status);
+  return WIRE_ACK_SIZE;
+}
+
+bool decodeWireHeader(const uint8_t* data, size_t length, WireHeader* header) {
+  if (length < WIRE_HEADER_SIZE || data[0] != 'F' || data[1] != 'W' || data[2] == 0 || data[2] > WIRE_VERSION) {
+    return false;
+  }
+  header->version = data[2];
+  header->type = data[3];
+  header->seq = getUint32(data + 4);
+  header->length = getUint16(data + 8);
+  return header->length <= WIRE_PAYLOAD_MAX;
+}
+
+// Version 2 payloads have no epoch and seq
+static const uint8_t* getJournalSeq(const uint8_t* data, bool present, JournalSeq* seq) {
+  if (seq != nullptr) {
+    seq->epoch = present ? getUint32(data) : 0;
+    seq->seq = present ? getUint32(data + 4) : 0;
+  }
+  return present ? data + 8 : data;
+}
+
+// Version 3 and older payloads have no table
+static const uint8_t* getTable(const uint8_t* data, bool present, uint16_t* table) {
+  *table = present ? getUint16(data) : SCORE_TABLE_ANY;
+  return present ? data + 2 : data;
+}
+
+bool decodeWireGoal(const uint8_t* data, size_t length, uint8_t* player, uint16_t* table, uint16_t* speedKmhX10,
+                    ScoreTrace* trace, JournalSeq* seq) {
+  bool tabled = length == WIRE_GOAL_SIZE || length == WIRE_GOAL_TRACED_SIZE;
+  bool sequenced = tabled || length == WIRE_GOAL_V3_SIZE || length == WIRE_GOAL_V3_TRACED_SIZE;
+  bool traced = length == WIRE_GOAL_TRACED_SIZE || length == WIRE_GOAL_V3_TRACED_SIZE ||
+                length == WIRE_GOAL_V2_TRACED_SIZE;
+  if ((!sequenced && length != WIRE_GOAL_V2_SIZE && !traced) || data[0] >= SCORE_PLAYER_COUNT) {
+    return false;
+  }
+  *player = data[0];
+  const uint8_t* rest = getTable(data + 1, tabled, table);
+  *speedKmhX10 = getUint16(rest);
+  rest = getJournalSeq(rest + 2, sequenced, seq);
+  if (trace != nullptr) {
+    trace->id = traced ? getUint32(rest) : 0;
+    trace->timed = traced && rest[4] != 0;
+    trace->breakUs = traced ? getUint32(rest + 5) : 0;
+    trace->sentUs = traced ? getUint32(rest + 9) : 0;
+  }
+  return true;
+}
+
+bool decodeWireReset(const uint8_t* data, size_t length, uint8_t* player, uint16_t* table, JournalSeq* seq) {
+  if ((length != WIRE_RESET_SIZE && length != WIRE_RESET_V3_SIZE && length != WIRE_RESET_V1_SIZE) ||
+      data[0] >= SCORE_PLAYER_COUNT) {
+    return false;
+  }
+  *player = data[0];
+  const uint8_t* rest = getTable(data + 1, length == WIRE_RESET_SIZE, table);
+  getJournalSeq(rest, length != WIRE_RESET_V1_SIZE, seq);
+  return true;
+}
+
+bool decodeWireEvents(const uint8_t* data, size_t length, WireEvents* batch) {
+  if (length < WIRE_EVENTS_V3_HEADER_SIZE || data[0] >= SCORE_PLAYER_COUNT || data[1] > WIRE_EVENTS_MAX) {
+    return false;
+  }
+  // The two header sizes leave different remainders for the same count
+  size_t records = (size_t)data[1] * WIRE_EVENT_SIZE;
+  bool tabled = length == WIRE_EVENTS_HEADER_SIZE + records;
+  if (!tabled && length != WIRE_EVENTS_V3_HEADER_SIZE + records) {
+    return false;
+  }
+  batch->player = data[0];
+  batch->count = data[1];
+  const uint8_t* record = getTable(data + 2, tabled, &batch->table);
+  batch->epoch = getUint32(record);
+  batch->now = getUint32(record + 4);
+  record += 8;
+  for (uint8_t i = 0; i < batch->count; i++) {
+    JournalEvent* event = &batch->events[i];
+    event->seq = getUint32(record);
+    event->timestamp = getUint32(record + 4);
+    event->type = record[8];
+    event->flags = record[9];
+    event->value = getUint16(record + 10);
+    record += WIRE_EVENT_SIZE;
+  }
+  return true;
+}
+
+bool decodeWireAck(const uint8_t* data, size_t length, uint16_t* status) {
+  if (length != WIRE_ACK_SIZE) {
+    return false;
+  }
+  *status = getUint16(data);
+  return true;
+}
+
+int wireFrameToRequest(const WireHeader& header, const uint8_t* payload, const char** path, char* body,
+                       size_t size) {
+  uint8_t player;
+  uint16_t table;
+  uint16_t speedKmhX10;
+  ScoreTrace trace;
+  JournalSeq seq;
+  switch (header.type) {
+    case WIRE_GOAL:
+      if (!decodeWireGoal(payload, header.length, &player, &table, &speedKmhX10, &trace, &seq)) {
+        return -1;
+      }
+      *path = "/score";
+      return formatScoreBody(body, size, scorePlayerName(player), table, speedKmhX10, &trace, &seq);
+
+    case WIRE_RESET:
+      if (!decodeWireReset(payload, header.length, &player, &table, &seq)) {
+        return -1;
+      }
+      *path = "/reset";
+      return formatResetBody(body, size, scorePlayerName(player), table, &seq);
+
+    case WIRE_EVENTS: {
+      // Big enough for a batch, only one frame is decoded at a time
+      static WireEvents batch;
+      if (!decodeWireEvents(payload, header.length, &batch)) {
+        return -1;
+      }
+      *path = "/events";
+      // Two sides, so the goals' side is the other one
+      return formatEventsBody(body, size, scorePlayerName(batch.player), scorePlayerName(1 - batch.player),
+                              batch.table, batch.epoch, batch.now, batch.events, batch.count);
+    }
+
+    default:
+      return -1;
+  }
+}
+
+const char* wireTypeName(uint8_t type) {
+  return type <= WIRE_ACK ? typeNames[type] : "?";
+}